@@ -0,0 +1,8 @@
+#version 330 core
+// Null fragment shader of depth only passes: depth is written by the fixed
+// function tests, color writes are masked off
+
+
+void main()
+{
+}
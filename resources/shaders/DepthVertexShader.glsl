@@ -0,0 +1,20 @@
+#version 330 core
+// Depth prepass: only the position is read, from a VAO holding nothing else
+
+// Positions/Coordinates
+layout (location = 0) in vec3 aPos;
+
+// Controls the scale of the vertices, left at 1 like in every other scene program
+uniform float scale = 1.0f;
+
+//matrices for 3d perspective
+#include "common/camera.glsl"
+
+// shaded passes test against this depth with GL_LEQUAL and must compute the exact same position
+invariant gl_Position;
+
+
+void main()
+{
+	gl_Position = projection * view * model * vec4(aPos * scale, 1.0f);
+}
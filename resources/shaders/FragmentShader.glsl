@@ -9,9 +9,40 @@ in vec2 texCoord;
 
 // Gets the Texture Unit from the main function
 uniform sampler2D tex0;
+// Opacity of the object, < 1 for translucent objects
+uniform float opacity;
+
+#if defined(CLUSTERED_LIGHTING) || defined(SHADOWS)
+// lit by the point lights of the fragment's cluster and/or the shadowed sun
+in vec3 viewPosition;
+uniform vec3 ambient;
+// the meshes carry no normals or roughness yet: faces are lit flat, with one roughness
+uniform float roughness = 0.6f;
+#endif
+#ifdef CLUSTERED_LIGHTING
+#include "common/clusters.glsl"
+#endif
+#ifdef SHADOWS
+#include "common/shadows.glsl"
+#endif
 
 
 void main()
 {
-	FragColor = texture(tex0, texCoord);
+#if defined(CLUSTERED_LIGHTING) || defined(SHADOWS)
+	vec4 albedo = texture(tex0, texCoord);
+	vec3 normal = normalize(cross(dFdx(viewPosition), dFdy(viewPosition)));
+	vec3 color = ambient * albedo.rgb;
+#ifdef SHADOWS
+	color += shadeSun(viewPosition, normal, albedo.rgb);
+#endif
+#ifdef CLUSTERED_LIGHTING
+	uvec2 range = texelFetch(clusterRanges, int(clusterIndex(gl_FragCoord.xy, viewPosition.z))).rg;
+	for(uint i = 0u; i < range.y; i++)
+		color += shadePointLight(clusterLight(texelFetch(clusterIndices, int(range.x + i)).r), viewPosition, normal, albedo.rgb, roughness);
+#endif
+	FragColor = vec4(color, albedo.a * opacity);
+#else
+	FragColor = texture(tex0, texCoord) * vec4(1.0f, 1.0f, 1.0f, opacity);
+#endif
 }
\ No newline at end of file
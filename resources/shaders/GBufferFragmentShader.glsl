@@ -0,0 +1,25 @@
+#version 330 core
+// G-buffer pass: writes the surface, lighting happens later per screen tile.
+// Position isn't stored, TiledLighting.glsl rebuilds it from the depth buffer
+
+// RG16: octahedral encoded view space normal
+layout (location = 0) out vec2 gNormal;
+// RGBA8: albedo, roughness in alpha
+layout (location = 1) out vec4 gAlbedoRoughness;
+
+in vec3 viewPosition;
+in vec2 texCoord;
+
+uniform sampler2D tex0;
+// the meshes carry no normals or roughness yet: faces are lit flat, with one roughness
+uniform float roughness = 0.6f;
+
+#include "common/normals.glsl"
+
+
+void main()
+{
+	vec3 normal = normalize(cross(dFdx(viewPosition), dFdy(viewPosition)));
+	gNormal = encodeNormal(normal);
+	gAlbedoRoughness = vec4(texture(tex0, texCoord).rgb, roughness);
+}
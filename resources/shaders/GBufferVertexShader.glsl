@@ -0,0 +1,32 @@
+#version 330 core
+// G-buffer pass: places the mesh like VertexShader.glsl and passes its view
+// space position on, the fragment shader derives the surface normal from it
+
+// Positions/Coordinates
+layout (location = 0) in vec3 aPos;
+// Texture Coordinates
+layout (location = 2) in vec2 aTex;
+
+
+// Outputs the view space position to the fragment shader
+out vec3 viewPosition;
+// Outputs the texture coordinates to the fragment shader
+out vec2 texCoord;
+
+// Controls the scale of the vertices, left at 1 like in every other scene program
+uniform float scale = 1.0f;
+
+//matrices for 3d perspective
+#include "common/camera.glsl"
+
+// the same position as the depth prepass, bit for bit
+invariant gl_Position;
+
+
+void main()
+{
+	// same expression as the depth prepass, so both produce the same depth
+	gl_Position = projection * view * model * vec4(aPos * scale, 1.0f);
+	viewPosition = vec3(view * model * vec4(aPos * scale, 1.0f));
+	texCoord = aTex;
+}
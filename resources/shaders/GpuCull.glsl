@@ -0,0 +1,110 @@
+#version 430 core
+// Frustum and Hi-Z occlusion culling of every instance. Visible instances
+// append a DrawElementsIndirectCommand to their batch's range of the command
+// buffer, the batch's counter ends up holding how many were written.
+
+layout (local_size_x = 64) in;
+
+#include "common/instances.glsl"
+
+struct Batch
+{
+	uint indexCount;
+	uint firstIndex;
+	int baseVertex;
+	// first command of the batch in the command buffer
+	uint commandOffset;
+};
+
+struct DrawCommand
+{
+	uint count;
+	uint instanceCount;
+	uint firstIndex;
+	int baseVertex;
+	uint baseInstance;
+};
+
+layout (std430, binding = 1) readonly buffer Batches
+{
+	Batch batches[];
+};
+
+layout (std430, binding = 2) writeonly buffer Commands
+{
+	DrawCommand commands[];
+};
+
+layout (std430, binding = 3) buffer DrawCounts
+{
+	uint drawCounts[];
+};
+
+uniform uint instanceCount;
+// inward facing planes: left, right, bottom, top, near, far
+uniform vec4 frustumPlanes[6];
+
+// max depth pyramid of the previous frame
+uniform bool occlusion;
+uniform sampler2D hiZ;
+uniform int hiZLevels;
+uniform mat4 previousViewProjection;
+
+
+// true if the sphere's bounding box was behind last frame's depth everywhere it covers
+bool occluded(vec4 sphere)
+{
+	vec2 size = vec2(textureSize(hiZ, 0));
+	vec2 minPixel = vec2(1e30f);
+	vec2 maxPixel = vec2(-1e30f);
+	float nearest = 1.0f;
+	for(int c = 0; c < 8; c++)
+	{
+		vec3 corner = sphere.xyz + sphere.w * vec3((c & 1) != 0 ? 1.0f : -1.0f, (c & 2) != 0 ? 1.0f : -1.0f, (c & 4) != 0 ? 1.0f : -1.0f);
+		vec4 clip = previousViewProjection * vec4(corner, 1.0f);
+		// crossing the near plane: it covers the view
+		if(clip.w <= 0.0f || clip.z < -clip.w)
+			return false;
+		vec3 ndc = clip.xyz / clip.w;
+		vec2 pixel = (ndc.xy * 0.5f + 0.5f) * size;
+		minPixel = min(minPixel, pixel);
+		maxPixel = max(maxPixel, pixel);
+		nearest = min(nearest, ndc.z * 0.5f + 0.5f);
+	}
+	ivec2 first = max(ivec2(floor(minPixel)), ivec2(0));
+	ivec2 last = min(ivec2(floor(maxPixel)), ivec2(size) - 1);
+	if(any(greaterThan(first, last)))
+		return false;
+	// the level where the rectangle spans at most 2x2 texels
+	int span = max(last.x - first.x, last.y - first.y);
+	int level = 0;
+	while((span >> level) > 0 && level < hiZLevels - 1)
+		level++;
+	// mip sizes halve rounding down. worked out here, as textureSize() of the smallest
+	// levels isn't reliable on every driver and a fetch outside the level reads 0
+	ivec2 levelSize = max(ivec2(size) >> level, ivec2(1));
+	first = min(first >> level, levelSize - 1);
+	last = min(last >> level, levelSize - 1);
+	float farthest = 0.0f;
+	for(int y = first.y; y <= last.y; y++)
+		for(int x = first.x; x <= last.x; x++)
+			farthest = max(farthest, texelFetch(hiZ, ivec2(x, y), level).r);
+	return nearest > farthest;
+}
+
+void main()
+{
+	uint i = gl_GlobalInvocationID.x;
+	if(i >= instanceCount)
+		return;
+	vec4 sphere = instances[i].sphere;
+	for(int p = 0; p < 6; p++)
+		if(dot(frustumPlanes[p].xyz, sphere.xyz) + frustumPlanes[p].w < -sphere.w)
+			return;
+	if(occlusion && occluded(sphere))
+		return;
+
+	Batch batch = batches[instances[i].batch];
+	uint slot = atomicAdd(drawCounts[instances[i].batch], 1u);
+	commands[batch.commandOffset + slot] = DrawCommand(batch.indexCount, 1u, batch.firstIndex, batch.baseVertex, i);
+}
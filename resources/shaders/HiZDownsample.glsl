@@ -0,0 +1,38 @@
+#version 430 core
+// Builds one level of the max depth pyramid: level 0 is copied from the depth
+// buffer, every other level keeps the farthest depth of the texels below it
+
+layout (local_size_x = 8, local_size_y = 8) in;
+
+layout (r32f, binding = 0) uniform readonly image2D source;
+layout (r32f, binding = 1) uniform writeonly image2D destination;
+// depth buffer, read when copyDepth is set
+uniform sampler2D depth;
+uniform bool copyDepth;
+
+
+void main()
+{
+	ivec2 texel = ivec2(gl_GlobalInvocationID.xy);
+	ivec2 size = imageSize(destination);
+	if(any(greaterThanEqual(texel, size)))
+		return;
+	if(copyDepth)
+	{
+		imageStore(destination, texel, vec4(texelFetch(depth, texel, 0).r));
+		return;
+	}
+	// odd sized levels fold their last row/column into the last texel below
+	ivec2 sourceSize = imageSize(source);
+	ivec2 first = texel * 2;
+	ivec2 last = min(texel * 2 + 1, sourceSize - 1);
+	if(texel.x == size.x - 1)
+		last.x = sourceSize.x - 1;
+	if(texel.y == size.y - 1)
+		last.y = sourceSize.y - 1;
+	float farthest = 0.0f;
+	for(int y = first.y; y <= last.y; y++)
+		for(int x = first.x; x <= last.x; x++)
+			farthest = max(farthest, imageLoad(source, ivec2(x, y)).r);
+	imageStore(destination, texel, vec4(farthest));
+}
@@ -0,0 +1,34 @@
+#version 430 core
+
+// Positions/Coordinates
+layout (location = 0) in vec3 aPos;
+// Colors
+layout (location = 1) in vec3 aColor;
+// Texture Coordinates
+layout (location = 2) in vec2 aTex;
+// Instance index, advanced once per instance from the draw's base instance
+layout (location = 3) in uint aInstance;
+
+
+// Outputs the color for the Fragment Shader
+out vec3 color;
+// Outputs the texture coordinates to the fragment shader
+out vec2 texCoord;
+
+// Controls the scale of the vertices
+uniform float scale;
+
+//matrices for 3d perspective, the model matrix comes from the instance
+#include "common/camera.glsl"
+#include "common/instances.glsl"
+
+// the same position as the depth prepass, bit for bit
+invariant gl_Position;
+
+
+void main()
+{
+	gl_Position = projection * view * instances[aInstance].model * vec4(aPos * scale, 1.0f);
+	color = aColor;
+	texCoord = aTex;
+}
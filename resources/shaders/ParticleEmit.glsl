@@ -0,0 +1,54 @@
+#version 430 core
+// Appends emitCount new particles to the destination streams, after the
+// survivors ParticleSimulate.glsl packed there. Particles that don't fit in
+// the capacity are dropped.
+
+layout (local_size_x = 256) in;
+
+#include "common/particles.glsl"
+
+layout (std430, binding = 1) writeonly buffer Destination
+{
+	float destination[];
+};
+
+uniform uint destinationCommand;
+uniform uint emitCount;
+// emission index of the first particle, the random numbers of a particle are hashed from its index
+uniform uint firstIndex;
+uniform vec3 emitterPosition;
+uniform float emitterRadius;
+uniform vec3 emitterVelocity;
+uniform float spread;
+uniform float minLife;
+uniform float maxLife;
+
+
+// a random number r in [0, 1) as an offset in [-scale, scale)
+float offset(uint index, uint field, float scale)
+{
+	return (random(index, field) * 2.0f - 1.0f) * scale;
+}
+
+void main()
+{
+	uint i = gl_GlobalInvocationID.x;
+	if(i >= emitCount)
+		return;
+	uint o = atomicAdd(commands[destinationCommand].instanceCount, 1u);
+	if(o >= capacity)
+	{
+		// full: take the particle back out of the count
+		atomicAdd(commands[destinationCommand].instanceCount, 0xffffffffu);
+		return;
+	}
+	uint index = firstIndex + i;
+	destination[POSITION_X * capacity + o] = emitterPosition.x + offset(index, RANDOM_X, emitterRadius);
+	destination[POSITION_Y * capacity + o] = emitterPosition.y;
+	destination[POSITION_Z * capacity + o] = emitterPosition.z + offset(index, RANDOM_Z, emitterRadius);
+	destination[VELOCITY_X * capacity + o] = emitterVelocity.x + offset(index, RANDOM_VELOCITY_X, spread);
+	destination[VELOCITY_Y * capacity + o] = emitterVelocity.y + offset(index, RANDOM_VELOCITY_Y, spread);
+	destination[VELOCITY_Z * capacity + o] = emitterVelocity.z + offset(index, RANDOM_VELOCITY_Z, spread);
+	destination[AGE * capacity + o] = 0.0f;
+	destination[LIFE * capacity + o] = minLife + random(index, RANDOM_LIFE) * (maxLife - minLife);
+}
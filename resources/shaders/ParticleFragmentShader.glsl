@@ -0,0 +1,16 @@
+#version 330 core
+// Particles are blended additively, a round spot fading out to the quad's edges
+out vec4 FragColor;
+
+in vec2 corner;
+in vec3 color;
+
+// scales every particle's color
+uniform float brightness;
+
+
+void main()
+{
+	float falloff = max(1.0f - dot(corner, corner), 0.0f);
+	FragColor = vec4(color * falloff * brightness, 1.0f);
+}
@@ -0,0 +1,83 @@
+#version 430 core
+// Ages and moves every live particle of the source streams by one step. The
+// survivors are packed into the destination streams: each work group counts
+// its own in shared memory and reserves room for them with one atomic on the
+// destination's draw command.
+
+layout (local_size_x = 256) in;
+
+#include "common/particles.glsl"
+
+layout (std430, binding = 0) readonly buffer Source
+{
+	float source[];
+};
+
+layout (std430, binding = 1) writeonly buffer Destination
+{
+	float destination[];
+};
+
+uniform uint sourceCommand;
+uniform uint destinationCommand;
+uniform float dt;
+// velocity is multiplied by damping, then gravity is added to its y
+uniform float damping;
+uniform float gravity;
+// particles below ground are put back on it, their vertical velocity multiplied by bounce
+uniform float ground;
+uniform float bounce;
+
+shared uint groupSurvivors;
+shared uint groupFirst;
+
+
+void main()
+{
+	uint i = gl_GlobalInvocationID.x;
+	if(gl_LocalInvocationIndex == 0u)
+		groupSurvivors = 0u;
+	barrier();
+
+	bool alive = false;
+	float age = 0.0f;
+	float life = 0.0f;
+	vec3 position = vec3(0.0f);
+	vec3 velocity = vec3(0.0f);
+	uint slot = 0u;
+	if(i < commands[sourceCommand].instanceCount)
+	{
+		age = source[AGE * capacity + i] + dt;
+		life = source[LIFE * capacity + i];
+		alive = age < life;
+	}
+	if(alive)
+	{
+		velocity = vec3(source[VELOCITY_X * capacity + i], source[VELOCITY_Y * capacity + i], source[VELOCITY_Z * capacity + i]) * damping;
+		velocity.y += gravity;
+		position = vec3(source[POSITION_X * capacity + i], source[POSITION_Y * capacity + i], source[POSITION_Z * capacity + i]) + velocity * dt;
+		if(position.y < ground)
+		{
+			position.y = ground;
+			velocity.y *= bounce;
+		}
+		slot = atomicAdd(groupSurvivors, 1u);
+	}
+	barrier();
+	if(gl_LocalInvocationIndex == 0u)
+		groupFirst = atomicAdd(commands[destinationCommand].instanceCount, groupSurvivors);
+	barrier();
+
+	if(alive)
+	{
+		uint o = groupFirst + slot;
+		destination[POSITION_X * capacity + o] = position.x;
+		destination[POSITION_Y * capacity + o] = position.y;
+		destination[POSITION_Z * capacity + o] = position.z;
+		destination[VELOCITY_X * capacity + o] = velocity.x;
+		destination[VELOCITY_Y * capacity + o] = velocity.y;
+		destination[VELOCITY_Z * capacity + o] = velocity.z;
+		destination[AGE * capacity + o] = age;
+		destination[LIFE * capacity + o] = life;
+	}
+}
@@ -0,0 +1,31 @@
+#version 330 core
+// Particles as camera facing quads: one instance per particle, its fields read
+// straight from the particle streams, and the quad's corner from gl_VertexID
+// of a 4 vertex triangle strip
+
+layout (location = 0) in float aX;
+layout (location = 1) in float aY;
+layout (location = 2) in float aZ;
+layout (location = 3) in float aAge;
+layout (location = 4) in float aLife;
+
+// corner of the quad in [-1, 1]
+out vec2 corner;
+// premultiplied color, fading out over the particle's life
+out vec3 color;
+
+// half the width of a quad at birth
+uniform float size;
+
+#include "common/camera.glsl"
+
+
+void main()
+{
+	corner = vec2(gl_VertexID & 1, gl_VertexID >> 1) * 2.0f - 1.0f;
+	float t = clamp(aAge / aLife, 0.0f, 1.0f);
+	vec4 viewPosition = view * vec4(aX, aY, aZ, 1.0f);
+	viewPosition.xy += corner * size * (1.0f - 0.5f * t);
+	gl_Position = projection * viewPosition;
+	color = mix(vec3(1.0f, 0.75f, 0.3f), vec3(0.6f, 0.15f, 0.05f), t) * (1.0f - t);
+}
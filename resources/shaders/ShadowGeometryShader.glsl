@@ -0,0 +1,29 @@
+#version 330 core
+// Shadow pass: layered rendering into the cascade array. Every triangle is
+// emitted once per cascade in layerMask, into that cascade's layer, so a
+// caster is one draw call however many cascades it lands in.
+// CASCADES and MAX_VERTICES (3 * CASCADES) are defined by ShadowMaps (shadowMaps.h)
+
+layout (triangles) in;
+layout (triangle_strip, max_vertices = MAX_VERTICES) out;
+
+uniform mat4 cascadeViewProjection[CASCADES];
+// bit c set: draw into cascade c
+uniform int layerMask;
+
+
+void main()
+{
+	for(int c = 0; c < CASCADES; c++)
+	{
+		if((layerMask & (1 << c)) == 0)
+			continue;
+		for(int v = 0; v < 3; v++)
+		{
+			gl_Layer = c;
+			gl_Position = cascadeViewProjection[c] * gl_in[v].gl_Position;
+			EmitVertex();
+		}
+		EndPrimitive();
+	}
+}
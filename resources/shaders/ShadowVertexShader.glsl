@@ -0,0 +1,14 @@
+#version 330 core
+// Shadow pass: moves the caster to world space, the geometry shader projects
+// it into each cascade it was culled into
+
+// Positions/Coordinates
+layout (location = 0) in vec3 aPos;
+
+uniform mat4 model;
+
+
+void main()
+{
+	gl_Position = model * vec4(aPos, 1.0f);
+}
@@ -0,0 +1,128 @@
+#version 430 core
+// Tiled deferred lighting. One work group per 16x16 pixel tile: it finds the
+// tile's depth range, culls every light against the tile's frustum into a list
+// in shared memory, then each pixel rebuilds its position from depth and sums
+// the lights on the list.
+
+layout (local_size_x = 16, local_size_y = 16) in;
+
+#include "common/lights.glsl"
+#include "common/normals.glsl"
+
+// lights a tile can hold, the rest are dropped (and counted in overflowTiles)
+#define MAX_TILE_LIGHTS 512u
+
+layout (binding = 0) uniform sampler2D gDepth;
+layout (binding = 1) uniform sampler2D gNormal;
+layout (binding = 2) uniform sampler2D gAlbedoRoughness;
+layout (rgba8, binding = 0) uniform writeonly image2D lit;
+
+layout (std430, binding = 0) readonly buffer Lights
+{
+	PointLight lights[];
+};
+
+layout (std430, binding = 1) buffer LightStats
+{
+	// light/tile pairs kept over the whole frame
+	uint tileLights;
+	uint overflowTiles;
+};
+
+uniform uint lightCount;
+uniform mat4 inverseProjection;
+uniform vec3 ambient;
+// color of pixels nothing was drawn to
+uniform vec3 background;
+
+shared uint minDepthBits;
+shared uint maxDepthBits;
+shared uint tileLightCount;
+shared uint tileLightList[MAX_TILE_LIGHTS];
+// inward facing side planes of the tile's frustum, through the camera
+shared vec3 tilePlanes[4];
+
+
+// view space position of a point on screen, ndc in [-1, 1]^3
+vec3 unproject(vec3 ndc)
+{
+	vec4 position = inverseProjection * vec4(ndc, 1.0f);
+	return position.xyz / position.w;
+}
+
+void main()
+{
+	ivec2 pixel = ivec2(gl_GlobalInvocationID.xy);
+	ivec2 size = textureSize(gDepth, 0);
+	bool inside = all(lessThan(pixel, size));
+	float depth = inside ? texelFetch(gDepth, pixel, 0).r : 1.0f;
+
+	if(gl_LocalInvocationIndex == 0u)
+	{
+		minDepthBits = 0xFFFFFFFFu;
+		maxDepthBits = 0u;
+		tileLightCount = 0u;
+		// corners of the tile on the far plane, counter clockwise from bottom left
+		vec2 tileMin = vec2(gl_WorkGroupID.xy * gl_WorkGroupSize.xy) / vec2(size) * 2.0f - 1.0f;
+		vec2 tileMax = vec2((gl_WorkGroupID.xy + 1u) * gl_WorkGroupSize.xy) / vec2(size) * 2.0f - 1.0f;
+		vec3 corners[4] = vec3[4](unproject(vec3(tileMin, 1.0f)), unproject(vec3(tileMax.x, tileMin.y, 1.0f)),
+		                          unproject(vec3(tileMax, 1.0f)), unproject(vec3(tileMin.x, tileMax.y, 1.0f)));
+		for(int i = 0; i < 4; i++)
+			tilePlanes[i] = normalize(cross(corners[(i + 1) & 3], corners[i]));
+	}
+	barrier();
+	// depths are positive, so their bits sort like the floats
+	if(depth < 1.0f)
+	{
+		atomicMin(minDepthBits, floatBitsToUint(depth));
+		atomicMax(maxDepthBits, floatBitsToUint(depth));
+	}
+	barrier();
+
+	// empty tiles skip culling, their pixels are all background
+	if(maxDepthBits != 0u)
+	{
+		// view space z is negative in front of the camera: near is the larger one
+		float tileNear = unproject(vec3(0.0f, 0.0f, uintBitsToFloat(minDepthBits) * 2.0f - 1.0f)).z;
+		float tileFar = unproject(vec3(0.0f, 0.0f, uintBitsToFloat(maxDepthBits) * 2.0f - 1.0f)).z;
+		uint threads = gl_WorkGroupSize.x * gl_WorkGroupSize.y;
+		for(uint i = gl_LocalInvocationIndex; i < lightCount; i += threads)
+		{
+			vec4 sphere = lights[i].positionRadius;
+			if(sphere.z - sphere.w > tileNear || sphere.z + sphere.w < tileFar)
+				continue;
+			bool visible = true;
+			for(int p = 0; p < 4; p++)
+				visible = visible && dot(tilePlanes[p], sphere.xyz) > -sphere.w;
+			if(!visible)
+				continue;
+			uint slot = atomicAdd(tileLightCount, 1u);
+			if(slot < MAX_TILE_LIGHTS)
+				tileLightList[slot] = i;
+		}
+	}
+	barrier();
+
+	if(gl_LocalInvocationIndex == 0u && tileLightCount > 0u)
+	{
+		atomicAdd(tileLights, min(tileLightCount, MAX_TILE_LIGHTS));
+		if(tileLightCount > MAX_TILE_LIGHTS)
+			atomicAdd(overflowTiles, 1u);
+	}
+	if(!inside)
+		return;
+	if(depth >= 1.0f)
+	{
+		imageStore(lit, pixel, vec4(background, 1.0f));
+		return;
+	}
+	vec2 ndc = (vec2(pixel) + 0.5f) / vec2(size) * 2.0f - 1.0f;
+	vec3 position = unproject(vec3(ndc, depth * 2.0f - 1.0f));
+	vec3 normal = decodeNormal(texelFetch(gNormal, pixel, 0).rg);
+	vec4 albedoRoughness = texelFetch(gAlbedoRoughness, pixel, 0);
+	vec3 color = ambient * albedoRoughness.rgb;
+	uint count = min(tileLightCount, MAX_TILE_LIGHTS);
+	for(uint i = 0u; i < count; i++)
+		color += shadePointLight(lights[tileLightList[i]], position, normal, albedoRoughness.rgb, albedoRoughness.a);
+	imageStore(lit, pixel, vec4(color, 1.0f));
+}
@@ -0,0 +1,42 @@
+#version 330 core
+// Upscale pass: stretches the part of the render target the scene was drawn
+// into over the whole output. Bilinear, plus an optional sharpening that adds
+// back the difference to the 4 neighbours, clamped to their range so edges
+// don't ring.
+
+out vec4 FragColor;
+
+in vec2 screenCoord;
+
+// the scaled frame, drawn into the bottom left of a possibly larger texture
+uniform sampler2D source;
+// drawn size / texture size
+uniform vec2 sourceScale;
+// 1 / texture size
+uniform vec2 texelSize;
+// 0 is plain bilinear, 1 the strongest sharpening
+uniform float sharpness;
+
+
+void main()
+{
+	// stay half a texel inside what was drawn, past it is last frame's or nothing
+	vec2 uv = clamp(screenCoord * sourceScale, texelSize * 0.5f, sourceScale - texelSize * 0.5f);
+	// alpha is passed through untouched, like a blit would
+	vec4 centerSample = texture(source, uv);
+	vec3 center = centerSample.rgb;
+	if(sharpness <= 0.0f)
+	{
+		FragColor = centerSample;
+		return;
+	}
+	vec2 limit = sourceScale - texelSize * 0.5f;
+	vec3 left = texture(source, max(uv - vec2(texelSize.x, 0.0f), texelSize * 0.5f)).rgb;
+	vec3 right = texture(source, min(uv + vec2(texelSize.x, 0.0f), limit)).rgb;
+	vec3 down = texture(source, max(uv - vec2(0.0f, texelSize.y), texelSize * 0.5f)).rgb;
+	vec3 up = texture(source, min(uv + vec2(0.0f, texelSize.y), limit)).rgb;
+	vec3 lowest = min(center, min(min(left, right), min(down, up)));
+	vec3 highest = max(center, max(max(left, right), max(down, up)));
+	vec3 sharpened = center + (center - (left + right + down + up) * 0.25f) * sharpness * 2.0f;
+	FragColor = vec4(clamp(sharpened, lowest, highest), centerSample.a);
+}
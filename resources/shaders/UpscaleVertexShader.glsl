@@ -0,0 +1,13 @@
+#version 330 core
+// Upscale pass: one triangle covering the screen, made from gl_VertexID alone,
+// so it draws from an empty VAO
+
+out vec2 screenCoord;
+
+
+void main()
+{
+	vec2 corner = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+	screenCoord = corner;
+	gl_Position = vec4(corner * 2.0f - 1.0f, 0.0f, 1.0f);
+}
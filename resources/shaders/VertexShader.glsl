@@ -12,22 +12,30 @@ layout (location = 2) in vec2 aTex;
 out vec3 color;
 // Outputs the texture coordinates to the fragment shader
 out vec2 texCoord;
+#if defined(CLUSTERED_LIGHTING) || defined(SHADOWS)
+// Outputs the view space position, the lit variants shade in view space
+out vec3 viewPosition;
+#endif
 
 // Controls the scale of the vertices
 uniform float scale;
 
 //matrices for 3d perspective
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+#include "common/camera.glsl"
+
+// the same position as the depth prepass, bit for bit
+invariant gl_Position;
 
 
 void main()
 {
-	// Outputs the positions/coordinates of all vertices
-	gl_Position = projection * view * model * vec4(aPos.x * scale, aPos.y * scale, aPos.z * scale, 1.0f);
+	// Outputs the positions/coordinates of all vertices, with the same expression as the depth prepass
+	gl_Position = projection * view * model * vec4(aPos * scale, 1.0f);
 	// Assigns the colors from the Vertex Data to "color"
 	color = aColor;
 	// Assigns the texture coordinates from the Vertex Data to "texCoord"
 	texCoord = aTex;
+#if defined(CLUSTERED_LIGHTING) || defined(SHADOWS)
+	viewPosition = vec3(view * model * vec4(aPos * scale, 1.0f));
+#endif
 }
\ No newline at end of file
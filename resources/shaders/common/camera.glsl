@@ -0,0 +1,13 @@
+#pragma once
+// Matrices shared by every vertex shader that places geometry in the 3d scene
+
+// model matrix: transforms local coordinates to world coordinates
+uniform mat4 model;
+// written once a frame by CameraUniforms, at binding 0
+layout (std140) uniform Camera
+{
+	// view matrix: transforms world coordinates to view space
+	mat4 view;
+	// projection matrix: transforms view space into clip space
+	mat4 projection;
+};
@@ -0,0 +1,34 @@
+#pragma once
+// Clustered light lists as ClusteredLighting (clusteredLighting.h) uploads them.
+// The view frustum is split into clusterCounts.x * clusterCounts.y screen tiles
+// and clusterCounts.z depth slices spaced logarithmically between near and far
+
+#include "lights.glsl"
+
+// two RGBA32F texels per light: positionRadius, colorIntensity (view space)
+uniform samplerBuffer clusterLights;
+// RG32UI per cluster: first entry in clusterIndices, number of lights
+uniform usamplerBuffer clusterRanges;
+// R32UI light indices, each cluster's a contiguous run
+uniform usamplerBuffer clusterIndices;
+uniform uvec3 clusterCounts;
+// clusters per pixel along x and y
+uniform vec2 clusterTileScale;
+// slice = log(-z) * x + y
+uniform vec2 clusterSliceScaleBias;
+
+
+// index of the cluster holding a fragment, x fastest then y then slice
+uint clusterIndex(vec2 fragCoord, float viewZ)
+{
+	uvec2 tile = min(uvec2(fragCoord * clusterTileScale), clusterCounts.xy - 1u);
+	float slice = log(max(-viewZ, 1e-4f)) * clusterSliceScaleBias.x + clusterSliceScaleBias.y;
+	uint z = uint(clamp(slice, 0.0f, float(clusterCounts.z - 1u)));
+	return (z * clusterCounts.y + tile.y) * clusterCounts.x + tile.x;
+}
+
+PointLight clusterLight(uint index)
+{
+	int texel = int(index) * 2;
+	return PointLight(texelFetch(clusterLights, texel), texelFetch(clusterLights, texel + 1));
+}
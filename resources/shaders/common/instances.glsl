@@ -0,0 +1,20 @@
+#pragma once
+// Per instance data of GPU culled draws, laid out like GpuInstance on the CPU
+
+struct Instance
+{
+	// model matrix: transforms local coordinates to world coordinates
+	mat4 model;
+	// world space bounding sphere, xyz center and w radius
+	vec4 sphere;
+	// index of the batch (mesh, texture) the instance is drawn with
+	uint batch;
+	uint pad0;
+	uint pad1;
+	uint pad2;
+};
+
+layout (std430, binding = 0) readonly buffer Instances
+{
+	Instance instances[];
+};
@@ -0,0 +1,35 @@
+#pragma once
+// Point lights as the renderers upload them (GpuLight in lights.h) and how one
+// lights a surface. Positions are in view space, so the camera is at the origin
+
+struct PointLight
+{
+	// xyz: position, w: radius no light reaches past
+	vec4 positionRadius;
+	// rgb: color, a: intensity
+	vec4 colorIntensity;
+};
+
+// inverse square falloff, windowed so it reaches 0 at the radius
+float lightFalloff(float distance, float radius)
+{
+	float ratio = distance / radius;
+	float window = clamp(1.0f - ratio * ratio * ratio * ratio, 0.0f, 1.0f);
+	return window * window / (distance * distance + 1.0f);
+}
+
+// Lambert diffuse plus Blinn-Phong specular whose sharpness follows roughness
+vec3 shadePointLight(PointLight light, vec3 position, vec3 normal, vec3 albedo, float roughness)
+{
+	vec3 toLight = light.positionRadius.xyz - position;
+	float distance = length(toLight);
+	if(distance >= light.positionRadius.w)
+		return vec3(0.0f);
+	vec3 direction = toLight / distance;
+	float diffuse = max(dot(normal, direction), 0.0f);
+	vec3 halfway = normalize(direction - normalize(position));
+	float shininess = exp2(10.0f * (1.0f - roughness) + 1.0f);
+	float specular = pow(max(dot(normal, halfway), 0.0f), shininess) * (1.0f - roughness);
+	vec3 radiance = light.colorIntensity.rgb * light.colorIntensity.a * lightFalloff(distance, light.positionRadius.w);
+	return radiance * (albedo * diffuse + specular * diffuse);
+}
@@ -0,0 +1,26 @@
+#pragma once
+// Octahedral normal encoding: a unit vector folded onto the octahedron and
+// flattened to two components, so it fits a two channel unorm target
+
+vec2 signNotZero(vec2 v)
+{
+	return vec2(v.x >= 0.0f ? 1.0f : -1.0f, v.y >= 0.0f ? 1.0f : -1.0f);
+}
+
+// unit vector -> [0, 1]^2
+vec2 encodeNormal(vec3 normal)
+{
+	normal /= abs(normal.x) + abs(normal.y) + abs(normal.z);
+	vec2 folded = normal.z >= 0.0f ? normal.xy : (1.0f - abs(normal.yx)) * signNotZero(normal.xy);
+	return folded * 0.5f + 0.5f;
+}
+
+// [0, 1]^2 -> unit vector
+vec3 decodeNormal(vec2 encoded)
+{
+	encoded = encoded * 2.0f - 1.0f;
+	vec3 normal = vec3(encoded, 1.0f - abs(encoded.x) - abs(encoded.y));
+	if(normal.z < 0.0f)
+		normal.xy = (1.0f - abs(normal.yx)) * signNotZero(normal.xy);
+	return normalize(normal);
+}
@@ -0,0 +1,55 @@
+#pragma once
+// Particles as ParticleSystem lays them out: one float stream per field, field
+// f of particle i at f * capacity + i of a copy of the streams
+
+#define POSITION_X 0u
+#define POSITION_Y 1u
+#define POSITION_Z 2u
+#define VELOCITY_X 3u
+#define VELOCITY_Y 4u
+#define VELOCITY_Z 5u
+#define AGE 6u
+#define LIFE 7u
+
+// random numbers a new particle draws
+#define RANDOM_X 0u
+#define RANDOM_Z 1u
+#define RANDOM_VELOCITY_X 2u
+#define RANDOM_VELOCITY_Y 3u
+#define RANDOM_VELOCITY_Z 4u
+#define RANDOM_LIFE 5u
+
+// the draw command of each copy of the streams, its instance count is how many particles live in the copy
+struct DrawCommand
+{
+	uint count;
+	uint instanceCount;
+	uint first;
+	uint baseInstance;
+};
+
+layout (std430, binding = 2) buffer Commands
+{
+	DrawCommand commands[];
+};
+
+// particles each copy of the streams has room for
+uniform uint capacity;
+
+
+// lowbias32 integer hash, the same as ParticleSystem::hash()
+uint hash(uint x)
+{
+	x ^= x >> 16;
+	x *= 0x7feb352du;
+	x ^= x >> 15;
+	x *= 0x846ca68bu;
+	x ^= x >> 16;
+	return x;
+}
+
+// uniform random number in [0, 1) for field of the particle emitted index-th
+float random(uint index, uint field)
+{
+	return float(hash(index * 8u + field) >> 8) * (1.0f / 16777216.0f);
+}
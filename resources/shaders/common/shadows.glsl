@@ -0,0 +1,43 @@
+#pragma once
+// Cascaded shadow lookup for forward shading, as ShadowMaps (shadowMaps.h)
+// sets it up. Everything is in view space, so the camera is at the origin
+
+// one layer per cascade, compared against with hardware filtering
+uniform sampler2DArrayShadow shadowMap;
+// view space -> [0, 1]^3 of each cascade's layer
+uniform mat4 shadowMatrices[CASCADES];
+// distance in front of the camera where each cascade ends
+uniform float cascadeEnds[CASCADES];
+// world size of a texel of each cascade, receivers are pushed out by it along the normal
+uniform float cascadeTexelSizes[CASCADES];
+// direction the sunlight travels, view space
+uniform vec3 sunDirection;
+uniform vec3 sunColor;
+
+
+// 1 where the sun reaches the surface, 0 in shadow, filtered over 3x3 texels
+float sunVisibility(vec3 position, vec3 normal)
+{
+	int cascade = 0;
+	while(cascade < CASCADES && -position.z > cascadeEnds[cascade])
+		cascade++;
+	if(cascade == CASCADES)
+		return 1.0f;
+	vec3 offset = position + normal * cascadeTexelSizes[cascade] * 1.5f;
+	vec3 coord = (shadowMatrices[cascade] * vec4(offset, 1.0f)).xyz;
+	vec2 texel = 1.0f / vec2(textureSize(shadowMap, 0).xy);
+	float visibility = 0.0f;
+	for(int y = -1; y <= 1; y++)
+		for(int x = -1; x <= 1; x++)
+			visibility += texture(shadowMap, vec4(coord.xy + vec2(x, y) * texel, float(cascade), coord.z));
+	return visibility / 9.0f;
+}
+
+// sunlight reaching a surface, Lambert diffuse
+vec3 shadeSun(vec3 position, vec3 normal, vec3 albedo)
+{
+	float diffuse = max(dot(normal, -sunDirection), 0.0f);
+	if(diffuse <= 0.0f)
+		return vec3(0.0f);
+	return albedo * sunColor * diffuse * sunVisibility(position, normal);
+}
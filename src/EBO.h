@@ -3,6 +3,8 @@
 
 #include <glad/glad.h>
 
+#include "profiler.h"
+
 class ElemBufObj{
     public:
         unsigned int ID;
@@ -15,6 +17,7 @@ class ElemBufObj{
          *      and a reference is assigned to the global var ID. 
         */
         ElemBufObj(int *drawOrder, size_t size, GLenum usage){
+            PROFILE_ZONE("buffer upload");
             glGenBuffers(1, &ID);
             glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ID);
             glBufferData(GL_ELEMENT_ARRAY_BUFFER, size, drawOrder, usage);
@@ -0,0 +1,78 @@
+/**
+ * Offscreen framebuffer with a color texture and a depth/stencil renderbuffer.
+ * Headless runs draw into one instead of a window, and whatever reads the
+ * frame back (see asyncReadback.h) reads from its color attachment.
+*/
+#ifndef FBO_CLASS
+#define FBO_CLASS
+
+#include <glad/glad.h>
+
+#include <stdio.h>
+
+class FrameBufObj{
+    public:
+        unsigned int ID;
+        unsigned int colorTexture;      //GL_RGBA8 color attachment
+        unsigned int depthBuffer;       //GL_DEPTH24_STENCIL8 renderbuffer
+        int width;
+        int height;
+
+        /**
+         * constructs a framebuffer with a color texture and a depth/stencil buffer
+         * @param width width of the attachments in pixels
+         * @param height height of the attachments in pixels
+         * pre: a GL context is current
+         * post: a complete framebuffer is referenced by ID, an error is printed if it isn't complete
+        */
+        FrameBufObj(int width, int height) : width(width), height(height){
+            glGenTextures(1, &colorTexture);
+            glBindTexture(GL_TEXTURE_2D, colorTexture);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glBindTexture(GL_TEXTURE_2D, 0);
+
+            glGenRenderbuffers(1, &depthBuffer);
+            glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
+            glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+            glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+            glGenFramebuffers(1, &ID);
+            glBindFramebuffer(GL_FRAMEBUFFER, ID);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, colorTexture, 0);
+            glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
+            GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+            if(status != GL_FRAMEBUFFER_COMPLETE)
+                printf("\nERROR: framebuffer %dx%d incomplete (0x%x)\n", width, height, status);
+            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        }
+
+        /**
+         * pre: none
+         * post: draws go to this framebuffer and the viewport covers all of it
+        */
+        void bind(){
+            glBindFramebuffer(GL_FRAMEBUFFER, ID);
+            glViewport(0, 0, width, height);
+        }
+
+        /**
+         * pre: none
+         * post: draws go to the default framebuffer
+        */
+        void unbind(){
+            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        }
+
+        /**
+         * pre: none
+         * post: deletes the framebuffer and its attachments
+        */
+        void destroy(){
+            glDeleteFramebuffers(1, &ID);
+            glDeleteTextures(1, &colorTexture);
+            glDeleteRenderbuffers(1, &depthBuffer);
+        }
+};
+#endif
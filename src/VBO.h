@@ -3,6 +3,8 @@
 
 #include <glad/glad.h>
 
+#include "profiler.h"
+
 class VertBufObj{
     public:
         unsigned int ID;
@@ -15,6 +17,7 @@ class VertBufObj{
          *      and a reference is assigned to the global var ID. 
         */
         VertBufObj(float *vertices, size_t size, GLenum usage){
+            PROFILE_ZONE("buffer upload");
             glGenBuffers(1, &ID);
             glBindBuffer(GL_ARRAY_BUFFER, ID);
             glBufferData(GL_ARRAY_BUFFER, size, vertices, usage);
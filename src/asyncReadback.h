@@ -0,0 +1,263 @@
+/**
+ * Asynchronous framebuffer readback. capture() queues a glReadPixels into one
+ * of a ring of pixel pack buffers and fences it, so the call returns as soon as
+ * the copy is queued. poll() maps the buffers whose fence has signaled, usually
+ * a frame or two later, copies the pixels out and hands them to a writer thread
+ * that runs the callback (PNG encoding, flipping, file IO) off the render thread.
+ *
+ * The render thread only blocks when it gets too far ahead: when every buffer of
+ * the ring is still in flight, or MAX_QUEUED frames wait for the writer. Both
+ * are counted as stalls.
+*/
+#ifndef ASYNC_READBACK_H
+#define ASYNC_READBACK_H
+
+#include <glad/glad.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "frameTimer.h"
+#include "profiler.h"
+
+/**
+ * pixels read back from a framebuffer
+*/
+struct CapturedFrame{
+    int frame = 0;          //the number given to capture()
+    int width = 0;
+    int height = 0;
+    std::vector<unsigned char> rgba;    //width * height * 4 bytes, bottom row first as GL returns them
+};
+
+struct ReadbackStats{
+    size_t captured = 0;        //since startup
+    size_t written = 0;         //callbacks that finished
+    size_t ringStalls = 0;      //capture() waited for the oldest buffer's fence
+    size_t writerStalls = 0;    //poll() waited for the writer to catch up
+    double copyMs = 0.0;        //render thread time mapping and copying out the last frame
+    size_t queued = 0;          //frames waiting for the writer at the last poll()
+
+    void print(const char *name) const{
+        printf("%s: %zu captured, %zu written, %zu queued, %.3f ms copy, %zu ring stalls, %zu writer stalls\n",
+               name, captured, written, queued, copyMs, ringStalls, writerStalls);
+    }
+};
+
+class AsyncReadback{
+    public:
+        static constexpr int RING_SIZE = 3;     //pack buffers in flight
+        static constexpr int MAX_QUEUED = 8;    //frames copied out but not yet written
+
+        ReadbackStats stats;
+
+        /**
+         * @param onFrame called on the writer thread with every captured frame, in capture order
+         * pre: a GL 3.3 context is current
+         * post: the writer thread is running
+        */
+        void init(const std::function<void(const CapturedFrame &)> &onFrame){
+            callback = onFrame;
+            glGenBuffers(RING_SIZE, buffers);
+            quit = false;
+            writer = std::thread(&AsyncReadback::writerLoop, this);
+        }
+
+        /**
+         * queues a copy of the color buffer, returning before the GPU has made it
+         * @param framebuffer read framebuffer, 0 for the window's back buffer
+         * @param width pixels to read from the bottom left corner
+         * @param height pixels to read
+         * @param frame handed back in CapturedFrame::frame
+         * pre: init() ran. what should be captured has been drawn
+         * post: the framebuffer bound for drawing is unchanged
+        */
+        void capture(unsigned int framebuffer, int width, int height, int frame){
+            PROFILE_ZONE("readback capture");
+            Slot &slot = slots[next];
+            if(slot.fence != NULL){
+                //every buffer is still in flight: the oldest one has to land first
+                stats.ringStalls++;
+                collect(next, true);
+            }
+            size_t size = (size_t)width * height * 4;
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+            if(framebuffer == 0)
+                glReadBuffer(GL_BACK);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, buffers[next]);
+            if(size > slot.capacity){
+                glBufferData(GL_PIXEL_PACK_BUFFER, size, NULL, GL_STREAM_READ);
+                slot.capacity = size;
+            }
+            glPixelStorei(GL_PACK_ALIGNMENT, 1);
+            glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, (void*)0);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+            slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            slot.width = width;
+            slot.height = height;
+            slot.frame = frame;
+            next = (next + 1) % RING_SIZE;
+            stats.captured++;
+        }
+
+        /**
+         * hands every copy that has landed to the writer, without waiting for the GPU
+         * pre: init() ran
+        */
+        void poll(){
+            PROFILE_ZONE("readback poll");
+            //oldest first, so frames reach the writer in capture order
+            for(int i = 0; i < RING_SIZE; i++){
+                int index = (next + i) % RING_SIZE;
+                if(slots[index].fence == NULL)
+                    continue;
+                GLenum state = glClientWaitSync(slots[index].fence, 0, 0);
+                if(state != GL_ALREADY_SIGNALED && state != GL_CONDITION_SATISFIED)
+                    break;
+                collect(index, false);
+            }
+            std::lock_guard<std::mutex> lock(mutex);
+            stats.queued = queue.size();
+            stats.written = written;
+        }
+
+        /**
+         * waits until every captured frame went through the callback
+         * pre: init() ran
+        */
+        void finish(){
+            for(int i = 0; i < RING_SIZE; i++){
+                int index = (next + i) % RING_SIZE;
+                if(slots[index].fence != NULL)
+                    collect(index, true);
+            }
+            std::unique_lock<std::mutex> lock(mutex);
+            drained.wait(lock, [this]{ return queue.empty() && !writing; });
+            stats.queued = 0;
+            stats.written = written;
+        }
+
+        /**
+         * writes out what is still queued and stops the writer thread
+         * pre: the context init() ran on is current
+         * post: every GL object is deleted
+        */
+        void destroy(){
+            if(!writer.joinable())
+                return;
+            finish();
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                quit = true;
+            }
+            wake.notify_all();
+            writer.join();
+            glDeleteBuffers(RING_SIZE, buffers);
+        }
+
+    private:
+        struct Slot{
+            GLsync fence = NULL;
+            size_t capacity = 0;    //bytes allocated for the buffer
+            int width = 0, height = 0;
+            int frame = 0;
+        };
+
+        unsigned int buffers[RING_SIZE] = {};
+        Slot slots[RING_SIZE];
+        int next = 0;               //slot the next capture() uses, the oldest one in flight
+
+        std::function<void(const CapturedFrame &)> callback;
+        std::thread writer;
+        std::mutex mutex;           //guards everything below
+        std::condition_variable wake;       //a frame was queued, or quit
+        std::condition_variable drained;    //the writer finished a frame
+        std::deque<CapturedFrame> queue;
+        std::vector<std::vector<unsigned char>> spare;     //pixel storage the writer is done with
+        bool writing = false;
+        bool quit = false;
+        size_t written = 0;
+
+        /**
+         * maps a slot's buffer, copies the pixels out and queues them for the writer
+         * @param wait block until the slot's fence signals
+        */
+        void collect(int index, bool wait){
+            Slot &slot = slots[index];
+            if(wait)
+                glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+            glDeleteSync(slot.fence);
+            slot.fence = NULL;
+
+            double start = nowSeconds();
+            CapturedFrame captured;
+            captured.frame = slot.frame;
+            captured.width = slot.width;
+            captured.height = slot.height;
+            size_t size = (size_t)slot.width * slot.height * 4;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                if(queue.size() >= MAX_QUEUED){
+                    stats.writerStalls++;
+                    drained.wait(lock, [this]{ return queue.size() < MAX_QUEUED; });
+                }
+                if(!spare.empty()){
+                    captured.rgba.swap(spare.back());
+                    spare.pop_back();
+                }
+            }
+            captured.rgba.resize(size);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, buffers[index]);
+            void *pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, GL_MAP_READ_BIT);
+            if(pixels != NULL){
+                memcpy(captured.rgba.data(), pixels, size);
+                glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+            } else{
+                printf("readback: mapping the pack buffer of frame %d failed\n", slot.frame);
+            }
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+            stats.copyMs = (nowSeconds() - start) * 1000.0;
+            if(pixels == NULL)
+                return;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                queue.push_back(std::move(captured));
+            }
+            wake.notify_one();
+        }
+
+        void writerLoop(){
+            Profiler::instance().setThreadName("readback writer");
+            while(true){
+                CapturedFrame captured;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    wake.wait(lock, [this]{ return quit || !queue.empty(); });
+                    if(queue.empty())
+                        return;
+                    captured = std::move(queue.front());
+                    queue.pop_front();
+                    writing = true;
+                }
+                {
+                    PROFILE_ZONE("readback write");
+                    callback(captured);
+                }
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    spare.push_back(std::move(captured.rgba));
+                    writing = false;
+                    written++;
+                }
+                drained.notify_all();
+            }
+        }
+};
+
+#endif
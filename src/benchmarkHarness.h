@@ -0,0 +1,461 @@
+/**
+ * Deterministic benchmark runs: every frame advances the simulation and a
+ * scripted camera by a fixed step instead of the wall clock, so two runs draw
+ * exactly the same frames and their timings can be compared.
+ *
+ * BenchmarkRecorder collects a FrameSample per frame, summarizes each metric as
+ * mean/p50/p95/p99/max, writes the results as JSON and compares them against a
+ * stored baseline (a previous results file) with per-metric thresholds.
+*/
+#ifndef BENCHMARK_HARNESS_H
+#define BENCHMARK_HARNESS_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * one frame's measurements
+*/
+struct FrameSample{
+    double cpuMs = 0.0;             //CPU time to simulate, record and submit the frame
+    double gpuMs = 0.0;             //GPU time of the frame's commands
+    double draws = 0.0;
+    double triangles = 0.0;
+    double stateChanges = 0.0;
+    double uploadBytes = 0.0;       //uniform and buffer data sent to the GL
+    double fenceWaitMs = 0.0;       //CPU time waiting for the GPU to free a frame in flight
+};
+
+struct MetricSummary{
+    double mean = 0.0;
+    double p50 = 0.0;
+    double p95 = 0.0;
+    double p99 = 0.0;
+    double max = 0.0;
+};
+
+/**
+ * @return summary of values, percentiles by nearest rank
+*/
+inline MetricSummary summarize(std::vector<double> values){
+    MetricSummary summary;
+    if(values.empty())
+        return summary;
+    std::sort(values.begin(), values.end());
+    auto percentile = [&](double p){
+        size_t rank = (size_t)ceil(p / 100.0 * values.size());
+        return values[std::min(std::max<size_t>(rank, 1), values.size()) - 1];
+    };
+    double sum = 0.0;
+    for(double value : values)
+        sum += value;
+    summary.mean = sum / values.size();
+    summary.p50 = percentile(50.0);
+    summary.p95 = percentile(95.0);
+    summary.p99 = percentile(99.0);
+    summary.max = values.back();
+    return summary;
+}
+
+/**
+ * camera keyframes, linearly interpolated and looped
+*/
+class CameraPath{
+    public:
+        struct Key{
+            double time;
+            glm::vec3 eye;
+            glm::vec3 target;
+        };
+
+        std::vector<Key> keys;      //in increasing time, the last key's time is the loop length
+
+        /**
+         * @param time seconds along the path
+         * @return the view matrix at that time
+         * pre: keys is not empty
+        */
+        glm::mat4 view(double time) const{
+            double length = keys.back().time;
+            time = length > 0.0 ? fmod(time, length) : 0.0;
+            size_t next = 1;
+            while(next < keys.size() - 1 && keys[next].time < time)
+                next++;
+            const Key &a = keys[next - 1];
+            const Key &b = keys[std::min(next, keys.size() - 1)];
+            float t = b.time > a.time ? (float)((time - a.time) / (b.time - a.time)) : 0.0f;
+            t = std::min(std::max(t, 0.0f), 1.0f);
+            return glm::lookAt(glm::mix(a.eye, b.eye, t), glm::mix(a.target, b.target, t), glm::vec3(0.0f, 1.0f, 0.0f));
+        }
+};
+
+class BenchmarkRecorder{
+    public:
+        std::vector<FrameSample> samples;
+        int warmupFrames;           //first frames left out of the summaries
+
+        explicit BenchmarkRecorder(int warmup = 10) : warmupFrames(warmup){}
+
+        /**
+         * @return the sample for frame, created if needed
+        */
+        FrameSample &sample(int frame){
+            if((size_t)frame >= samples.size())
+                samples.resize(frame + 1);
+            return samples[frame];
+        }
+
+        /**
+         * @return the summaries of every metric, keyed by metric name
+        */
+        std::vector<std::pair<std::string, MetricSummary>> summaries() const{
+            std::vector<std::pair<std::string, MetricSummary>> result;
+            for(const auto &metric : metrics())
+                result.push_back({metric.first, summarize(values(metric.second))});
+            return result;
+        }
+
+        /**
+         * pre: none
+         * post: the summary table and a CPU time histogram are printed
+        */
+        void printReport() const{
+            printf("benchmark: %zu frames measured (%d warmup)\n", measured(), warmupFrames);
+            printf("  %-14s %12s %12s %12s %12s %12s\n", "metric", "mean", "p50", "p95", "p99", "max");
+            for(const auto &summary : summaries()){
+                const MetricSummary &s = summary.second;
+                printf("  %-14s %12.3f %12.3f %12.3f %12.3f %12.3f\n", summary.first.c_str(), s.mean, s.p50, s.p95, s.p99, s.max);
+            }
+            std::vector<int> counts;
+            double bucket = histogram(values(&FrameSample::cpuMs), counts);
+            int most = *std::max_element(counts.begin(), counts.end());
+            printf("  cpu_ms histogram:\n");
+            for(size_t i = 0; i < counts.size(); i++){
+                int bar = most > 0 ? counts[i] * 40 / most : 0;
+                printf("  %8.3f - %8.3f %6d %s\n", i * bucket, (i + 1) * bucket, counts[i], std::string(bar, '#').c_str());
+            }
+        }
+
+        /**
+         * writes the summaries, histograms and every sample as JSON. the file can be used as a baseline
+         * @return false if the file couldn't be written
+        */
+        bool writeJson(const char *path, int width, int height) const{
+            FILE *file = fopen(path, "w");
+            if(file == NULL){
+                printf("failed to write benchmark results %s\n", path);
+                return false;
+            }
+            fprintf(file, "{\n  \"frames\": %zu,\n  \"warmup\": %d,\n  \"width\": %d,\n  \"height\": %d,\n  \"metrics\": {\n",
+                    measured(), warmupFrames, width, height);
+            std::vector<std::pair<std::string, MetricSummary>> all = summaries();
+            for(size_t i = 0; i < all.size(); i++){
+                const MetricSummary &s = all[i].second;
+                fprintf(file, "    \"%s\": {\"mean\": %.6f, \"p50\": %.6f, \"p95\": %.6f, \"p99\": %.6f, \"max\": %.6f}%s\n",
+                        all[i].first.c_str(), s.mean, s.p50, s.p95, s.p99, s.max, i + 1 < all.size() ? "," : "");
+            }
+            fprintf(file, "  },\n  \"histograms\": {\n");
+            const char *timed[] = {"cpu_ms", "gpu_ms"};
+            for(int h = 0; h < 2; h++){
+                std::vector<int> counts;
+                double bucket = histogram(values(h == 0 ? &FrameSample::cpuMs : &FrameSample::gpuMs), counts);
+                fprintf(file, "    \"%s\": {\"bucket_ms\": %.6f, \"counts\": [", timed[h], bucket);
+                for(size_t i = 0; i < counts.size(); i++)
+                    fprintf(file, "%s%d", i ? ", " : "", counts[i]);
+                fprintf(file, "]}%s\n", h == 0 ? "," : "");
+            }
+            fprintf(file, "  },\n  \"samples\": {\n");
+            std::vector<std::pair<std::string, double FrameSample::*>> allMetrics = metrics();
+            for(size_t m = 0; m < allMetrics.size(); m++){
+                fprintf(file, "    \"%s\": [", allMetrics[m].first.c_str());
+                std::vector<double> series = values(allMetrics[m].second);
+                for(size_t i = 0; i < series.size(); i++)
+                    fprintf(file, "%s%.4f", i ? ", " : "", series[i]);
+                fprintf(file, "]%s\n", m + 1 < allMetrics.size() ? "," : "");
+            }
+            fprintf(file, "  }\n}\n");
+            fclose(file);
+            printf("wrote benchmark results to %s\n", path);
+            return true;
+        }
+
+        /**
+         * compares this run against a results file from an earlier run. every gated
+         * metric may be at most its threshold percent higher than in the baseline
+         * @param path results JSON written by writeJson()
+         * @param thresholds "metric.stat=percent" overrides, or a bare "percent" for the default
+         * @return false if a gated metric regressed or the baseline couldn't be read
+        */
+        bool compareBaseline(const char *path, const std::vector<std::string> &thresholds) const{
+            std::map<std::string, double> baseline;
+            if(!readJsonNumbers(path, baseline)){
+                printf("failed to read baseline %s\n", path);
+                return false;
+            }
+            double defaultLimit = 10.0;
+            std::map<std::string, double> limits;
+            for(const std::string &threshold : thresholds){
+                size_t equals = threshold.find('=');
+                if(equals == std::string::npos)
+                    defaultLimit = atof(threshold.c_str());
+                else
+                    limits["metrics." + threshold.substr(0, equals)] = atof(threshold.c_str() + equals + 1);
+            }
+
+            const char *gated[] = {
+                "cpu_ms.mean", "cpu_ms.p95", "cpu_ms.p99", "gpu_ms.mean", "gpu_ms.p95", "gpu_ms.p99",
+                "draws.mean", "triangles.mean", "state_changes.mean", "upload_bytes.mean",
+            };
+            std::map<std::string, double> current;
+            for(const auto &summary : summaries()){
+                const MetricSummary &s = summary.second;
+                std::string prefix = "metrics." + summary.first + ".";
+                current[prefix + "mean"] = s.mean;
+                current[prefix + "p50"] = s.p50;
+                current[prefix + "p95"] = s.p95;
+                current[prefix + "p99"] = s.p99;
+                current[prefix + "max"] = s.max;
+            }
+            //explicitly given thresholds gate their metric even if it isn't gated by default
+            std::vector<std::string> keys;
+            for(const char *key : gated)
+                keys.push_back(std::string("metrics.") + key);
+            for(const auto &limit : limits)
+                if(std::find(keys.begin(), keys.end(), limit.first) == keys.end())
+                    keys.push_back(limit.first);
+
+            bool passed = true;
+            printf("baseline comparison against %s:\n", path);
+            for(const std::string &key : keys){
+                auto base = baseline.find(key);
+                auto now = current.find(key);
+                const char *name = key.c_str() + strlen("metrics.");
+                if(base == baseline.end() || now == current.end()){
+                    printf("  %-20s missing, skipped\n", name);
+                    continue;
+                }
+                double limit = limits.count(key) ? limits[key] : defaultLimit;
+                //nothing to compare against, e.g. no GPU timer queries on the baseline machine
+                if(base->second <= 0.0){
+                    printf("  %-20s baseline %12.3f current %12.3f   skipped\n", name, base->second, now->second);
+                    continue;
+                }
+                double change = (now->second - base->second) / base->second * 100.0;
+                bool regressed = change > limit;
+                passed &= !regressed;
+                printf("  %-20s baseline %12.3f current %12.3f %+8.2f%% (limit +%.1f%%) %s\n",
+                       name, base->second, now->second, change, limit, regressed ? "REGRESSED" : "ok");
+            }
+            printf("%s\n", passed ? "benchmark passed" : "benchmark FAILED: performance regressed");
+            return passed;
+        }
+
+    private:
+        static std::vector<std::pair<std::string, double FrameSample::*>> metrics(){
+            return {
+                {"cpu_ms", &FrameSample::cpuMs}, {"gpu_ms", &FrameSample::gpuMs}, {"draws", &FrameSample::draws},
+                {"triangles", &FrameSample::triangles}, {"state_changes", &FrameSample::stateChanges},
+                {"upload_bytes", &FrameSample::uploadBytes}, {"fence_wait_ms", &FrameSample::fenceWaitMs},
+            };
+        }
+
+        size_t measured() const{
+            return samples.size() > (size_t)warmupFrames ? samples.size() - warmupFrames : 0;
+        }
+
+        /**
+         * @return the measured (post warmup) values of one metric
+        */
+        std::vector<double> values(double FrameSample::*metric) const{
+            std::vector<double> result;
+            for(size_t i = warmupFrames; i < samples.size(); i++)
+                result.push_back(samples[i].*metric);
+            return result;
+        }
+
+        /**
+         * @param counts filled with 20 bucket counts from 0 to the largest value
+         * @return width of a bucket
+        */
+        static double histogram(const std::vector<double> &series, std::vector<int> &counts){
+            const int BUCKETS = 20;
+            counts.assign(BUCKETS, 0);
+            double largest = series.empty() ? 0.0 : *std::max_element(series.begin(), series.end());
+            double bucket = largest > 0.0 ? largest / BUCKETS : 1.0;
+            for(double value : series)
+                counts[std::min((int)(value / bucket), BUCKETS - 1)]++;
+            return bucket;
+        }
+
+        /**
+         * reads every number in a JSON file, keyed by its dotted path (array entries by index)
+         * @return false if the file couldn't be read or isn't valid JSON
+        */
+        static bool readJsonNumbers(const char *path, std::map<std::string, double> &out){
+            FILE *file = fopen(path, "rb");
+            if(file == NULL)
+                return false;
+            std::string text;
+            char buffer[4096];
+            size_t read;
+            while((read = fread(buffer, 1, sizeof(buffer), file)) > 0)
+                text.append(buffer, read);
+            fclose(file);
+            const char *p = text.c_str();
+            return parseJsonValue(p, "", out);
+        }
+
+        static void skipSpace(const char *&p){
+            while(*p == ' ' || *p == '\n' || *p == '\r' || *p == '\t')
+                p++;
+        }
+
+        static bool parseJsonString(const char *&p, std::string &out){
+            if(*p != '"')
+                return false;
+            for(p++; *p && *p != '"'; p++){
+                if(*p == '\\' && p[1])
+                    p++;
+                out += *p;
+            }
+            if(*p != '"')
+                return false;
+            p++;
+            return true;
+        }
+
+        static bool parseJsonValue(const char *&p, const std::string &key, std::map<std::string, double> &out){
+            skipSpace(p);
+            std::string prefix = key.empty() ? "" : key + ".";
+            if(*p == '{' || *p == '['){
+                bool object = *p == '{';
+                char close = object ? '}' : ']';
+                p++;
+                skipSpace(p);
+                for(int index = 0; *p != close; index++){
+                    std::string name = std::to_string(index);
+                    if(object){
+                        name.clear();
+                        if(!parseJsonString(p, name))
+                            return false;
+                        skipSpace(p);
+                        if(*p++ != ':')
+                            return false;
+                    }
+                    if(!parseJsonValue(p, prefix + name, out))
+                        return false;
+                    skipSpace(p);
+                    if(*p == ',')
+                        p++;
+                    else if(*p != close)
+                        return false;
+                    skipSpace(p);
+                }
+                p++;
+                return true;
+            }
+            if(*p == '"'){
+                std::string ignored;
+                return parseJsonString(p, ignored);
+            }
+            if(strncmp(p, "true", 4) == 0 || strncmp(p, "null", 4) == 0){
+                p += 4;
+                return true;
+            }
+            if(strncmp(p, "false", 5) == 0){
+                p += 5;
+                return true;
+            }
+            char *end;
+            double value = strtod(p, &end);
+            if(end == p)
+                return false;
+            out[key] = value;
+            p = end;
+            return true;
+        }
+};
+
+/**
+ * times whole frames on the GPU with GL_TIME_ELAPSED queries, read back LATENCY frames later
+*/
+class GpuFrameTimer{
+    public:
+        static constexpr int LATENCY = 4;
+
+        /**
+         * pre: a GL context is current, end() was called for the previous frame
+         * post: the GPU time of the commands until end() is measured for frame
+        */
+        void begin(int frame, BenchmarkRecorder &recorder){
+            slot = frame % LATENCY;
+            if(queries[slot] == 0)
+                glGenQueries(1, &queries[slot]);
+            //collect() normally emptied the slot already, without counting the wait as the frame's CPU time
+            if(frames[slot] >= 0)
+                read(slot, recorder);
+            frames[slot] = frame;
+            glBeginQuery(GL_TIME_ELAPSED, queries[slot]);
+        }
+
+        void end(){
+            glEndQuery(GL_TIME_ELAPSED);
+        }
+
+        /**
+         * reads back the query the next frame's begin() reuses, waiting for it if it isn't in yet
+         * pre: called after the frame's CPU time is sampled
+         * post: the slot of the next frame is free
+        */
+        void collect(BenchmarkRecorder &recorder){
+            int next = (slot + 1) % LATENCY;
+            if(frames[next] >= 0)
+                read(next, recorder);
+        }
+
+        /**
+         * waits for every outstanding query
+         * pre: none
+         * post: every measured frame has its gpuMs set
+        */
+        void finish(BenchmarkRecorder &recorder){
+            for(int i = 0; i < LATENCY; i++)
+                if(frames[i] >= 0)
+                    read(i, recorder);
+        }
+
+        void destroy(){
+            for(unsigned int &query : queries){
+                if(query != 0)
+                    glDeleteQueries(1, &query);
+                query = 0;
+            }
+        }
+
+    private:
+        unsigned int queries[LATENCY] = {};
+        int frames[LATENCY] = {-1, -1, -1, -1};
+        int slot = 0;
+
+        void read(int index, BenchmarkRecorder &recorder){
+            GLuint64 elapsed = 0;
+            glGetQueryObjectui64v(queries[index], GL_QUERY_RESULT, &elapsed);
+            recorder.sample(frames[index]).gpuMs = elapsed / 1e6;
+            frames[index] = -1;
+        }
+};
+
+#endif
@@ -0,0 +1,716 @@
+/**
+ * Benchmarks that can be run from the command line instead of the normal render loop
+*/
+#ifndef BENCHMARKS_H
+#define BENCHMARKS_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <math.h>
+#include <stdio.h>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "shader.h"
+#include "programPipeline.h"
+#include "VAO.h"
+#include "cameraUniforms.h"
+#include "frameTimer.h"
+#include "transformSystem.h"
+#include "entityStore.h"
+#include "frustumCuller.h"
+#include "gpuCuller.h"
+#include "particleSystem.h"
+#include "FBO.h"
+#include "occlusionCuller.h"
+#include "renderQueue.h"
+#include "scene.h"
+
+/**
+ * compares linking one program per vertex/fragment pairing against separable
+ * stage programs combined through cached pipelines
+ * @param variants number of vertex and of fragment shader variants (variants^2 pairings)
+ * @param vao vertex array to draw for every pairing
+ * @param indexCount number of indices to draw from vao
+ * pre: a GL context is current and glad is loaded
+ * post: build time, draw time and object counts of both approaches are printed
+*/
+inline void runPipelineBenchmark(int variants, VertArrObj &vao, int indexCount){
+    const std::string vertPath = "../resources/shaders/VertexShader.glsl";
+    const std::string fragPath = "../resources/shaders/FragmentShader.glsl";
+    if(!pipelinesSupported()){
+        printf("program pipelines need GL 4.1 or GL_ARB_separate_shader_objects\n");
+        return;
+    }
+    PreprocessedShader vert = ShaderPreprocessor::process(vertPath);
+    PreprocessedShader frag = ShaderPreprocessor::process(fragPath);
+    //every variant gets a unique define so the driver can't reuse a previous compile
+    auto variantDefine = [](int i){
+        return std::vector<std::string>{"VARIANT_ID " + std::to_string(i)};
+    };
+    glm::mat4 identity(1.0f);
+    CameraUniforms camera;
+    camera.init();
+    camera.latch(identity, identity);
+    glEnable(GL_DEPTH_TEST);
+
+    //1. monolithic: one linked program per pairing
+    double start = nowSeconds();
+    std::vector<unsigned int> programs;
+    for(int v = 0; v < variants; v++){
+        std::string vertCode = ShaderPreprocessor::addDefines(vert.source, variantDefine(v));
+        for(int f = 0; f < variants; f++)
+            programs.push_back(Shader::buildProgram(vertCode, ShaderPreprocessor::addDefines(frag.source, variantDefine(variants + f))));
+    }
+    glFinish();
+    double monoBuild = nowSeconds() - start;
+
+    start = nowSeconds();
+    vao.bind();
+    for(unsigned int program : programs){
+        glUseProgram(program);
+        glUniformMatrix4fv(glGetUniformLocation(program, "model"), 1, GL_FALSE, glm::value_ptr(identity));
+        glUniform1f(glGetUniformLocation(program, "scale"), 1.0f);
+        glDrawElements(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT, 0);
+    }
+    glFinish();
+    double monoDraw = nowSeconds() - start;
+
+    //2. separable: one program per stage variant, pairings are pipelines
+    ProgramPipelineCache cache;
+    start = nowSeconds();
+    std::vector<unsigned int> pipelines;
+    std::vector<unsigned int> vertStages;
+    for(int v = 0; v < variants; v++){
+        for(int f = 0; f < variants; f++){
+            pipelines.push_back(cache.get(vertPath, variantDefine(v), fragPath, variantDefine(variants + f)));
+            vertStages.push_back(cache.getStage(GL_VERTEX_SHADER, vertPath, variantDefine(v)));
+        }
+    }
+    glFinish();
+    double sepBuild = nowSeconds() - start;
+
+    start = nowSeconds();
+    glUseProgram(0);
+    for(size_t i = 0; i < pipelines.size(); i++){
+        unsigned int stage = vertStages[i];
+        glBindProgramPipeline(pipelines[i]);
+        glProgramUniformMatrix4fv(stage, glGetUniformLocation(stage, "model"), 1, GL_FALSE, glm::value_ptr(identity));
+        glProgramUniform1f(stage, glGetUniformLocation(stage, "scale"), 1.0f);
+        glDrawElements(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT, 0);
+    }
+    glFinish();
+    double sepDraw = nowSeconds() - start;
+    glBindProgramPipeline(0);
+    vao.unbind();
+
+    int pairings = variants * variants;
+    printf("pipeline benchmark: %d vertex x %d fragment variants (%d pairings)\n", variants, variants, pairings);
+    printf("  monolithic: %4d programs                  build %8.2f ms  draw %7.2f ms\n",
+           (int)programs.size(), monoBuild * 1000.0, monoDraw * 1000.0);
+    printf("  separable:  %4d programs + %4d pipelines  build %8.2f ms  draw %7.2f ms\n",
+           (int)cache.stageCount(), (int)cache.pipelineCount(), sepBuild * 1000.0, sepDraw * 1000.0);
+
+    for(unsigned int program : programs)
+        glDeleteProgram(program);
+    cache.destroy();
+    camera.destroy();
+}
+
+/**
+ * times world matrix updates of a large transform hierarchy. runs on the CPU only.
+ * @param count number of transforms, built as roots with 9 children of 10 children each
+ * pre: none
+ * post: full, partial (1% of roots changed) and idle update times are printed
+*/
+inline void runTransformBenchmark(size_t count){
+    TransformSystem transforms;
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+    auto randomRotation = [&](){
+        return glm::normalize(glm::quat(unit(rng), unit(rng), unit(rng), unit(rng)));
+    };
+    std::vector<TransformHandle> roots;
+    while(transforms.size() < count){
+        TransformHandle root = transforms.create(NO_PARENT, glm::vec3(unit(rng), unit(rng), unit(rng)) * 100.0f, randomRotation());
+        roots.push_back(root);
+        for(int c = 0; c < 9 && transforms.size() < count; c++){
+            TransformHandle child = transforms.create(root, glm::vec3(unit(rng), 0.0f, unit(rng)), randomRotation(), glm::vec3(0.5f));
+            for(int g = 0; g < 10 && transforms.size() < count; g++)
+                transforms.create(child, glm::vec3(0.0f, unit(rng), 0.0f), randomRotation());
+        }
+    }
+    //first update sorts the hierarchy by level
+    transforms.update();
+
+    const int runs = 10;
+    double full = 0.0, partial = 0.0, idle = 0.0;
+    size_t partialUpdated = 0;
+    for(int r = 0; r < runs; r++){
+        transforms.markAllDirty();
+        double start = nowSeconds();
+        transforms.update();
+        full += nowSeconds() - start;
+
+        for(size_t i = 0; i < roots.size() / 100; i++)
+            transforms.setRotation(roots[rng() % roots.size()], randomRotation());
+        start = nowSeconds();
+        transforms.update();
+        partial += nowSeconds() - start;
+        partialUpdated = transforms.lastUpdated;
+
+        start = nowSeconds();
+        transforms.update();
+        idle += nowSeconds() - start;
+    }
+    printf("transform benchmark: %zu transforms, %u threads\n", transforms.size(), JobSystem::instance().threadCount());
+    printf("  full update:    %8.3f ms\n", full * 1000.0 / runs);
+    printf("  partial update: %8.3f ms (%zu recomputed)\n", partial * 1000.0 / runs, partialUpdated);
+    printf("  idle update:    %8.3f ms\n", idle * 1000.0 / runs);
+}
+
+/**
+ * a typical array-of-objects scene object, for comparison with the entity store
+*/
+struct SceneObject{
+    std::string name;
+    glm::mat4 model;
+    glm::mat4 prevModel;
+    uint32_t mesh;
+    uint32_t material;
+    glm::vec3 boundsCenter;
+    float boundsRadius;
+    bool visible;
+};
+
+/**
+ * compares a culling style pass (sphere vs 6 planes, writing visibility) over the
+ * entity store against the same pass over an array of objects. runs on the CPU only.
+ * pre: none
+ * post: ns per entity for 10k, 100k and 1M entities are printed
+*/
+inline void runEntityBenchmark(){
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+    glm::vec4 planes[6] = {
+        {1, 0, 0, 50}, {-1, 0, 0, 50}, {0, 1, 0, 50}, {0, -1, 0, 50}, {0, 0, 1, 50}, {0, 0, -1, 50},
+    };
+    auto sphereVisible = [&](const glm::vec3 &center, float radius){
+        bool visible = true;
+        for(const glm::vec4 &plane : planes)
+            visible &= glm::dot(glm::vec3(plane), center) + plane.w > -radius;
+        return (uint8_t)visible;
+    };
+
+    printf("entity benchmark: visibility pass, %u threads\n", JobSystem::instance().threadCount());
+    printf("  %9s %14s %14s %14s\n", "entities", "objects ns/e", "store ns/e", "parallel ns/e");
+    for(size_t count : {10000u, 100000u, 1000000u}){
+        std::vector<SceneObject> objects(count);
+        EntityStore store;
+        for(size_t i = 0; i < count; i++){
+            glm::vec3 center(unit(rng) * 100.0f, unit(rng) * 100.0f, unit(rng) * 100.0f);
+            objects[i].name = "object" + std::to_string(i);
+            objects[i].model = glm::mat4(1.0f);
+            objects[i].boundsCenter = center;
+            objects[i].boundsRadius = 1.0f;
+            Entity entity = store.create();
+            store.add(entity, Transform{(TransformHandle)i});
+            store.add(entity, MeshRef{0});
+            store.add(entity, MaterialRef{0});
+            store.add(entity, Bounds{center, 1.0f});
+            store.add(entity, Visibility{0, 0xFF});
+        }
+        int runs = (int)(10000000 / count) + 1;
+        size_t visibleObjects = 0, visibleEntities = 0;
+
+        double start = nowSeconds();
+        for(int r = 0; r < runs; r++)
+            for(SceneObject &object : objects)
+                object.visible = sphereVisible(object.boundsCenter, object.boundsRadius);
+        double objectTime = nowSeconds() - start;
+        for(const SceneObject &object : objects)
+            visibleObjects += object.visible;
+
+        start = nowSeconds();
+        for(int r = 0; r < runs; r++)
+            store.each<Bounds, Visibility>([&](Entity, Bounds &bounds, Visibility &visibility){
+                visibility.visible = sphereVisible(bounds.center, bounds.radius);
+            });
+        double storeTime = nowSeconds() - start;
+
+        start = nowSeconds();
+        for(int r = 0; r < runs; r++)
+            store.parallelEach<Bounds, Visibility>(16384, [&](Entity, Bounds &bounds, Visibility &visibility){
+                visibility.visible = sphereVisible(bounds.center, bounds.radius);
+            });
+        double parallelTime = nowSeconds() - start;
+        store.each<Visibility>([&](Entity, Visibility &visibility){
+            visibleEntities += visibility.visible;
+        });
+        if(visibleEntities != visibleObjects)
+            printf("  mismatch: %zu visible objects vs %zu visible entities\n", visibleObjects, visibleEntities);
+
+        double scale = 1e9 / ((double)runs * count);
+        printf("  %9zu %14.2f %14.2f %14.2f\n", count, objectTime * scale, storeTime * scale, parallelTime * scale);
+    }
+}
+
+/**
+ * culls a static set of random spheres with a scalar loop, the SIMD kernel, the
+ * SIMD kernel across threads and the BVH. runs on the CPU only.
+ * @param count number of spheres, spread through a 1000 unit cube around the camera
+ * pre: none
+ * post: time, tests and visible count of each method are printed, and any
+ *       disagreement with the scalar results
+*/
+inline void runCullingBenchmark(size_t count){
+    std::mt19937 rng(11);
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+    FrustumCuller culler;
+    culler.spheres.resize(count);
+    for(size_t i = 0; i < count; i++)
+        culler.spheres.set(i, glm::vec3(unit(rng), unit(rng), unit(rng)) * 500.0f, 0.5f + (unit(rng) + 1.0f));
+    double start = nowSeconds();
+    CullBvh bvh;
+    bvh.build(culler.spheres);
+    double buildMs = (nowSeconds() - start) * 1000.0;
+
+    glm::mat4 projection = glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, 400.0f);
+    const int runs = 10;
+    CullStats scalar, simd, parallel, tree;
+    std::vector<uint8_t> reference(count), simdVisible(count), bvhVisible;
+    size_t mismatches = 0;
+    for(int r = 0; r < runs; r++){
+        //look in a different direction every run
+        glm::vec3 direction(cosf(r * 0.6f), 0.3f * unit(rng), sinf(r * 0.6f));
+        Frustum frustum(projection * glm::lookAt(glm::vec3(0.0f), direction, glm::vec3(0.0f, 1.0f, 0.0f)));
+
+        start = nowSeconds();
+        size_t visible = 0;
+        for(size_t i = 0; i < count; i++){
+            glm::vec3 center(culler.spheres.x[i], culler.spheres.y[i], culler.spheres.z[i]);
+            reference[i] = frustum.sphereVisible(center, culler.spheres.radius[i]);
+            visible += reference[i];
+        }
+        scalar.ms += (nowSeconds() - start) * 1000.0;
+        scalar.tested += count;
+        scalar.visible += visible;
+
+        start = nowSeconds();
+        simd.visible += cullSpheres(frustum, ALL_PLANES, culler.spheres, 0, count, simdVisible.data());
+        simd.ms += (nowSeconds() - start) * 1000.0;
+        simd.tested += count;
+
+        const CullStats &frame = culler.cull(frustum);
+        parallel.ms += frame.ms;
+        parallel.tested += frame.tested;
+        parallel.visible += frame.visible;
+
+        const CullStats &treeFrame = bvh.cull(frustum, bvhVisible);
+        tree.ms += treeFrame.ms;
+        tree.tested += treeFrame.tested;
+        tree.nodes += treeFrame.nodes;
+        tree.visible += treeFrame.visible;
+
+        for(size_t i = 0; i < count; i++)
+            mismatches += (simdVisible[i] != reference[i]) + (culler.visible[i] != reference[i]) + (bvhVisible[i] != reference[i]);
+    }
+
+#if defined(CULL_AVX2)
+    const char *kernel = "AVX2";
+#elif defined(CULL_SSE)
+    const char *kernel = "SSE";
+#else
+    const char *kernel = "scalar";
+#endif
+    printf("culling benchmark: %zu spheres, %s kernel, %u threads, BVH %zu nodes built in %.1f ms\n",
+           count, kernel, JobSystem::instance().threadCount(), bvh.nodeCount(), buildMs);
+    printf("  %-14s %10s %12s %10s %10s\n", "method", "ms/frame", "tested", "nodes", "visible");
+    auto row = [&](const char *name, const CullStats &total){
+        printf("  %-14s %10.3f %12zu %10zu %10zu\n", name, total.ms / runs, total.tested / runs, total.nodes / runs, total.visible / runs);
+    };
+    row("scalar", scalar);
+    row("simd", simd);
+    row("simd threaded", parallel);
+    row("bvh", tree);
+    if(mismatches > 0)
+        printf("  %zu results differ from the scalar test\n", mismatches);
+}
+
+/**
+ * street level view of a city: buildings are occluders, a scattered set of small
+ * objects is frustum culled and then tested against the occlusion culler's depth
+ * pyramid. runs on the CPU only.
+ * @param count number of small objects
+ * pre: none
+ * post: per frame cost of each occlusion stage and the occluded counts are printed,
+ *       along with objects the hierarchical test hid that a full resolution test wouldn't
+*/
+inline void runOcclusionBenchmark(size_t count){
+    std::mt19937 rng(5);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    OcclusionCuller occlusion;
+    std::vector<glm::vec3> boxVertices;
+    for(int c = 0; c < 8; c++)
+        boxVertices.push_back(glm::vec3(c & 1 ? 0.5f : -0.5f, c & 2 ? 1.0f : 0.0f, c & 4 ? 0.5f : -0.5f));
+    std::vector<uint32_t> boxIndices = {
+        0, 1, 3, 0, 3, 2,   4, 6, 7, 4, 7, 5,   0, 4, 5, 0, 5, 1,
+        2, 3, 7, 2, 7, 6,   0, 2, 6, 0, 6, 4,   1, 5, 7, 1, 7, 3,
+    };
+    uint32_t boxMesh = occlusion.addMesh(boxVertices, boxIndices);
+
+    //16x16 blocks of buildings 12 wide on a 20 unit grid, leaving 8 unit streets
+    const int blocks = 16;
+    const float spacing = 20.0f;
+    std::vector<glm::mat4> buildings;
+    for(int z = 0; z < blocks; z++){
+        for(int x = 0; x < blocks; x++){
+            glm::vec3 position((x - blocks / 2) * spacing + spacing * 0.5f, 0.0f, (z - blocks / 2) * spacing + spacing * 0.5f);
+            buildings.push_back(glm::scale(glm::translate(glm::mat4(1.0f), position), glm::vec3(12.0f, 10.0f + 30.0f * unit(rng), 12.0f)));
+        }
+    }
+    SphereBounds objects;
+    objects.resize(count);
+    float half = blocks * spacing * 0.5f;
+    for(size_t i = 0; i < count; i++)
+        objects.set(i, glm::vec3((unit(rng) * 2.0f - 1.0f) * half, 0.5f + 8.0f * unit(rng), (unit(rng) * 2.0f - 1.0f) * half), 0.3f + 1.5f * unit(rng));
+
+    glm::mat4 projection = glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, 1000.0f);
+    const int runs = 10;
+    OcclusionStats total;
+    double frustumMs = 0.0;
+    size_t frustumVisible = 0, exactOccluded = 0, overOccluded = 0;
+    std::vector<uint8_t> visible(count), hierarchical;
+    for(int r = 0; r < runs; r++){
+        //stand in a street looking down a different direction every run
+        glm::vec3 eye(0.0f, 1.8f, (r - runs / 2) * 2.0f);
+        glm::vec3 direction(cosf(r * 0.7f), -0.05f, sinf(r * 0.7f));
+        glm::mat4 viewProjection = projection * glm::lookAt(eye, eye + direction, glm::vec3(0.0f, 1.0f, 0.0f));
+
+        double start = nowSeconds();
+        frustumVisible += cullSpheres(Frustum(viewProjection), ALL_PLANES, objects, 0, count, visible.data());
+        frustumMs += (nowSeconds() - start) * 1000.0;
+
+        occlusion.clearOccluders();
+        for(const glm::mat4 &building : buildings)
+            occlusion.addOccluder(boxMesh, building);
+        occlusion.rasterize(viewProjection);
+        hierarchical = visible;
+        occlusion.testSpheres(objects, hierarchical);
+        total.occluders += occlusion.stats.occluders;
+        total.triangles += occlusion.stats.triangles;
+        total.tested += occlusion.stats.tested;
+        total.occluded += occlusion.stats.occluded;
+        total.rasterMs += occlusion.stats.rasterMs;
+        total.pyramidMs += occlusion.stats.pyramidMs;
+        total.testMs += occlusion.stats.testMs;
+
+        //the hierarchical test may keep more objects than the full resolution one, never fewer
+        for(size_t i = 0; i < count; i++){
+            if(!visible[i])
+                continue;
+            glm::vec3 extent(objects.radius[i]);
+            bool exact = occlusion.boxVisible(glm::vec3(objects.x[i], objects.y[i], objects.z[i]), extent, false);
+            exactOccluded += !exact;
+            overOccluded += exact && !hierarchical[i];
+        }
+    }
+
+#if defined(CULL_AVX2)
+    const char *kernel = "AVX2";
+#elif defined(CULL_SSE)
+    const char *kernel = "SSE";
+#else
+    const char *kernel = "scalar";
+#endif
+    printf("occlusion benchmark: %zu objects, %zu occluders (%zu triangles drawn), %dx%d depth buffer, %s rasterizer, %u threads\n",
+           count, buildings.size(), total.triangles / runs, occlusion.width(), occlusion.height(), kernel, JobSystem::instance().threadCount());
+    printf("  frustum culling  %8.3f ms/frame, %zu visible\n", frustumMs / runs, frustumVisible / runs);
+    printf("  rasterize        %8.3f ms/frame\n", total.rasterMs / runs);
+    printf("  depth pyramid    %8.3f ms/frame\n", total.pyramidMs / runs);
+    printf("  test             %8.3f ms/frame, %.1f ns/object\n", total.testMs / runs, total.testMs * 1e6 / std::max<size_t>(total.tested, 1));
+    printf("  occluded         %zu of %zu frustum visible (%.1f%%), %zu with the full resolution test\n",
+           total.occluded / runs, total.tested / runs, 100.0 * total.occluded / std::max<size_t>(total.tested, 1), exactOccluded / runs);
+    if(overOccluded > 0)
+        printf("  %zu objects hidden by the hierarchical test but not the full resolution one\n", overOccluded);
+}
+
+/**
+ * compares recording draws on the GL thread through RenderQueue::submit against
+ * recording them into per-thread command lists on the job system
+ * @param count number of entities to draw
+ * @param shader program the draws use
+ * @param vao vertex array the draws use
+ * @param indexCount number of indices per draw
+ * pre: a GL context is current and glad is loaded
+ * post: record and execute times of both approaches are printed
+*/
+inline void runRecordingBenchmark(size_t count, Shader &shader, VertArrObj &vao, int indexCount){
+    unsigned int textures[4];
+    glGenTextures(4, textures);
+    for(unsigned int texture : textures){
+        const unsigned char white[4] = {255, 255, 255, 255};
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, white);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    Scene scene;
+    uint32_t mesh = scene.addMesh({vao.ID, indexCount, glm::vec3(0.0f, 0.4f, 0.0f), 0.82f});
+    std::vector<uint32_t> materials;
+    for(int i = 0; i < 8; i++)
+        materials.push_back(scene.addMaterial({&shader, textures[i % 4], i < 6 ? 1.0f : 0.6f}));
+    size_t side = (size_t)ceil(sqrt((double)count));
+    for(size_t i = 0; i < count; i++)
+        scene.spawn(NO_PARENT, glm::vec3((float)(i % side) - side * 0.5f, -2.0f, -(float)(i / side)), mesh, materials[i % materials.size()]);
+    scene.updateTransforms();
+
+    glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 2.0f, 4.0f), glm::vec3(0.0f, 0.0f, -2.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    glm::mat4 projection = glm::perspective(glm::radians(45.0f), 1.0f, 0.1f, 1000.0f);
+    RenderQueue queue(0.1f, 1000.0f);
+    CameraUniforms camera;
+    camera.init();
+    camera.latch(view, projection);
+    glEnable(GL_DEPTH_TEST);
+
+    const int runs = 10;
+    double serialRecord = 0.0, serialExecute = 0.0, parallelRecord = 0.0, parallelExecute = 0.0;
+    for(int r = 0; r < runs; r++){
+        //1. every draw submitted from the GL thread
+        double start = nowSeconds();
+        scene.entities.each<Transform, MeshRef, MaterialRef>([&](Entity, Transform &transform, MeshRef &meshRef, MaterialRef &materialRef){
+            const Mesh &drawMesh = scene.meshes[meshRef.mesh];
+            const Material &material = scene.materials[materialRef.material];
+            DrawCommand draw;
+            draw.shader = material.shader;
+            draw.texture = material.texture;
+            draw.vao = drawMesh.vao;
+            draw.indexCount = drawMesh.indexCount;
+            draw.model = scene.transforms.getWorld(transform.node);
+            draw.opacity = material.opacity;
+            queue.submit(draw, -(view * draw.model[3]).z);
+        });
+        serialRecord += nowSeconds() - start;
+        start = nowSeconds();
+        queue.execute();
+        glFinish();
+        serialExecute += nowSeconds() - start;
+
+        //2. recorded into per-thread command lists
+        start = nowSeconds();
+        scene.buildDraws(queue, view);
+        parallelRecord += nowSeconds() - start;
+        start = nowSeconds();
+        queue.execute();
+        glFinish();
+        parallelExecute += nowSeconds() - start;
+    }
+    glDeleteTextures(4, textures);
+    camera.destroy();
+
+    printf("recording benchmark: %zu draws, %u threads\n", count, JobSystem::instance().threadCount());
+    printf("  GL thread submit: record %8.3f ms  execute %8.3f ms\n", serialRecord * 1000.0 / runs, serialExecute * 1000.0 / runs);
+    printf("  command lists:    record %8.3f ms  execute %8.3f ms (%d lists)\n", parallelRecord * 1000.0 / runs, parallelExecute * 1000.0 / runs, queue.stats.lists);
+}
+
+/**
+ * culls random pyramids with GpuCuller at a tenth, and all of count, showing the
+ * CPU cost stays flat while the instance count grows. a huge pyramid in front of
+ * the camera hides part of the rest from the Hi-Z test.
+ * @param count largest number of instances
+ * @param shader program drawing culled instances (IndirectVertexShader.glsl)
+ * @param vao vertex array of the pyramid
+ * @param indexCount number of indices of the pyramid
+ * pre: a GL 4.3 context is current and glad is loaded
+ * post: CPU and GPU time per frame and drawn counts are printed, along with any
+ *       difference between the GPU's frustum test and the CPU's
+*/
+inline void runGpuCullingBenchmark(size_t count, Shader &shader, VertArrObj &vao, int indexCount){
+    GpuCuller culler;
+    if(!culler.init("../resources/shaders", &shader)){
+        culler.destroy();
+        return;
+    }
+    culler.attachInstanceIds(vao.ID);
+    uint32_t batch = culler.addBatch(vao.ID, indexCount, 0, 1.0f);
+    FrameBufObj target(512, 512);
+    target.bind();
+    glEnable(GL_DEPTH_TEST);
+    glm::mat4 view = glm::lookAt(glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    glm::mat4 projection = glm::perspective(glm::radians(60.0f), 1.0f, 0.1f, 1000.0f);
+    glm::mat4 viewProjection = projection * view;
+    Frustum frustum(viewProjection);
+    CameraUniforms camera;
+    camera.init();
+    camera.latch(view, projection);
+    unsigned int query;
+    glGenQueries(1, &query);
+
+    printf("gpu culling benchmark: %s, %s\n", glGetString(GL_RENDERER),
+           GLAD_GL_VERSION_4_6 ? "glMultiDrawElementsIndirectCount" : "glMultiDrawElementsIndirect over zeroed commands");
+    printf("  %9s %10s %10s %10s %10s %12s %12s %12s\n", "instances", "fill ms", "cull ms", "draw ms", "gpu ms", "cpu frustum", "gpu frustum", "gpu hi-z");
+    for(size_t instances : {count / 10, count}){
+        std::mt19937 rng(3);
+        std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+        SphereBounds spheres;
+        spheres.resize(instances);
+        std::vector<glm::mat4> models(instances);
+        for(size_t i = 0; i < instances; i++){
+            glm::vec3 position(unit(rng) * 300.0f, unit(rng) * 300.0f, unit(rng) * 300.0f);
+            float scale = 1.0f + (unit(rng) + 1.0f) * 2.0f;
+            //the first one is a wall in front of the camera
+            if(i == 0){
+                position = glm::vec3(0.0f, -150.0f, -250.0f);
+                scale = 400.0f;
+            }
+            models[i] = glm::scale(glm::translate(glm::mat4(1.0f), position), glm::vec3(scale));
+            spheres.set(i, position + glm::vec3(0.0f, 0.4f, 0.0f) * scale, 0.82f * scale);
+        }
+        std::vector<uint8_t> visible(instances);
+        size_t cpuVisible = cullSpheres(frustum, ALL_PLANES, spheres, 0, instances, visible.data());
+
+        double fillMs = 0.0, cullMs = 0.0, drawMs = 0.0, gpuMs = 0.0;
+        size_t drawn[2] = {0, 0};
+        const int frames = 2 * GpuCuller::READBACK_LATENCY + 2;
+        for(int pass = 0; pass < 2; pass++){
+            //frustum only, then with the depth of the previous frames
+            culler.occlusion = pass == 1;
+            for(int frame = 0; frame < frames; frame++){
+                double start = nowSeconds();
+                culler.clearInstances();
+                for(size_t i = 0; i < instances; i++)
+                    culler.addInstance(batch, models[i], glm::vec3(spheres.x[i], spheres.y[i], spheres.z[i]), spheres.radius[i]);
+                double filled = nowSeconds();
+                glBeginQuery(GL_TIME_ELAPSED, query);
+                glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+                culler.cull(viewProjection);
+                double culled = nowSeconds();
+                culler.draw();
+                double drew = nowSeconds();
+                culler.captureDepth(target.width, target.height, viewProjection);
+                glEndQuery(GL_TIME_ELAPSED);
+                GLuint64 elapsed = 0;
+                glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
+                if(pass == 1){
+                    fillMs += (filled - start) * 1000.0;
+                    cullMs += (culled - filled) * 1000.0;
+                    drawMs += (drew - culled) * 1000.0;
+                    gpuMs += elapsed / 1e6;
+                }
+            }
+            drawn[pass] = culler.stats.drawn;
+        }
+        printf("  %9zu %10.3f %10.3f %10.3f %10.3f %12zu %12zu %12zu\n", instances, fillMs / frames, cullMs / frames, drawMs / frames,
+               gpuMs / frames, cpuVisible, drawn[0], drawn[1]);
+    }
+    glDeleteQueries(1, &query);
+    target.unbind();
+    target.destroy();
+    culler.destroy();
+    camera.destroy();
+}
+
+
+/**
+ * runs a fountain of particles on the CPU and on the GPU backend, with a tenth
+ * and with all of count particles alive once it has filled up. both backends
+ * emit the same particles, so the same number should be alive after the same
+ * updates.
+ * @param count particles alive at once in the larger run
+ * pre: a GL context is current and glad is loaded, the GPU backend is skipped below GL 4.3
+ * post: CPU and GPU time of updating and drawing per frame and the live counts are printed
+*/
+inline void runParticleBenchmark(size_t count){
+    FrameBufObj target(512, 512);
+    target.bind();
+    glEnable(GL_DEPTH_TEST);
+    glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 2.0f, 6.0f), glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    glm::mat4 projection = glm::perspective(glm::radians(60.0f), 1.0f, 0.1f, 100.0f);
+    CameraUniforms camera;
+    camera.init();
+    camera.latch(view, projection);
+    unsigned int queries[2];
+    glGenQueries(2, queries);
+    const float dt = 1.0f / 60.0f;
+    const int frames = 30;
+    const float minLife = 1.6f, maxLife = 2.0f;
+
+#if defined(CULL_AVX2)
+    const char *simd = "AVX2";
+#elif defined(CULL_SSE)
+    const char *simd = "SSE";
+#else
+    const char *simd = "scalar";
+#endif
+    printf("particle benchmark: %s, %u threads, %s\n", glGetString(GL_RENDERER), JobSystem::instance().threadCount(), simd);
+    printf("  %7s %10s %10s %10s %10s %10s %10s %10s\n", "backend", "capacity", "alive", "update ms", "draw ms", "gpu update", "gpu draw", "upload ms");
+    size_t cpuAlive[2] = {0, 0};
+    for(ParticleBackend backend : {PARTICLES_CPU, PARTICLES_GPU}){
+        const char *name = backend == PARTICLES_CPU ? "cpu" : "gpu";
+        if(!ParticleSystem::supported(backend)){
+            printf("  %7s needs GL 4.3\n", name);
+            continue;
+        }
+        for(int run = 0; run < 2; run++){
+            size_t alive = run == 0 ? count / 10 : count;
+            //emitted at a rate that keeps alive particles living on average, with room for the longest lived
+            float rate = (float)alive / ((minLife + maxLife) * 0.5f);
+            size_t capacity = (size_t)ceil(rate * (maxLife + dt)) + 1;
+            ParticleSystem particles;
+            if(!particles.init("../resources/shaders", backend, capacity)){
+                printf("  %7s failed to start with room for %zu particles\n", name, capacity);
+                particles.destroy();
+                continue;
+            }
+            particles.emitter.position = glm::vec3(0.0f);
+            particles.emitter.rate = rate;
+            particles.emitter.minLife = minLife;
+            particles.emitter.maxLife = maxLife;
+            //fill up, then measure
+            int warmup = (int)ceil(maxLife / dt) + 1;
+            for(int frame = 0; frame < warmup; frame++)
+                particles.update(dt);
+            glFinish();
+            double updateMs = 0.0, drawMs = 0.0, gpuUpdateMs = 0.0, gpuDrawMs = 0.0, uploadMs = 0.0;
+            for(int frame = 0; frame < frames; frame++){
+                glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+                double start = nowSeconds();
+                glBeginQuery(GL_TIME_ELAPSED, queries[0]);
+                particles.update(dt);
+                glEndQuery(GL_TIME_ELAPSED);
+                double updated = nowSeconds();
+                glBeginQuery(GL_TIME_ELAPSED, queries[1]);
+                particles.draw();
+                glEndQuery(GL_TIME_ELAPSED);
+                double drew = nowSeconds();
+                GLuint64 elapsed[2] = {0, 0};
+                glGetQueryObjectui64v(queries[0], GL_QUERY_RESULT, &elapsed[0]);
+                glGetQueryObjectui64v(queries[1], GL_QUERY_RESULT, &elapsed[1]);
+                updateMs += (updated - start) * 1000.0;
+                drawMs += (drew - updated) * 1000.0;
+                gpuUpdateMs += elapsed[0] / 1e6;
+                gpuDrawMs += elapsed[1] / 1e6;
+                uploadMs += particles.stats.uploadMs;
+            }
+            size_t live = particles.readAlive();
+            printf("  %7s %10zu %10zu %10.3f %10.3f %10.3f %10.3f %10.3f\n", name, capacity, live, updateMs / frames, drawMs / frames,
+                   gpuUpdateMs / frames, gpuDrawMs / frames, uploadMs / frames);
+            if(backend == PARTICLES_CPU)
+                cpuAlive[run] = live;
+            else if(cpuAlive[run] != 0 && live != cpuAlive[run])
+                printf("  %zu particles alive on the gpu, %zu on the cpu\n", live, cpuAlive[run]);
+            particles.destroy();
+        }
+    }
+    glDeleteQueries(2, queries);
+    target.unbind();
+    target.destroy();
+    camera.destroy();
+}
+
+#endif
@@ -0,0 +1,102 @@
+/**
+ * The camera's view and projection matrices in a uniform buffer, the Camera
+ * block of common/camera.glsl. Every program that draws the scene reads them
+ * from there instead of from uniforms of its own, so they are written once a
+ * frame and can be written late: latch() runs after culling, shadows and
+ * recording, right before the scene's draws are submitted, with the view moved
+ * by the newest input.
+ *
+ * With GL 4.4 the buffer is mapped persistently and coherently, so a latch is a
+ * copy into mapped memory with no GL call besides the binding. There is a slot
+ * per frame in flight, and FrameContexts' fences guarantee the GPU is done with
+ * a slot before it is written again. Older contexts fall back to
+ * glBufferSubData.
+*/
+#ifndef CAMERA_UNIFORMS_H
+#define CAMERA_UNIFORMS_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <string.h>
+#include <algorithm>
+
+#include "frameContext.h"
+
+/**
+ * std140 layout of the Camera block
+*/
+struct CameraBlock{
+    glm::mat4 view;
+    glm::mat4 projection;
+};
+
+class CameraUniforms{
+    public:
+        static constexpr unsigned int BINDING = 0;     //uniform buffer binding of the Camera block, every block's default
+        static constexpr int SLOTS = FrameContexts::MAX_FRAMES;
+
+        bool persistent = false;    //latch() writes through a persistent mapping
+
+        /**
+         * pre: a GL 3.3 context is current
+        */
+        void init(){
+            GLint alignment = 0;
+            glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+            alignment = std::max<GLint>(alignment, 1);
+            stride = (sizeof(CameraBlock) + alignment - 1) / alignment * alignment;
+            glGenBuffers(1, &buffer);
+            glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+            if(GLAD_GL_VERSION_4_4){
+                GLbitfield mapFlags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+                //dynamic storage keeps glBufferSubData open if the mapping fails
+                glBufferStorage(GL_UNIFORM_BUFFER, stride * SLOTS, NULL, mapFlags | GL_DYNAMIC_STORAGE_BIT);
+                mapped = (unsigned char*)glMapBufferRange(GL_UNIFORM_BUFFER, 0, stride * SLOTS, mapFlags);
+            } else{
+                glBufferData(GL_UNIFORM_BUFFER, stride * SLOTS, NULL, GL_DYNAMIC_DRAW);
+            }
+            glBindBuffer(GL_UNIFORM_BUFFER, 0);
+            persistent = mapped != NULL;
+        }
+
+        /**
+         * writes the matrices every following draw of the scene uses
+         * @param slot FrameContexts::index() of the frame, the GPU is done with the slot's last use
+         * pre: init() ran
+         * post: the Camera block reads view and projection until the next latch()
+        */
+        void latch(const glm::mat4 &view, const glm::mat4 &projection, int slot = 0){
+            CameraBlock block;
+            block.view = view;
+            block.projection = projection;
+            size_t offset = (size_t)slot * stride;
+            if(mapped != NULL){
+                memcpy(mapped + offset, &block, sizeof(block));
+            } else{
+                glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+                glBufferSubData(GL_UNIFORM_BUFFER, offset, sizeof(block), &block);
+                glBindBuffer(GL_UNIFORM_BUFFER, 0);
+            }
+            glBindBufferRange(GL_UNIFORM_BUFFER, BINDING, buffer, offset, sizeof(block));
+        }
+
+        void destroy(){
+            if(mapped != NULL){
+                glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+                glUnmapBuffer(GL_UNIFORM_BUFFER);
+                glBindBuffer(GL_UNIFORM_BUFFER, 0);
+                mapped = NULL;
+            }
+            glDeleteBuffers(1, &buffer);
+            buffer = 0;
+            persistent = false;
+        }
+
+    private:
+        unsigned int buffer = 0;
+        size_t stride = 0;                  //bytes between slots, a multiple of the offset alignment
+        unsigned char *mapped = NULL;
+};
+
+#endif
@@ -0,0 +1,370 @@
+/**
+ * Clustered forward lighting. The view frustum is split into CLUSTERS_X * CLUSTERS_Y
+ * screen tiles and CLUSTERS_Z depth slices, spaced logarithmically so clusters stay
+ * roughly as deep as they are wide. Every frame the lights are binned into the
+ * clusters on the CPU: the slices are spread over the job system, each one first
+ * keeps the lights overlapping its depth range, then tests those against each of
+ * its clusters' view space boxes 8 at a time with AVX2, 4 with SSE and one at a time
+ * otherwise. The lights, each cluster's (first, count) range and the packed light
+ * index lists go to the GPU in texture buffers, and FragmentShader.glsl built with
+ * CLUSTERED_LIGHTING shades a fragment with only its cluster's lights.
+ *
+ * Unlike deferred shading this keeps one pass per draw, so translucent draws are
+ * lit the same way as opaque ones and MSAA targets would work unchanged.
+*/
+#ifndef CLUSTERED_LIGHTING_H
+#define CLUSTERED_LIGHTING_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <algorithm>
+#include <vector>
+
+#include "frameTimer.h"
+#include "jobSystem.h"
+#include "lights.h"
+#include "profiler.h"
+#include "shader.h"
+#include "simd.h"
+
+struct ClusterStats{
+    static constexpr int HISTOGRAM_BUCKETS = 9;
+
+    size_t lights = 0;
+    size_t clusters = 0;
+    size_t litClusters = 0;     //clusters with at least one light
+    size_t indices = 0;         //light/cluster pairs
+    size_t maxLights = 0;       //most lights in one cluster
+    size_t dropped = 0;         //pairs that didn't fit the index buffer
+    //clusters by light count: 0, 1, 2, 3-4, 5-8, ... 33-64, more
+    size_t histogram[HISTOGRAM_BUCKETS] = {};
+    double binMs = 0.0;         //CPU time of bin(), upload included
+
+    void print(const char *name) const{
+        printf("%s: %zu lights, %zu of %zu clusters lit, %.1f lights per lit cluster, %zu max, %.3f ms binning\n",
+               name, lights, litClusters, clusters, litClusters > 0 ? (double)indices / litClusters : 0.0, maxLights, binMs);
+        printf("%s: lights per cluster", name);
+        for(int b = 0; b < HISTOGRAM_BUCKETS; b++){
+            if(b < 3)
+                printf(" %d:%zu", b, histogram[b]);
+            else if(b < HISTOGRAM_BUCKETS - 1)
+                printf(" %d-%d:%zu", (1 << (b - 2)) + 1, 1 << (b - 1), histogram[b]);
+            else
+                printf(" >%d:%zu", 1 << (b - 2), histogram[b]);
+        }
+        if(dropped > 0)
+            printf(" (%zu dropped)", dropped);
+        printf("\n");
+    }
+};
+
+class ClusteredLighting{
+    public:
+        static constexpr int CLUSTERS_X = 16;
+        static constexpr int CLUSTERS_Y = 9;
+        static constexpr int CLUSTERS_Z = 24;
+        static constexpr int CLUSTER_COUNT = CLUSTERS_X * CLUSTERS_Y * CLUSTERS_Z;
+        static constexpr int FIRST_TEXTURE_UNIT = 1;    //the three buffers take this unit and the two after it
+
+        glm::vec3 ambient{0.15f};
+        ClusterStats stats;
+
+        /**
+         * creates the buffers and their buffer textures
+         * pre: a GL context is current
+        */
+        void init(){
+            glGenBuffers(3, buffers);
+            glGenTextures(3, textures);
+            GLenum formats[3] = {GL_RGBA32F, GL_RG32UI, GL_R32UI};
+            for(int i = 0; i < 3; i++){
+                glBindBuffer(GL_TEXTURE_BUFFER, buffers[i]);
+                glBufferData(GL_TEXTURE_BUFFER, 16, NULL, GL_STREAM_DRAW);
+                glBindTexture(GL_TEXTURE_BUFFER, textures[i]);
+                glTexBuffer(GL_TEXTURE_BUFFER, formats[i], buffers[i]);
+            }
+            glBindBuffer(GL_TEXTURE_BUFFER, 0);
+            glBindTexture(GL_TEXTURE_BUFFER, 0);
+            int maxTexels = 0;
+            glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTexels);
+            maxIndices = (size_t)maxTexels;
+        }
+
+        /**
+         * bins the lights into this frame's clusters and uploads the lists
+         * @param lights lights in world space
+         * @param view the camera's view matrix
+         * @param projection the camera's perspective projection matrix
+         * @param width width of the framebuffer drawn to
+         * @param height height of the framebuffer drawn to
+         * pre: init() ran
+         * post: apply() makes a program read this frame's lists
+        */
+        void bin(const std::vector<PointLight> &lights, const glm::mat4 &view, const glm::mat4 &projection, int width, int height){
+            PROFILE_ZONE("light binning");
+            double start = nowSeconds();
+            if(projection != clusterProjection)
+                buildClusters(projection);
+            targetWidth = width;
+            targetHeight = height;
+
+            lightsToView(lights, view, gpuLights);
+            size_t count = gpuLights.size();
+            lightX.resize(count);
+            lightY.resize(count);
+            lightZ.resize(count);
+            lightRadius.resize(count);
+            for(size_t i = 0; i < count; i++){
+                lightX[i] = gpuLights[i].positionRadius.x;
+                lightY[i] = gpuLights[i].positionRadius.y;
+                lightZ[i] = gpuLights[i].positionRadius.z;
+                lightRadius[i] = gpuLights[i].positionRadius.w;
+            }
+
+            JobSystem::instance().parallelFor(CLUSTERS_Z, 1, [&](size_t begin, size_t end){
+                for(size_t slice = begin; slice < end; slice++)
+                    binSlice((int)slice);
+            });
+
+            //concatenate the slices' lists, each cluster's range pointing into the result
+            stats = ClusterStats();
+            indices.clear();
+            for(int slice = 0; slice < CLUSTERS_Z; slice++){
+                const Slice &s = slices[slice];
+                size_t next = 0;
+                for(int c = 0; c < CLUSTERS_X * CLUSTERS_Y; c++){
+                    int cluster = slice * CLUSTERS_X * CLUSTERS_Y + c;
+                    uint32_t lightCount = s.counts[c];
+                    size_t kept = std::min<size_t>(lightCount, maxIndices - std::min(maxIndices, indices.size()));
+                    ranges[cluster * 2] = (uint32_t)indices.size();
+                    ranges[cluster * 2 + 1] = (uint32_t)kept;
+                    indices.insert(indices.end(), s.indices.begin() + next, s.indices.begin() + next + kept);
+                    next += lightCount;
+                    stats.dropped += lightCount - kept;
+                    stats.litClusters += lightCount > 0;
+                    stats.maxLights = std::max<size_t>(stats.maxLights, lightCount);
+                    stats.histogram[histogramBucket(lightCount)]++;
+                }
+            }
+            upload(0, gpuLights.data(), count * sizeof(GpuLight));
+            upload(1, ranges, sizeof(ranges));
+            upload(2, indices.data(), indices.size() * sizeof(uint32_t));
+
+            stats.lights = count;
+            stats.clusters = CLUSTER_COUNT;
+            stats.indices = indices.size();
+            stats.binMs = (nowSeconds() - start) * 1000.0;
+            PROFILE_COUNTER("light binning ms", stats.binMs);
+            PROFILE_COUNTER("lights per lit cluster", stats.litClusters > 0 ? (double)stats.indices / stats.litClusters : 0.0);
+        }
+
+        /**
+         * makes shader light its draws with the lists of the last bin()
+         * @param shader program built with CLUSTERED_LIGHTING, see FragmentShader.glsl
+         * post: shader is bound, the buffers are bound to their texture units and
+         *       texture unit 0 is active
+        */
+        void apply(Shader &shader){
+            shader.use();
+            glUniform3ui(shader.getUniformLocation("clusterCounts"), CLUSTERS_X, CLUSTERS_Y, CLUSTERS_Z);
+            glUniform2f(shader.getUniformLocation("clusterTileScale"), (float)CLUSTERS_X / targetWidth, (float)CLUSTERS_Y / targetHeight);
+            glUniform2f(shader.getUniformLocation("clusterSliceScaleBias"), sliceScale, sliceBias);
+            glUniform3fv(shader.getUniformLocation("ambient"), 1, glm::value_ptr(ambient));
+            //set every frame, a hot reload resets the sampler units to 0
+            shader.setIntUniform("clusterLights", FIRST_TEXTURE_UNIT);
+            shader.setIntUniform("clusterRanges", FIRST_TEXTURE_UNIT + 1);
+            shader.setIntUniform("clusterIndices", FIRST_TEXTURE_UNIT + 2);
+            for(int i = 0; i < 3; i++){
+                glActiveTexture(GL_TEXTURE0 + FIRST_TEXTURE_UNIT + i);
+                glBindTexture(GL_TEXTURE_BUFFER, textures[i]);
+            }
+            glActiveTexture(GL_TEXTURE0);
+        }
+
+        /**
+         * pre: the context init() ran on is current
+         * post: the buffers and their textures are deleted
+        */
+        void destroy(){
+            glDeleteTextures(3, textures);
+            glDeleteBuffers(3, buffers);
+            for(int i = 0; i < 3; i++)
+                textures[i] = buffers[i] = 0;
+        }
+
+    private:
+        //view space bounds of a slice's clusters and the lists binned into them
+        struct Slice{
+            float nearZ, farZ;      //distances in front of the camera
+            float minX[CLUSTERS_X * CLUSTERS_Y], minY[CLUSTERS_X * CLUSTERS_Y], minZ[CLUSTERS_X * CLUSTERS_Y];
+            float maxX[CLUSTERS_X * CLUSTERS_Y], maxY[CLUSTERS_X * CLUSTERS_Y], maxZ[CLUSTERS_X * CLUSTERS_Y];
+            //lights overlapping the slice's depth range
+            std::vector<float> x, y, z, radius;
+            std::vector<uint32_t> ids;
+            uint32_t counts[CLUSTERS_X * CLUSTERS_Y];
+            std::vector<uint32_t> indices;      //every cluster's lights, in cluster order
+        };
+
+        Slice slices[CLUSTERS_Z];
+        glm::mat4 clusterProjection{0.0f};      //projection the bounds were built for
+        float sliceScale = 0.0f, sliceBias = 0.0f;
+        int targetWidth = 1, targetHeight = 1;
+
+        std::vector<GpuLight> gpuLights;
+        std::vector<float> lightX, lightY, lightZ, lightRadius;
+        uint32_t ranges[CLUSTER_COUNT * 2];
+        std::vector<uint32_t> indices;
+        size_t maxIndices = 0;          //texels a texture buffer can hold
+
+        unsigned int buffers[3] = {};   //lights, ranges, indices
+        unsigned int textures[3] = {};
+
+        static int histogramBucket(uint32_t count){
+            int bucket = 0;
+            while(bucket < ClusterStats::HISTOGRAM_BUCKETS - 1 && count > (bucket < 2 ? (uint32_t)bucket : 1u << (bucket - 1)))
+                bucket++;
+            return bucket;
+        }
+
+        /**
+         * computes every cluster's view space box, and the slice mapping the shader uses
+         * @param projection a perspective projection
+        */
+        void buildClusters(const glm::mat4 &projection){
+            clusterProjection = projection;
+            //near and far distances back out of the depth row of a GL perspective matrix
+            float nearZ = projection[3][2] / (projection[2][2] - 1.0f);
+            float farZ = projection[3][2] / (projection[2][2] + 1.0f);
+            float logRatio = logf(farZ / nearZ);
+            sliceScale = CLUSTERS_Z / logRatio;
+            sliceBias = -CLUSTERS_Z * logf(nearZ) / logRatio;
+
+            //view space directions through the tile corners, scaled to z = -1
+            glm::mat4 inverse = glm::inverse(projection);
+            glm::vec3 corners[CLUSTERS_Y + 1][CLUSTERS_X + 1];
+            for(int y = 0; y <= CLUSTERS_Y; y++){
+                for(int x = 0; x <= CLUSTERS_X; x++){
+                    glm::vec4 point = inverse * glm::vec4(-1.0f + 2.0f * x / CLUSTERS_X, -1.0f + 2.0f * y / CLUSTERS_Y, -1.0f, 1.0f);
+                    glm::vec3 view = glm::vec3(point) / point.w;
+                    corners[y][x] = view / -view.z;
+                }
+            }
+            for(int z = 0; z < CLUSTERS_Z; z++){
+                Slice &slice = slices[z];
+                slice.nearZ = nearZ * powf(farZ / nearZ, (float)z / CLUSTERS_Z);
+                slice.farZ = nearZ * powf(farZ / nearZ, (float)(z + 1) / CLUSTERS_Z);
+                for(int y = 0; y < CLUSTERS_Y; y++){
+                    for(int x = 0; x < CLUSTERS_X; x++){
+                        glm::vec3 low(INFINITY), high(-INFINITY);
+                        for(int corner = 0; corner < 4; corner++){
+                            const glm::vec3 &direction = corners[y + corner / 2][x + corner % 2];
+                            low = glm::min(low, glm::min(direction * slice.nearZ, direction * slice.farZ));
+                            high = glm::max(high, glm::max(direction * slice.nearZ, direction * slice.farZ));
+                        }
+                        int c = y * CLUSTERS_X + x;
+                        slice.minX[c] = low.x;
+                        slice.minY[c] = low.y;
+                        slice.minZ[c] = low.z;
+                        slice.maxX[c] = high.x;
+                        slice.maxY[c] = high.y;
+                        slice.maxZ[c] = high.z;
+                    }
+                }
+            }
+        }
+
+        /**
+         * fills a slice's counts and indices from the view space lights
+        */
+        void binSlice(int z){
+            Slice &slice = slices[z];
+            slice.x.clear();
+            slice.y.clear();
+            slice.z.clear();
+            slice.radius.clear();
+            slice.ids.clear();
+            slice.indices.clear();
+            for(size_t i = 0; i < lightX.size(); i++){
+                if(lightZ[i] - lightRadius[i] > -slice.nearZ || lightZ[i] + lightRadius[i] < -slice.farZ)
+                    continue;
+                slice.x.push_back(lightX[i]);
+                slice.y.push_back(lightY[i]);
+                slice.z.push_back(lightZ[i]);
+                slice.radius.push_back(lightRadius[i]);
+                slice.ids.push_back((uint32_t)i);
+            }
+            for(int c = 0; c < CLUSTERS_X * CLUSTERS_Y; c++){
+                size_t before = slice.indices.size();
+                binCluster(slice, c);
+                slice.counts[c] = (uint32_t)(slice.indices.size() - before);
+            }
+        }
+
+        /**
+         * appends the slice's lights whose sphere touches cluster c's box to slice.indices
+        */
+        static void binCluster(Slice &slice, int c){
+            size_t count = slice.ids.size();
+            size_t i = 0;
+#if defined(CULL_AVX2)
+            __m256 minX = _mm256_set1_ps(slice.minX[c]), minY = _mm256_set1_ps(slice.minY[c]), minZ = _mm256_set1_ps(slice.minZ[c]);
+            __m256 maxX = _mm256_set1_ps(slice.maxX[c]), maxY = _mm256_set1_ps(slice.maxY[c]), maxZ = _mm256_set1_ps(slice.maxZ[c]);
+            __m256 zero = _mm256_setzero_ps();
+            for(; i + 8 <= count; i += 8){
+                //distance from the sphere's center to the box along each axis, 0 inside
+                __m256 x = _mm256_loadu_ps(&slice.x[i]), y = _mm256_loadu_ps(&slice.y[i]), z = _mm256_loadu_ps(&slice.z[i]);
+                __m256 dx = _mm256_max_ps(_mm256_max_ps(_mm256_sub_ps(minX, x), _mm256_sub_ps(x, maxX)), zero);
+                __m256 dy = _mm256_max_ps(_mm256_max_ps(_mm256_sub_ps(minY, y), _mm256_sub_ps(y, maxY)), zero);
+                __m256 dz = _mm256_max_ps(_mm256_max_ps(_mm256_sub_ps(minZ, z), _mm256_sub_ps(z, maxZ)), zero);
+                __m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)), _mm256_mul_ps(dz, dz));
+                __m256 radius = _mm256_loadu_ps(&slice.radius[i]);
+                int bits = _mm256_movemask_ps(_mm256_cmp_ps(distance, _mm256_mul_ps(radius, radius), _CMP_LE_OQ));
+                for(int k = 0; k < 8; k++)
+                    if(bits >> k & 1)
+                        slice.indices.push_back(slice.ids[i + k]);
+            }
+#elif defined(CULL_SSE)
+            __m128 minX = _mm_set1_ps(slice.minX[c]), minY = _mm_set1_ps(slice.minY[c]), minZ = _mm_set1_ps(slice.minZ[c]);
+            __m128 maxX = _mm_set1_ps(slice.maxX[c]), maxY = _mm_set1_ps(slice.maxY[c]), maxZ = _mm_set1_ps(slice.maxZ[c]);
+            __m128 zero = _mm_setzero_ps();
+            for(; i + 4 <= count; i += 4){
+                //distance from the sphere's center to the box along each axis, 0 inside
+                __m128 x = _mm_loadu_ps(&slice.x[i]), y = _mm_loadu_ps(&slice.y[i]), z = _mm_loadu_ps(&slice.z[i]);
+                __m128 dx = _mm_max_ps(_mm_max_ps(_mm_sub_ps(minX, x), _mm_sub_ps(x, maxX)), zero);
+                __m128 dy = _mm_max_ps(_mm_max_ps(_mm_sub_ps(minY, y), _mm_sub_ps(y, maxY)), zero);
+                __m128 dz = _mm_max_ps(_mm_max_ps(_mm_sub_ps(minZ, z), _mm_sub_ps(z, maxZ)), zero);
+                __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+                __m128 radius = _mm_loadu_ps(&slice.radius[i]);
+                int bits = _mm_movemask_ps(_mm_cmple_ps(distance, _mm_mul_ps(radius, radius)));
+                for(int k = 0; k < 4; k++)
+                    if(bits >> k & 1)
+                        slice.indices.push_back(slice.ids[i + k]);
+            }
+#endif
+            for(; i < count; i++){
+                float dx = std::max(std::max(slice.minX[c] - slice.x[i], slice.x[i] - slice.maxX[c]), 0.0f);
+                float dy = std::max(std::max(slice.minY[c] - slice.y[i], slice.y[i] - slice.maxY[c]), 0.0f);
+                float dz = std::max(std::max(slice.minZ[c] - slice.z[i], slice.z[i] - slice.maxZ[c]), 0.0f);
+                if(dx * dx + dy * dy + dz * dz <= slice.radius[i] * slice.radius[i])
+                    slice.indices.push_back(slice.ids[i]);
+            }
+        }
+
+        /**
+         * replaces the contents of one of the texture buffers
+        */
+        void upload(int buffer, const void *data, size_t size){
+            glBindBuffer(GL_TEXTURE_BUFFER, buffers[buffer]);
+            //orphan the old store, a texture buffer needs at least one texel
+            glBufferData(GL_TEXTURE_BUFFER, size > 0 ? size : 16, size > 0 ? data : NULL, GL_STREAM_DRAW);
+            glBindBuffer(GL_TEXTURE_BUFFER, 0);
+        }
+};
+
+#endif
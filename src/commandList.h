@@ -0,0 +1,147 @@
+/**
+ * Command lists: draws recorded as plain memory so they can be built on worker
+ * threads and replayed in GL later on the thread that owns the context.
+ *
+ * Every list owns a linear allocator that packets and their uniform data are
+ * carved from. Resetting a list rewinds the allocator but keeps its blocks,
+ * so after the first few frames recording doesn't allocate at all.
+*/
+#ifndef COMMAND_LIST_H
+#define COMMAND_LIST_H
+
+#include <glm/glm.hpp>
+
+#include <stdint.h>
+#include <algorithm>
+#include <memory>
+#include <new>
+#include <vector>
+
+#include "shader.h"
+
+/**
+ * Bump allocator over a list of fixed size blocks. Nothing is freed
+ * individually, reset() makes all of it available again.
+*/
+class LinearAllocator{
+    public:
+        /**
+         * Constructor for a LinearAllocator
+         * @param blockSize bytes per block, the largest allocation that can be made
+        */
+        explicit LinearAllocator(size_t blockSize = 64 * 1024) : blockSize(blockSize){}
+
+        /**
+         * @param size bytes to allocate
+         * @param align alignment of the allocation, a power of two up to 16
+         * @return memory valid until the next reset()
+         * pre: size <= the block size
+        */
+        void *allocate(size_t size, size_t align){
+            size_t offset = (used + align - 1) & ~(align - 1);
+            if(blocks.empty() || offset + size > blockSize){
+                //move on to the next block, reusing blocks from earlier frames
+                if(!blocks.empty())
+                    current++;
+                if(current == blocks.size())
+                    blocks.emplace_back(new uint8_t[blockSize]);
+                offset = 0;
+            }
+            used = offset + size;
+            return blocks[current].get() + offset;
+        }
+
+        /**
+         * @return a default constructed T in the allocator's memory. its destructor is never run
+        */
+        template<typename T> T *create(){
+            return new (allocate(sizeof(T), alignof(T))) T();
+        }
+
+        /**
+         * pre: nothing allocated since the last reset is still in use
+         * post: all blocks are free again, none are released
+        */
+        void reset(){
+            current = 0;
+            used = 0;
+        }
+
+        size_t capacity() const{
+            return blocks.size() * blockSize;
+        }
+
+    private:
+        size_t blockSize;
+        std::vector<std::unique_ptr<uint8_t[]>> blocks;
+        size_t current = 0;         //block allocations currently come from
+        size_t used = 0;            //bytes used in the current block
+};
+
+/**
+ * per draw uniform values, packed when the draw is recorded
+*/
+struct DrawUniforms{
+    glm::mat4 model;
+    float opacity;
+};
+
+/**
+ * one recorded draw. only stores names and pointers, no GL calls are made recording it
+*/
+struct DrawPacket{
+    Shader *shader;
+    unsigned int texture;
+    unsigned int vao;
+    int indexCount;
+    const DrawUniforms *uniforms;
+};
+
+/**
+ * Draws recorded by one thread, each with its sort key
+*/
+class alignas(64) CommandList{
+    public:
+        std::vector<uint64_t> keys;                 //keys[i] is the sort key of packets[i]
+        std::vector<const DrawPacket *> packets;
+
+        /**
+         * records a draw, copying its uniforms into the list's memory
+         * @param key sort key of the draw, see RenderQueue
+         * pre: only one thread records into a list at a time
+         * post: the draw is in the list until reset()
+        */
+        void draw(uint64_t key, Shader *shader, unsigned int texture, unsigned int vao, int indexCount,
+                  const glm::mat4 &model, float opacity){
+            DrawUniforms *uniforms = memory.create<DrawUniforms>();
+            uniforms->model = model;
+            uniforms->opacity = opacity;
+            DrawPacket *packet = memory.create<DrawPacket>();
+            packet->shader = shader;
+            packet->texture = texture;
+            packet->vao = vao;
+            packet->indexCount = indexCount;
+            packet->uniforms = uniforms;
+            keys.push_back(key);
+            packets.push_back(packet);
+        }
+
+        size_t size() const{
+            return packets.size();
+        }
+
+        /**
+         * pre: the list's packets have been replayed, or are no longer needed
+         * post: the list is empty, its memory is kept for the next frame
+        */
+        void reset(){
+            keys.clear();
+            packets.clear();
+            memory.reset();
+        }
+
+    private:
+        LinearAllocator memory;
+};
+
+#endif
@@ -0,0 +1,114 @@
+/**
+ * Compute shader programs (GL 4.3)
+*/
+#ifndef COMPUTE_SHADER_H
+#define COMPUTE_SHADER_H
+
+#include <glad/glad.h>
+
+#include <stdio.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "shaderPreprocessor.h"
+#include "profiler.h"
+
+/**
+ * @return true if the current context can run compute shaders (core since 4.3)
+*/
+inline bool computeSupported(){
+    return GLAD_GL_VERSION_4_3;
+}
+
+class ComputeShader{
+    public:
+        unsigned int programID = 0;
+        std::string path;
+
+        ComputeShader() = default;
+
+        /**
+         * Constructor for a ComputeShader
+         * @param path the path to the compute shader source
+         * @param defines "NAME" or "NAME VALUE" strings injected after #version
+         * pre: computeSupported()
+         * post: programID is the linked program, 0 if it failed to build (errors are printed)
+        */
+        explicit ComputeShader(const std::string &path, const std::vector<std::string> &defines = {}) : path(path){
+            PROFILE_ZONE("shader compile");
+            PreprocessedShader shader = ShaderPreprocessor::process(path);
+            if(!shader.ok)
+                return;
+            std::string source = ShaderPreprocessor::addDefines(shader.source, defines);
+            const char *code = source.c_str();
+            unsigned int compute = glCreateShader(GL_COMPUTE_SHADER);
+            glShaderSource(compute, 1, &code, NULL);
+            glCompileShader(compute);
+            int success;
+            char log[1024];
+            glGetShaderiv(compute, GL_COMPILE_STATUS, &success);
+            if(!success){
+                glGetShaderInfoLog(compute, 1024, NULL, log);
+                printf("\nCOMPUTE SHADER COMPILATION ERROR (%s):\n%s\n", path.c_str(), log);
+                shader.printSourceMap();
+                glDeleteShader(compute);
+                return;
+            }
+            programID = glCreateProgram();
+            glAttachShader(programID, compute);
+            glLinkProgram(programID);
+            glDeleteShader(compute);
+            glGetProgramiv(programID, GL_LINK_STATUS, &success);
+            if(!success){
+                glGetProgramInfoLog(programID, 1024, NULL, log);
+                printf("\nCOMPUTE SHADER LINKING ERROR (%s):\n%s\n", path.c_str(), log);
+                glDeleteProgram(programID);
+                programID = 0;
+            }
+        }
+
+        bool ok() const{
+            return programID != 0;
+        }
+
+        void use() const{
+            glUseProgram(programID);
+        }
+
+        /**
+         * runs enough work groups to cover count invocations along x
+         * @param count total invocations needed
+         * @param groupSize local_size_x of the shader
+         * pre: the program is bound
+        */
+        static void dispatch1D(unsigned int count, unsigned int groupSize){
+            if(count > 0)
+                glDispatchCompute((count + groupSize - 1) / groupSize, 1, 1);
+        }
+
+        /**
+         * @param name the name of a uniform in this program
+         * @return the location of the uniform, looked up once and cached after
+        */
+        int getUniformLocation(const std::string &name) const{
+            auto it = uniformLocations.find(name);
+            if(it != uniformLocations.end())
+                return it->second;
+            int location = glGetUniformLocation(programID, name.c_str());
+            uniformLocations.emplace(name, location);
+            return location;
+        }
+
+        void destroy(){
+            if(programID != 0)
+                glDeleteProgram(programID);
+            programID = 0;
+            uniformLocations.clear();
+        }
+
+    private:
+        mutable std::unordered_map<std::string, int> uniformLocations;
+};
+
+#endif
@@ -0,0 +1,293 @@
+/**
+ * Deferred shading with tiled light culling. Opaque geometry is drawn once into
+ * a G-buffer holding what the lighting needs per pixel, and no position:
+ *   RG16                octahedral view space normal (see common/normals.glsl)
+ *   RGBA8               albedo, roughness in alpha
+ *   DEPTH24_STENCIL8    depth, the position is rebuilt from it
+ * 12 bytes a pixel. A compute shader (TiledLighting.glsl) then splits the screen
+ * into TILE_SIZE pixel tiles, culls the lights against each tile's frustum, cut
+ * to the depth range of what the tile shows, and shades every pixel with only
+ * its tile's lights. The lit image and the G-buffer depth are blitted to the
+ * frame's framebuffer, where translucent geometry is drawn forward on top.
+ *
+ * How many light/tile pairs survived culling is read back READBACK_LATENCY
+ * frames late, so reading it never stalls.
+*/
+#ifndef DEFERRED_RENDERER_H
+#define DEFERRED_RENDERER_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "computeShader.h"
+#include "frameContext.h"
+#include "lights.h"
+#include "profiler.h"
+#include "shader.h"
+
+struct DeferredStats{
+    size_t lights = 0;
+    size_t tiles = 0;
+    size_t tileLights = 0;      //light/tile pairs after culling, read back DeferredRenderer::READBACK_LATENCY frames late
+    size_t overflowTiles = 0;   //tiles with more lights than TiledLighting.glsl keeps, same latency
+    double gbufferMB = 0.0;
+
+    void print(const char *name) const{
+        printf("%s: %zu lights, %zu tiles, %.1f lights per tile, %zu tiles overflowed, %.1f MB g-buffer\n",
+               name, lights, tiles, tiles > 0 ? (double)tileLights / tiles : 0.0, overflowTiles, gbufferMB);
+    }
+};
+
+class DeferredRenderer{
+    public:
+        static constexpr int TILE_SIZE = 16;            //local size of TiledLighting.glsl
+        static constexpr int READBACK_LATENCY = 4;      //frames between lighting and reading back its counters
+        static constexpr int BYTES_PER_PIXEL = 12;      //of the G-buffer, depth included
+
+        glm::vec3 ambient{0.15f};
+        glm::vec3 background{0.2f, 0.3f, 0.3f};     //where no geometry was drawn
+        DeferredStats stats;
+        std::unique_ptr<Shader> geometryShader;     //draws opaque geometry into the G-buffer
+        FrameContexts *frames = NULL;   //lights are uploaded into the frame's transient buffer, NULL rewrites one buffer
+
+        /**
+         * @return true if the current context can run the tiled lighting pass
+        */
+        static bool supported(){
+            return computeSupported();
+        }
+
+        /**
+         * @param shaderDir directory holding the GBuffer shaders and TiledLighting.glsl
+         * @return false if a shader failed to build
+         * pre: supported()
+        */
+        bool init(const std::string &shaderDir){
+            geometryShader.reset(new Shader((shaderDir + "/GBufferVertexShader.glsl").c_str(), (shaderDir + "/GBufferFragmentShader.glsl").c_str()));
+            lightingShader = ComputeShader(shaderDir + "/TiledLighting.glsl");
+            glGenBuffers(1, &lightBuffer);
+            glGenBuffers(1, &statsBuffer);
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, statsBuffer);
+            glBufferData(GL_SHADER_STORAGE_BUFFER, 2 * sizeof(uint32_t), NULL, GL_DYNAMIC_DRAW);
+            glGenBuffers(READBACK_LATENCY, readbackBuffers);
+            for(int i = 0; i < READBACK_LATENCY; i++){
+                glBindBuffer(GL_COPY_WRITE_BUFFER, readbackBuffers[i]);
+                glBufferData(GL_COPY_WRITE_BUFFER, 2 * sizeof(uint32_t), NULL, GL_STREAM_READ);
+            }
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+            return geometryShader->programID != 0 && lightingShader.ok();
+        }
+
+        /**
+         * binds the G-buffer, (re)creating it at the given size, and clears it
+         * @param width width of the frame's draw framebuffer
+         * @param height height of the frame's draw framebuffer
+         * pre: init() succeeded. the frame's framebuffer is bound for drawing
+         * post: opaque draws using geometryShader fill the G-buffer until light()
+        */
+        void beginGeometry(int width, int height){
+            int bound = 0;
+            glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &bound);
+            target = (unsigned int)bound;
+            if(width != gbufferWidth || height != gbufferHeight)
+                createTargets(width, height);
+            glBindFramebuffer(GL_FRAMEBUFFER, gbuffer);
+            glViewport(0, 0, width, height);
+            glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+            glClearDepth(1.0);
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+        }
+
+        /**
+         * lights the G-buffer and copies the result, with its depth, to the frame's framebuffer
+         * @param lights lights in world space
+         * @param view the camera's view matrix
+         * @param projection the camera's projection matrix
+         * pre: beginGeometry() ran this frame and the opaque geometry is drawn
+         * post: the frame's framebuffer is bound again holding the lit opaque geometry and
+         *       its depth and stencil, ready for translucent draws. texture unit 0 is active
+        */
+        void light(const std::vector<PointLight> &lights, const glm::mat4 &view, const glm::mat4 &projection){
+            PROFILE_ZONE("tiled lighting");
+            PROFILE_GPU_ZONE("tiled lighting");
+            readStats();
+            lightsToView(lights, view, gpuLights);
+            size_t size = gpuLights.size() * sizeof(GpuLight);
+            TransientAllocation lightRange;
+            if(frames != NULL && size > 0){
+                //a range no frame in flight reads, so writing it doesn't wait for the last frame's lighting
+                lightRange = frames->upload(gpuLights.data(), size, frames->storageAlignment);
+            } else{
+                glBindBuffer(GL_SHADER_STORAGE_BUFFER, lightBuffer);
+                if(size > lightCapacity || lightCapacity == 0){
+                    lightCapacity = std::max<size_t>(size, sizeof(GpuLight));
+                    glBufferData(GL_SHADER_STORAGE_BUFFER, lightCapacity, NULL, GL_DYNAMIC_DRAW);
+                }
+                if(size > 0)
+                    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, size, gpuLights.data());
+            }
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, statsBuffer);
+            glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, NULL);
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+            lightingShader.use();
+            glUniform1ui(lightingShader.getUniformLocation("lightCount"), (uint32_t)gpuLights.size());
+            glm::mat4 inverseProjection = glm::inverse(projection);
+            glUniformMatrix4fv(lightingShader.getUniformLocation("inverseProjection"), 1, GL_FALSE, glm::value_ptr(inverseProjection));
+            glUniform3fv(lightingShader.getUniformLocation("ambient"), 1, glm::value_ptr(ambient));
+            glUniform3fv(lightingShader.getUniformLocation("background"), 1, glm::value_ptr(background));
+            unsigned int textures[] = {depthTexture, normalTexture, albedoTexture};
+            for(int i = 0; i < 3; i++){
+                glActiveTexture(GL_TEXTURE0 + i);
+                glBindTexture(GL_TEXTURE_2D, textures[i]);
+            }
+            glBindImageTexture(0, litTexture, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA8);
+            if(lightRange.buffer != 0)
+                glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 0, lightRange.buffer, lightRange.offset, lightRange.size);
+            else
+                glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, lightBuffer);
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, statsBuffer);
+            glDispatchCompute(tilesX, tilesY, 1);
+            glMemoryBarrier(GL_FRAMEBUFFER_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+            glBindImageTexture(0, 0, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA8);
+            for(int i = 2; i >= 0; i--){
+                glActiveTexture(GL_TEXTURE0 + i);
+                glBindTexture(GL_TEXTURE_2D, 0);
+            }
+
+            //keep this frame's counters for readStats() a few frames from now
+            int slot = frameIndex % READBACK_LATENCY;
+            glBindBuffer(GL_COPY_READ_BUFFER, statsBuffer);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, readbackBuffers[slot]);
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, 2 * sizeof(uint32_t));
+            glBindBuffer(GL_COPY_READ_BUFFER, 0);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+            readbackUsed[slot] = true;
+            frameIndex++;
+
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, litFramebuffer);
+            glBindFramebuffer(GL_DRAW_FRAMEBUFFER, target);
+            glBlitFramebuffer(0, 0, gbufferWidth, gbufferHeight, 0, 0, gbufferWidth, gbufferHeight, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, gbuffer);
+            glBlitFramebuffer(0, 0, gbufferWidth, gbufferHeight, 0, 0, gbufferWidth, gbufferHeight, GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT, GL_NEAREST);
+            glBindFramebuffer(GL_FRAMEBUFFER, target);
+
+            stats.lights = lights.size();
+            stats.tiles = (size_t)tilesX * tilesY;
+            stats.gbufferMB = (double)gbufferWidth * gbufferHeight * BYTES_PER_PIXEL / (1024.0 * 1024.0);
+            PROFILE_COUNTER("g-buffer MB", stats.gbufferMB);
+            PROFILE_COUNTER("lights", (double)stats.lights);
+            PROFILE_COUNTER("light tile pairs", (double)stats.tileLights);
+        }
+
+        /**
+         * pre: the context init() ran on is current
+         * post: every GL object of the renderer is deleted
+        */
+        void destroy(){
+            if(geometryShader)
+                geometryShader->destroy();
+            lightingShader.destroy();
+            glDeleteBuffers(1, &lightBuffer);
+            glDeleteBuffers(1, &statsBuffer);
+            glDeleteBuffers(READBACK_LATENCY, readbackBuffers);
+            lightBuffer = statsBuffer = 0;
+            destroyTargets();
+        }
+
+    private:
+        ComputeShader lightingShader;
+        std::vector<GpuLight> gpuLights;
+        unsigned int lightBuffer = 0, statsBuffer = 0;
+        size_t lightCapacity = 0;       //bytes allocated for lightBuffer
+
+        unsigned int readbackBuffers[READBACK_LATENCY] = {};
+        bool readbackUsed[READBACK_LATENCY] = {};
+        unsigned long long frameIndex = 0;
+
+        unsigned int target = 0;        //the frame's framebuffer, remembered by beginGeometry()
+        unsigned int gbuffer = 0, normalTexture = 0, albedoTexture = 0, depthTexture = 0;
+        unsigned int litFramebuffer = 0, litTexture = 0;
+        int gbufferWidth = 0, gbufferHeight = 0;
+        unsigned int tilesX = 0, tilesY = 0;
+
+        /**
+         * copies the counters stored READBACK_LATENCY frames ago into stats
+        */
+        void readStats(){
+            int slot = frameIndex % READBACK_LATENCY;
+            if(!readbackUsed[slot])
+                return;
+            uint32_t counts[2];
+            glBindBuffer(GL_COPY_READ_BUFFER, readbackBuffers[slot]);
+            glGetBufferSubData(GL_COPY_READ_BUFFER, 0, sizeof(counts), counts);
+            glBindBuffer(GL_COPY_READ_BUFFER, 0);
+            stats.tileLights = counts[0];
+            stats.overflowTiles = counts[1];
+        }
+
+        static unsigned int createTexture(GLenum format, int width, int height){
+            unsigned int texture;
+            glGenTextures(1, &texture);
+            glBindTexture(GL_TEXTURE_2D, texture);
+            glTexStorage2D(GL_TEXTURE_2D, 1, format, width, height);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            return texture;
+        }
+
+        static void checkFramebuffer(const char *name, int width, int height){
+            GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+            if(status != GL_FRAMEBUFFER_COMPLETE)
+                printf("\nERROR: %s framebuffer %dx%d incomplete (0x%x)\n", name, width, height, status);
+        }
+
+        void createTargets(int width, int height){
+            destroyTargets();
+            gbufferWidth = width;
+            gbufferHeight = height;
+            tilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+            tilesY = (height + TILE_SIZE - 1) / TILE_SIZE;
+            normalTexture = createTexture(GL_RG16, width, height);
+            albedoTexture = createTexture(GL_RGBA8, width, height);
+            depthTexture = createTexture(GL_DEPTH24_STENCIL8, width, height);
+            glGenFramebuffers(1, &gbuffer);
+            glBindFramebuffer(GL_FRAMEBUFFER, gbuffer);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, normalTexture, 0);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, albedoTexture, 0);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, depthTexture, 0);
+            GLenum drawBuffers[] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1};
+            glDrawBuffers(2, drawBuffers);
+            checkFramebuffer("g-buffer", width, height);
+
+            litTexture = createTexture(GL_RGBA8, width, height);
+            glGenFramebuffers(1, &litFramebuffer);
+            glBindFramebuffer(GL_FRAMEBUFFER, litFramebuffer);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, litTexture, 0);
+            checkFramebuffer("lighting", width, height);
+            glBindTexture(GL_TEXTURE_2D, 0);
+            glBindFramebuffer(GL_FRAMEBUFFER, target);
+        }
+
+        void destroyTargets(){
+            unsigned int framebuffers[] = {gbuffer, litFramebuffer};
+            unsigned int textures[] = {normalTexture, albedoTexture, depthTexture, litTexture};
+            glDeleteFramebuffers(2, framebuffers);
+            glDeleteTextures(4, textures);
+            gbuffer = litFramebuffer = 0;
+            normalTexture = albedoTexture = depthTexture = litTexture = 0;
+            gbufferWidth = gbufferHeight = 0;
+        }
+};
+
+#endif
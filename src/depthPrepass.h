@@ -0,0 +1,308 @@
+/**
+ * Depth prepass: opaque draws are drawn depth only first, reading a position only
+ * vertex stream with a fragment shader that does nothing. The shading pass after it
+ * tests GL_LEQUAL without writing depth, so the material's fragment shader only runs
+ * for the fragments that end up visible. Where two fragments tie in depth the last
+ * one drawn now wins rather than the first, which moves a few silhouette pixels.
+ *
+ * That pays off where opaque geometry overlaps, and costs a second vertex pass where
+ * it doesn't, so in PREPASS_AUTO mode it is chosen per bucket (opaque draws sharing
+ * program, texture and VAO). Every MEASURE_INTERVAL frames occlusion queries count, per
+ * bucket, the fragments that passed the depth test as it was drawn and the ones still
+ * visible at the end of the frame. Their ratio is the bucket's overdraw, and buckets
+ * whose overdraw is high get the prepass.
+ *
+ * The overdraw counter is a debug pass over the whole frame: every fragment passing the
+ * depth test increments the stencil buffer, which is read back and averaged over the
+ * pixels that were drawn at all.
+*/
+#ifndef DEPTH_PREPASS_H
+#define DEPTH_PREPASS_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "shader.h"
+#include "profiler.h"
+
+enum PrepassMode{
+    PREPASS_OFF = 0,
+    PREPASS_ON = 1,         //every opaque bucket
+    PREPASS_AUTO = 2,       //opaque buckets whose measured overdraw is high
+};
+
+struct PrepassStats{
+    int buckets = 0;            //opaque buckets drawn last frame
+    int prepassBuckets = 0;     //of those, the ones drawn depth first
+    int prepassDraws = 0;
+    int measured = 0;           //buckets with an overdraw measurement
+    double overdraw = 0.0;      //fragments shaded per pixel covered, from the last counted frame
+
+    void print(const char *name) const{
+        printf("%s: %d of %d opaque buckets depth first (%d draws), %d measured, overdraw %.2f\n",
+               name, prepassBuckets, buckets, prepassDraws, measured, overdraw);
+    }
+};
+
+class DepthPrepass{
+    public:
+        static constexpr int MEASURE_INTERVAL = 30;         //frames between overdraw measurements
+        static constexpr float ENABLE_OVERDRAW = 1.5f;      //a bucket gets the prepass above this
+        static constexpr float DISABLE_OVERDRAW = 1.2f;     //and loses it below this
+        static constexpr float SMOOTHING = 0.5f;            //weight of the newest measurement
+
+        PrepassMode mode = PREPASS_OFF;
+        bool countOverdraw = false;         //run the stencil counter, see beginOverdrawCount()
+        PrepassStats stats;
+        std::unique_ptr<Shader> depthShader;
+
+        /**
+         * @param shaderDir directory holding DepthVertexShader.glsl and DepthFragmentShader.glsl
+         * @return false if the depth only program didn't build
+         * pre: a GL context is current
+        */
+        bool init(const std::string &shaderDir){
+            depthShader.reset(new Shader((shaderDir + "/DepthVertexShader.glsl").c_str(), (shaderDir + "/DepthFragmentShader.glsl").c_str()));
+            return depthShader->programID != 0;
+        }
+
+        /**
+         * makes depth only draws of vao read positionVao instead
+         * @param vao a VAO draws are recorded with
+         * @param positionVao a VAO with only the positions at attribute 0, and the same element buffer
+        */
+        void addPositionStream(unsigned int vao, unsigned int positionVao){
+            positionStreams[vao] = positionVao;
+        }
+
+        /**
+         * @return the VAO depth only draws of vao use: its position stream, or vao itself without one
+        */
+        unsigned int positionStream(unsigned int vao) const{
+            auto it = positionStreams.find(vao);
+            return it != positionStreams.end() ? it->second : vao;
+        }
+
+        /**
+         * called by RenderQueue::execute() before it draws a frame
+         * post: finished measurements are applied to their buckets, measuring() tells
+         *       whether this frame is measured and the per frame stats are reset
+        */
+        void beginFrame(){
+            collectMeasurements();
+            measuringFrame = mode == PREPASS_AUTO && pending.empty() && frame % MEASURE_INTERVAL == 0;
+            frame++;
+            stats.buckets = 0;
+            stats.prepassBuckets = 0;
+            stats.prepassDraws = 0;
+        }
+
+        bool measuring() const{
+            return measuringFrame;
+        }
+
+        /**
+         * @param bucket the pass and state bits of an opaque draw's sort key
+         * @return true if the bucket is drawn depth first this frame
+        */
+        bool usePrepass(uint64_t bucket) const{
+            if(mode != PREPASS_AUTO)
+                return mode == PREPASS_ON;
+            auto it = buckets.find(bucket);
+            return it != buckets.end() && it->second.prepass;
+        }
+
+        /**
+         * starts counting the samples of one bucket that pass the depth test
+         * @param bucket the bucket about to be drawn
+         * @param visible false while it is shaded or drawn in the prepass, true while it
+         *        is redrawn against the frame's final depth
+         * pre: measuring(), no query is running
+        */
+        void beginQuery(uint64_t bucket, bool visible){
+            auto it = measurementSlots.find(bucket);
+            if(it == measurementSlots.end()){
+                it = measurementSlots.emplace(bucket, measurements.size()).first;
+                measurements.push_back({bucket, takeQuery(), takeQuery()});
+            }
+            const Measurement &measurement = measurements[it->second];
+            glBeginQuery(GL_SAMPLES_PASSED, visible ? measurement.visibleQuery : measurement.shadedQuery);
+        }
+
+        void endQuery(){
+            glEndQuery(GL_SAMPLES_PASSED);
+        }
+
+        /**
+         * pre: called once the frame's queries have all ended
+         * post: the frame's measurements are read back by a later beginFrame(), once the GL has them
+        */
+        void endMeasurement(){
+            pending.swap(measurements);
+            measurements.clear();
+            measurementSlots.clear();
+        }
+
+        /**
+         * sets up depth only drawing: the position only program, no color or stencil writes
+         * pre: the camera is latched, see cameraUniforms.h
+        */
+        void beginDepthOnly(){
+            glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+            glStencilMask(0);
+            depthShader->use();
+            boundVao = ~0u;
+        }
+
+        /**
+         * draws one mesh depth only
+         * @param vao the VAO the draw was recorded with, its position stream is drawn
+         * pre: beginDepthOnly() was called
+        */
+        void drawDepth(unsigned int vao, int indexCount, const glm::mat4 &model){
+            unsigned int stream = positionStream(vao);
+            if(stream != boundVao){
+                boundVao = stream;
+                glBindVertexArray(stream);
+            }
+            depthShader->setMat4Uniform("model", glm::value_ptr(model));
+            glDrawElements(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT, 0);
+        }
+
+        /**
+         * post: color and stencil writes are back on, no VAO is bound
+        */
+        void endDepthOnly(){
+            glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+            glStencilMask(0xFF);
+            glBindVertexArray(0);
+        }
+
+        /**
+         * starts counting fragments: each one passing the depth test increments the stencil
+         * pre: the bound framebuffer has a stencil buffer, nothing of the frame is drawn yet
+         * post: stencil testing is on until endOverdrawCount()
+        */
+        void beginOverdrawCount(){
+            glStencilMask(0xFF);
+            glClearStencil(0);
+            glClear(GL_STENCIL_BUFFER_BIT);
+            glEnable(GL_STENCIL_TEST);
+            glStencilFunc(GL_ALWAYS, 0, 0xFF);
+            glStencilOp(GL_KEEP, GL_KEEP, GL_INCR);
+        }
+
+        /**
+         * reads back the fragment counts, waiting for the frame to finish drawing
+         * @param width width of the bound framebuffer
+         * @param height height of the bound framebuffer
+         * post: stats.overdraw is the average count of the pixels drawn at least once
+        */
+        void endOverdrawCount(int width, int height){
+            PROFILE_ZONE("overdraw readback");
+            glDisable(GL_STENCIL_TEST);
+            glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
+            stencil.resize((size_t)width * height);
+            glPixelStorei(GL_PACK_ALIGNMENT, 1);
+            glReadPixels(0, 0, width, height, GL_STENCIL_INDEX, GL_UNSIGNED_BYTE, stencil.data());
+            uint64_t fragments = 0, covered = 0;
+            for(uint8_t count : stencil){
+                fragments += count;
+                covered += count != 0;
+            }
+            stats.overdraw = covered > 0 ? (double)fragments / covered : 0.0;
+        }
+
+        /**
+         * pre: the context init() ran on is current
+         * post: the program and every query are deleted
+        */
+        void destroy(){
+            if(depthShader)
+                depthShader->destroy();
+            for(const Measurement &measurement : pending)
+                queries.insert(queries.end(), {measurement.shadedQuery, measurement.visibleQuery});
+            if(!queries.empty())
+                glDeleteQueries((int)queries.size(), queries.data());
+            queries.clear();
+            pending.clear();
+        }
+
+    private:
+        struct Bucket{
+            float overdraw = 0.0f;
+            bool prepass = false;
+        };
+
+        struct Measurement{
+            uint64_t bucket;
+            unsigned int shadedQuery;       //samples passing the depth test as the bucket was drawn
+            unsigned int visibleQuery;      //samples still visible at the end of the frame
+        };
+
+        std::unordered_map<unsigned int, unsigned int> positionStreams;     //VAO -> position only VAO
+        std::unordered_map<uint64_t, Bucket> buckets;
+        std::vector<Measurement> measurements;      //queries of the frame being measured
+        std::unordered_map<uint64_t, size_t> measurementSlots;      //bucket -> index in measurements
+        std::vector<Measurement> pending;           //queries of a measured frame the GL may not have finished
+        std::vector<unsigned int> queries;          //query objects not in use
+        std::vector<uint8_t> stencil;
+        unsigned long long frame = 0;
+        bool measuringFrame = false;
+        unsigned int boundVao = ~0u;
+
+        unsigned int takeQuery(){
+            if(queries.empty()){
+                unsigned int query;
+                glGenQueries(1, &query);
+                return query;
+            }
+            unsigned int query = queries.back();
+            queries.pop_back();
+            return query;
+        }
+
+        /**
+         * folds the pending measurements into their buckets, if the GL has finished them
+        */
+        void collectMeasurements(){
+            if(pending.empty())
+                return;
+            //queries finish in order, so the last one being ready means all of them are
+            int available = 0;
+            glGetQueryObjectiv(pending.back().visibleQuery, GL_QUERY_RESULT_AVAILABLE, &available);
+            if(!available)
+                return;
+            for(const Measurement &measurement : pending){
+                unsigned int shaded = 0, visible = 0;
+                glGetQueryObjectuiv(measurement.shadedQuery, GL_QUERY_RESULT, &shaded);
+                glGetQueryObjectuiv(measurement.visibleQuery, GL_QUERY_RESULT, &visible);
+                queries.insert(queries.end(), {measurement.shadedQuery, measurement.visibleQuery});
+                if(shaded == 0)
+                    continue;
+                float overdraw = (float)shaded / std::max(visible, 1u);
+                auto found = buckets.find(measurement.bucket);
+                Bucket &bucket = buckets[measurement.bucket];
+                bucket.overdraw = found == buckets.end() ? overdraw : bucket.overdraw + (overdraw - bucket.overdraw) * SMOOTHING;
+                //hysteresis so buckets near the threshold don't flip every measurement
+                if(bucket.overdraw > ENABLE_OVERDRAW)
+                    bucket.prepass = true;
+                else if(bucket.overdraw < DISABLE_OVERDRAW)
+                    bucket.prepass = false;
+            }
+            pending.clear();
+            stats.measured = (int)buckets.size();
+        }
+};
+
+#endif
@@ -0,0 +1,329 @@
+/**
+ * Dynamic resolution: the scene is drawn into an offscreen target at a fraction
+ * of the output size, then stretched over the output by an upscale pass
+ * (UpscaleFragmentShader.glsl, bilinear with optional sharpening). The fraction
+ * is steered by a PID controller towards a GPU time budget, measured with
+ * GL_TIMESTAMP queries read back without stalling a few frames late.
+ *
+ * Cost grows with the pixel count, so the controller drives the pixel fraction
+ * (scale squared) rather than the scale. The scale is quantized and held for a
+ * few frames between changes, so targets sized after the frame (G-buffer, hi-z)
+ * are not recreated every frame.
+ *
+ * The render target comes from a pool that only ever hands out a larger texture
+ * than asked for: it grows in SIZE_STEP pixel steps and shrinks only once the
+ * output is less than half of it, so dragging a window edge doesn't reallocate
+ * on every resize event.
+*/
+#ifndef DYNAMIC_RESOLUTION_H
+#define DYNAMIC_RESOLUTION_H
+
+#include <glad/glad.h>
+
+#include <stdio.h>
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <string>
+
+#include "FBO.h"
+#include "frameContext.h"
+#include "profiler.h"
+#include "shader.h"
+
+/**
+ * textbook PID controller, with the integral clamped so it can't wind up while
+ * the output is pinned at a limit
+*/
+struct PidController{
+    float kp = 0.0f;
+    float ki = 0.0f;
+    float kd = 0.0f;
+    float bias = 0.0f;      //output with no error and nothing integrated
+    float integral = 0.0f;
+    float previousError = 0.0f;
+    bool started = false;
+
+    /**
+     * @param error setpoint - measurement
+     * @param minOutput lowest output wanted
+     * @param maxOutput highest output wanted
+     * @return the controller's output for this sample, clamped to [minOutput, maxOutput]
+    */
+    float update(float error, float minOutput, float maxOutput){
+        float derivative = started ? error - previousError : 0.0f;
+        previousError = error;
+        started = true;
+        float candidate = integral + error;
+        float output = bias + kp * error + ki * candidate + kd * derivative;
+        //only keep integrating while that doesn't push further into a limit
+        if((output < maxOutput || error < 0.0f) && (output > minOutput || error > 0.0f))
+            integral = candidate;
+        return std::min(maxOutput, std::max(minOutput, bias + kp * error + ki * integral + kd * derivative));
+    }
+
+    void reset(){
+        integral = previousError = 0.0f;
+        started = false;
+    }
+};
+
+/**
+ * offscreen targets reused across frames. acquire() returns a framebuffer at
+ * least as large as asked for, reallocating only when it has to
+*/
+class RenderTargetPool{
+    public:
+        static constexpr int SIZE_STEP = 128;   //allocations are rounded up to this many pixels
+        int allocations = 0;                    //since startup
+
+        /**
+         * @param width pixels needed
+         * @param height pixels needed
+         * @param frames if not NULL, a replaced framebuffer is deleted once the frames in flight are done with it
+         * @return a framebuffer of at least width x height, draw into its bottom left corner
+         * pre: a GL context is current
+        */
+        FrameBufObj &acquire(int width, int height, FrameContexts *frames = NULL){
+            bool tooSmall = !target || width > target->width || height > target->height;
+            //shrink only when the request uses under half the area, resizing back and forth stays put
+            bool wasteful = target && (double)width * height * 2.0 < (double)target->width * target->height;
+            if(tooSmall || wasteful){
+                release(frames);
+                target.reset(new FrameBufObj(roundUp(width), roundUp(height)));
+                allocations++;
+            }
+            return *target;
+        }
+
+        /**
+         * @param frames if not NULL, the framebuffer is deleted once the frames in flight are done with it
+         * pre: none
+         * post: the pooled framebuffer is deleted, the next acquire() allocates
+        */
+        void release(FrameContexts *frames = NULL){
+            if(target && frames != NULL){
+                frames->deferDelete(GL_FRAMEBUFFER, target->ID);
+                frames->deferDelete(GL_TEXTURE, target->colorTexture);
+                frames->deferDelete(GL_RENDERBUFFER, target->depthBuffer);
+            } else if(target){
+                target->destroy();
+            }
+            target.reset();
+        }
+
+    private:
+        std::unique_ptr<FrameBufObj> target;
+
+        static int roundUp(int size){
+            return std::max(SIZE_STEP, (size + SIZE_STEP - 1) / SIZE_STEP * SIZE_STEP);
+        }
+};
+
+struct DynamicResolutionStats{
+    float scale = 1.0f;         //render size / output size, per axis
+    int renderWidth = 0;
+    int renderHeight = 0;
+    double gpuMs = 0.0;         //last measured GPU time of the scaled part of a frame
+    double budgetMs = 0.0;
+    int scaleChanges = 0;       //since startup
+    int allocations = 0;        //render targets allocated since startup
+
+    void print(const char *name) const{
+        printf("%s: %.3f scale (%dx%d), gpu %.2f of %.2f ms, %d scale changes, %d allocations\n",
+               name, scale, renderWidth, renderHeight, gpuMs, budgetMs, scaleChanges, allocations);
+    }
+};
+
+class DynamicResolution{
+    public:
+        static constexpr int LATENCY = 4;           //frames between a frame's timestamps and reading them
+        static constexpr int SCALE_STEPS = 32;      //the scale is a multiple of 1 / SCALE_STEPS
+        static constexpr int HOLD_FRAMES = 8;       //frames a scale is kept at least
+
+        float minScale = 0.5f;
+        float maxScale = 1.0f;
+        double budgetMs = 15.0;     //GPU time the scaled part of the frame should take
+        float sharpness = 0.5f;     //of the upscale pass, 0 is plain bilinear
+        PidController controller;
+        DynamicResolutionStats stats;
+        FrameContexts *frames = NULL;   //render targets replaced after a resize are deleted behind its fences
+
+        DynamicResolution(){
+            //gains per sample, on the budget's relative error and the pixel fraction
+            controller.kp = 0.25f;
+            controller.ki = 0.08f;
+            controller.kd = 0.05f;
+        }
+
+        /**
+         * @param shaderDir directory holding the Upscale shaders
+         * @return false if the upscale shader failed to build
+         * pre: a GL 3.3 context is current
+        */
+        bool init(const std::string &shaderDir){
+            upscaleShader.reset(new Shader((shaderDir + "/UpscaleVertexShader.glsl").c_str(), (shaderDir + "/UpscaleFragmentShader.glsl").c_str()));
+            glGenVertexArrays(1, &emptyVao);
+            glGenQueries(2 * LATENCY, queries);
+            //with no error the controller asks for every pixel, overruns pull it down
+            controller.bias = maxScale * maxScale;
+            controller.reset();
+            pixelFraction = maxScale * maxScale;
+            scale = maxScale;
+            return upscaleShader->programID != 0;
+        }
+
+        /**
+         * the output changed size, e.g. from the framebuffer size callback. Only the
+         * size is kept: the render target follows at the next begin()
+        */
+        void resizeOutput(int width, int height){
+            //minimized windows report 0, keep what was drawn before
+            if(width <= 0 || height <= 0)
+                return;
+            outputWidth = width;
+            outputHeight = height;
+        }
+
+        /**
+         * updates the scale from the timings that arrived, then binds a render target
+         * at the scaled output size and starts timing
+         * pre: init() succeeded, resizeOutput() was called
+         * post: draws go to the bottom left renderWidth() x renderHeight() of the target,
+         *       the viewport covers it
+        */
+        void begin(){
+            PROFILE_ZONE("dynamic resolution");
+            readTimings();
+            int width = std::max(1, (int)lroundf(outputWidth * scale));
+            int height = std::max(1, (int)lroundf(outputHeight * scale));
+            //the target is sized for the largest scale, so the scale never reallocates it
+            target = &pool.acquire(std::max(1, (int)ceilf(outputWidth * maxScale)), std::max(1, (int)ceilf(outputHeight * maxScale)), frames);
+            glBindFramebuffer(GL_FRAMEBUFFER, target->ID);
+            glViewport(0, 0, width, height);
+            stats.renderWidth = width;
+            stats.renderHeight = height;
+            stats.scale = scale;
+            stats.budgetMs = budgetMs;
+            stats.allocations = pool.allocations;
+            PROFILE_COUNTER("render scale", scale);
+
+            slot = frameIndex % LATENCY;
+            if(pending[slot])
+                readSlot(slot, true);
+            glQueryCounter(queries[2 * slot], GL_TIMESTAMP);
+        }
+
+        /**
+         * stops timing and stretches the scaled frame over the output
+         * @param output framebuffer to draw the full size frame into, 0 for the window
+         * pre: begin() ran this frame
+         * post: output is bound with the viewport covering all of it, depth testing
+         *       is enabled and texture unit 0 is active
+        */
+        void end(unsigned int output){
+            PROFILE_ZONE("upscale");
+            PROFILE_GPU_ZONE("upscale");
+            glQueryCounter(queries[2 * slot + 1], GL_TIMESTAMP);
+            pending[slot] = true;
+            frameIndex++;
+
+            glBindFramebuffer(GL_FRAMEBUFFER, output);
+            glViewport(0, 0, outputWidth, outputHeight);
+            glDisable(GL_DEPTH_TEST);
+            glDisable(GL_BLEND);
+            upscaleShader->use();
+            upscaleShader->setIntUniform("source", 0);
+            glUniform2f(upscaleShader->getUniformLocation("sourceScale"),
+                        (float)stats.renderWidth / target->width, (float)stats.renderHeight / target->height);
+            glUniform2f(upscaleShader->getUniformLocation("texelSize"), 1.0f / target->width, 1.0f / target->height);
+            upscaleShader->setFloatUniform("sharpness", sharpness);
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_2D, target->colorTexture);
+            glBindVertexArray(emptyVao);
+            glDrawArrays(GL_TRIANGLES, 0, 3);
+            glBindVertexArray(0);
+            glBindTexture(GL_TEXTURE_2D, 0);
+            glEnable(GL_DEPTH_TEST);
+        }
+
+        int renderWidth() const{
+            return stats.renderWidth;
+        }
+
+        int renderHeight() const{
+            return stats.renderHeight;
+        }
+
+        /**
+         * pre: the context init() ran on is current
+         * post: every GL object is deleted
+        */
+        void destroy(){
+            if(upscaleShader)
+                upscaleShader->destroy();
+            glDeleteVertexArrays(1, &emptyVao);
+            glDeleteQueries(2 * LATENCY, queries);
+            emptyVao = 0;
+            pool.release();
+        }
+
+        std::unique_ptr<Shader> upscaleShader;
+
+    private:
+        RenderTargetPool pool;
+        FrameBufObj *target = NULL;
+        unsigned int emptyVao = 0;
+        unsigned int queries[2 * LATENCY] = {};     //start and end timestamp of each frame in flight
+        bool pending[LATENCY] = {};
+        int slot = 0;
+        unsigned long long frameIndex = 0;
+        int outputWidth = 1, outputHeight = 1;
+        float pixelFraction = 1.0f;     //the controller's output
+        float scale = 1.0f;             //what frames are drawn at, pixelFraction quantized
+        int heldFrames = 0;
+
+        /**
+         * feeds every frame whose timestamps are available to the controller, oldest first
+         * pre: frameIndex % LATENCY is the oldest slot, the one begin() writes next
+        */
+        void readTimings(){
+            for(int i = 0; i < LATENCY; i++){
+                int index = (int)((frameIndex + i) % LATENCY);
+                if(pending[index] && !readSlot(index, false))
+                    break;
+            }
+            heldFrames++;
+            float wanted = std::floor(std::sqrt(pixelFraction) * SCALE_STEPS + 0.5f) / SCALE_STEPS;
+            wanted = std::min(maxScale, std::max(minScale, wanted));
+            if(wanted != scale && heldFrames >= HOLD_FRAMES){
+                scale = wanted;
+                heldFrames = 0;
+                stats.scaleChanges++;
+            }
+        }
+
+        /**
+         * @param wait block until the slot's timestamps are available
+         * @return false if they weren't available yet
+        */
+        bool readSlot(int index, bool wait){
+            if(!wait){
+                GLint available = 0;
+                glGetQueryObjectiv(queries[2 * index + 1], GL_QUERY_RESULT_AVAILABLE, &available);
+                if(!available)
+                    return false;
+            }
+            GLuint64 start = 0, end = 0;
+            glGetQueryObjectui64v(queries[2 * index], GL_QUERY_RESULT, &start);
+            glGetQueryObjectui64v(queries[2 * index + 1], GL_QUERY_RESULT, &end);
+            pending[index] = false;
+            stats.gpuMs = (end - start) / 1e6;
+            //positive error is headroom: draw more pixels
+            float error = (float)((budgetMs - stats.gpuMs) / budgetMs);
+            pixelFraction = controller.update(error, minScale * minScale, maxScale * maxScale);
+            return true;
+        }
+};
+
+#endif
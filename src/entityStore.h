@@ -0,0 +1,237 @@
+/**
+ * Data oriented entity storage for renderable objects.
+ *
+ * Every component type lives in its own sparse set: a densely packed array of
+ * components plus the entity each belongs to, and a sparse entity -> slot
+ * lookup. Iterating a component type walks its dense array front to back,
+ * and parallelEach hands chunks of it to the job system.
+*/
+#ifndef ENTITY_STORE_H
+#define ENTITY_STORE_H
+
+#include <glm/glm.hpp>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <tuple>
+#include <vector>
+
+#include "jobSystem.h"
+#include "transformSystem.h"
+
+typedef uint32_t Entity;                    //low 24 bits index, high 8 bits generation
+const Entity NO_ENTITY = 0xFFFFFFFF;
+
+inline uint32_t entityIndex(Entity entity){
+    return entity & 0x00FFFFFF;
+}
+
+//----------------------------------- components -----------------------------------
+
+struct Transform{
+    TransformHandle node;       //node in the scene's TransformSystem
+};
+
+struct MeshRef{
+    uint32_t mesh;              //index into the scene's mesh table
+};
+
+struct MaterialRef{
+    uint32_t material;          //index into the scene's material table
+};
+
+struct Bounds{
+    glm::vec3 center;           //bounding sphere in world space
+    float radius;
+};
+
+struct OccluderRef{
+    uint32_t mesh;              //occluder mesh id in the scene's OcclusionCuller
+};
+
+struct Visibility{
+    uint8_t visible;            //result of culling this frame
+    uint8_t layerMask;          //which views may draw the entity
+};
+
+struct ShadowCaster{
+    uint8_t isStatic;           //never moves, drawn into the cached shadow cascades
+};
+
+/**
+ * Packed storage for one component type
+*/
+template<typename T>
+class SparseSet{
+    public:
+        std::vector<T> components;              //dense, in no particular order
+        std::vector<Entity> entities;           //entities[i] owns components[i]
+
+        bool has(Entity entity) const{
+            uint32_t index = entityIndex(entity);
+            return index < sparse.size() && sparse[index] != EMPTY && entities[sparse[index]] == entity;
+        }
+
+        T &get(Entity entity){
+            return components[sparse[entityIndex(entity)]];
+        }
+
+        /**
+         * pre: none
+         * post: entity owns value, replacing any component it had of this type
+        */
+        T &add(Entity entity, const T &value){
+            uint32_t index = entityIndex(entity);
+            if(index >= sparse.size())
+                sparse.resize(index + 1, EMPTY);
+            if(sparse[index] != EMPTY){
+                components[sparse[index]] = value;
+                entities[sparse[index]] = entity;
+                return components[sparse[index]];
+            }
+            sparse[index] = (uint32_t)components.size();
+            components.push_back(value);
+            entities.push_back(entity);
+            return components.back();
+        }
+
+        /**
+         * pre: none
+         * post: entity no longer has this component. the last component is moved
+         *       into the hole so the array stays packed
+        */
+        void remove(Entity entity){
+            if(!has(entity))
+                return;
+            uint32_t index = entityIndex(entity);
+            uint32_t slot = sparse[index];
+            uint32_t last = (uint32_t)components.size() - 1;
+            components[slot] = components[last];
+            entities[slot] = entities[last];
+            sparse[entityIndex(entities[slot])] = slot;
+            components.pop_back();
+            entities.pop_back();
+            sparse[index] = EMPTY;
+        }
+
+        size_t size() const{
+            return components.size();
+        }
+
+    private:
+        static constexpr uint32_t EMPTY = 0xFFFFFFFF;
+        std::vector<uint32_t> sparse;           //entity index -> slot in the dense arrays
+};
+
+class EntityStore{
+    public:
+        /**
+         * @return a new entity without components, NO_ENTITY when every index is in use
+        */
+        Entity create(){
+            uint32_t index;
+            if(!freeList.empty()){
+                index = freeList.back();
+                freeList.pop_back();
+            } else{
+                //the last index would collide with NO_ENTITY
+                if(generations.size() >= MAX_ENTITIES){
+                    printf("\nERROR: entity store full, %u entities alive\n", MAX_ENTITIES);
+                    return NO_ENTITY;
+                }
+                index = (uint32_t)generations.size();
+                generations.push_back(0);
+            }
+            return index | ((Entity)generations[index] << 24);
+        }
+
+        /**
+         * @param transforms the system the entity's Transform node belongs to
+         * pre: entity is alive, no other live node has its Transform node as parent
+         * post: entity and all its components are gone, its handle is stale and its
+         *       transform node is released
+        */
+        void destroy(Entity entity, TransformSystem &transforms){
+            if(has<Transform>(entity))
+                transforms.release(get<Transform>(entity).node);
+            std::apply([&](auto &...pool){ (pool.remove(entity), ...); }, pools);
+            uint32_t index = entityIndex(entity);
+            generations[index]++;
+            freeList.push_back(index);
+        }
+
+        bool alive(Entity entity) const{
+            uint32_t index = entityIndex(entity);
+            return index < generations.size() && (uint8_t)(entity >> 24) == generations[index];
+        }
+
+        template<typename T> SparseSet<T> &pool(){
+            return std::get<SparseSet<T>>(pools);
+        }
+
+        template<typename T> T &add(Entity entity, const T &value){
+            return pool<T>().add(entity, value);
+        }
+
+        template<typename T> T &get(Entity entity){
+            return pool<T>().get(entity);
+        }
+
+        template<typename T> bool has(Entity entity){
+            return pool<T>().has(entity);
+        }
+
+        /**
+         * calls body(entity, first, others...) for every entity that has all the given components.
+         * walks the dense array of First, so put the rarest component first. entities that
+         * got their components in the same order sit in the same slot of every pool, in
+         * which case the other components are read linearly too.
+        */
+        template<typename First, typename... Others, typename Body>
+        void each(Body body){
+            eachInRange<First, Others...>(0, pool<First>().size(), body);
+        }
+
+        /**
+         * like each(), but chunks of the dense array of First run on the job system.
+         * body must only write the components it is handed.
+        */
+        template<typename First, typename... Others, typename Body>
+        void parallelEach(size_t chunkSize, Body body){
+            JobSystem::instance().parallelFor(pool<First>().size(), chunkSize, [&](size_t begin, size_t end){
+                eachInRange<First, Others...>(begin, end, body);
+            });
+        }
+
+    private:
+        static constexpr uint32_t MAX_ENTITIES = 0x00FFFFFF;   //indices that fit in 24 bits, less NO_ENTITY's
+
+        std::vector<uint8_t> generations;
+        std::vector<uint32_t> freeList;
+        std::tuple<SparseSet<Transform>, SparseSet<MeshRef>, SparseSet<MaterialRef>,
+                   SparseSet<Bounds>, SparseSet<Visibility>, SparseSet<OccluderRef>, SparseSet<ShadowCaster>> pools;
+
+        /**
+         * @return the T of entity, looking in slot first, NULL if it has none
+        */
+        template<typename T> T *find(size_t slot, Entity entity){
+            SparseSet<T> &set = pool<T>();
+            if(slot < set.size() && set.entities[slot] == entity)
+                return &set.components[slot];
+            return set.has(entity) ? &set.get(entity) : NULL;
+        }
+
+        template<typename First, typename... Others, typename Body>
+        void eachInRange(size_t begin, size_t end, Body &body){
+            SparseSet<First> &driver = pool<First>();
+            for(size_t i = begin; i < end; i++){
+                Entity entity = driver.entities[i];
+                std::tuple<Others *...> others(find<Others>(i, entity)...);
+                bool complete = std::apply([](auto *...component){ return ((component != NULL) && ...); }, others);
+                if(complete)
+                    std::apply([&](auto *...component){ body(entity, driver.components[i], *component...); }, others);
+            }
+        }
+};
+
+#endif
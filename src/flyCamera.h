@@ -0,0 +1,136 @@
+/**
+ * A camera flown with timestamped input events (see inputQueue.h). W, A, S and
+ * D move it, Q and E lower and raise it, dragging with the right mouse button
+ * held looks around and scrolling zooms. Movement is integrated between the
+ * times the events arrived rather than once per frame, so a key tapped for
+ * half a frame moves the camera half a frame's distance.
+*/
+#ifndef FLY_CAMERA_H
+#define FLY_CAMERA_H
+
+#include <GLFW/glfw3.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include <math.h>
+#include <algorithm>
+
+#include "inputQueue.h"
+
+class FlyCamera{
+    public:
+        glm::vec3 eye;
+        glm::vec3 target;           //point looked at, its distance from eye is kept
+        float fov = 45.0f;          //vertical field of view in degrees
+        float nearPlane = 0.1f;
+        float farPlane = 100.0f;
+        float speed = 3.0f;         //units per second
+        float sensitivity = 0.1f;   //degrees per screen coordinate of cursor motion
+
+        FlyCamera(const glm::vec3 &eye, const glm::vec3 &target) : eye(eye), target(target){}
+
+        /**
+         * applies one event
+         * pre: events are handled in the order they arrived
+         * post: the camera moved for the keys held up to event.time
+        */
+        void handle(const InputEvent &event){
+            moveTo(event.time);
+            switch(event.type){
+                case INPUT_KEY:{
+                    int direction = keyDirection(event.code);
+                    if(direction >= 0 && event.action != GLFW_REPEAT)
+                        held[direction] = event.action == GLFW_PRESS;
+                    break;
+                }
+                case INPUT_MOUSE_BUTTON:
+                    if(event.code == GLFW_MOUSE_BUTTON_RIGHT){
+                        looking = event.action == GLFW_PRESS;
+                        //the cursor jumps when it is captured, motion counts from the next position
+                        hasCursor = false;
+                    }
+                    break;
+                case INPUT_CURSOR:
+                    if(looking && hasCursor)
+                        look((float)(event.x - cursorX), (float)(event.y - cursorY));
+                    cursorX = event.x;
+                    cursorY = event.y;
+                    hasCursor = true;
+                    break;
+                case INPUT_SCROLL:
+                    fov = std::min(std::max(fov - (float)event.y * 2.0f, 10.0f), 90.0f);
+                    break;
+            }
+        }
+
+        /**
+         * moves the camera for the keys held since the last event or moveTo()
+         * @param time nowSeconds() to move up to
+        */
+        void moveTo(double time){
+            if(movedUntil == 0.0 || time <= movedUntil){
+                movedUntil = std::max(movedUntil, time);
+                return;
+            }
+            float seconds = (float)(time - movedUntil);
+            movedUntil = time;
+            glm::vec3 forward = glm::normalize(target - eye);
+            glm::vec3 right = glm::normalize(glm::cross(forward, up));
+            glm::vec3 motion = forward * (float)(held[FORWARD] - held[BACK]) + right * (float)(held[RIGHT] - held[LEFT])
+                             + up * (float)(held[RISE] - held[SINK]);
+            glm::vec3 offset = motion * speed * seconds;
+            eye += offset;
+            target += offset;
+        }
+
+        glm::mat4 view() const{
+            return glm::lookAt(eye, target, up);
+        }
+
+        /**
+         * @param aspect width / height of what is drawn
+        */
+        glm::mat4 projection(float aspect) const{
+            return glm::perspective(glm::radians(fov), aspect, nearPlane, farPlane);
+        }
+
+    private:
+        enum Direction{FORWARD, BACK, LEFT, RIGHT, SINK, RISE, DIRECTIONS};
+        const glm::vec3 up{0.0f, 1.0f, 0.0f};
+
+        bool held[DIRECTIONS] = {};
+        bool looking = false;       //right mouse button held
+        bool hasCursor = false;     //cursorX/Y hold a position to measure motion from
+        double cursorX = 0.0;
+        double cursorY = 0.0;
+        double movedUntil = 0.0;
+
+        static int keyDirection(int key){
+            switch(key){
+                case GLFW_KEY_W: return FORWARD;
+                case GLFW_KEY_S: return BACK;
+                case GLFW_KEY_A: return LEFT;
+                case GLFW_KEY_D: return RIGHT;
+                case GLFW_KEY_Q: return SINK;
+                case GLFW_KEY_E: return RISE;
+                default: return -1;
+            }
+        }
+
+        /**
+         * turns the view by cursor motion, yaw around the world's up and pitch short of straight up or down
+        */
+        void look(float dx, float dy){
+            glm::vec3 offset = target - eye;
+            float distance = glm::length(offset);
+            glm::vec3 direction = glm::angleAxis(glm::radians(-dx * sensitivity), up) * (offset / distance);
+            float pitch = glm::degrees(asinf(std::min(std::max(direction.y, -1.0f), 1.0f)));
+            float turn = std::min(std::max(pitch - dy * sensitivity, -89.0f), 89.0f) - pitch;
+            glm::vec3 right = glm::normalize(glm::cross(direction, up));
+            direction = glm::angleAxis(glm::radians(turn), right) * direction;
+            target = eye + direction * distance;
+        }
+};
+
+#endif
@@ -0,0 +1,244 @@
+/**
+ * Frames in flight. The CPU may record up to framesInFlight frames ahead of
+ * the GPU, and each of those frames owns a FrameContext: a linear upload
+ * buffer for its transient data (lights, instances, anything rewritten every
+ * frame), the GL objects it deleted and a pair of timestamp queries.
+ *
+ * endFrame() fences the frame's commands. When the same context comes around
+ * again, beginFrame() waits on that fence, which is the only place the CPU
+ * waits for the GPU: after it every query result is available, the upload
+ * buffer can be overwritten without synchronizing and deleted objects are
+ * really unused. The time spent waiting is the fence wait in the stats, high
+ * values mean the GPU is the bottleneck.
+*/
+#ifndef FRAME_CONTEXT_H
+#define FRAME_CONTEXT_H
+
+#include <glad/glad.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+#include "computeShader.h"
+#include "frameTimer.h"
+#include "profiler.h"
+
+/**
+ * a range of a frame's upload buffer, valid until the frame's fence signals
+*/
+struct TransientAllocation{
+    unsigned int buffer = 0;
+    size_t offset = 0;
+    size_t size = 0;
+};
+
+struct FrameContextStats{
+    int framesInFlight = 0;
+    double fenceWaitMs = 0.0;       //CPU time beginFrame() waited for the GPU, this frame
+    double gpuMs = 0.0;             //GPU time of the newest frame that completed
+    size_t transientBytes = 0;      //uploaded through the last finished frame's buffer
+    size_t transientCapacity = 0;   //bytes of every frame's upload buffer together
+    size_t deletions = 0;           //GL objects deleted behind a fence since startup
+    size_t grows = 0;               //upload buffers replaced by a larger one since startup
+
+    void print(const char *name) const{
+        printf("%s: %d frames, %.3f ms fence wait, gpu %.2f ms, %zu of %zu transient bytes, %zu deferred deletions, %zu grows\n",
+               name, framesInFlight, fenceWaitMs, gpuMs, transientBytes, transientCapacity, deletions, grows);
+    }
+};
+
+class FrameContexts{
+    public:
+        static constexpr int MAX_FRAMES = 4;
+        static constexpr size_t INITIAL_CAPACITY = 256 * 1024;     //upload buffer bytes per frame to start with
+
+        FrameContextStats stats;
+        size_t uniformAlignment = 256;      //offset alignment of uniform buffer ranges, set by init()
+        size_t storageAlignment = 256;      //of shader storage buffer ranges
+
+        /**
+         * @param framesInFlight frames the CPU may run ahead of the GPU, clamped to [1, MAX_FRAMES]
+         * pre: a GL 3.3 context is current
+        */
+        void init(int framesInFlight){
+            count = std::min(MAX_FRAMES, std::max(1, framesInFlight));
+            stats.framesInFlight = count;
+            GLint alignment = 0;
+            glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+            uniformAlignment = std::max<GLint>(alignment, 1);
+            if(computeSupported()){
+                glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+                storageAlignment = std::max<GLint>(alignment, 1);
+            }
+            for(int i = 0; i < count; i++){
+                glGenQueries(2, frames[i].queries);
+                createBuffer(frames[i], INITIAL_CAPACITY);
+            }
+        }
+
+        /**
+         * waits for the frame that last used this frame's context, then recycles it
+         * pre: init() ran, endFrame() ran for the previous frame
+         * post: the GPU is done with everything the context held, its deletions are made
+        */
+        void beginFrame(){
+            PROFILE_ZONE("frame fence");
+            FrameContext &context = frames[current];
+            double start = nowSeconds();
+            if(context.fence != NULL){
+                glClientWaitSync(context.fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+                glDeleteSync(context.fence);
+                context.fence = NULL;
+            }
+            stats.fenceWaitMs = (nowSeconds() - start) * 1000.0;
+            PROFILE_COUNTER("fence wait ms", stats.fenceWaitMs);
+            if(context.timed){
+                //the fence came after the queries, so they are available without stalling
+                GLuint64 begin = 0, end = 0;
+                glGetQueryObjectui64v(context.queries[0], GL_QUERY_RESULT, &begin);
+                glGetQueryObjectui64v(context.queries[1], GL_QUERY_RESULT, &end);
+                stats.gpuMs = (end - begin) / 1e6;
+                stats.transientBytes = context.used;
+                context.timed = false;
+            }
+            deleteObjects(context.deletions);
+            context.used = 0;
+            glQueryCounter(context.queries[0], GL_TIMESTAMP);
+        }
+
+        /**
+         * fences the frame's commands
+         * pre: beginFrame() ran this frame, every command of the frame is issued
+         * post: the next beginFrame() moves on to the next context
+        */
+        void endFrame(){
+            FrameContext &context = frames[current];
+            glQueryCounter(context.queries[1], GL_TIMESTAMP);
+            context.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            context.timed = true;
+            current = (current + 1) % count;
+        }
+
+        /**
+         * @return the context of the frame between beginFrame() and endFrame(), in [0, framesInFlight).
+         *         per frame resources indexed by it are free once beginFrame() returned
+        */
+        int index() const{
+            return current;
+        }
+
+        /**
+         * copies data into this frame's upload buffer. The GPU is done with the
+         * range, so it is written without the driver synchronizing or copying
+         * @param alignment the returned offset is a multiple of it, see uniformAlignment / storageAlignment
+         * @return where the data is, to bind with glBindBufferRange and the like
+         * pre: beginFrame() ran this frame
+        */
+        TransientAllocation upload(const void *data, size_t size, size_t alignment){
+            FrameContext &context = frames[current];
+            size_t offset = (context.used + alignment - 1) / alignment * alignment;
+            if(offset + size > context.capacity){
+                //commands already issued this frame read the old buffer, it goes when the frame completes
+                context.deletions.push_back({GL_BUFFER, context.buffer});
+                createBuffer(context, std::max(context.capacity * 2, size + alignment));
+                stats.grows++;
+                offset = 0;
+            }
+            TransientAllocation allocation;
+            allocation.buffer = context.buffer;
+            allocation.offset = offset;
+            allocation.size = size;
+            context.used = offset + size;
+            if(size == 0)
+                return allocation;
+            glBindBuffer(GL_COPY_WRITE_BUFFER, context.buffer);
+            void *target = glMapBufferRange(GL_COPY_WRITE_BUFFER, offset, size,
+                                            GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+            if(target != NULL){
+                memcpy(target, data, size);
+                glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+            }
+            glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+            return allocation;
+        }
+
+        /**
+         * deletes a GL object once every frame in flight that may still use it completed
+         * @param type GL_BUFFER, GL_TEXTURE, GL_FRAMEBUFFER, GL_RENDERBUFFER, GL_VERTEX_ARRAY, GL_QUERY or GL_PROGRAM
+         * @param name the object, 0 is ignored
+        */
+        void deferDelete(GLenum type, unsigned int name){
+            if(name != 0)
+                frames[current].deletions.push_back({type, name});
+        }
+
+        /**
+         * waits for every frame in flight and deletes what the contexts hold
+         * pre: the context init() ran on is current
+        */
+        void destroy(){
+            for(int i = 0; i < count; i++){
+                FrameContext &context = frames[i];
+                if(context.fence != NULL){
+                    glClientWaitSync(context.fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+                    glDeleteSync(context.fence);
+                    context.fence = NULL;
+                }
+                deleteObjects(context.deletions);
+                glDeleteBuffers(1, &context.buffer);
+                glDeleteQueries(2, context.queries);
+                context = FrameContext();
+            }
+            count = 0;
+        }
+
+    private:
+        struct Deletion{
+            GLenum type;
+            unsigned int name;
+        };
+
+        struct FrameContext{
+            GLsync fence = NULL;
+            unsigned int buffer = 0;        //transient uploads
+            size_t capacity = 0;
+            size_t used = 0;
+            unsigned int queries[2] = {};   //timestamps at the start and end of the frame
+            bool timed = false;             //the queries were issued and not read yet
+            std::vector<Deletion> deletions;
+        };
+
+        FrameContext frames[MAX_FRAMES];
+        int count = 0;
+        int current = 0;
+
+        void createBuffer(FrameContext &context, size_t capacity){
+            glGenBuffers(1, &context.buffer);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, context.buffer);
+            glBufferData(GL_COPY_WRITE_BUFFER, capacity, NULL, GL_DYNAMIC_DRAW);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+            stats.transientCapacity += capacity - context.capacity;
+            context.capacity = capacity;
+        }
+
+        void deleteObjects(std::vector<Deletion> &deletions){
+            for(const Deletion &deletion : deletions){
+                switch(deletion.type){
+                    case GL_BUFFER: glDeleteBuffers(1, &deletion.name); break;
+                    case GL_TEXTURE: glDeleteTextures(1, &deletion.name); break;
+                    case GL_FRAMEBUFFER: glDeleteFramebuffers(1, &deletion.name); break;
+                    case GL_RENDERBUFFER: glDeleteRenderbuffers(1, &deletion.name); break;
+                    case GL_VERTEX_ARRAY: glDeleteVertexArrays(1, &deletion.name); break;
+                    case GL_QUERY: glDeleteQueries(1, &deletion.name); break;
+                    case GL_PROGRAM: glDeleteProgram(deletion.name); break;
+                    default: printf("frame contexts: can't delete objects of type 0x%x\n", deletion.type); break;
+                }
+            }
+            stats.deletions += deletions.size();
+            deletions.clear();
+        }
+};
+
+#endif
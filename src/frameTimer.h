@@ -0,0 +1,237 @@
+/**
+ * Frame timing: fixed timestep simulation, a CPU friendly frame limiter and
+ * per-second frame statistics.
+*/
+#ifndef FRAME_TIMER_H
+#define FRAME_TIMER_H
+
+#include <stdio.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <thread>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <timeapi.h>
+#else
+#include <time.h>
+#endif
+
+/**
+ * @return seconds on a monotonic clock
+*/
+inline double nowSeconds(){
+    using namespace std::chrono;
+    return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * @return CPU time consumed by every thread of this process, in seconds
+*/
+inline double processCpuSeconds(){
+#ifdef _WIN32
+    FILETIME creation, exitTime, kernel, user;
+    if(!GetProcessTimes(GetCurrentProcess(), &creation, &exitTime, &kernel, &user))
+        return 0.0;
+    auto toSeconds = [](const FILETIME &t){
+        return (double)(((unsigned long long)t.dwHighDateTime << 32) | t.dwLowDateTime) * 1e-7;
+    };
+    return toSeconds(kernel) + toSeconds(user);
+#else
+    timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+#endif
+}
+
+/**
+ * Accumulates real frame time and turns it into a whole number of fixed size
+ * simulation steps. alpha() is how far the render time lies between the last
+ * two simulation states, for interpolation.
+*/
+class FixedTimestep{
+    public:
+        double step;        //simulation step in seconds
+        int maxSteps;       //cap on steps per frame, so a long stall can't snowball
+
+        FixedTimestep(double stepSeconds = 1.0 / 60.0, int maxStepsPerFrame = 8) : step(stepSeconds), maxSteps(maxStepsPerFrame){}
+
+        /**
+         * @param frameSeconds real time elapsed since the previous frame
+         * @return the number of simulation steps to run this frame
+         * pre: none
+         * post: the consumed time is removed from the accumulator. if more than
+         *       maxSteps are due the excess time is dropped.
+        */
+        int advance(double frameSeconds){
+            accumulator += frameSeconds;
+            int steps = (int)(accumulator / step);
+            if(steps > maxSteps){
+                steps = maxSteps;
+                accumulator = 0.0;
+            } else{
+                accumulator -= steps * step;
+            }
+            return steps;
+        }
+
+        /**
+         * @return interpolation factor in [0, 1) between the previous and current simulation state
+        */
+        float alpha() const{
+            return (float)(accumulator / step);
+        }
+
+    private:
+        double accumulator = 0.0;
+};
+
+/**
+ * Holds the frame rate to a target without burning a core: sleeps until just
+ * before the deadline and spins only for the last stretch. The spin margin
+ * adapts to how late the OS actually wakes the thread up.
+*/
+class FrameLimiter{
+    public:
+        /**
+         * @param targetFps frames per second to hold, 0 disables limiting
+        */
+        FrameLimiter(double targetFps = 0.0){
+            setTarget(targetFps);
+#ifdef _WIN32
+            //default scheduler granularity is ~15ms, far too coarse to sleep to a frame deadline
+            timeBeginPeriod(1);
+#endif
+        }
+
+        ~FrameLimiter(){
+#ifdef _WIN32
+            timeEndPeriod(1);
+#endif
+        }
+
+        /**
+         * @param targetFps frames per second to hold, 0 disables limiting
+        */
+        void setTarget(double targetFps){
+            frameSeconds = targetFps > 0.0 ? 1.0 / targetFps : 0.0;
+        }
+
+        /**
+         * blocks until the frame that started at frameStart has lasted the target time
+         * @param frameStart nowSeconds() at the start of the frame
+         * pre: none
+         * post: returns no earlier than frameStart + 1/targetFps
+        */
+        void wait(double frameStart){
+            if(frameSeconds <= 0.0)
+                return;
+            double deadline = frameStart + frameSeconds;
+            //sleep in 1ms slices while we're comfortably away from the deadline
+            while(deadline - nowSeconds() > spinMargin){
+                double before = nowSeconds();
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                double oversleep = nowSeconds() - before - 0.001;
+                //track the worst recent oversleep, decaying slowly so one hiccup doesn't stick
+                spinMargin = std::max(spinMargin * 0.99, std::min(oversleep + 0.0005, 0.02));
+            }
+            //spin the remaining fraction of a millisecond
+            while(nowSeconds() < deadline)
+                std::this_thread::yield();
+        }
+
+    private:
+        double frameSeconds = 0.0;
+        double spinMargin = 0.002;  //time before the deadline at which we stop sleeping
+};
+
+/**
+ * mean, standard deviation and maximum of a series of samples
+*/
+struct SampleStats{
+    size_t count = 0;
+    double sum = 0.0;
+    double sumSquares = 0.0;
+    double max = 0.0;
+
+    void add(double value){
+        count++;
+        sum += value;
+        sumSquares += value * value;
+        max = std::max(max, value);
+    }
+
+    double mean() const{
+        return count > 0 ? sum / count : 0.0;
+    }
+
+    double deviation() const{
+        if(count == 0)
+            return 0.0;
+        double m = mean();
+        return std::sqrt(std::max(0.0, sumSquares / count - m * m));
+    }
+
+    void reset(){
+        *this = SampleStats();
+    }
+};
+
+/**
+ * Collects frame statistics and reports them once per interval
+*/
+class FrameStats{
+    public:
+        double frameMs = 0.0;           //average frame time of the last interval
+        double stepsPerFrame = 0.0;     //average simulation steps per frame of the last interval
+        double cpuPercent = 0.0;        //process CPU time / wall time of the last interval (100 = one core)
+
+        FrameStats(double reportSeconds = 1.0) : interval(reportSeconds){
+            intervalStart = nowSeconds();
+            cpuStart = processCpuSeconds();
+        }
+
+        /**
+         * records one finished frame
+         * @param steps simulation steps run during the frame
+         * @return true if a new interval was completed and the averages were updated
+        */
+        bool addFrame(int steps){
+            frames++;
+            totalSteps += steps;
+            double now = nowSeconds();
+            double elapsed = now - intervalStart;
+            if(elapsed < interval)
+                return false;
+            double cpuNow = processCpuSeconds();
+            frameMs = elapsed * 1000.0 / frames;
+            stepsPerFrame = (double)totalSteps / frames;
+            cpuPercent = (cpuNow - cpuStart) * 100.0 / elapsed;
+            frames = 0;
+            totalSteps = 0;
+            intervalStart = now;
+            cpuStart = cpuNow;
+            return true;
+        }
+
+        /**
+         * pre: none
+         * post: the averages of the last interval are printed to stdout
+        */
+        void print() const{
+            printf("frame %6.2f ms (%6.1f fps) | sim steps/frame %4.2f | cpu %5.1f%%\n",
+                   frameMs, frameMs > 0.0 ? 1000.0 / frameMs : 0.0, stepsPerFrame, cpuPercent);
+        }
+
+    private:
+        double interval;
+        double intervalStart;
+        double cpuStart;
+        int frames = 0;
+        int totalSteps = 0;
+};
+
+#endif
@@ -0,0 +1,463 @@
+/**
+ * View frustum culling of bounding volumes.
+ *
+ * Bounds are kept as structure of arrays so the plane tests run on 8 objects
+ * at a time with AVX2, 4 with SSE and one at a time otherwise. Large static
+ * sets can also be put in a BVH: a subtree outside a plane is rejected with a
+ * single box test, and planes a node lies fully inside are masked off for
+ * everything below it, so subtrees fully inside the frustum aren't tested at all.
+*/
+#ifndef FRUSTUM_CULLER_H
+#define FRUSTUM_CULLER_H
+
+#include <glm/glm.hpp>
+
+#include <math.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <algorithm>
+#include <atomic>
+#include <numeric>
+#include <vector>
+
+#include "frameTimer.h"
+#include "jobSystem.h"
+#include "simd.h"
+
+const uint8_t ALL_PLANES = 0x3F;    //one bit per frustum plane
+
+/**
+ * The 6 planes of a view frustum with normals pointing inwards. point p is on the
+ * inner side of plane i when dot(planes[i].xyz, p) + planes[i].w >= 0
+*/
+struct Frustum{
+    glm::vec4 planes[6];            //left, right, bottom, top, near, far
+
+    Frustum() = default;
+
+    /**
+     * extracts the planes from a clip matrix (GL clip space, -w <= z <= w)
+     * @param clip projection * view for world space planes
+    */
+    explicit Frustum(const glm::mat4 &clip){
+        glm::vec4 rows[4];
+        for(int r = 0; r < 4; r++)
+            rows[r] = glm::vec4(clip[0][r], clip[1][r], clip[2][r], clip[3][r]);
+        for(int i = 0; i < 3; i++){
+            planes[i * 2] = rows[3] + rows[i];
+            planes[i * 2 + 1] = rows[3] - rows[i];
+        }
+        for(glm::vec4 &plane : planes)
+            plane /= glm::length(glm::vec3(plane));
+    }
+
+    /**
+     * @return true if the sphere is at least partly on the inner side of every plane in mask
+    */
+    bool sphereVisible(const glm::vec3 &center, float radius, uint8_t mask = ALL_PLANES) const{
+        for(int p = 0; p < 6; p++){
+            const glm::vec4 &plane = planes[p];
+            if((mask >> p & 1) && plane.x * center.x + plane.y * center.y + plane.z * center.z + plane.w < -radius)
+                return false;
+        }
+        return true;
+    }
+
+    /**
+     * tests an axis aligned box against the planes in mask
+     * @param center center of the box
+     * @param extent half size of the box along each axis
+     * @param mask planes to test
+     * @return -1 if the box is outside, otherwise mask with the planes the box is fully inside cleared
+    */
+    int boxTest(const glm::vec3 &center, const glm::vec3 &extent, uint8_t mask) const{
+        for(int p = 0; p < 6; p++){
+            if(!(mask >> p & 1))
+                continue;
+            glm::vec3 normal(planes[p]);
+            float distance = glm::dot(normal, center) + planes[p].w;
+            float radius = glm::dot(glm::abs(normal), extent);
+            if(distance < -radius)
+                return -1;
+            if(distance >= radius)
+                mask &= ~(1 << p);
+        }
+        return mask;
+    }
+};
+
+/**
+ * bounding spheres as structure of arrays
+*/
+struct SphereBounds{
+    std::vector<float> x, y, z, radius;
+
+    size_t size() const{
+        return x.size();
+    }
+
+    void resize(size_t count){
+        x.resize(count);
+        y.resize(count);
+        z.resize(count);
+        radius.resize(count);
+    }
+
+    void set(size_t i, const glm::vec3 &center, float r){
+        x[i] = center.x;
+        y[i] = center.y;
+        z[i] = center.z;
+        radius[i] = r;
+    }
+};
+
+/**
+ * axis aligned boxes as structure of arrays
+*/
+struct BoxBounds{
+    std::vector<float> x, y, z;             //centers
+    std::vector<float> ex, ey, ez;          //half sizes
+
+    size_t size() const{
+        return x.size();
+    }
+
+    void resize(size_t count){
+        for(std::vector<float> *array : {&x, &y, &z, &ex, &ey, &ez})
+            array->resize(count);
+    }
+
+    void set(size_t i, const glm::vec3 &center, const glm::vec3 &extent){
+        x[i] = center.x;
+        y[i] = center.y;
+        z[i] = center.z;
+        ex[i] = extent.x;
+        ey[i] = extent.y;
+        ez[i] = extent.z;
+    }
+};
+
+/**
+ * tests spheres [begin, end) against the planes in mask
+ * @param out out[i - begin] is set to 1 if sphere i is visible, 0 if not
+ * @return number of visible spheres
+*/
+inline size_t cullSpheres(const Frustum &frustum, uint8_t mask, const SphereBounds &bounds, size_t begin, size_t end, uint8_t *out){
+    size_t visible = 0;
+    size_t i = begin;
+#if defined(CULL_AVX2)
+    for(; i + 8 <= end; i += 8){
+        __m256 x = _mm256_loadu_ps(&bounds.x[i]), y = _mm256_loadu_ps(&bounds.y[i]), z = _mm256_loadu_ps(&bounds.z[i]);
+        __m256 minDistance = _mm256_sub_ps(_mm256_setzero_ps(), _mm256_loadu_ps(&bounds.radius[i]));
+        __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+        for(int p = 0; p < 6; p++){
+            if(!(mask >> p & 1))
+                continue;
+            const glm::vec4 &plane = frustum.planes[p];
+            __m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(
+                _mm256_mul_ps(_mm256_set1_ps(plane.x), x), _mm256_mul_ps(_mm256_set1_ps(plane.y), y)),
+                _mm256_mul_ps(_mm256_set1_ps(plane.z), z)), _mm256_set1_ps(plane.w));
+            inside = _mm256_and_ps(inside, _mm256_cmp_ps(distance, minDistance, _CMP_GE_OQ));
+        }
+        int bits = _mm256_movemask_ps(inside);
+        for(int k = 0; k < 8; k++){
+            out[i - begin + k] = bits >> k & 1;
+            visible += bits >> k & 1;
+        }
+    }
+#elif defined(CULL_SSE)
+    for(; i + 4 <= end; i += 4){
+        __m128 x = _mm_loadu_ps(&bounds.x[i]), y = _mm_loadu_ps(&bounds.y[i]), z = _mm_loadu_ps(&bounds.z[i]);
+        __m128 minDistance = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(&bounds.radius[i]));
+        __m128 inside = _mm_cmpeq_ps(x, x);
+        for(int p = 0; p < 6; p++){
+            if(!(mask >> p & 1))
+                continue;
+            const glm::vec4 &plane = frustum.planes[p];
+            __m128 distance = _mm_add_ps(_mm_add_ps(_mm_add_ps(
+                _mm_mul_ps(_mm_set1_ps(plane.x), x), _mm_mul_ps(_mm_set1_ps(plane.y), y)),
+                _mm_mul_ps(_mm_set1_ps(plane.z), z)), _mm_set1_ps(plane.w));
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, minDistance));
+        }
+        int bits = _mm_movemask_ps(inside);
+        for(int k = 0; k < 4; k++){
+            out[i - begin + k] = bits >> k & 1;
+            visible += bits >> k & 1;
+        }
+    }
+#endif
+    for(; i < end; i++){
+        out[i - begin] = frustum.sphereVisible(glm::vec3(bounds.x[i], bounds.y[i], bounds.z[i]), bounds.radius[i], mask);
+        visible += out[i - begin];
+    }
+    return visible;
+}
+
+/**
+ * tests boxes [begin, end) against the planes in mask
+ * @param out out[i - begin] is set to 1 if box i is visible, 0 if not
+ * @return number of visible boxes
+*/
+inline size_t cullBoxes(const Frustum &frustum, uint8_t mask, const BoxBounds &bounds, size_t begin, size_t end, uint8_t *out){
+    size_t visible = 0;
+    size_t i = begin;
+#if defined(CULL_AVX2)
+    for(; i + 8 <= end; i += 8){
+        __m256 x = _mm256_loadu_ps(&bounds.x[i]), y = _mm256_loadu_ps(&bounds.y[i]), z = _mm256_loadu_ps(&bounds.z[i]);
+        __m256 ex = _mm256_loadu_ps(&bounds.ex[i]), ey = _mm256_loadu_ps(&bounds.ey[i]), ez = _mm256_loadu_ps(&bounds.ez[i]);
+        __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+        for(int p = 0; p < 6; p++){
+            if(!(mask >> p & 1))
+                continue;
+            const glm::vec4 &plane = frustum.planes[p];
+            __m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(
+                _mm256_mul_ps(_mm256_set1_ps(plane.x), x), _mm256_mul_ps(_mm256_set1_ps(plane.y), y)),
+                _mm256_mul_ps(_mm256_set1_ps(plane.z), z)), _mm256_set1_ps(plane.w));
+            //projected half size of the box onto the plane normal
+            __m256 radius = _mm256_add_ps(_mm256_add_ps(
+                _mm256_mul_ps(_mm256_set1_ps(fabsf(plane.x)), ex), _mm256_mul_ps(_mm256_set1_ps(fabsf(plane.y)), ey)),
+                _mm256_mul_ps(_mm256_set1_ps(fabsf(plane.z)), ez));
+            inside = _mm256_and_ps(inside, _mm256_cmp_ps(distance, _mm256_sub_ps(_mm256_setzero_ps(), radius), _CMP_GE_OQ));
+        }
+        int bits = _mm256_movemask_ps(inside);
+        for(int k = 0; k < 8; k++){
+            out[i - begin + k] = bits >> k & 1;
+            visible += bits >> k & 1;
+        }
+    }
+#elif defined(CULL_SSE)
+    for(; i + 4 <= end; i += 4){
+        __m128 x = _mm_loadu_ps(&bounds.x[i]), y = _mm_loadu_ps(&bounds.y[i]), z = _mm_loadu_ps(&bounds.z[i]);
+        __m128 ex = _mm_loadu_ps(&bounds.ex[i]), ey = _mm_loadu_ps(&bounds.ey[i]), ez = _mm_loadu_ps(&bounds.ez[i]);
+        __m128 inside = _mm_cmpeq_ps(x, x);
+        for(int p = 0; p < 6; p++){
+            if(!(mask >> p & 1))
+                continue;
+            const glm::vec4 &plane = frustum.planes[p];
+            __m128 distance = _mm_add_ps(_mm_add_ps(_mm_add_ps(
+                _mm_mul_ps(_mm_set1_ps(plane.x), x), _mm_mul_ps(_mm_set1_ps(plane.y), y)),
+                _mm_mul_ps(_mm_set1_ps(plane.z), z)), _mm_set1_ps(plane.w));
+            __m128 radius = _mm_add_ps(_mm_add_ps(
+                _mm_mul_ps(_mm_set1_ps(fabsf(plane.x)), ex), _mm_mul_ps(_mm_set1_ps(fabsf(plane.y)), ey)),
+                _mm_mul_ps(_mm_set1_ps(fabsf(plane.z)), ez));
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, _mm_sub_ps(_mm_setzero_ps(), radius)));
+        }
+        int bits = _mm_movemask_ps(inside);
+        for(int k = 0; k < 4; k++){
+            out[i - begin + k] = bits >> k & 1;
+            visible += bits >> k & 1;
+        }
+    }
+#endif
+    for(; i < end; i++){
+        glm::vec3 center(bounds.x[i], bounds.y[i], bounds.z[i]);
+        glm::vec3 extent(bounds.ex[i], bounds.ey[i], bounds.ez[i]);
+        out[i - begin] = frustum.boxTest(center, extent, mask) >= 0;
+        visible += out[i - begin];
+    }
+    return visible;
+}
+
+/**
+ * per frame culling counters
+*/
+struct CullStats{
+    size_t tested = 0;          //bounding volumes tested one by one
+    size_t nodes = 0;           //BVH nodes tested
+    size_t visible = 0;
+    double ms = 0.0;
+
+    void print(const char *name) const{
+        printf("%s: %zu tested, %zu nodes, %zu visible, %.3f ms\n", name, tested, nodes, visible, ms);
+    }
+};
+
+/**
+ * Culls a set of bounding spheres that changes every frame: the whole set is
+ * tested, split across the job system
+*/
+class FrustumCuller{
+    public:
+        SphereBounds spheres;           //filled by the caller before cull()
+        std::vector<uint8_t> visible;   //visible[i] is the result for spheres[i]
+        CullStats stats;
+
+        /**
+         * pre: spheres holds this frame's bounds
+         * post: visible and stats hold the results
+        */
+        const CullStats &cull(const Frustum &frustum){
+            double start = nowSeconds();
+            size_t count = spheres.size();
+            visible.resize(count);
+            std::atomic<size_t> visibleCount{0};
+            JobSystem::instance().parallelFor(count, CHUNK_SIZE, [&](size_t begin, size_t end){
+                visibleCount += cullSpheres(frustum, ALL_PLANES, spheres, begin, end, visible.data() + begin);
+            });
+            stats.tested = count;
+            stats.nodes = 0;
+            stats.visible = visibleCount;
+            stats.ms = (nowSeconds() - start) * 1000.0;
+            return stats;
+        }
+
+    private:
+        static constexpr size_t CHUNK_SIZE = 16384;
+};
+
+/**
+ * Bounding volume hierarchy over a static set of spheres. Leaves hold up to
+ * LEAF_SIZE spheres, stored contiguously so they go through the SIMD kernel.
+*/
+class CullBvh{
+    public:
+        CullStats stats;
+
+        /**
+         * builds the tree, splitting at the median along the longest axis
+         * @param spheres the spheres to cull, copied into tree order
+         * pre: none
+         * post: any previous tree is replaced
+        */
+        void build(const SphereBounds &spheres){
+            size_t count = spheres.size();
+            order.resize(count);
+            std::iota(order.begin(), order.end(), 0u);
+            nodes.clear();
+            nodes.push_back(Node());
+            if(count > 0)
+                buildNode(0, 0, (uint32_t)count, spheres);
+            sorted.resize(count);
+            for(size_t i = 0; i < count; i++){
+                uint32_t source = order[i];
+                sorted.set(i, glm::vec3(spheres.x[source], spheres.y[source], spheres.z[source]), spheres.radius[source]);
+            }
+        }
+
+        /**
+         * @param visible resized to the number of spheres, visible[i] is the result for sphere i as given to build()
+         * @return counters of this cull
+        */
+        const CullStats &cull(const Frustum &frustum, std::vector<uint8_t> &visible){
+            double start = nowSeconds();
+            visible.assign(order.size(), 0);
+            //the top levels are walked here, so whole halves off screen are rejected before any job
+            //starts. the subtrees TASK_DEPTH levels down that still cross a plane become the jobs
+            CullStats top;
+            tasks.clear();
+            if(!order.empty())
+                visit(0, ALL_PLANES, 0, frustum, visible.data(), top, &tasks);
+            std::atomic<size_t> tested{top.tested}, nodeCount{top.nodes}, visibleCount{top.visible};
+            JobSystem::instance().parallelFor(tasks.size(), 1, [&](size_t begin, size_t end){
+                CullStats local;
+                for(size_t t = begin; t < end; t++)
+                    visit(tasks[t].node, tasks[t].mask, 0, frustum, visible.data(), local, NULL);
+                tested += local.tested;
+                nodeCount += local.nodes;
+                visibleCount += local.visible;
+            });
+            stats.tested = tested;
+            stats.nodes = nodeCount;
+            stats.visible = visibleCount;
+            stats.ms = (nowSeconds() - start) * 1000.0;
+            return stats;
+        }
+
+        size_t nodeCount() const{
+            return nodes.size();
+        }
+
+    private:
+        static constexpr uint32_t LEAF_SIZE = 16;
+        static constexpr int TASK_DEPTH = 6;        //up to 2^6 subtrees to spread over threads
+
+        struct Node{
+            glm::vec3 center;
+            glm::vec3 extent;
+            uint32_t first = 0;         //range of sorted spheres below the node
+            uint32_t count = 0;
+            uint32_t left = 0;          //children are left and left + 1, 0 for leaves
+        };
+
+        //a subtree left for a job, with the planes its parent wasn't fully inside of
+        struct Task{
+            uint32_t node;
+            uint8_t mask;
+        };
+
+        std::vector<Node> nodes;
+        std::vector<uint32_t> order;            //order[i] = index given to build() of sorted sphere i
+        std::vector<Task> tasks;
+        SphereBounds sorted;
+
+        void buildNode(uint32_t index, uint32_t first, uint32_t count, const SphereBounds &spheres){
+            glm::vec3 boundsMin(INFINITY), boundsMax(-INFINITY);
+            glm::vec3 centerMin(INFINITY), centerMax(-INFINITY);
+            for(uint32_t i = first; i < first + count; i++){
+                uint32_t s = order[i];
+                glm::vec3 center(spheres.x[s], spheres.y[s], spheres.z[s]);
+                boundsMin = glm::min(boundsMin, center - spheres.radius[s]);
+                boundsMax = glm::max(boundsMax, center + spheres.radius[s]);
+                centerMin = glm::min(centerMin, center);
+                centerMax = glm::max(centerMax, center);
+            }
+            nodes[index].center = (boundsMin + boundsMax) * 0.5f;
+            nodes[index].extent = (boundsMax - boundsMin) * 0.5f;
+            nodes[index].first = first;
+            nodes[index].count = count;
+            if(count <= LEAF_SIZE)
+                return;
+
+            glm::vec3 size = centerMax - centerMin;
+            int axis = size.x > size.y ? (size.x > size.z ? 0 : 2) : (size.y > size.z ? 1 : 2);
+            const std::vector<float> &key = axis == 0 ? spheres.x : axis == 1 ? spheres.y : spheres.z;
+            uint32_t half = count / 2;
+            std::nth_element(order.begin() + first, order.begin() + first + half, order.begin() + first + count,
+                             [&](uint32_t a, uint32_t b){ return key[a] < key[b]; });
+            uint32_t left = (uint32_t)nodes.size();
+            nodes[index].left = left;
+            nodes.push_back(Node());
+            nodes.push_back(Node());
+            buildNode(left, first, half, spheres);
+            buildNode(left + 1, first + half, count - half, spheres);
+        }
+
+        /**
+         * culls the subtree at index
+         * @param mask planes the subtree's ancestors weren't fully inside of
+         * @param depth of index below where the walk started
+         * @param tasks NULL to walk the whole subtree, otherwise nodes TASK_DEPTH levels down are
+         *        appended to it untested instead of visited
+        */
+        void visit(uint32_t index, uint8_t mask, int depth, const Frustum &frustum, uint8_t *visible, CullStats &local, std::vector<Task> *tasks) const{
+            if(tasks != NULL && depth == TASK_DEPTH){
+                tasks->push_back({index, mask});
+                return;
+            }
+            const Node &node = nodes[index];
+            local.nodes++;
+            int result = frustum.boxTest(node.center, node.extent, mask);
+            if(result < 0)
+                return;
+            mask = (uint8_t)result;
+            if(mask == 0){
+                //fully inside every plane: everything below is visible
+                for(uint32_t i = node.first; i < node.first + node.count; i++)
+                    visible[order[i]] = 1;
+                local.visible += node.count;
+                return;
+            }
+            if(node.left == 0){
+                uint8_t leafVisible[LEAF_SIZE];
+                local.visible += cullSpheres(frustum, mask, sorted, node.first, node.first + node.count, leafVisible);
+                local.tested += node.count;
+                for(uint32_t i = 0; i < node.count; i++)
+                    visible[order[node.first + i]] = leafVisible[i];
+                return;
+            }
+            visit(node.left, mask, depth + 1, frustum, visible, local, tasks);
+            visit(node.left + 1, mask, depth + 1, frustum, visible, local, tasks);
+        }
+};
+
+#endif
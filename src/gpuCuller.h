@@ -0,0 +1,464 @@
+/**
+ * GPU driven culling: instance bounds live in a shader storage buffer and a
+ * compute shader tests every instance against the view frustum and against a
+ * max depth pyramid (Hi-Z) built from the previous frame's depth buffer. Each
+ * visible instance appends a DrawElementsIndirectCommand to its batch, and a
+ * batch is drawn with one multi-draw-indirect call whatever its size, so the
+ * CPU side is a buffer upload and a fixed number of GL calls.
+ *
+ * With GL 4.6 the per-batch counters the shader increments are passed to
+ * glMultiDrawElementsIndirectCount directly. On older contexts the command
+ * buffer is zeroed before culling and all of a batch's slots are drawn, the
+ * unused ones having an instance count of 0.
+ *
+ * testing against last frame's depth means an object that comes into view from
+ * behind an occluder shows up one frame late.
+*/
+#ifndef GPU_CULLER_H
+#define GPU_CULLER_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include "computeShader.h"
+#include "frameContext.h"
+#include "frameTimer.h"
+#include "frustumCuller.h"
+#include "profiler.h"
+#include "shader.h"
+
+/**
+ * one instance as the shaders see it (std430, see common/instances.glsl)
+*/
+struct GpuInstance{
+    glm::mat4 model;
+    glm::vec4 sphere;           //world space bounding sphere, w is the radius
+    uint32_t batch;
+    uint32_t pad[3];
+};
+static_assert(sizeof(GpuInstance) == 96, "GpuInstance must match the std430 layout of Instance");
+
+/**
+ * per frame GPU culling counters
+*/
+struct GpuCullStats{
+    size_t instances = 0;
+    size_t batches = 0;
+    size_t drawn = 0;           //instances that passed culling, read back GpuCuller::READBACK_LATENCY frames late
+    double cpuMs = 0.0;         //CPU time of cull(), uploads included
+
+    void print(const char *name) const{
+        printf("%s: %zu instances in %zu batches, %zu drawn, %.3f ms cpu\n", name, instances, batches, drawn, cpuMs);
+    }
+};
+
+class GpuCuller{
+    public:
+        static constexpr int READBACK_LATENCY = 4;      //frames between culling and reading back its counters
+        static constexpr unsigned int INSTANCE_ATTRIBUTE = 3;   //vertex attribute the instance index is read from
+
+        bool occlusion = true;      //also test against the previous frame's depth
+        GpuCullStats stats;
+        FrameContexts *frames = NULL;   //instances and batches are uploaded into the frame's transient buffer, NULL rewrites one buffer each
+
+        /**
+         * @return true if the current context can cull on the GPU
+        */
+        static bool supported(){
+            return computeSupported();
+        }
+
+        /**
+         * builds the compute shaders and creates the buffers
+         * @param shaderDir directory holding GpuCull.glsl and HiZDownsample.glsl
+         * @param drawShader program the culled instances are drawn with, reading the model
+         *        matrix from the instance buffer (see IndirectVertexShader.glsl)
+         * @return false if a shader failed to build
+         * pre: supported()
+        */
+        bool init(const std::string &shaderDir, Shader *drawShader){
+            shader = drawShader;
+            cullShader = ComputeShader(shaderDir + "/GpuCull.glsl");
+            hiZShader = ComputeShader(shaderDir + "/HiZDownsample.glsl");
+            glGenBuffers(1, &instanceBuffer);
+            glGenBuffers(1, &batchBuffer);
+            glGenBuffers(1, &commandBuffer);
+            glGenBuffers(1, &countBuffer);
+            glGenBuffers(1, &instanceIdBuffer);
+            glGenBuffers(READBACK_LATENCY, readbackBuffers);
+            indirectCount = GLAD_GL_VERSION_4_6;
+            return cullShader.ok() && hiZShader.ok();
+        }
+
+        /**
+         * adds the per instance index attribute the draw shader reads to a VAO
+         * @param vao the vertex array of a mesh drawn through this culler
+         * post: attribute INSTANCE_ATTRIBUTE advances once per instance. the VAO is unbound
+        */
+        void attachInstanceIds(unsigned int vao){
+            glBindVertexArray(vao);
+            glBindBuffer(GL_ARRAY_BUFFER, instanceIdBuffer);
+            glEnableVertexAttribArray(INSTANCE_ATTRIBUTE);
+            glVertexAttribIPointer(INSTANCE_ATTRIBUTE, 1, GL_UNSIGNED_INT, sizeof(uint32_t), (void*)0);
+            glVertexAttribDivisor(INSTANCE_ATTRIBUTE, 1);
+            glBindVertexArray(0);
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+        }
+
+        /**
+         * @param vao vertex array given to attachInstanceIds()
+         * @param indexCount indices per draw, starting at the first index of the element buffer
+         * @param texture GL_TEXTURE_2D bound to unit 0
+         * @param opacity opacity uniform of the draws
+         * @return id of the batch for addInstance()
+        */
+        uint32_t addBatch(unsigned int vao, int indexCount, unsigned int texture, float opacity){
+            batches.push_back({vao, texture, opacity, 0});
+            batchData.push_back({(uint32_t)indexCount, 0, 0, 0});
+            return (uint32_t)batches.size() - 1;
+        }
+
+        /**
+         * pre: none
+         * post: no instances are culled or drawn until added again, batches are kept
+        */
+        void clearInstances(){
+            instances.clear();
+            for(Batch &batch : batches)
+                batch.capacity = 0;
+        }
+
+        /**
+         * @param batch id returned by addBatch()
+         * @param model model matrix of the instance
+         * @param center world space center of its bounding sphere
+         * @param radius radius of its bounding sphere
+        */
+        void addInstance(uint32_t batch, const glm::mat4 &model, const glm::vec3 &center, float radius){
+            GpuInstance instance;
+            instance.model = model;
+            instance.sphere = glm::vec4(center, radius);
+            instance.batch = batch;
+            instance.pad[0] = instance.pad[1] = instance.pad[2] = 0;
+            instances.push_back(instance);
+            batches[batch].capacity++;
+        }
+
+        /**
+         * uploads the instances and culls them on the GPU
+         * @param viewProjection projection * view of the camera
+         * pre: init() succeeded
+         * post: the commands for draw() are being generated on the GPU
+        */
+        void cull(const glm::mat4 &viewProjection){
+            PROFILE_ZONE("gpu culling");
+            PROFILE_GPU_ZONE("gpu culling");
+            double start = nowSeconds();
+            readCounts();
+            uint32_t count = (uint32_t)instances.size();
+            if(count > instanceIds){
+                std::vector<uint32_t> ids(count);
+                for(uint32_t i = 0; i < count; i++)
+                    ids[i] = i;
+                glBindBuffer(GL_ARRAY_BUFFER, instanceIdBuffer);
+                glBufferData(GL_ARRAY_BUFFER, ids.size() * sizeof(uint32_t), ids.data(), GL_STATIC_DRAW);
+                glBindBuffer(GL_ARRAY_BUFFER, 0);
+                instanceIds = count;
+            }
+            //every batch gets as many command slots as it has instances
+            uint32_t offset = 0;
+            for(size_t b = 0; b < batches.size(); b++){
+                batchData[b].commandOffset = offset;
+                offset += batches[b].capacity;
+            }
+            size_t instanceBytes = instances.size() * sizeof(GpuInstance), batchBytes = batchData.size() * sizeof(BatchData);
+            if(frames != NULL && instanceBytes > 0 && batchBytes > 0){
+                //ranges no frame in flight reads, so the upload doesn't wait for last frame's culling and draws
+                instanceRange = frames->upload(instances.data(), instanceBytes, frames->storageAlignment);
+                batchRange = frames->upload(batchData.data(), batchBytes, frames->storageAlignment);
+            } else{
+                upload(instanceBuffer, instanceCapacity, instances.data(), instanceBytes);
+                upload(batchBuffer, batchCapacity, batchData.data(), batchBytes);
+                instanceRange = batchRange = TransientAllocation();
+            }
+            reserve(commandBuffer, commandCapacity, (size_t)count * sizeof(DrawCommand));
+            reserve(countBuffer, countCapacity, batches.size() * sizeof(uint32_t));
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, countBuffer);
+            glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, NULL);
+            if(!indirectCount){
+                glBindBuffer(GL_SHADER_STORAGE_BUFFER, commandBuffer);
+                glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, NULL);
+            }
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+            if(count > 0){
+                bindStorage(0, instanceRange, instanceBuffer);
+                bindStorage(1, batchRange, batchBuffer);
+                glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, commandBuffer);
+                glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, countBuffer);
+                Frustum frustum(viewProjection);
+                cullShader.use();
+                glUniform1ui(cullShader.getUniformLocation("instanceCount"), count);
+                glUniform4fv(cullShader.getUniformLocation("frustumPlanes"), 6, glm::value_ptr(frustum.planes[0]));
+                bool testDepth = occlusion && hiZTexture != 0;
+                glUniform1i(cullShader.getUniformLocation("occlusion"), testDepth);
+                if(testDepth){
+                    glActiveTexture(GL_TEXTURE0);
+                    glBindTexture(GL_TEXTURE_2D, hiZTexture);
+                    glUniform1i(cullShader.getUniformLocation("hiZ"), 0);
+                    glUniform1i(cullShader.getUniformLocation("hiZLevels"), hiZLevels);
+                    glUniformMatrix4fv(cullShader.getUniformLocation("previousViewProjection"), 1, GL_FALSE, glm::value_ptr(previousViewProjection));
+                }
+                ComputeShader::dispatch1D(count, CULL_GROUP_SIZE);
+                glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+            }
+
+            //keep this frame's counters for readCounts() a few frames from now
+            int slot = frameIndex % READBACK_LATENCY;
+            glBindBuffer(GL_COPY_READ_BUFFER, countBuffer);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, readbackBuffers[slot]);
+            if(readbackSizes[slot] < batches.size())
+                glBufferData(GL_COPY_WRITE_BUFFER, batches.size() * sizeof(uint32_t), NULL, GL_STREAM_READ);
+            if(!batches.empty())
+                glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, batches.size() * sizeof(uint32_t));
+            readbackSizes[slot] = std::max(readbackSizes[slot], batches.size());
+            readbackBatches[slot] = batches.size();
+            glBindBuffer(GL_COPY_READ_BUFFER, 0);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+            frameIndex++;
+
+            stats.instances = count;
+            stats.batches = batches.size();
+            stats.cpuMs = (nowSeconds() - start) * 1000.0;
+        }
+
+        /**
+         * draws the instances that passed cull(), one multi-draw per batch
+         * pre: cull() ran this frame and the camera is latched, see cameraUniforms.h
+         * post: the VAO, program and indirect buffer bindings are reset
+        */
+        void draw(){
+            if(instances.empty())
+                return;
+            PROFILE_GPU_ZONE("gpu culled draws");
+            shader->use();
+            shader->setFloatUniform("scale", 1.0f);
+            bindStorage(0, instanceRange, instanceBuffer);
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+            if(indirectCount)
+                glBindBuffer(GL_PARAMETER_BUFFER, countBuffer);
+            glActiveTexture(GL_TEXTURE0);
+            for(size_t b = 0; b < batches.size(); b++){
+                const Batch &batch = batches[b];
+                if(batch.capacity == 0)
+                    continue;
+                glBindTexture(GL_TEXTURE_2D, batch.texture);
+                shader->setFloatUniform("opacity", batch.opacity);
+                glBindVertexArray(batch.vao);
+                void *commands = (void*)(batchData[b].commandOffset * sizeof(DrawCommand));
+                if(indirectCount)
+                    glMultiDrawElementsIndirectCount(GL_TRIANGLES, GL_UNSIGNED_INT, commands, (GLintptr)(b * sizeof(uint32_t)), batch.capacity, 0);
+                else
+                    glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, commands, batch.capacity, 0);
+            }
+            glBindVertexArray(0);
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+            if(indirectCount)
+                glBindBuffer(GL_PARAMETER_BUFFER, 0);
+        }
+
+        /**
+         * copies the depth of the frame just drawn and builds next frame's depth pyramid from it
+         * @param width width of the bound draw framebuffer
+         * @param height height of the bound draw framebuffer
+         * @param viewProjection projection * view the frame was drawn with, after any late latch
+         * pre: the frame's opaque geometry is drawn and nothing translucent yet, the framebuffer has a 24 bit depth, 8 bit stencil buffer
+         * post: the next cull() tests against it. the draw framebuffer binding is kept
+        */
+        void captureDepth(int width, int height, const glm::mat4 &viewProjection){
+            PROFILE_ZONE("hi-z build");
+            PROFILE_GPU_ZONE("hi-z build");
+            int target = 0;
+            glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &target);
+            if(width != depthWidth || height != depthHeight)
+                createDepthTargets(width, height);
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, target);
+            glBindFramebuffer(GL_DRAW_FRAMEBUFFER, depthFramebuffer);
+            glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+            glBindFramebuffer(GL_FRAMEBUFFER, target);
+
+            hiZShader.use();
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_2D, depthTexture);
+            glUniform1i(hiZShader.getUniformLocation("depth"), 0);
+            for(int level = 0; level < hiZLevels; level++){
+                glUniform1i(hiZShader.getUniformLocation("copyDepth"), level == 0);
+                if(level > 0)
+                    glBindImageTexture(0, hiZTexture, level - 1, GL_FALSE, 0, GL_READ_ONLY, GL_R32F);
+                glBindImageTexture(1, hiZTexture, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+                int levelWidth = std::max(1, width >> level), levelHeight = std::max(1, height >> level);
+                glDispatchCompute((levelWidth + 7) / 8, (levelHeight + 7) / 8, 1);
+                glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
+            }
+            glBindImageTexture(0, 0, 0, GL_FALSE, 0, GL_READ_ONLY, GL_R32F);
+            glBindImageTexture(1, 0, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+            glBindTexture(GL_TEXTURE_2D, 0);
+            previousViewProjection = viewProjection;
+        }
+
+        /**
+         * pre: the context init() ran on is current
+         * post: every GL object of the culler is deleted
+        */
+        void destroy(){
+            cullShader.destroy();
+            hiZShader.destroy();
+            unsigned int buffers[] = {instanceBuffer, batchBuffer, commandBuffer, countBuffer, instanceIdBuffer};
+            glDeleteBuffers(5, buffers);
+            glDeleteBuffers(READBACK_LATENCY, readbackBuffers);
+            destroyDepthTargets();
+        }
+
+    private:
+        static constexpr unsigned int CULL_GROUP_SIZE = 64;     //local_size_x of GpuCull.glsl
+
+        struct Batch{
+            unsigned int vao;
+            unsigned int texture;
+            float opacity;
+            uint32_t capacity;      //instances in the batch this frame
+        };
+
+        //as GpuCull.glsl reads them
+        struct BatchData{
+            uint32_t indexCount;
+            uint32_t firstIndex;
+            int32_t baseVertex;
+            uint32_t commandOffset;
+        };
+
+        struct DrawCommand{
+            uint32_t count;
+            uint32_t instanceCount;
+            uint32_t firstIndex;
+            int32_t baseVertex;
+            uint32_t baseInstance;
+        };
+
+        Shader *shader = NULL;
+        ComputeShader cullShader;
+        ComputeShader hiZShader;
+        bool indirectCount = false;     //glMultiDrawElementsIndirectCount is available
+        std::vector<GpuInstance> instances;
+        std::vector<Batch> batches;
+        std::vector<BatchData> batchData;
+
+        unsigned int instanceBuffer = 0, batchBuffer = 0, commandBuffer = 0, countBuffer = 0, instanceIdBuffer = 0;
+        size_t instanceCapacity = 0, batchCapacity = 0, commandCapacity = 0, countCapacity = 0;    //bytes allocated
+        uint32_t instanceIds = 0;       //entries of instanceIdBuffer
+        TransientAllocation instanceRange, batchRange;     //this frame's uploads, empty when they went to the buffers above
+
+        unsigned int readbackBuffers[READBACK_LATENCY] = {};
+        size_t readbackSizes[READBACK_LATENCY] = {};        //batches each readback buffer has room for
+        size_t readbackBatches[READBACK_LATENCY] = {};      //batches copied into it, 0 if unused
+        unsigned long long frameIndex = 0;
+
+        unsigned int depthTexture = 0, depthFramebuffer = 0, hiZTexture = 0;
+        int depthWidth = 0, depthHeight = 0, hiZLevels = 0;
+        glm::mat4 previousViewProjection{1.0f};
+
+        /**
+         * makes sure buffer holds at least size bytes, growing it by half again when it doesn't
+        */
+        static void reserve(unsigned int buffer, size_t &capacity, size_t size){
+            if(size <= capacity && capacity > 0)
+                return;
+            capacity = std::max<size_t>(size + size / 2, 64);
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+            glBufferData(GL_SHADER_STORAGE_BUFFER, capacity, NULL, GL_DYNAMIC_DRAW);
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        }
+
+        /**
+         * binds a transient range if there is one, otherwise the whole of buffer
+        */
+        static void bindStorage(unsigned int binding, const TransientAllocation &range, unsigned int buffer){
+            if(range.buffer != 0)
+                glBindBufferRange(GL_SHADER_STORAGE_BUFFER, binding, range.buffer, range.offset, range.size);
+            else
+                glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, buffer);
+        }
+
+        static void upload(unsigned int buffer, size_t &capacity, const void *data, size_t size){
+            reserve(buffer, capacity, size);
+            if(size == 0)
+                return;
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+            glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, size, data);
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        }
+
+        /**
+         * sums the counters copied READBACK_LATENCY frames ago into stats.drawn
+        */
+        void readCounts(){
+            int slot = frameIndex % READBACK_LATENCY;
+            if(readbackBatches[slot] == 0)
+                return;
+            std::vector<uint32_t> counts(readbackBatches[slot]);
+            glBindBuffer(GL_COPY_READ_BUFFER, readbackBuffers[slot]);
+            glGetBufferSubData(GL_COPY_READ_BUFFER, 0, counts.size() * sizeof(uint32_t), counts.data());
+            glBindBuffer(GL_COPY_READ_BUFFER, 0);
+            stats.drawn = 0;
+            for(uint32_t count : counts)
+                stats.drawn += count;
+        }
+
+        void createDepthTargets(int width, int height){
+            destroyDepthTargets();
+            depthWidth = width;
+            depthHeight = height;
+            glGenTextures(1, &depthTexture);
+            glBindTexture(GL_TEXTURE_2D, depthTexture);
+            glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH24_STENCIL8, width, height);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            glGenFramebuffers(1, &depthFramebuffer);
+            glBindFramebuffer(GL_DRAW_FRAMEBUFFER, depthFramebuffer);
+            glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, depthTexture, 0);
+            glDrawBuffer(GL_NONE);
+            GLenum status = glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER);
+            if(status != GL_FRAMEBUFFER_COMPLETE)
+                printf("\nERROR: depth capture framebuffer %dx%d incomplete (0x%x)\n", width, height, status);
+
+            hiZLevels = 1;
+            while(std::max(width, height) >> hiZLevels)
+                hiZLevels++;
+            glGenTextures(1, &hiZTexture);
+            glBindTexture(GL_TEXTURE_2D, hiZTexture);
+            glTexStorage2D(GL_TEXTURE_2D, hiZLevels, GL_R32F, width, height);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            glBindTexture(GL_TEXTURE_2D, 0);
+        }
+
+        void destroyDepthTargets(){
+            if(depthFramebuffer != 0)
+                glDeleteFramebuffers(1, &depthFramebuffer);
+            if(depthTexture != 0)
+                glDeleteTextures(1, &depthTexture);
+            if(hiZTexture != 0)
+                glDeleteTextures(1, &hiZTexture);
+            depthFramebuffer = depthTexture = hiZTexture = 0;
+            depthWidth = depthHeight = hiZLevels = 0;
+        }
+};
+
+#endif
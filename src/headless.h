@@ -0,0 +1,144 @@
+/**
+ * Offscreen GL context for machines without a display.
+ *
+ * Built with USE_EGL (and linked against libEGL) the context comes from EGL on
+ * Mesa's surfaceless platform, or the default display with a pbuffer, so it
+ * works with llvmpipe and no display server at all. Otherwise an invisible
+ * GLFW window provides it, which still needs a display but never shows up.
+ * Either way rendering is meant to go to a framebuffer object.
+*/
+#ifndef HEADLESS_H
+#define HEADLESS_H
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#ifdef USE_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+//core context versions to try, newest first. 4.1 adds separable programs/pipelines, 4.3 compute shaders
+const int GL_CONTEXT_VERSIONS[][2] = {{4, 6}, {4, 5}, {4, 3}, {4, 1}, {3, 3}};
+
+class HeadlessContext{
+    public:
+        GLFWwindow *window = NULL;      //the invisible window, NULL when EGL is used
+
+        /**
+         * creates the newest core context available and makes it current
+         * @return false if no context could be created
+        */
+        bool create(){
+#ifdef USE_EGL
+            PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+                (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+            if(getPlatformDisplay != NULL)
+                display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+            if(display == EGL_NO_DISPLAY || !eglInitialize(display, NULL, NULL)){
+                display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+                if(display == EGL_NO_DISPLAY || !eglInitialize(display, NULL, NULL)){
+                    printf("HEADLESS: no EGL display\n");
+                    return false;
+                }
+            }
+            eglBindAPI(EGL_OPENGL_API);
+            const EGLint configAttribs[] = {
+                EGL_SURFACE_TYPE, EGL_PBUFFER_BIT, EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+                EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8, EGL_DEPTH_SIZE, 24, EGL_NONE,
+            };
+            EGLConfig config = NULL;
+            EGLint configCount = 0;
+            eglChooseConfig(display, configAttribs, &config, 1, &configCount);
+            for(const auto &version : GL_CONTEXT_VERSIONS){
+                const EGLint contextAttribs[] = {
+                    EGL_CONTEXT_MAJOR_VERSION, version[0], EGL_CONTEXT_MINOR_VERSION, version[1],
+                    EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT, EGL_NONE,
+                };
+                context = eglCreateContext(display, configCount > 0 ? config : NULL, EGL_NO_CONTEXT, contextAttribs);
+                if(context != EGL_NO_CONTEXT)
+                    break;
+            }
+            if(context == EGL_NO_CONTEXT){
+                printf("HEADLESS: failed to create an EGL context\n");
+                return false;
+            }
+            //without surfaceless support a tiny pbuffer stands in, rendering goes to an FBO anyway
+            const char *extensions = eglQueryString(display, EGL_EXTENSIONS);
+            if((extensions == NULL || strstr(extensions, "EGL_KHR_surfaceless_context") == NULL) && configCount > 0){
+                const EGLint pbufferAttribs[] = {EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE};
+                surface = eglCreatePbufferSurface(display, config, pbufferAttribs);
+            }
+            if(!eglMakeCurrent(display, surface, surface, context)){
+                printf("HEADLESS: failed to make the EGL context current\n");
+                return false;
+            }
+            return true;
+#else
+            glfwInit();
+            glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+            glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+            #ifdef __APPLE__
+            glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+            #endif
+            for(const auto &version : GL_CONTEXT_VERSIONS){
+                glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, version[0]);
+                glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, version[1]);
+                window = glfwCreateWindow(1, 1, "LearnOpenGL (headless)", NULL, NULL);
+                if(window != NULL)
+                    break;
+            }
+            if(window == NULL){
+                printf("HEADLESS: failed to create an invisible window\n");
+                glfwTerminate();
+                return false;
+            }
+            glfwMakeContextCurrent(window);
+            return true;
+#endif
+        }
+
+        /**
+         * @return the function glad should load GL entry points with
+        */
+        GLADloadproc loader() const{
+#ifdef USE_EGL
+            return (GLADloadproc)eglGetProcAddress;
+#else
+            return (GLADloadproc)glfwGetProcAddress;
+#endif
+        }
+
+        /**
+         * pre: none
+         * post: the context and whatever provided it are gone
+        */
+        void destroy(){
+#ifdef USE_EGL
+            if(display != EGL_NO_DISPLAY){
+                eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+                if(surface != EGL_NO_SURFACE)
+                    eglDestroySurface(display, surface);
+                if(context != EGL_NO_CONTEXT)
+                    eglDestroyContext(display, context);
+                eglTerminate(display);
+            }
+            display = EGL_NO_DISPLAY;
+#else
+            glfwTerminate();
+            window = NULL;
+#endif
+        }
+
+    private:
+#ifdef USE_EGL
+        EGLDisplay display = EGL_NO_DISPLAY;
+        EGLContext context = EGL_NO_CONTEXT;
+        EGLSurface surface = EGL_NO_SURFACE;
+#endif
+};
+
+#endif
@@ -0,0 +1,105 @@
+/**
+ * Input events stamped with the time they arrived. GLFW's key, mouse button,
+ * cursor and scroll callbacks push them while glfwPollEvents() dispatches
+ * them, and whoever applies input drains the queue. Unlike sampling
+ * glfwGetKey() once per frame, nothing pressed and released between two
+ * frames is lost, and the consumer knows when within the frame each event
+ * happened. The queue is a lock-free SpscQueue: the callbacks run on the main
+ * thread and the consumer may be the render thread (--render-thread).
+*/
+#ifndef INPUT_QUEUE_H
+#define INPUT_QUEUE_H
+
+#include <stdio.h>
+#include <atomic>
+
+#include "frameTimer.h"
+#include "spscQueue.h"
+
+enum InputEventType{
+    INPUT_KEY,              //code is a GLFW_KEY_*, action GLFW_PRESS, GLFW_RELEASE or GLFW_REPEAT
+    INPUT_MOUSE_BUTTON,     //code is a GLFW_MOUSE_BUTTON_*, action GLFW_PRESS or GLFW_RELEASE
+    INPUT_CURSOR,           //x, y: cursor position in screen coordinates, unaccelerated with raw mouse motion
+    INPUT_SCROLL            //x, y: scroll offsets
+};
+
+struct InputEvent{
+    InputEventType type = INPUT_KEY;
+    int code = 0;
+    int action = 0;
+    double x = 0.0;
+    double y = 0.0;
+    double time = 0.0;      //nowSeconds() the callback ran at
+};
+
+struct InputStats{
+    size_t events = 0;      //events consumed
+    size_t latched = 0;     //of those, consumed by the late latch right before the frame was culled
+    size_t dropped = 0;     //events lost to a full queue
+    SampleStats ageMs;      //how long events waited between their callback and being consumed
+
+    void print(const char *name) const{
+        printf("%s: %zu events, %zu late latched, age %.3f ms mean, %.3f ms max, %zu dropped\n",
+               name, events, latched, ageMs.mean(), ageMs.max, dropped);
+    }
+};
+
+class InputQueue{
+    public:
+        static constexpr size_t CAPACITY = 1024;
+
+        /**
+         * producer side, called from the GLFW callbacks
+         * post: the event is queued stamped with the current time, or counted as dropped if the queue is full
+        */
+        void push(InputEventType type, int code, int action, double x, double y){
+            InputEvent event;
+            event.type = type;
+            event.code = code;
+            event.action = action;
+            event.x = x;
+            event.y = y;
+            event.time = nowSeconds();
+            if(!events.push(event))
+                dropped.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        /**
+         * consumer side: hands every queued event to handle, oldest first
+         * @param handle called as handle(const InputEvent &)
+         * @param late true for the late latch, counted separately in the stats
+         * @return the number of events handled
+        */
+        template<typename Handler>
+        size_t drain(Handler &&handle, bool late = false){
+            InputEvent event;
+            size_t handled = 0;
+            while(events.pop(event)){
+                stats.ageMs.add((nowSeconds() - event.time) * 1000.0);
+                handle(event);
+                handled++;
+            }
+            stats.events += handled;
+            if(late)
+                stats.latched += handled;
+            return handled;
+        }
+
+        /**
+         * consumer side
+         * @return the stats since the last call
+        */
+        InputStats takeStats(){
+            InputStats taken = stats;
+            taken.dropped = dropped.exchange(0, std::memory_order_relaxed);
+            stats = InputStats();
+            return taken;
+        }
+
+    private:
+        SpscQueue<InputEvent> events{CAPACITY};
+        std::atomic<size_t> dropped{0};
+        InputStats stats;
+};
+
+#endif
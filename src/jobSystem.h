@@ -0,0 +1,164 @@
+/**
+ * Minimal thread pool for data parallel loops.
+ *
+ * parallelFor splits [0, count) into chunks that the calling thread and the
+ * worker threads claim from an atomic counter until none are left. Only one
+ * loop runs on the pool at a time; a loop started while another is running
+ * (or from inside a job) simply runs on the calling thread.
+*/
+#ifndef JOB_SYSTEM_H
+#define JOB_SYSTEM_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "profiler.h"
+
+class JobSystem{
+    public:
+        /**
+         * @return the process wide pool, with one worker per hardware thread besides the caller
+        */
+        static JobSystem &instance(){
+            static JobSystem pool(std::max(1u, std::thread::hardware_concurrency()) - 1);
+            return pool;
+        }
+
+        /**
+         * Constructor for a JobSystem
+         * @param workers number of worker threads to start (0 runs everything on the caller)
+        */
+        explicit JobSystem(unsigned int workers){
+            for(unsigned int i = 0; i < workers; i++)
+                threads.emplace_back(&JobSystem::workerLoop, this, i + 1);
+        }
+
+        ~JobSystem(){
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                quit = true;
+            }
+            wake.notify_all();
+            for(std::thread &thread : threads)
+                thread.join();
+        }
+
+        /**
+         * @return the number of threads a parallelFor runs on, including the caller
+        */
+        unsigned int threadCount() const{
+            return (unsigned int)threads.size() + 1;
+        }
+
+        /**
+         * @return index of the calling thread within its pool, 1..workers for workers
+         *         and 0 for any thread that isn't a worker (such as the one calling parallelFor)
+        */
+        static unsigned int threadIndex(){
+            return currentThread;
+        }
+
+        /**
+         * runs body over [0, count) split into chunks of at most chunkSize
+         * @param count number of items
+         * @param chunkSize number of items handed to body at once
+         * @param body called as body(begin, end) for every chunk, from any thread
+         * pre: body is safe to run concurrently on disjoint ranges
+         * post: every chunk has been processed when this returns
+        */
+        void parallelFor(size_t count, size_t chunkSize, const std::function<void(size_t, size_t)> &body){
+            if(count == 0)
+                return;
+            chunkSize = std::max<size_t>(chunkSize, 1);
+            size_t chunks = (count + chunkSize - 1) / chunkSize;
+            std::unique_lock<std::mutex> busy(loopMutex, std::try_to_lock);
+            if(threads.empty() || chunks == 1 || insideJob || !busy.owns_lock()){
+                body(0, count);
+                return;
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                job = &body;
+                jobCount = count;
+                jobChunk = chunkSize;
+                nextChunk = 0;
+                pendingChunks = chunks;
+                generation++;
+            }
+            wake.notify_all();
+            runChunks();
+            //wait for workers still finishing chunks, so none can touch the job after it's gone
+            std::unique_lock<std::mutex> lock(mutex);
+            done.wait(lock, [this]{ return pendingChunks == 0 && activeWorkers == 0; });
+            job = NULL;
+        }
+
+    private:
+        std::vector<std::thread> threads;
+        std::mutex loopMutex;                   //held for the duration of a parallelFor
+        std::mutex mutex;                       //guards the job description below
+        std::condition_variable wake;
+        std::condition_variable done;
+        bool quit = false;
+        unsigned long long generation = 0;
+        const std::function<void(size_t, size_t)> *job = NULL;
+        size_t jobCount = 0;
+        size_t jobChunk = 0;
+        std::atomic<size_t> nextChunk{0};
+        size_t pendingChunks = 0;
+        unsigned int activeWorkers = 0;         //workers currently inside runChunks
+
+        static inline thread_local bool insideJob = false;     //true while this thread runs a chunk
+        static inline thread_local unsigned int currentThread = 0;
+
+        /**
+         * claims and runs chunks of the current job until none are left
+        */
+        void runChunks(){
+            PROFILE_ZONE("job");
+            insideJob = true;
+            size_t finished = 0;
+            while(true){
+                size_t chunk = nextChunk.fetch_add(1);
+                size_t begin = chunk * jobChunk;
+                if(begin >= jobCount)
+                    break;
+                (*job)(begin, std::min(begin + jobChunk, jobCount));
+                finished++;
+            }
+            insideJob = false;
+            std::lock_guard<std::mutex> lock(mutex);
+            pendingChunks -= finished;
+            if(pendingChunks == 0)
+                done.notify_all();
+        }
+
+        void workerLoop(unsigned int index){
+            currentThread = index;
+            Profiler::instance().setThreadName("worker " + std::to_string(index));
+            unsigned long long seen = 0;
+            while(true){
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    wake.wait(lock, [&]{ return quit || (generation != seen && job != NULL); });
+                    if(quit)
+                        return;
+                    seen = generation;
+                    activeWorkers++;
+                }
+                runChunks();
+                std::lock_guard<std::mutex> lock(mutex);
+                activeWorkers--;
+                done.notify_all();
+            }
+        }
+};
+
+#endif
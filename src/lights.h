@@ -0,0 +1,75 @@
+/**
+ * Point lights of the lit renderers, and the layout the shaders read them in
+*/
+#ifndef LIGHTS_H
+#define LIGHTS_H
+
+#include <glm/glm.hpp>
+
+#include <stdint.h>
+#include <cmath>
+#include <vector>
+
+struct PointLight{
+    glm::vec3 position;     //world space
+    float radius;           //no light reaches past this distance
+    glm::vec3 color;
+    float intensity;
+};
+
+/**
+ * a light as common/lights.glsl declares it: view space, 32 bytes in std140 and std430
+*/
+struct GpuLight{
+    glm::vec4 positionRadius;
+    glm::vec4 colorIntensity;
+};
+
+static_assert(sizeof(GpuLight) == 32, "GpuLight must match PointLight in common/lights.glsl");
+
+/**
+ * @param count lights to make
+ * @param min corner of the box the lights are scattered in
+ * @param max opposite corner of the box
+ * @param minRadius smallest light radius
+ * @param maxRadius largest light radius
+ * @param seed the same seed gives the same lights
+ * @return lights at random positions in the box with random saturated colors
+*/
+inline std::vector<PointLight> scatterLights(size_t count, const glm::vec3 &min, const glm::vec3 &max,
+                                             float minRadius, float maxRadius, uint32_t seed = 1){
+    //xorshift32, so every platform scatters the same lights
+    uint32_t state = seed != 0 ? seed : 1;
+    auto random = [&state](){
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return (state >> 8) * (1.0f / 16777216.0f);
+    };
+    std::vector<PointLight> lights(count);
+    for(PointLight &light : lights){
+        light.position = min + (max - min) * glm::vec3(random(), random(), random());
+        light.radius = minRadius + (maxRadius - minRadius) * random();
+        //hue around the color wheel at full saturation
+        float hue = random() * 6.0f;
+        light.color = glm::clamp(glm::vec3(std::abs(hue - 3.0f) - 1.0f, 2.0f - std::abs(hue - 2.0f), 2.0f - std::abs(hue - 4.0f)),
+                                 glm::vec3(0.0f), glm::vec3(1.0f));
+        light.intensity = 1.0f;
+    }
+    return lights;
+}
+
+/**
+ * @param lights lights in world space
+ * @param view the camera's view matrix
+ * @param out resized to lights.size(), the lights in view space as the shaders read them
+*/
+inline void lightsToView(const std::vector<PointLight> &lights, const glm::mat4 &view, std::vector<GpuLight> &out){
+    out.resize(lights.size());
+    for(size_t i = 0; i < lights.size(); i++){
+        out[i].positionRadius = glm::vec4(glm::vec3(view * glm::vec4(lights[i].position, 1.0f)), lights[i].radius);
+        out[i].colorIntensity = glm::vec4(lights[i].color, lights[i].intensity);
+    }
+}
+
+#endif
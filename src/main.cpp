@@ -9,23 +9,63 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <thread>
 #include <vector>
 
 #include "stb_image.h"
 #include "shader.h"
+#include "shaderReloader.h"
 #include "VBO.h"
 #include "EBO.h"
 #include "VAO.h"
 #include "texture.h"
+#include "options.h"
+#include "frameTimer.h"
+#include "renderQueue.h"
+#include "scene.h"
+#include "benchmarks.h"
+#include "profiler.h"
+#include "headless.h"
+#include "FBO.h"
+#include "pngWriter.h"
+#include "benchmarkHarness.h"
+#include "depthPrepass.h"
+#include "deferredRenderer.h"
+#include "clusteredLighting.h"
+#include "shadowMaps.h"
+#include "dynamicResolution.h"
+#include "frameContext.h"
+#include "asyncReadback.h"
+#include "videoRecorder.h"
+#include "tripleBuffer.h"
+#include "simSnapshot.h"
+#include "inputQueue.h"
+#include "flyCamera.h"
+#include "cameraUniforms.h"
+#include "particleSystem.h"
 
 
-void framebuffer_size_callback(GLFWwindow* window, int width, int height);
+/**
+ * what the GLFW callbacks reach through the window user pointer
+*/
+struct WindowHandlers{
+    InputQueue *input = NULL;       //receives key, mouse and scroll events when the camera is flown
+};
+
+void key_callback(GLFWwindow *window, int key, int scancode, int action, int mods);
+void mouse_button_callback(GLFWwindow *window, int button, int action, int mods);
+void cursor_position_callback(GLFWwindow *window, double x, double y);
+void scroll_callback(GLFWwindow *window, double x, double y);
 void processInput(GLFWwindow *window);
 GLFWwindow *startupGLFW();
 
 
 const unsigned int SCR_WIDTH = 800;
 const unsigned int SCR_HEIGHT = 800;
+const int GRID_SIZE = 5;    //pyramids per side of the demo scene
 
 //vertex coordinates (pyramid)
 GLfloat vertices[] = {
@@ -47,24 +87,68 @@ const int drawOrder[] = {
 	3, 0, 4
 };
 
-int main()
+int main(int argc, char **argv)
 {
-    //initialize window
-    GLFWwindow* window = startupGLFW();
-    if(!window){
-        glfwTerminate();
+    AppOptions options;
+    if(!parseOptions(argc, argv, options))
         return -1;
+    //CPU only benchmarks don't need a window
+    if(options.benchTransforms > 0){
+        runTransformBenchmark(options.benchTransforms);
+        return 0;
+    }
+    if(options.benchEntities){
+        runEntityBenchmark();
+        return 0;
+    }
+    if(options.benchCulling > 0){
+        runCullingBenchmark(options.benchCulling);
+        return 0;
+    }
+    if(options.benchOcclusion > 0){
+        runOcclusionBenchmark(options.benchOcclusion);
+        return 0;
+    }
+
+    //initialize window, or an offscreen context when running headless
+    GLFWwindow* window = NULL;
+    HeadlessContext headless;
+    GLADloadproc loader = (GLADloadproc)glfwGetProcAddress;
+    if(options.headless){
+        if(!headless.create())
+            return -1;
+        window = headless.window;
+        loader = headless.loader();
+    } else{
+        window = startupGLFW();
+        if(!window){
+            glfwTerminate();
+            return -1;
+        }
     }
     // glad: load all OpenGL function pointers
-    if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
+    if (!gladLoadGLLoader(loader))
     {
         printf("Failed to load all OpenGL function pointers\n");
-        glfwTerminate();
+        if(options.headless)
+            headless.destroy();
+        else
+            glfwTerminate();
         return -1;
     }    
+    //profiling starts here with --trace so loading shows up too, otherwise F12 toggles it
+    Profiler &profiler = Profiler::instance();
+    profiler.setThreadName("main");
+    profiler.initGpu();
+    if(options.tracePath)
+        profiler.startCapture();
+    bool traceKeyDown = false;
 
     //get shader program from path specified
     Shader myShader("../resources/shaders/VertexShader.glsl", "../resources/shaders/FragmentShader.glsl");
+    //recompile the shader in the background whenever its files are saved
+    ShaderReloader shaderReloader(window, "../resources/shaders");
+    shaderReloader.watch(myShader);
     
     VertArrObj vao1;
     vao1.bind();
@@ -78,8 +162,49 @@ int main()
     //unbind VAO/VBO/EBO to prevent accidental modification
     vao1.unbind();
     vbo1.unbind();
+
+    //positions alone, for depth only passes to fetch nothing else. shares the element buffer
+    std::vector<float> positions;
+    for(size_t v = 0; v < sizeof(vertices) / sizeof(GLfloat); v += 8)
+        positions.insert(positions.end(), vertices + v, vertices + v + 3);
+    VertArrObj positionVao;
+    positionVao.bind();
+    VertBufObj positionVbo(positions.data(), positions.size() * sizeof(float), GL_STATIC_DRAW);
+    ebo1.bind();
+    positionVao.linkAttrib(positionVbo, 0, 3, GL_FLOAT, 3 * sizeof(float), (void*) 0);
+    positionVao.unbind();
+    positionVbo.unbind();
     ebo1.unbind();
 
+    //GL benchmarks skip the render loop
+    bool benchmarkOnly = false;
+    if(options.benchPipelines > 0){
+        runPipelineBenchmark(options.benchPipelines, vao1, sizeof(drawOrder) / sizeof(int));
+        benchmarkOnly = true;
+    }
+    if(options.benchRecording > 0){
+        runRecordingBenchmark(options.benchRecording, myShader, vao1, sizeof(drawOrder) / sizeof(int));
+        benchmarkOnly = true;
+    }
+
+    //culled instances are drawn by a variant of the shader that reads its model matrix from the instance buffer
+    std::unique_ptr<Shader> indirectShader;
+    if((options.gpuCulling || options.benchGpuCulling > 0) && GpuCuller::supported()){
+        indirectShader.reset(new Shader("../resources/shaders/IndirectVertexShader.glsl", "../resources/shaders/FragmentShader.glsl"));
+        shaderReloader.watch(*indirectShader);
+    }
+    if(options.benchGpuCulling > 0){
+        if(indirectShader)
+            runGpuCullingBenchmark(options.benchGpuCulling, *indirectShader, vao1, sizeof(drawOrder) / sizeof(int));
+        else
+            printf("gpu culling benchmark: needs GL 4.3\n");
+        benchmarkOnly = true;
+    }
+    if(options.benchParticles > 0){
+        runParticleBenchmark(options.benchParticles);
+        benchmarkOnly = true;
+    }
+
     //initialize textures from given path
     Texture popCat( "../resources/textures/pop_cat.png", GL_TEXTURE_2D, GL_TEXTURE0, GL_RGBA, GL_UNSIGNED_BYTE);
 	popCat.texUnit(myShader, "tex0", 0);
@@ -87,84 +212,737 @@ int main()
     Texture brick( "../resources/textures/brick.png", GL_TEXTURE_2D, GL_TEXTURE0, GL_RGBA, GL_UNSIGNED_BYTE);
     brick.texUnit(myShader, "tex0", 0);
 
-    //rotation rate specification
-    float rotation = 0.0f;
-    double prevTime = glfwGetTime();
+    //simulation runs at a fixed 60Hz, rendering interpolates between the last two states
+    FixedTimestep simClock(1.0 / 60.0);
+    //headless and benchmark runs go as fast as they can
+    bool unlimited = options.headless || options.benchmark;
+    FrameLimiter limiter(unlimited ? 0.0 : options.targetFps);
+    FrameStats frameStats;
+    if(!options.headless)
+        glfwSwapInterval(options.vsync && !unlimited ? 1 : 0);
+
+    //rotation rate specification (degrees per simulation step)
+    const float rotationStep = 0.5f;
+    double prevFrame = nowSeconds();
+
+    //draws are queued each frame and submitted sorted by state
+    RenderQueue renderQueue(0.1f, 100.0f);
+    //with --prepass opaque queued draws are drawn depth only first, --overdraw counts fragments per pixel
+    DepthPrepass depthPrepass;
+    if(options.prepass != PREPASS_OFF || options.overdraw){
+        if(depthPrepass.init("../resources/shaders")){
+            shaderReloader.watch(*depthPrepass.depthShader);
+            depthPrepass.addPositionStream(vao1.ID, positionVao.ID);
+            depthPrepass.mode = (PrepassMode)options.prepass;
+            depthPrepass.countOverdraw = options.overdraw;
+            renderQueue.prepass = &depthPrepass;
+        } else{
+            printf("depth prepass shaders failed to build, drawing without it\n");
+        }
+    }
+
+    //point lights over the grid for the lit paths, they move with the simulation
+    std::vector<PointLight> lights;
+    std::vector<glm::vec3> lightOrigins;
+    if(options.deferred || options.clustered){
+        lights = scatterLights(std::max(options.lights, 0), glm::vec3(-3.5f, 0.1f, -6.0f), glm::vec3(3.5f, 1.5f, 1.0f), 0.4f, 1.2f);
+        for(const PointLight &light : lights)
+            lightOrigins.push_back(light.position);
+    }
+    //with --deferred opaque draws fill a G-buffer that a compute pass lights, tile by tile
+    DeferredRenderer deferred;
+    bool deferredShading = false;
+    if(options.deferred){
+        if(!DeferredRenderer::supported()){
+            printf("deferred shading needs GL 4.3, shading forward\n");
+        } else if(deferred.init("../resources/shaders")){
+            shaderReloader.watch(*deferred.geometryShader);
+            deferredShading = true;
+        } else{
+            printf("deferred shaders failed to build, shading forward\n");
+        }
+    }
+    //with --clustered forward draws are lit by the lights binned into their cluster,
+    //with --shadows by the sun too. both are variants of the forward shader
+    ClusteredLighting clustered;
+    std::vector<std::string> litDefines;
+    if(options.clustered)
+        litDefines.push_back("CLUSTERED_LIGHTING");
+    if(options.shadows){
+        std::vector<std::string> shadowDefines = ShadowMaps::shaderDefines();
+        litDefines.insert(litDefines.end(), shadowDefines.begin(), shadowDefines.end());
+    }
+    std::unique_ptr<Shader> litShader;
+    if(!litDefines.empty()){
+        litShader.reset(new Shader("../resources/shaders/VertexShader.glsl", "../resources/shaders/FragmentShader.glsl", litDefines));
+        if(litShader->programID != 0){
+            shaderReloader.watch(*litShader);
+            if(options.clustered)
+                clustered.init();
+        } else{
+            printf("lit forward shader failed to build, drawing unlit\n");
+            litShader.reset();
+        }
+    }
+    //opaque materials draw into the G-buffer when deferred, translucent ones are always forward
+    Shader *forwardShader = litShader ? litShader.get() : &myShader;
+    Shader *opaqueShader = deferredShading ? deferred.geometryShader.get() : forwardShader;
+
+    //scene: a grid of pyramids parented to one root node, alternating textures.
+    //the front row is translucent
+    Scene scene;
+    //pyramid spans [-0.5, 0.5] x [0, 0.8] x [-0.5, 0.5]
+    uint32_t pyramidMesh = scene.addMesh({vao1.ID, sizeof(drawOrder) / sizeof(int), glm::vec3(0.0f, 0.4f, 0.0f), 0.82f});
+    uint32_t gridMaterials[2][2] = {
+        {scene.addMaterial({opaqueShader, brick.ID, 1.0f}), scene.addMaterial({opaqueShader, popCat.ID, 1.0f})},
+        {scene.addMaterial({forwardShader, brick.ID, 0.6f}), scene.addMaterial({forwardShader, popCat.ID, 0.6f})},
+    };
+    //with --occlusion the opaque pyramids also hide what's behind them, using their own triangles
+    scene.occlusionCulling = options.occlusion;
+    std::vector<glm::vec3> pyramidPositions;
+    for(size_t v = 0; v < sizeof(vertices) / sizeof(GLfloat); v += 8)
+        pyramidPositions.push_back(glm::vec3(vertices[v], vertices[v + 1], vertices[v + 2]));
+    uint32_t pyramidOccluder = scene.occlusion.addMesh(pyramidPositions, std::vector<uint32_t>(drawOrder, drawOrder + sizeof(drawOrder) / sizeof(int)));
+    TransformHandle gridRoot = scene.transforms.create();
+    for(int z = 0; z < GRID_SIZE; z++){
+        for(int x = 0; x < GRID_SIZE; x++){
+            Entity pyramid = scene.spawn(gridRoot, glm::vec3((x - GRID_SIZE / 2) * 1.2f, 0.0f, -z * 1.2f), pyramidMesh, gridMaterials[z == 0][(x + z) % 2]);
+            if(z != 0)
+                scene.makeOccluder(pyramid, pyramidOccluder);
+            scene.makeShadowCaster(pyramid, false);
+        }
+    }
+
+    //with --shadows the sun shadows forward draws. the grid gets a ground to fall on and
+    //a ring of static towers around it, which only move in the cached far cascades
+    std::unique_ptr<VertArrObj> groundVao;
+    std::unique_ptr<VertBufObj> groundVbo;
+    std::unique_ptr<ElemBufObj> groundEbo;
+    if(options.shadows && litShader){
+        if(scene.shadows.init("../resources/shaders", options.shadowSize)){
+            scene.shadowCasting = true;
+            if(deferredShading)
+                printf("shadows only fall on forward draws, the deferred opaque ones stay unshadowed\n");
+        } else{
+            printf("shadow maps failed to initialize, drawing without shadows\n");
+        }
+    }
+    if(scene.shadowCasting){
+        GLfloat groundVertices[] = {
+            -20.0f, -0.01f,  20.0f,     1.0f, 1.0f, 1.0f,	 0.0f,  0.0f,
+             20.0f, -0.01f,  20.0f,     1.0f, 1.0f, 1.0f,	20.0f,  0.0f,
+             20.0f, -0.01f, -20.0f,     1.0f, 1.0f, 1.0f,	20.0f, 20.0f,
+            -20.0f, -0.01f, -20.0f,     1.0f, 1.0f, 1.0f,	 0.0f, 20.0f,
+        };
+        int groundOrder[] = {0, 1, 2, 0, 2, 3};
+        groundVao.reset(new VertArrObj());
+        groundVao->bind();
+        groundVbo.reset(new VertBufObj(groundVertices, sizeof(groundVertices), GL_STATIC_DRAW));
+        groundEbo.reset(new ElemBufObj(groundOrder, sizeof(groundOrder), GL_STATIC_DRAW));
+        groundVao->linkAttrib(*groundVbo, 0, 3, GL_FLOAT, 8 * sizeof(float), (void*) 0);
+        groundVao->linkAttrib(*groundVbo, 1, 3, GL_FLOAT, 8 * sizeof(float), (void*) (3 * sizeof(float)));
+        groundVao->linkAttrib(*groundVbo, 2, 2, GL_FLOAT, 8 * sizeof(float), (void*) (6 * sizeof(float)));
+        groundVao->unbind();
+        groundVbo->unbind();
+        groundEbo->unbind();
+        //the ground only receives: casting onto itself would just be acne
+        uint32_t groundMesh = scene.addMesh({groundVao->ID, 6, glm::vec3(0.0f), 28.3f});
+        scene.spawn(NO_PARENT, glm::vec3(0.0f, 0.0f, -2.4f), groundMesh, gridMaterials[0][1]);
+        for(int i = 0; i < 8; i++){
+            float angle = glm::radians(45.0f * i + 22.5f);
+            glm::vec3 position(9.0f * std::cos(angle), 0.0f, -2.4f + 9.0f * std::sin(angle));
+            Entity tower = scene.spawn(NO_PARENT, position, pyramidMesh, gridMaterials[0][i % 2]);
+            scene.transforms.setScale(scene.entities.get<Transform>(tower).node, glm::vec3(1.5f, 4.0f, 1.5f));
+            scene.makeShadowCaster(tower, true);
+        }
+    }
+
+    //with --gpu-culling the opaque pyramids are culled and drawn on the GPU
+    if(options.gpuCulling){
+        if(deferredShading)
+            printf("GPU culling draws forward, not combined with --deferred\n");
+        else if(!indirectShader)
+            printf("GPU culling needs GL 4.3, culling on the CPU\n");
+        else if(scene.gpuCuller.init("../resources/shaders", indirectShader.get())){
+            scene.gpuCuller.attachInstanceIds(vao1.ID);
+            if(scene.shadowCasting){
+                scene.gpuCuller.attachInstanceIds(groundVao->ID);
+                printf("shadows only fall on forward draws, the GPU culled opaque ones stay unshadowed\n");
+            }
+            scene.gpuCulling = true;
+        }
+    }
+
+    //headless frames are drawn into an offscreen framebuffer instead of a window
+    int renderWidth = options.headless ? options.width : SCR_WIDTH;
+    int renderHeight = options.headless ? options.height : SCR_HEIGHT;
+    std::unique_ptr<FrameBufObj> offscreen;
+    if(options.headless)
+        offscreen.reset(new FrameBufObj(renderWidth, renderHeight));
+    int frame = 0;
+    double runStart = nowSeconds();
+
+    //--record streams every frame into a video, dropping the ones the disk can't keep up with
+    VideoRecorder videoRecorder;
+    bool recording = false;
+    if(options.recordPath){
+        int fps = options.targetFps > 0.0 ? (int)lround(options.targetFps) : 60;
+        recording = videoRecorder.open(options.recordPath, fps);
+    }
+
+    //--dump and --record capture every frame, F2 one screenshot. pixels are read back a few
+    //frames late and written on a thread of their own, so capturing doesn't stall the frame
+    AsyncReadback readback;
+    bool readingBack = options.dumpDir != NULL || recording || !options.headless;
+    bool screenshotKeyDown = false;
+    std::atomic<int> screenshotFrame{-1};      //frame F2 was pressed on, while recording captures them all
+    if(readingBack){
+        std::string prefix = options.dumpDir ? std::string(options.dumpDir) + "/frame_" : std::string("screenshot_");
+        bool raw = options.dumpRaw;
+        bool everyImage = options.dumpDir != NULL || !recording;
+        readback.init([&videoRecorder, &screenshotFrame, recording, everyImage, prefix, raw](const CapturedFrame &captured){
+            if(recording)
+                videoRecorder.push(captured.rgba.data(), captured.width, captured.height, true);
+            if(!everyImage && captured.frame != screenshotFrame.load())
+                return;
+            char path[512];
+            snprintf(path, sizeof(path), "%s%05d.%s", prefix.c_str(), captured.frame, raw ? "rgba" : "png");
+            if(raw)
+                writeRaw(path, captured.width, captured.height, captured.rgba.data(), true);
+            else
+                writePng(path, captured.width, captured.height, captured.rgba.data(), true);
+        });
+    }
+
+    //with --dynamic-res the scene is drawn smaller while the GPU runs over budget, then upscaled
+    WindowHandlers windowHandlers;
+    if(!options.headless)
+        glfwSetWindowUserPointer(window, &windowHandlers);
+    DynamicResolution dynamicResolution;
+    bool dynamicScaling = false;
+    if(options.dynamicResolution){
+        dynamicResolution.minScale = std::min(options.minScale, options.maxScale);
+        dynamicResolution.maxScale = options.maxScale;
+        double frameMs = 1000.0 / (options.targetFps > 0.0 ? options.targetFps : 60.0);
+        dynamicResolution.budgetMs = options.gpuBudgetMs > 0.0 ? options.gpuBudgetMs : frameMs * 0.9;
+        if(!options.sharpen)
+            dynamicResolution.sharpness = 0.0f;
+        if(dynamicResolution.init("../resources/shaders")){
+            dynamicScaling = true;
+            shaderReloader.watch(*dynamicResolution.upscaleShader);
+            int outputWidth = renderWidth, outputHeight = renderHeight;
+            //windowed runs follow resizes at the start of each frame, see drawFrame
+            if(!options.headless)
+                glfwGetFramebufferSize(window, &outputWidth, &outputHeight);
+            dynamicResolution.resizeOutput(outputWidth, outputHeight);
+        } else{
+            printf("upscale shader failed to build, drawing at full resolution\n");
+        }
+    }
+
+    //per frame uploads and deletions are recycled only once the frame's fence signals, and
+    //the CPU waits on the fence of the frame framesInFlight frames back before starting one
+    FrameContexts frameContexts;
+    frameContexts.init(options.framesInFlight);
+    deferred.frames = &frameContexts;
+    scene.gpuCuller.frames = &frameContexts;
+    dynamicResolution.frames = &frameContexts;
+    //the view and projection every scene program reads, written late in the frame
+    CameraUniforms cameraUniforms;
+    cameraUniforms.init();
+
+    //with --particles a fountain sprays from the middle of the grid, simulated on the CPU or in compute shaders
+    ParticleSystem particles;
+    bool particleEffects = false;
+    unsigned long long particleSteps = 0;   //simulation steps the particles have taken
+    if(options.particles > 0){
+        ParticleBackend backend = options.gpuParticles ? PARTICLES_GPU : PARTICLES_CPU;
+        if(!ParticleSystem::supported(backend)){
+            printf("gpu particles need GL 4.3, simulating them on the cpu\n");
+            backend = PARTICLES_CPU;
+        }
+        if(particles.init("../resources/shaders", backend, options.particles)){
+            shaderReloader.watch(*particles.drawShader);
+            particles.frames = &frameContexts;
+            particles.emitter.position = glm::vec3(0.0f, 0.0f, -2.5f);
+            particles.emitter.velocity = glm::vec3(0.0f, 4.0f, 0.0f);
+            //the room runs out about when the first particles born reach the longest life
+            particles.emitter.rate = (float)options.particles / particles.emitter.maxLife;
+            particleEffects = true;
+        } else{
+            printf("particle system failed to start, no particles\n");
+            particles.destroy();
+        }
+    }
+
+    //windowed runs fly the camera with input events from the GLFW callbacks, applied at the
+    //start of a frame and again once its shadows are drawn, right before it is culled
+    FlyCamera camera(glm::vec3(0.0f, 2.5f, 4.0f), glm::vec3(0.0f, 0.0f, -2.0f));
+    InputQueue inputQueue;
+    bool flying = !options.headless && !options.benchmark;
+    if(flying){
+        windowHandlers.input = &inputQueue;
+        glfwSetKeyCallback(window, key_callback);
+        glfwSetMouseButtonCallback(window, mouse_button_callback);
+        glfwSetCursorPosCallback(window, cursor_position_callback);
+        glfwSetScrollCallback(window, scroll_callback);
+        //unaccelerated motion while the cursor is captured to look around
+        if(glfwRawMouseMotionSupported())
+            glfwSetInputMode(window, GLFW_RAW_MOUSE_MOTION, GLFW_TRUE);
+    }
+
+    //benchmark runs step time by a fixed amount per frame and fly the camera around the grid
+    BenchmarkRecorder recorder(options.warmup);
+    GpuFrameTimer gpuTimer;
+    CameraPath cameraPath;
+    cameraPath.keys = {
+        {0.0, glm::vec3(0.0f, 2.5f, 4.0f), glm::vec3(0.0f, 0.0f, -2.0f)},
+        {3.0, glm::vec3(6.0f, 1.5f, -2.4f), glm::vec3(0.0f, 0.0f, -2.4f)},
+        {6.0, glm::vec3(0.0f, 5.0f, -9.0f), glm::vec3(0.0f, 0.0f, -2.4f)},
+        {9.0, glm::vec3(-6.0f, 1.5f, -2.4f), glm::vec3(0.0f, 0.0f, -2.4f)},
+        {10.5, glm::vec3(-1.0f, 1.0f, -1.0f), glm::vec3(1.0f, 0.3f, -4.0f)},
+        {12.0, glm::vec3(0.0f, 2.5f, 4.0f), glm::vec3(0.0f, 0.0f, -2.0f)},
+    };
+    int exitCode = 0;
 
     //enable depth buffer
     glEnable(GL_DEPTH_TEST);
 
-    // glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);   //uncomment to draw in wireframe mode
-    //render loop
-    while (!glfwWindowShouldClose(window))
-    {
-        //process user input
-        processInput(window);
+    //the simulation state frames are drawn from, see simSnapshot.h. headless and benchmark
+    //runs stay on one thread so their frames repeat exactly
+    bool renderThreaded = options.renderThread && !options.headless && !options.benchmark;
+    SimSnapshot sim;
+    double lastPoll = nowSeconds();
+    //how evenly simulation steps are spaced in real time, and how old the input a frame
+    //was drawn from is when its swap returns
+    SampleStats stepIntervals, inputLatency;
+    double lastStepAt = nowSeconds();
+    auto stepSimulation = [&](double dueTime, double now){
+        sim.prevRotation = sim.rotation;
+        sim.rotation += rotationStep;
+        sim.stepCount++;
+        sim.stepTime = dueTime;
+        stepIntervals.add((now - lastStepAt) * 1000.0);
+        lastStepAt = now;
+    };
+    //what frames need from GLFW, which only hands it out on the main thread
+    auto sampleInput = [&](double polledAt){
+        sim.polledAt = polledAt;
+        sim.screenshotKey = glfwGetKey(window, GLFW_KEY_F2) == GLFW_PRESS;
+        sim.traceKey = glfwGetKey(window, GLFW_KEY_F12) == GLFW_PRESS;
+        glfwGetFramebufferSize(window, &sim.framebufferWidth, &sim.framebufferHeight);
+    };
+    auto printSimulation = [&](){
+        printf("simulation: %zu steps, %.2f ms apart, %.2f ms deviation, %.2f ms max\n",
+               stepIntervals.count, stepIntervals.mean(), stepIntervals.deviation(), stepIntervals.max);
+        stepIntervals.reset();
+    };
+
+    //the framebuffer size the viewport and dynamic resolution last followed
+    int appliedWidth = 0, appliedHeight = 0;
+    //draws and presents one frame, on the thread that owns the GL context
+    auto drawFrame = [&](const SimSnapshot &state, float alpha, double frameStart){
+        //resizes are applied here, between frames: events are also polled by the late latch in
+        //the middle of a frame and with --render-thread they arrive without the GL context
+        if(!options.headless && (state.framebufferWidth != appliedWidth || state.framebufferHeight != appliedHeight)){
+            appliedWidth = state.framebufferWidth;
+            appliedHeight = state.framebufferHeight;
+            glViewport(0, 0, appliedWidth, appliedHeight);
+            if(dynamicScaling)
+                dynamicResolution.resizeOutput(appliedWidth, appliedHeight);
+        }
+        //F12 starts a profiler capture, pressing it again writes it to trace.json
+        if(state.traceKey && !traceKeyDown){
+            if(profiler.capturing()){
+                profiler.stopCapture();
+                profiler.exportChromeTrace("trace.json");
+            } else{
+                profiler.startCapture();
+            }
+        }
+        traceKeyDown = state.traceKey;
+        //swap in any shaders that finished recompiling since last frame
+        shaderReloader.poll();
+        frameContexts.beginFrame();
 
+        if(options.benchmark)
+            gpuTimer.begin(frame, recorder);
+        if(offscreen)
+            offscreen->bind();
+        if(dynamicScaling)
+            dynamicResolution.begin();
         //specify background color
         glClearColor(0.2f, 0.3f, 0.3f, 1.0f);
         //clear color and depth buffers to prevent garbage from being drawnt o screen
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        if(depthPrepass.countOverdraw)
+            depthPrepass.beginOverdrawCount();
 
-        //tell OpenGL state machine to use previously initialized shader
-        myShader.use();
+        float renderRotation = glm::mix(state.prevRotation, state.rotation, alpha);
+
+        //fly the camera by the input that arrived since the last frame
+        if(flying){
+            inputQueue.drain([&](const InputEvent &event){ camera.handle(event); });
+            camera.moveTo(nowSeconds());
+        }
+        //view matrix: transforms world coordinates to view space (camera looks down at the grid until flown)
+        glm::mat4 view = camera.view();
+        if(options.benchmark)
+            view = cameraPath.view(frame * simClock.step);
+
+        //the size of what this frame draws into
+        int targetWidth = renderWidth, targetHeight = renderHeight;
+        if(!options.headless){
+            targetWidth = state.framebufferWidth;
+            targetHeight = state.framebufferHeight;
+        }
+        if(dynamicScaling){
+            targetWidth = dynamicResolution.renderWidth();
+            targetHeight = dynamicResolution.renderHeight();
+        }
+        //projection matrix: transforms view space into clip space. follows the target through
+        //resizes, a minimized window has no size and keeps a square one
+        float aspect = targetWidth > 0 && targetHeight > 0 ? (float)targetWidth / targetHeight : 1.0f;
+        glm::mat4 projection = camera.projection(aspect);
 
-        //increment rotation amount
-        double curTime = glfwGetTime();
-        if(curTime - prevTime >= 1.0f/60.0f){
-            rotation += 0.5f;
-            prevTime = curTime;
-        }
-
-        //initialize matrices to the identity matrix
-        glm::mat4 model = glm::mat4(1.0f);          //model matrix: transforms local coordinates to world coordinates
-        glm::mat4 view = glm::mat4(1.0f);           //view matrix: transforms world coordinates to view space
-        glm::mat4 projection = glm::mat4(1.0f);     //projection matrix: transforms view space into clip space
-
-        //rotate the object
-        model = glm::rotate(model, glm::radians(rotation), glm::vec3(0.0f, 1.0f, 0.0f));
-        //move camera away from world coordinate origin
-        view = glm::translate(view, glm::vec3(0.0f, -0.5f, -2.0f));
-        //get perspective
-                                        //45 degree FOV     //aspect ratio              //closest   //farthest
-        projection = glm::perspective(glm::radians(45.0f), ((float)SCR_WIDTH)/SCR_HEIGHT, 0.1f, 100.0f);
-
-        //send values in the matrices to the vertex shader
-        int modelLoc = glGetUniformLocation(myShader.programID, "model");
-        glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-        int viewLoc = glGetUniformLocation(myShader.programID, "view");
-        glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-        int projectionLoc = glGetUniformLocation(myShader.programID, "projection");
-        glUniformMatrix4fv(projectionLoc, 1, GL_FALSE, glm::value_ptr(projection));
-
-        
         //scale the vertices
+        myShader.use();
         myShader.setFloatUniform("scale", 1.0f);
-        //give it a texture
-        // popCat.bind();
-        brick.bind();
+        if(litShader){
+            litShader->use();
+            litShader->setFloatUniform("scale", 1.0f);
+        }
+
+        //spin every pyramid but the static ones, then rebuild the world matrices that changed
+        glm::quat spin = glm::angleAxis(glm::radians(renderRotation), glm::vec3(0.0f, 1.0f, 0.0f));
+        scene.entities.each<Transform, MeshRef>([&](Entity entity, Transform &transform, MeshRef &meshRef){
+            if(meshRef.mesh == pyramidMesh && !scene.isStatic(entity))
+                scene.transforms.setRotation(transform.node, spin);
+        });
+        scene.updateTransforms();
+        //shadows are drawn from the updated transforms before anything samples them
+        if(scene.shadowCasting)
+            scene.renderShadows(view, projection);
 
-        //bind VAO and draw
-        vao1.bind();
-        glDrawElements(GL_TRIANGLES, sizeof(drawOrder) / sizeof(int), GL_UNSIGNED_INT, 0);
+        //late latch: input that arrived while the shadows were drawn still moves the camera. the
+        //shadow cascades keep the view from the start of the frame, which is at most the frame's own
+        //motion behind. culling comes after, a frustum from before the latch could miss what it turned to
+        if(flying){
+            //a single thread only hears of new events by polling. the callbacks only queue events,
+            //resizes and cursor capture wait for the start of the next frame
+            if(!renderThreaded)
+                glfwPollEvents();
+            inputQueue.drain([&](const InputEvent &event){ camera.handle(event); }, true);
+            camera.moveTo(nowSeconds());
+            view = camera.view();
+            projection = camera.projection(aspect);
+        }
+        cameraUniforms.latch(view, projection, frameContexts.index());
+        //hide everything outside the view frustum
+        scene.cull(projection * view);
+        //queue a draw for every visible entity
+        scene.buildDraws(renderQueue, view);
+        if(scene.shadowCasting)
+            scene.shadows.apply(*litShader, view);
+        //opaque GPU culled entities go first so translucent ones blend over them
+        if(scene.gpuCulling){
+            scene.drawGpuCulled();
+            //next frame's GPU occlusion test uses this depth. translucent draws write depth
+            //too, so take it before them or they would hide what's behind them
+            scene.gpuCuller.captureDepth(targetWidth, targetHeight, projection * view);
+        }
+        //the lights bob on circles of their own, following the simulation so benchmarks repeat
+        for(size_t i = 0; i < lights.size(); i++){
+            float phase = glm::radians(renderRotation * 2.0f) + (float)i * 2.399f;
+            lights[i].position = lightOrigins[i] + glm::vec3(std::cos(phase), 0.0f, std::sin(phase)) * 0.5f;
+        }
+        if(litShader && options.clustered){
+            clustered.bin(lights, view, projection, targetWidth, targetHeight);
+            clustered.apply(*litShader);
+        }
+        //sort and draw everything queued this frame
+        if(deferredShading){
+            deferred.beginGeometry(targetWidth, targetHeight);
+            renderQueue.executeOpaque();
+            deferred.light(lights, view, projection);
+            renderQueue.executeTranslucent();
+        } else{
+            renderQueue.execute();
+        }
+        //particles step with the simulation, a few steps at most per frame so a hitch doesn't snowball
+        if(particleEffects){
+            particleSteps = std::max(particleSteps, state.stepCount > 4 ? state.stepCount - 4 : 0);
+            for(; particleSteps < state.stepCount; particleSteps++)
+                particles.update((float)simClock.step);
+            particles.draw();
+        }
+        if(depthPrepass.countOverdraw)
+            depthPrepass.endOverdrawCount(targetWidth, targetHeight);
+        if(dynamicScaling)
+            dynamicResolution.end(offscreen ? offscreen->ID : 0);
+        if(options.benchmark){
+            gpuTimer.end();
+            FrameSample &sample = recorder.sample(frame);
+            sample.cpuMs = (nowSeconds() - frameStart) * 1000.0;
+            sample.draws = renderQueue.stats.draws;
+            sample.triangles = (double)renderQueue.stats.triangles;
+            sample.stateChanges = renderQueue.stats.sorted.total();
+            sample.uploadBytes = (double)renderQueue.stats.uploadBytes;
+            sample.fenceWaitMs = frameContexts.stats.fenceWaitMs;
+            gpuTimer.collect(recorder);
+        }
 
  
-        // glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
+        //queue the finished frame's readback before the swap, while it is still in the back buffer
+        bool screenshot = state.screenshotKey && !screenshotKeyDown;
+        if(screenshot)
+            screenshotFrame = frame;
+        if(options.dumpDir || recording || screenshot){
+            int captureWidth = renderWidth, captureHeight = renderHeight;
+            if(!options.headless){
+                captureWidth = state.framebufferWidth;
+                captureHeight = state.framebufferHeight;
+            }
+            readback.capture(offscreen ? offscreen->ID : 0, captureWidth, captureHeight, frame);
+        }
+        screenshotKeyDown = state.screenshotKey;
+        frameContexts.endFrame();
+ 
+        // glfw: swap buffers
         // -------------------------------------------------------------------------------
-        glfwSwapBuffers(window);
-        glfwPollEvents();
+        if(options.headless){
+            //nothing swaps, so hand the frame to the driver like a swap would
+            glFlush();
+        } else{
+            {
+                PROFILE_ZONE("swap buffers");
+                glfwSwapBuffers(window);
+            }
+            inputLatency.add((nowSeconds() - state.polledAt) * 1000.0);
+        }
+        //hand the readbacks that landed to the writer
+        if(readingBack)
+            readback.poll();
+        frame++;
+    };
+
+    //timing once a second, and with --stats everything else. true when title was filled in
+    auto reportFrame = [&](int steps, WindowTitle &title){
+        if(!frameStats.addFrame(steps))
+            return false;
+        snprintf(title.text, sizeof(title.text), "LearnOpenGL | %.2f ms | %.0f%% cpu", frameStats.frameMs, frameStats.cpuPercent);
+        if(options.printStats)
+            frameStats.print();
+        //--input-stats reports how old input is when it is used, without the rest of --stats
+        if(!options.headless && (options.printStats || options.inputStats)){
+            printf("input latency: %.2f ms mean, %.2f ms max (event poll to swap)\n", inputLatency.mean(), inputLatency.max);
+            inputLatency.reset();
+            if(flying)
+                inputQueue.takeStats().print("input events");
+        }
+        if(options.printStats){
+            //with a render thread the main thread reports the simulation
+            if(!renderThreaded)
+                printSimulation();
+            renderQueue.printStats();
+            scene.culler.stats.print("culling");
+            if(scene.occlusionCulling)
+                scene.occlusion.stats.print("occlusion");
+            if(scene.gpuCulling)
+                scene.gpuCuller.stats.print("gpu culling");
+            if(renderQueue.prepass != NULL)
+                depthPrepass.stats.print("depth prepass");
+            if(deferredShading)
+                deferred.stats.print("deferred");
+            if(litShader && options.clustered)
+                clustered.stats.print("clustered");
+            if(scene.shadowCasting)
+                scene.shadows.stats.print("shadows", ShadowMaps::FIRST_CACHED);
+            if(dynamicScaling)
+                dynamicResolution.stats.print("dynamic resolution");
+            if(particleEffects)
+                particles.stats.print("particles");
+            frameContexts.stats.print("frames in flight");
+            if(readingBack && readback.stats.captured > 0)
+                readback.stats.print("readback");
+            if(recording)
+                videoRecorder.snapshot().print("recorder");
+        }
+        return true;
+    };
+
+    // glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);   //uncomment to draw in wireframe mode
+    //render loop
+    if(!options.headless)
+        sampleInput(lastPoll);
+    while (!benchmarkOnly && !renderThreaded && (options.headless || options.benchmark ? frame < options.frames : !glfwWindowShouldClose(window)))
+    {
+        double frameStart = nowSeconds();
+        profiler.newFrame();
+        PROFILE_ZONE("frame");
+
+        //process user input
+        if(!options.headless){
+            processInput(window);
+            sampleInput(lastPoll);
+        }
+        //advance the simulation by however many fixed steps fit in the elapsed time
+        int steps = simClock.advance(options.benchmark ? simClock.step : frameStart - prevFrame);
+        prevFrame = frameStart;
+        for(int i = 0; i < steps; i++)
+            stepSimulation(frameStart, frameStart);
+        drawFrame(sim, simClock.alpha(), frameStart);
+
+        //poll IO events (keys pressed/released, mouse moved etc.) for the next frame
+        if(!options.headless){
+            glfwPollEvents();
+            lastPoll = nowSeconds();
+        }
+        //sleep off the rest of the frame instead of spinning, then report timing
+        limiter.wait(frameStart);
+        WindowTitle title;
+        if(reportFrame(steps, title) && !options.headless)
+            glfwSetWindowTitle(window, title.text);
     }
 
-    //deallocate resources
+    //with --render-thread the render thread owns the GL context and draws the newest snapshot,
+    //while this thread polls events and steps the simulation on a clock of its own
+    if(!benchmarkOnly && renderThreaded){
+        TripleBuffer<SimSnapshot> snapshots;
+        TripleBuffer<WindowTitle> titles;
+        std::atomic<bool> rendering{true};
+        double now = nowSeconds();
+        sampleInput(now);
+        sim.stepTime = now;
+        snapshots.write(sim);
+        glfwMakeContextCurrent(NULL);
+        std::thread renderer([&](){
+            profiler.setThreadName("render");
+            glfwMakeContextCurrent(window);
+            unsigned long long drawnSteps = 0;
+            while(rendering.load(std::memory_order_acquire)){
+                double frameStart = nowSeconds();
+                profiler.newFrame();
+                PROFILE_ZONE("frame");
+                snapshots.update();
+                const SimSnapshot &state = snapshots.front();
+                drawFrame(state, state.alphaAt(frameStart, simClock.step), frameStart);
+                int steps = (int)(state.stepCount - drawnSteps);
+                drawnSteps = state.stepCount;
+                limiter.wait(frameStart);
+                WindowTitle title;
+                if(reportFrame(steps, title))
+                    titles.write(title);
+            }
+            glfwMakeContextCurrent(NULL);
+        });
+
+        double nextStep = now + simClock.step;
+        double reportStart = now;
+        while(!glfwWindowShouldClose(window)){
+            //sleep until the next step is due or an event arrives
+            double wait = nextStep - nowSeconds();
+            if(wait > 0.0)
+                glfwWaitEventsTimeout(wait);
+            else
+                glfwPollEvents();
+            now = nowSeconds();
+            processInput(window);
+            sampleInput(now);
+            int steps = 0;
+            while(now >= nextStep && steps < simClock.maxSteps){
+                stepSimulation(nextStep, now);
+                nextStep += simClock.step;
+                steps++;
+            }
+            //too far behind to catch up: drop the backlog, like FixedTimestep does
+            if(now >= nextStep)
+                nextStep = now + simClock.step;
+            //every poll is published, so input reaches the next frame without waiting for a step
+            snapshots.write(sim);
+            if(titles.update())
+                glfwSetWindowTitle(window, titles.front().text);
+            if(options.printStats && now - reportStart >= 1.0){
+                printSimulation();
+                reportStart = now;
+            }
+        }
+        rendering = false;
+        renderer.join();
+        glfwMakeContextCurrent(window);
+    }
+
+    if(options.headless && !benchmarkOnly){
+        glFinish();
+        double seconds = nowSeconds() - runStart;
+        printf("headless: %d frames at %dx%d in %.3f s (%.3f ms/frame, %.1f fps)\n",
+               frame, renderWidth, renderHeight, seconds, seconds * 1000.0 / std::max(frame, 1), frame / seconds);
+    }
+
+    if(options.benchmark && !benchmarkOnly){
+        gpuTimer.finish(recorder);
+        recorder.printReport();
+        if(options.benchOut)
+            recorder.writeJson(options.benchOut, renderWidth, renderHeight);
+        if(options.baseline && !recorder.compareBaseline(options.baseline, options.thresholds))
+            exitCode = 1;
+    }
+
+    //deallocate resources, after the last captures are written
+    if(readingBack)
+        readback.destroy();
+    if(recording){
+        videoRecorder.close();
+        videoRecorder.snapshot().print("recorder");
+    }
+    shaderReloader.stop();
+    gpuTimer.destroy();
+    if(options.tracePath){
+        profiler.stopCapture();
+        profiler.exportChromeTrace(options.tracePath);
+    }
+    profiler.destroyGpu();
     vao1.destroy();
     vbo1.destroy();
     ebo1.destroy();
+    positionVao.destroy();
+    positionVbo.destroy();
     popCat.destroy();
+    brick.destroy();
     myShader.destroy();
+    if(indirectShader)
+        indirectShader->destroy();
+    if(scene.gpuCulling)
+        scene.gpuCuller.destroy();
+    depthPrepass.destroy();
+    if(deferredShading)
+        deferred.destroy();
+    if(litShader){
+        litShader->destroy();
+        if(options.clustered)
+            clustered.destroy();
+    }
+    if(scene.shadowCasting){
+        scene.shadows.destroy();
+        groundVao->destroy();
+        groundVbo->destroy();
+        groundEbo->destroy();
+    }
+    if(options.dynamicResolution)
+        dynamicResolution.destroy();
+    if(offscreen)
+        offscreen->destroy();
+    if(particleEffects)
+        particles.destroy();
+    cameraUniforms.destroy();
+    frameContexts.destroy();
 
     // glfw: terminate, clearing all previously allocated GLFW resources.
-    glfwTerminate();
-    return 0;
+    if(options.headless)
+        headless.destroy();
+    else
+        glfwTerminate();
+    return exitCode;
 }
 
 
@@ -174,15 +952,43 @@ void processInput(GLFWwindow *window)
 {
     if(glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
         glfwSetWindowShouldClose(window, 1);
+    //the cursor is captured while looking around with the fly camera, so it can't leave the window
+    WindowHandlers *handlers = (WindowHandlers*)glfwGetWindowUserPointer(window);
+    if(handlers != NULL && handlers->input != NULL){
+        int cursor = glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_RIGHT) == GLFW_PRESS ? GLFW_CURSOR_DISABLED : GLFW_CURSOR_NORMAL;
+        if(glfwGetInputMode(window, GLFW_CURSOR) != cursor)
+            glfwSetInputMode(window, GLFW_CURSOR, cursor);
+    }
 }
 
-// glfw: whenever the window size changed (by OS or user resize) this callback function executes
+// glfw: input callbacks queue timestamped events for the fly camera, see inputQueue.h
 // ---------------------------------------------------------------------------------------------
-void framebuffer_size_callback(GLFWwindow* window, int width, int height)
+void key_callback(GLFWwindow *window, int key, int /*scancode*/, int action, int /*mods*/)
+{
+    WindowHandlers *handlers = (WindowHandlers*)glfwGetWindowUserPointer(window);
+    if(handlers != NULL && handlers->input != NULL)
+        handlers->input->push(INPUT_KEY, key, action, 0.0, 0.0);
+}
+
+void mouse_button_callback(GLFWwindow *window, int button, int action, int /*mods*/)
 {
-    // make sure the viewport matches the new window dimensions; note that width and 
-    // height will be significantly larger than specified on retina displays.
-    glViewport(0, 0, width, height);
+    WindowHandlers *handlers = (WindowHandlers*)glfwGetWindowUserPointer(window);
+    if(handlers != NULL && handlers->input != NULL)
+        handlers->input->push(INPUT_MOUSE_BUTTON, button, action, 0.0, 0.0);
+}
+
+void cursor_position_callback(GLFWwindow *window, double x, double y)
+{
+    WindowHandlers *handlers = (WindowHandlers*)glfwGetWindowUserPointer(window);
+    if(handlers != NULL && handlers->input != NULL)
+        handlers->input->push(INPUT_CURSOR, 0, 0, x, y);
+}
+
+void scroll_callback(GLFWwindow *window, double x, double y)
+{
+    WindowHandlers *handlers = (WindowHandlers*)glfwGetWindowUserPointer(window);
+    if(handlers != NULL && handlers->input != NULL)
+        handlers->input->push(INPUT_SCROLL, 0, 0, x, y);
 }
 
 /**
@@ -192,10 +998,8 @@ void framebuffer_size_callback(GLFWwindow* window, int width, int height)
 */
 GLFWwindow *startupGLFW(){
 
-    // glfw: initialize to context version 3.3
+    // glfw: initialize to the newest core context available, 3.3 at minimum
     glfwInit();
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 
     #ifdef __APPLE__
@@ -204,7 +1008,14 @@ GLFWwindow *startupGLFW(){
     //-----------INTIIALIZE GLFW AND LOAD OPENGL FUNCTION POINTERS---------------------------------
 
     // glfw window creation
-    GLFWwindow* window = glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, "LearnOpenGL", NULL, NULL);
+    GLFWwindow* window = NULL;
+    for(const auto &version : GL_CONTEXT_VERSIONS){
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, version[0]);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, version[1]);
+        window = glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, "LearnOpenGL", NULL, NULL);
+        if(window != NULL)
+            break;
+    }
     if (window == NULL)
     {
         printf("Failed to init window\n");
@@ -212,7 +1023,6 @@ GLFWwindow *startupGLFW(){
         return NULL;
     }
     glfwMakeContextCurrent(window);
-    glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
     return window;
 
 }
\ No newline at end of file
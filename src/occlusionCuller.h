@@ -0,0 +1,549 @@
+/**
+ * Software occlusion culling against a hierarchical depth buffer.
+ *
+ * A small set of simplified occluder meshes is rasterized on the CPU into a
+ * low resolution depth buffer. The screen is split into tiles, triangles are
+ * binned into the tiles they touch and every tile is rasterized by its own job,
+ * evaluating the edge functions for 8 pixels at once with AVX2 (4 with SSE).
+ * A pyramid of min and max depth is then built on top, and the bounding box of
+ * each object is tested at the pyramid level where its screen rectangle covers
+ * about 2x2 texels, refining a few levels down when that doesn't decide it.
+ *
+ * Objects are only hidden when they are certainly behind the occluders at the
+ * depth buffer's resolution: boxes crossing the near plane count as visible, and
+ * boxes crossing the screen edges are tested on the part of their rectangle that
+ * is on screen. Occluder meshes must lie inside what they stand in for.
+*/
+#ifndef OCCLUSION_CULLER_H
+#define OCCLUSION_CULLER_H
+
+#include <glm/glm.hpp>
+
+#include <math.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+#include "frameTimer.h"
+#include "frustumCuller.h"
+#include "jobSystem.h"
+
+/**
+ * per frame occlusion culling counters
+*/
+struct OcclusionStats{
+    size_t occluders = 0;
+    size_t triangles = 0;       //occluder triangles that reached the rasterizer
+    size_t tested = 0;          //objects tested against the depth pyramid
+    size_t occluded = 0;
+    double rasterMs = 0.0;      //transforming, binning and rasterizing occluders
+    double pyramidMs = 0.0;
+    double testMs = 0.0;
+
+    void print(const char *name) const{
+        printf("%s: %zu occluders (%zu triangles), %zu tested, %zu occluded, raster %.3f ms, pyramid %.3f ms, test %.3f ms\n",
+               name, occluders, triangles, tested, occluded, rasterMs, pyramidMs, testMs);
+    }
+};
+
+class OcclusionCuller{
+    public:
+        static constexpr int TILE_WIDTH = 32;       //multiple of the SIMD width
+        static constexpr int TILE_HEIGHT = 16;
+
+        OcclusionStats stats;
+
+        /**
+         * Constructor for an OcclusionCuller
+         * @param width width of the depth buffer, rounded up to a power of two
+         * @param height height of the depth buffer, rounded up to a power of two
+        */
+        explicit OcclusionCuller(int width = 256, int height = 128){
+            bufferWidth = TILE_WIDTH;
+            while(bufferWidth < width)
+                bufferWidth *= 2;
+            bufferHeight = TILE_HEIGHT;
+            while(bufferHeight < height)
+                bufferHeight *= 2;
+            tilesX = bufferWidth / TILE_WIDTH;
+            tilesY = bufferHeight / TILE_HEIGHT;
+            bins.resize(tilesX * tilesY);
+            for(int w = bufferWidth, h = bufferHeight; ; w = std::max(1, w / 2), h = std::max(1, h / 2)){
+                levels.push_back({w, h, std::vector<float>(w * h, 1.0f), std::vector<float>(w * h, 1.0f)});
+                if(w == 1 && h == 1)
+                    break;
+            }
+        }
+
+        int width() const{
+            return bufferWidth;
+        }
+
+        int height() const{
+            return bufferHeight;
+        }
+
+        /**
+         * @param vertices positions in the mesh's local space
+         * @param indices triangle list into vertices
+         * @return id of the mesh for addOccluder()
+        */
+        uint32_t addMesh(const std::vector<glm::vec3> &vertices, const std::vector<uint32_t> &indices){
+            meshes.push_back({vertices, indices});
+            return (uint32_t)meshes.size() - 1;
+        }
+
+        /**
+         * pre: none
+         * post: no occluders are drawn by the next rasterize()
+        */
+        void clearOccluders(){
+            instances.clear();
+        }
+
+        /**
+         * @param mesh id returned by addMesh()
+         * @param world placement of the mesh this frame
+        */
+        void addOccluder(uint32_t mesh, const glm::mat4 &world){
+            instances.push_back({mesh, world});
+        }
+
+        /**
+         * rasterizes every occluder added since clearOccluders() and builds the depth pyramid
+         * @param viewProjection projection * view of the camera
+         * pre: none
+         * post: boxVisible() and the test functions test against this frame's occluders
+        */
+        void rasterize(const glm::mat4 &viewProjection){
+            double start = nowSeconds();
+            clip = viewProjection;
+            JobSystem &jobs = JobSystem::instance();
+
+            //transform and set up triangles, each occluder by one job
+            instanceTriangles.resize(instances.size());
+            jobs.parallelFor(instances.size(), 1, [&](size_t begin, size_t end){
+                for(size_t i = begin; i < end; i++)
+                    setupTriangles(instances[i], instanceTriangles[i]);
+            });
+            triangles.clear();
+            for(size_t i = 0; i < instances.size(); i++)
+                triangles.insert(triangles.end(), instanceTriangles[i].begin(), instanceTriangles[i].end());
+
+            //bin them into every tile their bounding rectangle touches
+            for(std::vector<uint32_t> &bin : bins)
+                bin.clear();
+            for(uint32_t t = 0; t < (uint32_t)triangles.size(); t++){
+                const ScreenTriangle &triangle = triangles[t];
+                for(int ty = triangle.minY / TILE_HEIGHT; ty <= triangle.maxY / TILE_HEIGHT; ty++)
+                    for(int tx = triangle.minX / TILE_WIDTH; tx <= triangle.maxX / TILE_WIDTH; tx++)
+                        bins[ty * tilesX + tx].push_back(t);
+            }
+
+            //tiles don't share pixels, so each is rasterized by one job without locking
+            jobs.parallelFor(bins.size(), 1, [&](size_t begin, size_t end){
+                for(size_t tile = begin; tile < end; tile++)
+                    rasterizeTile((int)tile % tilesX, (int)tile / tilesX);
+            });
+            stats.occluders = instances.size();
+            stats.triangles = triangles.size();
+            stats.rasterMs = (nowSeconds() - start) * 1000.0;
+
+            start = nowSeconds();
+            buildPyramid();
+            stats.pyramidMs = (nowSeconds() - start) * 1000.0;
+            stats.tested = 0;
+            stats.occluded = 0;
+            stats.testMs = 0.0;
+            ready = true;
+        }
+
+        /**
+         * tests an axis aligned box against the depth pyramid
+         * @param center center of the box in world space
+         * @param extent half size of the box along each axis
+         * @param hierarchical false tests every covered texel of the full resolution buffer instead
+         * @return false if the box is certainly hidden behind the occluders
+         * pre: rasterize() ran this frame
+        */
+        bool boxVisible(const glm::vec3 &center, const glm::vec3 &extent, bool hierarchical = true) const{
+            if(!ready)
+                return true;
+            float minX, minY, maxX, maxY, nearest;
+            //crossing the near plane: it covers the view, so don't bother
+            if(!projectBox(center, extent, minX, minY, maxX, maxY, nearest))
+                return true;
+            //every pixel the rectangle touches, not just the ones whose centers it covers
+            int x0 = std::max(0, (int)floorf(minX)), x1 = std::min(bufferWidth - 1, (int)floorf(maxX));
+            int y0 = std::max(0, (int)floorf(minY)), y1 = std::min(bufferHeight - 1, (int)floorf(maxY));
+            if(x0 > x1 || y0 > y1)
+                return true;
+
+            if(!hierarchical)
+                return !behind(0, x0, y0, x1, y1, nearest, NULL);
+            int level = 0;
+            while(level + 1 < (int)levels.size() && ((x1 >> level) - (x0 >> level) > 1 || (y1 >> level) - (y0 >> level) > 1))
+                level++;
+            //finer levels can only be nearer the occluders, so start coarse and refine while undecided
+            for(int l = level; l >= std::max(0, level - REFINE_LEVELS); l--){
+                bool inFront = true;
+                if(behind(l, x0 >> l, y0 >> l, x1 >> l, y1 >> l, nearest, &inFront))
+                    return false;
+                if(inFront)
+                    return true;
+            }
+            return true;
+        }
+
+        /**
+         * hides spheres behind the occluders, testing their bounding boxes
+         * @param spheres bounds of the objects
+         * @param visible visible[i] is the result for spheres[i]. only objects still visible
+         *        are tested, those found occluded are set to 0
+         * @return number of objects found occluded
+         * pre: rasterize() ran this frame
+         * post: stats holds the test counters
+        */
+        size_t testSpheres(const SphereBounds &spheres, std::vector<uint8_t> &visible){
+            return test(spheres.size(), visible, [&](size_t i, glm::vec3 &center, glm::vec3 &extent){
+                center = glm::vec3(spheres.x[i], spheres.y[i], spheres.z[i]);
+                extent = glm::vec3(spheres.radius[i]);
+            });
+        }
+
+        /**
+         * like testSpheres() for boxes
+        */
+        size_t testBoxes(const BoxBounds &boxes, std::vector<uint8_t> &visible){
+            return test(boxes.size(), visible, [&](size_t i, glm::vec3 &center, glm::vec3 &extent){
+                center = glm::vec3(boxes.x[i], boxes.y[i], boxes.z[i]);
+                extent = glm::vec3(boxes.ex[i], boxes.ey[i], boxes.ez[i]);
+            });
+        }
+
+        /**
+         * @return depth (0 near, 1 far) of a pixel of the full resolution buffer, y up
+        */
+        float depthAt(int x, int y) const{
+            return levels[0].maxDepth[y * bufferWidth + x];
+        }
+
+    private:
+        static constexpr int REFINE_LEVELS = 2;     //levels below the starting one a test may descend
+        static constexpr size_t TEST_CHUNK = 1024;
+
+        struct OccluderMesh{
+            std::vector<glm::vec3> vertices;
+            std::vector<uint32_t> indices;
+        };
+
+        struct OccluderInstance{
+            uint32_t mesh;
+            glm::mat4 world;
+        };
+
+        /**
+         * a triangle in pixel coordinates: three edge functions and a depth plane,
+         * each evaluated as a * x + b * y + c
+        */
+        struct ScreenTriangle{
+            float edgeA[3], edgeB[3], edgeC[3];     //>= 0 on the inner side of every edge
+            float depthA, depthB, depthC;
+            int minX, minY, maxX, maxY;             //pixels the triangle may cover
+        };
+
+        struct Level{
+            int width;
+            int height;
+            std::vector<float> minDepth;
+            std::vector<float> maxDepth;
+        };
+
+        int bufferWidth, bufferHeight;
+        int tilesX, tilesY;
+        glm::mat4 clip{1.0f};
+        bool ready = false;
+        std::vector<OccluderMesh> meshes;
+        std::vector<OccluderInstance> instances;
+        std::vector<std::vector<ScreenTriangle>> instanceTriangles;
+        std::vector<ScreenTriangle> triangles;
+        std::vector<std::vector<uint32_t>> bins;    //triangles touching each tile
+        std::vector<Level> levels;                  //levels[0] is the depth buffer itself
+
+        /**
+         * projects the 8 corners of a box
+         * @param minX..maxY receive the pixel rectangle the corners span
+         * @param nearest receives the nearest depth of the corners
+         * @return false if a corner is in front of the near plane, the outputs are undefined then
+        */
+        bool projectBox(const glm::vec3 &center, const glm::vec3 &extent, float &minX, float &minY, float &maxX, float &maxY, float &nearest) const{
+            //corners are the clip space center plus or minus each scaled axis
+            glm::vec4 base = clip * glm::vec4(center, 1.0f);
+            glm::vec4 axisX = clip[0] * extent.x, axisY = clip[1] * extent.y, axisZ = clip[2] * extent.z;
+#if defined(CULL_AVX2)
+            //one corner per lane
+            const __m256 signX = _mm256_setr_ps(-1.0f, 1.0f, -1.0f, 1.0f, -1.0f, 1.0f, -1.0f, 1.0f);
+            const __m256 signY = _mm256_setr_ps(-1.0f, -1.0f, 1.0f, 1.0f, -1.0f, -1.0f, 1.0f, 1.0f);
+            const __m256 signZ = _mm256_setr_ps(-1.0f, -1.0f, -1.0f, -1.0f, 1.0f, 1.0f, 1.0f, 1.0f);
+            __m256 corner[4];
+            for(int k = 0; k < 4; k++){
+                corner[k] = _mm256_add_ps(_mm256_add_ps(_mm256_set1_ps(base[k]), _mm256_mul_ps(signX, _mm256_set1_ps(axisX[k]))),
+                    _mm256_add_ps(_mm256_mul_ps(signY, _mm256_set1_ps(axisY[k])), _mm256_mul_ps(signZ, _mm256_set1_ps(axisZ[k]))));
+            }
+            __m256 behindNear = _mm256_or_ps(_mm256_cmp_ps(corner[3], _mm256_setzero_ps(), _CMP_LE_OQ),
+                                             _mm256_cmp_ps(corner[2], _mm256_sub_ps(_mm256_setzero_ps(), corner[3]), _CMP_LT_OQ));
+            if(_mm256_movemask_ps(behindNear) != 0)
+                return false;
+            __m256 inverseW = _mm256_div_ps(_mm256_set1_ps(1.0f), corner[3]);
+            __m256 x = _mm256_mul_ps(corner[0], inverseW), y = _mm256_mul_ps(corner[1], inverseW), z = _mm256_mul_ps(corner[2], inverseW);
+            __m128 lowX = _mm256_castps256_ps128(x), highX = _mm256_extractf128_ps(x, 1);
+            __m128 lowY = _mm256_castps256_ps128(y), highY = _mm256_extractf128_ps(y, 1);
+            __m128 lowZ = _mm256_castps256_ps128(z), highZ = _mm256_extractf128_ps(z, 1);
+            __m128 ndcMinX = _mm_min_ps(lowX, highX), ndcMaxX = _mm_max_ps(lowX, highX);
+            __m128 ndcMinY = _mm_min_ps(lowY, highY), ndcMaxY = _mm_max_ps(lowY, highY);
+            __m128 ndcMinZ = _mm_min_ps(lowZ, highZ);
+#elif defined(CULL_SSE)
+            //corners 0-3 and 4-7, one per lane
+            const __m128 signX = _mm_setr_ps(-1.0f, 1.0f, -1.0f, 1.0f);
+            const __m128 signY = _mm_setr_ps(-1.0f, -1.0f, 1.0f, 1.0f);
+            __m128 low[4], high[4];
+            for(int k = 0; k < 4; k++){
+                __m128 planar = _mm_add_ps(_mm_add_ps(_mm_set1_ps(base[k]), _mm_mul_ps(signX, _mm_set1_ps(axisX[k]))),
+                                           _mm_mul_ps(signY, _mm_set1_ps(axisY[k])));
+                low[k] = _mm_sub_ps(planar, _mm_set1_ps(axisZ[k]));
+                high[k] = _mm_add_ps(planar, _mm_set1_ps(axisZ[k]));
+            }
+            __m128 behindNear = _mm_or_ps(
+                _mm_or_ps(_mm_cmple_ps(low[3], _mm_setzero_ps()), _mm_cmplt_ps(low[2], _mm_sub_ps(_mm_setzero_ps(), low[3]))),
+                _mm_or_ps(_mm_cmple_ps(high[3], _mm_setzero_ps()), _mm_cmplt_ps(high[2], _mm_sub_ps(_mm_setzero_ps(), high[3]))));
+            if(_mm_movemask_ps(behindNear) != 0)
+                return false;
+            __m128 lowInverseW = _mm_div_ps(_mm_set1_ps(1.0f), low[3]), highInverseW = _mm_div_ps(_mm_set1_ps(1.0f), high[3]);
+            __m128 lowX = _mm_mul_ps(low[0], lowInverseW), highX = _mm_mul_ps(high[0], highInverseW);
+            __m128 lowY = _mm_mul_ps(low[1], lowInverseW), highY = _mm_mul_ps(high[1], highInverseW);
+            __m128 ndcMinX = _mm_min_ps(lowX, highX), ndcMaxX = _mm_max_ps(lowX, highX);
+            __m128 ndcMinY = _mm_min_ps(lowY, highY), ndcMaxY = _mm_max_ps(lowY, highY);
+            __m128 ndcMinZ = _mm_min_ps(_mm_mul_ps(low[2], lowInverseW), _mm_mul_ps(high[2], highInverseW));
+#endif
+#if defined(CULL_AVX2) || defined(CULL_SSE)
+            float lanes[5][4];
+            _mm_storeu_ps(lanes[0], ndcMinX);
+            _mm_storeu_ps(lanes[1], ndcMinY);
+            _mm_storeu_ps(lanes[2], ndcMaxX);
+            _mm_storeu_ps(lanes[3], ndcMaxY);
+            _mm_storeu_ps(lanes[4], ndcMinZ);
+            float ndc[5];
+            for(int m = 0; m < 5; m++){
+                bool takeMax = m == 2 || m == 3;
+                float a = takeMax ? std::max(lanes[m][0], lanes[m][1]) : std::min(lanes[m][0], lanes[m][1]);
+                float b = takeMax ? std::max(lanes[m][2], lanes[m][3]) : std::min(lanes[m][2], lanes[m][3]);
+                ndc[m] = takeMax ? std::max(a, b) : std::min(a, b);
+            }
+#else
+            float ndc[5] = {INFINITY, INFINITY, -INFINITY, -INFINITY, INFINITY};
+            for(int c = 0; c < 8; c++){
+                glm::vec4 corner = base + (c & 1 ? axisX : -axisX) + (c & 2 ? axisY : -axisY) + (c & 4 ? axisZ : -axisZ);
+                if(corner.w <= 0.0f || corner.z < -corner.w)
+                    return false;
+                float inverseW = 1.0f / corner.w;
+                ndc[0] = std::min(ndc[0], corner.x * inverseW);
+                ndc[1] = std::min(ndc[1], corner.y * inverseW);
+                ndc[2] = std::max(ndc[2], corner.x * inverseW);
+                ndc[3] = std::max(ndc[3], corner.y * inverseW);
+                ndc[4] = std::min(ndc[4], corner.z * inverseW);
+            }
+#endif
+            minX = (ndc[0] * 0.5f + 0.5f) * bufferWidth;
+            minY = (ndc[1] * 0.5f + 0.5f) * bufferHeight;
+            maxX = (ndc[2] * 0.5f + 0.5f) * bufferWidth;
+            maxY = (ndc[3] * 0.5f + 0.5f) * bufferHeight;
+            nearest = ndc[4] * 0.5f + 0.5f;
+            return true;
+        }
+
+        void setupTriangles(const OccluderInstance &instance, std::vector<ScreenTriangle> &out) const{
+            out.clear();
+            const OccluderMesh &mesh = meshes[instance.mesh];
+            glm::mat4 toClip = clip * instance.world;
+            for(size_t i = 0; i + 2 < mesh.indices.size(); i += 3){
+                float x[3], y[3], z[3];
+                bool clipped = false;
+                for(int v = 0; v < 3; v++){
+                    glm::vec4 position = toClip * glm::vec4(mesh.vertices[mesh.indices[i + v]], 1.0f);
+                    //occluders are optional: drop triangles crossing the near plane instead of clipping them
+                    if(position.w <= 0.0f || position.z < -position.w){
+                        clipped = true;
+                        break;
+                    }
+                    float inverseW = 1.0f / position.w;
+                    x[v] = (position.x * inverseW * 0.5f + 0.5f) * bufferWidth;
+                    y[v] = (position.y * inverseW * 0.5f + 0.5f) * bufferHeight;
+                    z[v] = position.z * inverseW * 0.5f + 0.5f;
+                }
+                if(clipped)
+                    continue;
+                float area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+                if(fabsf(area) < 1e-6f)
+                    continue;
+                //both windings are drawn, flip clockwise ones
+                if(area < 0.0f){
+                    std::swap(x[1], x[2]);
+                    std::swap(y[1], y[2]);
+                    std::swap(z[1], z[2]);
+                    area = -area;
+                }
+                ScreenTriangle triangle;
+                triangle.minX = std::max(0, (int)floorf(std::min(x[0], std::min(x[1], x[2]))));
+                triangle.maxX = std::min(bufferWidth - 1, (int)ceilf(std::max(x[0], std::max(x[1], x[2]))));
+                triangle.minY = std::max(0, (int)floorf(std::min(y[0], std::min(y[1], y[2]))));
+                triangle.maxY = std::min(bufferHeight - 1, (int)ceilf(std::max(y[0], std::max(y[1], y[2]))));
+                if(triangle.minX > triangle.maxX || triangle.minY > triangle.maxY)
+                    continue;
+                for(int e = 0; e < 3; e++){
+                    int next = (e + 1) % 3;
+                    triangle.edgeA[e] = y[e] - y[next];
+                    triangle.edgeB[e] = x[next] - x[e];
+                    triangle.edgeC[e] = -triangle.edgeA[e] * x[e] - triangle.edgeB[e] * y[e];
+                }
+                triangle.depthA = ((z[1] - z[0]) * (y[2] - y[0]) - (y[1] - y[0]) * (z[2] - z[0])) / area;
+                triangle.depthB = ((x[1] - x[0]) * (z[2] - z[0]) - (z[1] - z[0]) * (x[2] - x[0])) / area;
+                triangle.depthC = z[0] - triangle.depthA * x[0] - triangle.depthB * y[0];
+                out.push_back(triangle);
+            }
+        }
+
+        void rasterizeTile(int tileX, int tileY){
+            std::vector<float> &depth = levels[0].maxDepth;
+            int left = tileX * TILE_WIDTH, bottom = tileY * TILE_HEIGHT;
+            for(int y = bottom; y < bottom + TILE_HEIGHT; y++)
+                std::fill(&depth[y * bufferWidth + left], &depth[y * bufferWidth + left] + TILE_WIDTH, 1.0f);
+
+            for(uint32_t index : bins[tileY * tilesX + tileX]){
+                const ScreenTriangle &triangle = triangles[index];
+                int minX = std::max(triangle.minX, left), maxX = std::min(triangle.maxX, left + TILE_WIDTH - 1);
+                int minY = std::max(triangle.minY, bottom), maxY = std::min(triangle.maxY, bottom + TILE_HEIGHT - 1);
+                for(int y = minY; y <= maxY; y++){
+                    float pixelY = y + 0.5f;
+                    float row[3];       //edge functions at x = 0 of this row
+                    for(int e = 0; e < 3; e++)
+                        row[e] = triangle.edgeB[e] * pixelY + triangle.edgeC[e];
+                    float depthRow = triangle.depthB * pixelY + triangle.depthC;
+                    float *pixels = &depth[y * bufferWidth];
+#if defined(CULL_AVX2)
+                    //tiles start at multiples of 8, so aligning down stays inside the tile
+                    const __m256 lanes = _mm256_setr_ps(0.5f, 1.5f, 2.5f, 3.5f, 4.5f, 5.5f, 6.5f, 7.5f);
+                    for(int x = minX & ~7; x <= maxX; x += 8){
+                        __m256 pixelX = _mm256_add_ps(_mm256_set1_ps((float)x), lanes);
+                        __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+                        for(int e = 0; e < 3; e++){
+                            __m256 edge = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(triangle.edgeA[e]), pixelX), _mm256_set1_ps(row[e]));
+                            inside = _mm256_and_ps(inside, _mm256_cmp_ps(edge, _mm256_setzero_ps(), _CMP_GE_OQ));
+                        }
+                        if(_mm256_movemask_ps(inside) == 0)
+                            continue;
+                        __m256 z = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(triangle.depthA), pixelX), _mm256_set1_ps(depthRow));
+                        __m256 current = _mm256_loadu_ps(pixels + x);
+                        _mm256_storeu_ps(pixels + x, _mm256_blendv_ps(current, _mm256_min_ps(current, z), inside));
+                    }
+#elif defined(CULL_SSE)
+                    const __m128 lanes = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+                    for(int x = minX & ~3; x <= maxX; x += 4){
+                        __m128 pixelX = _mm_add_ps(_mm_set1_ps((float)x), lanes);
+                        __m128 inside = _mm_cmpeq_ps(pixelX, pixelX);
+                        for(int e = 0; e < 3; e++){
+                            __m128 edge = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(triangle.edgeA[e]), pixelX), _mm_set1_ps(row[e]));
+                            inside = _mm_and_ps(inside, _mm_cmpge_ps(edge, _mm_setzero_ps()));
+                        }
+                        if(_mm_movemask_ps(inside) == 0)
+                            continue;
+                        __m128 z = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(triangle.depthA), pixelX), _mm_set1_ps(depthRow));
+                        __m128 current = _mm_loadu_ps(pixels + x);
+                        __m128 nearer = _mm_min_ps(current, z);
+                        _mm_storeu_ps(pixels + x, _mm_or_ps(_mm_and_ps(inside, nearer), _mm_andnot_ps(inside, current)));
+                    }
+#else
+                    for(int x = minX; x <= maxX; x++){
+                        float pixelX = x + 0.5f;
+                        if(triangle.edgeA[0] * pixelX + row[0] < 0.0f || triangle.edgeA[1] * pixelX + row[1] < 0.0f ||
+                           triangle.edgeA[2] * pixelX + row[2] < 0.0f)
+                            continue;
+                        pixels[x] = std::min(pixels[x], triangle.depthA * pixelX + depthRow);
+                    }
+#endif
+                }
+            }
+        }
+
+        void buildPyramid(){
+            levels[0].minDepth = levels[0].maxDepth;
+            for(size_t l = 1; l < levels.size(); l++){
+                const Level &source = levels[l - 1];
+                Level &level = levels[l];
+                for(int y = 0; y < level.height; y++){
+                    int y0 = std::min(y * 2, source.height - 1), y1 = std::min(y * 2 + 1, source.height - 1);
+                    for(int x = 0; x < level.width; x++){
+                        int x0 = std::min(x * 2, source.width - 1), x1 = std::min(x * 2 + 1, source.width - 1);
+                        int texels[4] = {y0 * source.width + x0, y0 * source.width + x1, y1 * source.width + x0, y1 * source.width + x1};
+                        float nearest = source.minDepth[texels[0]], farthest = source.maxDepth[texels[0]];
+                        for(int t = 1; t < 4; t++){
+                            nearest = std::min(nearest, source.minDepth[texels[t]]);
+                            farthest = std::max(farthest, source.maxDepth[texels[t]]);
+                        }
+                        level.minDepth[y * level.width + x] = nearest;
+                        level.maxDepth[y * level.width + x] = farthest;
+                    }
+                }
+            }
+        }
+
+        /**
+         * @param level pyramid level, x0..y1 the texel rectangle on it
+         * @param nearest nearest depth of the tested box
+         * @param inFront if not NULL, cleared unless the box is in front of every texel's nearest depth
+         * @return true if every texel's farthest depth is in front of the box
+        */
+        bool behind(int level, int x0, int y0, int x1, int y1, float nearest, bool *inFront) const{
+            const Level &texels = levels[level];
+            bool hidden = true;
+            for(int y = y0; y <= y1; y++){
+                for(int x = x0; x <= x1; x++){
+                    int texel = y * texels.width + x;
+                    if(nearest <= texels.maxDepth[texel])
+                        hidden = false;
+                    if(inFront != NULL && nearest > texels.minDepth[texel])
+                        *inFront = false;
+                }
+            }
+            return hidden;
+        }
+
+        template<typename BoxAt>
+        size_t test(size_t count, std::vector<uint8_t> &visible, BoxAt boxAt){
+            double start = nowSeconds();
+            std::atomic<size_t> tested{0}, occluded{0};
+            JobSystem::instance().parallelFor(count, TEST_CHUNK, [&](size_t begin, size_t end){
+                size_t localTested = 0, localOccluded = 0;
+                for(size_t i = begin; i < end; i++){
+                    if(!visible[i])
+                        continue;
+                    glm::vec3 center, extent;
+                    boxAt(i, center, extent);
+                    localTested++;
+                    if(!boxVisible(center, extent)){
+                        visible[i] = 0;
+                        localOccluded++;
+                    }
+                }
+                tested += localTested;
+                occluded += localOccluded;
+            });
+            stats.tested += tested;
+            stats.occluded += occluded;
+            stats.testMs += (nowSeconds() - start) * 1000.0;
+            return occluded;
+        }
+};
+
+#endif
@@ -0,0 +1,165 @@
+/**
+ * Command line options for the application
+*/
+#ifndef OPTIONS_H
+#define OPTIONS_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+struct AppOptions{
+    int benchPipelines = 0;     //variants per stage for the pipeline benchmark, 0 = don't run it
+    double targetFps = 60.0;    //frame limiter target, 0 = unlimited
+    bool vsync = true;          //sync buffer swaps to the display refresh
+    bool printStats = false;    //print frame statistics every second
+    bool occlusion = false;     //cull entities hidden behind occluders on the CPU
+    bool gpuCulling = false;    //cull and draw opaque entities on the GPU with indirect draws
+    int prepass = 0;            //depth prepass of the render queue's opaque draws, a PrepassMode: 0 off, 1 on, 2 auto
+    bool overdraw = false;      //count fragments per pixel with a stencil pass every frame
+    bool deferred = false;      //deferred shading of opaque draws with tiled light culling
+    bool clustered = false;     //light forward draws with lights binned into view frustum clusters
+    int lights = 256;           //point lights scattered over the scene when lit
+    bool shadows = false;       //cascaded shadow maps of the sun on forward draws, over a ground plane
+    int shadowSize = 1024;      //width and height of each shadow cascade, ShadowMaps::init() clamps it to what GL supports
+    bool dynamicResolution = false; //scale the scene's resolution to hold a GPU time budget, then upscale
+    float minScale = 0.5f;      //smallest render size / output size with dynamic resolution
+    float maxScale = 1.0f;      //largest
+    double gpuBudgetMs = 0.0;   //GPU time dynamic resolution aims for, 0 = 90% of the frame at the target fps
+    bool sharpen = true;        //sharpen when upscaling, otherwise plain bilinear
+    int framesInFlight = 2;     //frames the CPU may record ahead of the GPU before waiting on a fence
+    bool renderThread = false;  //render on a thread of its own while the main thread polls input and simulates
+    bool inputStats = false;    //print how old input events are when the camera applies them, every second
+    size_t particles = 0;       //particles the fountain in the middle of the grid has room for, 0 = no fountain
+    bool gpuParticles = false;  //simulate particles in compute shaders instead of on the CPU
+    size_t benchTransforms = 0; //transforms for the transform benchmark, 0 = don't run it
+    bool benchEntities = false; //run the entity store vs array of objects benchmark
+    size_t benchCulling = 0;    //objects for the frustum culling benchmark, 0 = don't run it
+    size_t benchOcclusion = 0;  //objects for the occlusion culling benchmark, 0 = don't run it
+    size_t benchRecording = 0;  //draws for the command list recording benchmark, 0 = don't run it
+    size_t benchGpuCulling = 0; //instances for the GPU culling benchmark, 0 = don't run it
+    size_t benchParticles = 0;  //particles for the particle benchmark, 0 = don't run it
+    const char *tracePath = NULL;   //profile the whole run and write a Chrome trace here on exit
+    bool headless = false;      //render offscreen without a window
+    int width = 800;            //size of the offscreen framebuffer when headless
+    int height = 800;
+    int frames = 100;           //frames to render when headless
+    const char *dumpDir = NULL; //every frame is written here as a PNG, read back asynchronously
+    bool dumpRaw = false;       //dump headerless RGBA files instead of PNGs
+    const char *recordPath = NULL;  //every frame is recorded to this .y4m video, frames the disk can't keep up with are dropped
+    bool benchmark = false;     //deterministic run of --frames frames on the scripted camera path
+    int warmup = 10;            //benchmark frames left out of the results
+    const char *benchOut = NULL;        //benchmark results JSON
+    const char *baseline = NULL;        //results JSON of an earlier run to compare against
+    std::vector<std::string> thresholds;    //"percent" or "metric.stat=percent" regression limits
+};
+
+/**
+ * @param argc argument count given to main
+ * @param argv arguments given to main
+ * @param options the options to fill in
+ * @return false if an argument wasn't recognized (usage is printed)
+ * pre: none
+ * post: options holds the values given on the command line, defaults otherwise
+*/
+inline bool parseOptions(int argc, char **argv, AppOptions &options){
+    for(int i = 1; i < argc; i++){
+        const char *arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if(strcmp(arg, "--bench-pipelines") == 0 && hasValue){
+            options.benchPipelines = atoi(argv[++i]);
+        } else if(strcmp(arg, "--fps") == 0 && hasValue){
+            options.targetFps = atof(argv[++i]);
+        } else if(strcmp(arg, "--vsync") == 0 && hasValue){
+            options.vsync = atoi(argv[++i]) != 0;
+        } else if(strcmp(arg, "--bench-transforms") == 0 && hasValue){
+            options.benchTransforms = strtoull(argv[++i], NULL, 10);
+        } else if(strcmp(arg, "--bench-entities") == 0){
+            options.benchEntities = true;
+        } else if(strcmp(arg, "--bench-culling") == 0 && hasValue){
+            options.benchCulling = strtoull(argv[++i], NULL, 10);
+        } else if(strcmp(arg, "--bench-occlusion") == 0 && hasValue){
+            options.benchOcclusion = strtoull(argv[++i], NULL, 10);
+        } else if(strcmp(arg, "--occlusion") == 0){
+            options.occlusion = true;
+        } else if(strcmp(arg, "--gpu-culling") == 0){
+            options.gpuCulling = true;
+        } else if(strcmp(arg, "--prepass") == 0 && hasValue && (strcmp(argv[i + 1], "off") == 0 || strcmp(argv[i + 1], "on") == 0 || strcmp(argv[i + 1], "auto") == 0)){
+            const char *mode = argv[++i];
+            options.prepass = strcmp(mode, "off") == 0 ? 0 : strcmp(mode, "on") == 0 ? 1 : 2;
+        } else if(strcmp(arg, "--overdraw") == 0){
+            options.overdraw = true;
+        } else if(strcmp(arg, "--deferred") == 0){
+            options.deferred = true;
+        } else if(strcmp(arg, "--clustered") == 0){
+            options.clustered = true;
+        } else if(strcmp(arg, "--shadows") == 0){
+            options.shadows = true;
+        } else if(strcmp(arg, "--shadow-size") == 0 && hasValue){
+            options.shadowSize = atoi(argv[++i]);
+        } else if(strcmp(arg, "--dynamic-res") == 0){
+            options.dynamicResolution = true;
+        } else if(strcmp(arg, "--min-scale") == 0 && hasValue){
+            options.minScale = (float)atof(argv[++i]);
+        } else if(strcmp(arg, "--max-scale") == 0 && hasValue){
+            options.maxScale = (float)atof(argv[++i]);
+        } else if(strcmp(arg, "--gpu-budget") == 0 && hasValue){
+            options.gpuBudgetMs = atof(argv[++i]);
+        } else if(strcmp(arg, "--upscale") == 0 && hasValue && (strcmp(argv[i + 1], "bilinear") == 0 || strcmp(argv[i + 1], "sharpen") == 0)){
+            options.sharpen = strcmp(argv[++i], "sharpen") == 0;
+        } else if(strcmp(arg, "--frames-in-flight") == 0 && hasValue){
+            options.framesInFlight = atoi(argv[++i]);
+        } else if(strcmp(arg, "--render-thread") == 0){
+            options.renderThread = true;
+        } else if(strcmp(arg, "--input-stats") == 0){
+            options.inputStats = true;
+        } else if(strcmp(arg, "--particles") == 0 && hasValue){
+            options.particles = strtoull(argv[++i], NULL, 10);
+        } else if(strcmp(arg, "--particle-backend") == 0 && hasValue && (strcmp(argv[i + 1], "cpu") == 0 || strcmp(argv[i + 1], "gpu") == 0)){
+            options.gpuParticles = strcmp(argv[++i], "gpu") == 0;
+        } else if(strcmp(arg, "--lights") == 0 && hasValue){
+            options.lights = atoi(argv[++i]);
+        } else if(strcmp(arg, "--bench-gpu-culling") == 0 && hasValue){
+            options.benchGpuCulling = strtoull(argv[++i], NULL, 10);
+        } else if(strcmp(arg, "--bench-particles") == 0 && hasValue){
+            options.benchParticles = strtoull(argv[++i], NULL, 10);
+        } else if(strcmp(arg, "--bench-recording") == 0 && hasValue){
+            options.benchRecording = strtoull(argv[++i], NULL, 10);
+        } else if(strcmp(arg, "--trace") == 0 && hasValue){
+            options.tracePath = argv[++i];
+        } else if(strcmp(arg, "--headless") == 0){
+            options.headless = true;
+        } else if(strcmp(arg, "--size") == 0 && hasValue && sscanf(argv[i + 1], "%dx%d", &options.width, &options.height) == 2){
+            i++;
+        } else if(strcmp(arg, "--frames") == 0 && hasValue){
+            options.frames = atoi(argv[++i]);
+        } else if(strcmp(arg, "--dump") == 0 && hasValue){
+            options.dumpDir = argv[++i];
+        } else if(strcmp(arg, "--dump-raw") == 0){
+            options.dumpRaw = true;
+        } else if(strcmp(arg, "--record") == 0 && hasValue){
+            options.recordPath = argv[++i];
+        } else if(strcmp(arg, "--benchmark") == 0){
+            options.benchmark = true;
+        } else if(strcmp(arg, "--warmup") == 0 && hasValue){
+            options.warmup = atoi(argv[++i]);
+        } else if(strcmp(arg, "--bench-out") == 0 && hasValue){
+            options.benchOut = argv[++i];
+        } else if(strcmp(arg, "--baseline") == 0 && hasValue){
+            options.baseline = argv[++i];
+        } else if(strcmp(arg, "--threshold") == 0 && hasValue){
+            options.thresholds.push_back(argv[++i]);
+        } else if(strcmp(arg, "--stats") == 0){
+            options.printStats = true;
+        } else{
+            printf("unknown argument %s\n", arg);
+            printf("usage: %s [--fps target] [--vsync 0|1] [--stats] [--occlusion] [--gpu-culling] [--prepass off|on|auto] [--overdraw] [--deferred] [--clustered] [--lights count] [--shadows] [--shadow-size texels] [--dynamic-res] [--min-scale scale] [--max-scale scale] [--gpu-budget ms] [--upscale bilinear|sharpen] [--frames-in-flight count] [--render-thread] [--input-stats] [--particles count] [--particle-backend cpu|gpu] [--trace file.json] [--headless] [--size WxH] [--frames count] [--dump dir] [--dump-raw] [--record file.y4m] [--benchmark] [--warmup frames] [--bench-out results.json] [--baseline results.json] [--threshold [metric.stat=]percent] [--bench-pipelines variants] [--bench-transforms count] [--bench-entities] [--bench-culling count] [--bench-occlusion count] [--bench-recording count] [--bench-gpu-culling count] [--bench-particles count]\n", argv[0]);
+            return false;
+        }
+    }
+    return true;
+}
+
+#endif
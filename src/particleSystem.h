@@ -0,0 +1,712 @@
+/**
+ * Particle effects of up to millions of particles. Particles are stored as a
+ * structure of arrays, one float stream per field, laid out the same way on
+ * the CPU and on the GPU, where the streams are consecutive ranges of one
+ * buffer: field f of particle i is float f * capacity + i.
+ *
+ * The CPU backend steps 8 particles at a time with AVX2 (4 with SSE) on the
+ * job system's threads and keeps the live particles packed at the front of
+ * the streams. A first pass counts the survivors of every chunk, a second
+ * simulates each chunk into the other copy of the streams at the offset the
+ * counts give it, left packing the survivors of each 8 lanes with a permute.
+ * New particles are appended after the survivors, and draw() uploads the
+ * live range.
+ *
+ * The GPU backend does the same in compute shaders (GL 4.3) between two
+ * buffers. The number of live particles is the instance count of an indirect
+ * draw command the kernels increment, so particles are simulated, compacted,
+ * emitted and drawn without the CPU reading or writing any of them.
+ *
+ * Either way particles are drawn as instanced camera facing quads, blended
+ * additively, with the streams as vertex attributes. Both backends draw the
+ * random numbers of a particle from a hash of its emission index, so they
+ * emit the same particles and their live counts can be compared.
+*/
+#ifndef PARTICLE_SYSTEM_H
+#define PARTICLE_SYSTEM_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "computeShader.h"
+#include "frameContext.h"
+#include "frameTimer.h"
+#include "jobSystem.h"
+#include "profiler.h"
+#include "shader.h"
+#include "simd.h"
+
+enum ParticleBackend{
+    PARTICLES_CPU,      //SIMD on the job system's threads, uploaded for drawing
+    PARTICLES_GPU       //compute shaders, drawn indirectly from the same buffer
+};
+
+/**
+ * where and how particles are born
+*/
+struct ParticleEmitter{
+    glm::vec3 position{0.0f};
+    float radius = 0.1f;                        //particles start up to this far from position on x and z
+    glm::vec3 velocity{0.0f, 5.0f, 0.0f};       //mean launch velocity
+    float spread = 1.0f;                        //up to this much is added to or taken from each component of it
+    float rate = 1000.0f;                       //particles per second
+    float minLife = 1.5f;                       //seconds
+    float maxLife = 3.0f;
+};
+
+/**
+ * per update particle counters
+*/
+struct ParticleStats{
+    size_t alive = 0;           //live particles, on the GPU read back at least ParticleSystem::READBACK_LATENCY updates late
+    size_t emitted = 0;         //born in the last update
+    size_t dropped = 0;         //not born in the last update for lack of room, CPU backend only
+    double simulateMs = 0.0;    //CPU time of the last update()
+    double uploadMs = 0.0;      //CPU time of the last draw()'s upload, CPU backend only
+
+    void print(const char *name) const{
+        printf("%s: %zu alive, %zu emitted, %zu dropped, %.3f ms simulate, %.3f ms upload\n",
+               name, alive, emitted, dropped, simulateMs, uploadMs);
+    }
+};
+
+class ParticleSystem{
+    public:
+        enum Field{POSITION_X, POSITION_Y, POSITION_Z, VELOCITY_X, VELOCITY_Y, VELOCITY_Z, AGE, LIFE, FIELDS};
+        //random numbers a new particle draws, see common/particles.glsl
+        enum Random{RANDOM_X, RANDOM_Z, RANDOM_VELOCITY_X, RANDOM_VELOCITY_Y, RANDOM_VELOCITY_Z, RANDOM_LIFE};
+        static constexpr size_t CHUNK = 16384;              //particles per job, a multiple of 8
+        static constexpr int READBACK_LATENCY = 4;          //fewest updates between a GPU update and reading back its count
+        static constexpr unsigned int GROUP_SIZE = 256;     //local_size_x of ParticleSimulate.glsl and ParticleEmit.glsl
+
+        ParticleEmitter emitter;
+        float gravity = -9.81f;     //acceleration along y
+        float drag = 0.2f;          //fraction of the velocity lost per second
+        float ground = 0.0f;        //height particles bounce off
+        float restitution = 0.4f;   //fraction of the vertical speed kept by a bounce
+        float size = 0.02f;         //half the width of a particle's quad at birth
+        float brightness = 0.25f;   //scales each particle's color, dense sprays saturate less the lower it is
+        ParticleStats stats;
+        FrameContexts *frames = NULL;   //the CPU backend uploads into the frame's transient buffer, NULL rewrites one buffer
+        std::unique_ptr<Shader> drawShader;
+
+        /**
+         * @return true if the current context can run the backend
+        */
+        static bool supported(ParticleBackend backend){
+            return backend == PARTICLES_CPU || computeSupported();
+        }
+
+        /**
+         * builds the shaders and allocates room for capacity particles
+         * @param shaderDir directory holding the particle shaders
+         * @param backend where particles are simulated
+         * @param capacity most particles alive at once
+         * @return false if a shader failed to build, or the GPU can't hold capacity particles
+         * pre: supported(backend)
+        */
+        bool init(const std::string &shaderDir, ParticleBackend backend, size_t capacity){
+            kind = backend;
+            room = capacity;
+            drawShader.reset(new Shader((shaderDir + "/ParticleVertexShader.glsl").c_str(), (shaderDir + "/ParticleFragmentShader.glsl").c_str()));
+            glGenVertexArrays(2, vaos);
+            glGenBuffers(2, buffers);
+            if(kind == PARTICLES_CPU){
+                for(std::vector<float> &copy : streams)
+                    copy.assign(FIELDS * room, 0.0f);
+                glBindBuffer(GL_ARRAY_BUFFER, buffers[0]);
+                glBufferData(GL_ARRAY_BUFFER, DRAWN_FIELDS * room * sizeof(float), NULL, GL_STREAM_DRAW);
+                glBindBuffer(GL_ARRAY_BUFFER, 0);
+                return drawShader->programID != 0;
+            }
+
+            //the kernels see each copy of the streams as one storage block
+            GLint64 maxBlock = 0;
+            glGetInteger64v(GL_MAX_SHADER_STORAGE_BLOCK_SIZE, &maxBlock);
+            if((GLint64)(FIELDS * room * sizeof(float)) > maxBlock){
+                printf("%zu particles don't fit in a %lld byte storage block\n", room, (long long)maxBlock);
+                return false;
+            }
+            simulateShader = ComputeShader(shaderDir + "/ParticleSimulate.glsl");
+            emitShader = ComputeShader(shaderDir + "/ParticleEmit.glsl");
+            for(int copy = 0; copy < 2; copy++){
+                glBindBuffer(GL_ARRAY_BUFFER, buffers[copy]);
+                glBufferData(GL_ARRAY_BUFFER, FIELDS * room * sizeof(float), NULL, GL_DYNAMIC_COPY);
+                unsigned int sources[DRAWN_FIELDS];
+                size_t offsets[DRAWN_FIELDS];
+                for(int a = 0; a < DRAWN_FIELDS; a++){
+                    sources[a] = buffers[copy];
+                    offsets[a] = DRAWN[a] * room * sizeof(float);
+                }
+                pointAttributes(vaos[copy], sources, offsets);
+            }
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+            //both copies start out empty
+            DrawCommand commands[2] = {{4, 0, 0, 0}, {4, 0, 0, 0}};
+            glGenBuffers(1, &commandBuffer);
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+            glBufferData(GL_DRAW_INDIRECT_BUFFER, sizeof(commands), commands, GL_DYNAMIC_DRAW);
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+            glGenBuffers(READBACK_LATENCY, readbackBuffers);
+            for(int i = 0; i < READBACK_LATENCY; i++){
+                glBindBuffer(GL_COPY_WRITE_BUFFER, readbackBuffers[i]);
+                glBufferData(GL_COPY_WRITE_BUFFER, sizeof(uint32_t), NULL, GL_STREAM_READ);
+            }
+            glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+            return drawShader->programID != 0 && simulateShader.ok() && emitShader.ok();
+        }
+
+        size_t capacity() const{
+            return room;
+        }
+
+        ParticleBackend backend() const{
+            return kind;
+        }
+
+        /**
+         * ages and moves every particle by dt, removes the dead and emits new ones
+         * @param dt seconds to advance
+         * pre: init() succeeded
+         * post: the live particles are packed at the front of the current streams
+        */
+        void update(float dt){
+            PROFILE_ZONE("particles");
+            double start = nowSeconds();
+            //whole particles due since the last update, the fraction carries over
+            emitCarry += (double)emitter.rate * dt;
+            size_t emitCount = (size_t)std::max(emitCarry, 0.0);
+            emitCarry -= (double)emitCount;
+            Step step;
+            step.dt = dt;
+            step.damping = std::max(1.0f - drag * dt, 0.0f);
+            step.gravity = gravity * dt;
+            step.ground = ground;
+            step.bounce = -restitution;
+            if(kind == PARTICLES_CPU)
+                updateCpu(step, emitCount);
+            else
+                updateGpu(step, emitCount);
+            stats.simulateMs = (nowSeconds() - start) * 1000.0;
+        }
+
+        /**
+         * draws the live particles, blended additively over what is drawn and depth tested against it
+         * pre: the Camera block is latched. the CPU backend uploads, so with frames set beginFrame() ran
+         * post: blending is off and depth writes on, no VAO is bound
+        */
+        void draw(){
+            PROFILE_ZONE("particle draw");
+            PROFILE_GPU_ZONE("particle draw");
+            if(kind == PARTICLES_CPU){
+                if(alive == 0)
+                    return;
+                upload();
+            }
+            drawShader->use();
+            drawShader->setFloatUniform("size", size);
+            drawShader->setFloatUniform("brightness", brightness);
+            glEnable(GL_BLEND);
+            glBlendFunc(GL_ONE, GL_ONE);
+            glDepthMask(GL_FALSE);
+            if(kind == PARTICLES_CPU){
+                glBindVertexArray(vaos[0]);
+                glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, (GLsizei)alive);
+            } else{
+                glBindVertexArray(vaos[current]);
+                glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+                glDrawArraysIndirect(GL_TRIANGLE_STRIP, (void*)(current * sizeof(DrawCommand)));
+                glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+            }
+            glDepthMask(GL_TRUE);
+            glDisable(GL_BLEND);
+            glBindVertexArray(0);
+        }
+
+        /**
+         * @return the live particles right now. waits for the GPU to finish updating them,
+         *         meant for benchmarks and checks rather than every frame
+        */
+        size_t readAlive(){
+            if(kind == PARTICLES_CPU)
+                return alive;
+            uint32_t count = 0;
+            glBindBuffer(GL_COPY_READ_BUFFER, commandBuffer);
+            glGetBufferSubData(GL_COPY_READ_BUFFER, current * sizeof(DrawCommand) + offsetof(DrawCommand, instanceCount), sizeof(count), &count);
+            glBindBuffer(GL_COPY_READ_BUFFER, 0);
+            return count;
+        }
+
+        /**
+         * pre: the context init() ran on is current
+         * post: every GL object of the particle system is deleted, and the CPU streams freed
+        */
+        void destroy(){
+            if(drawShader)
+                drawShader->destroy();
+            simulateShader.destroy();
+            emitShader.destroy();
+            glDeleteVertexArrays(2, vaos);
+            glDeleteBuffers(2, buffers);
+            glDeleteBuffers(1, &commandBuffer);
+            glDeleteBuffers(READBACK_LATENCY, readbackBuffers);
+            for(GLsync &fence : readbackFences){
+                glDeleteSync(fence);
+                fence = NULL;
+            }
+            for(std::vector<float> &copy : streams)
+                std::vector<float>().swap(copy);
+            alive = 0;
+        }
+
+    private:
+        //as glDrawArraysIndirect and common/particles.glsl read it
+        struct DrawCommand{
+            uint32_t count;
+            uint32_t instanceCount;
+            uint32_t first;
+            uint32_t baseInstance;
+        };
+
+        //constants of one update, as both backends apply them
+        struct Step{
+            float dt;
+            float damping;      //velocity is multiplied by it
+            float gravity;      //then this is added to its y
+            float ground;
+            float bounce;       //vertical velocity is multiplied by it when a particle hits the ground
+        };
+
+        //lanes[bits] lists the set bits of bits from the lowest, the rest of the lanes are 0
+        struct CompactTable{
+            alignas(32) int32_t lanes[256][8];
+            uint8_t counts[256];
+
+            CompactTable(){
+                for(int bits = 0; bits < 256; bits++){
+                    int count = 0;
+                    for(int k = 0; k < 8; k++){
+                        lanes[bits][k] = 0;
+                        if(bits >> k & 1)
+                            lanes[bits][count++] = k;
+                    }
+                    counts[bits] = (uint8_t)count;
+                }
+            }
+        };
+
+        //the fields the vertex shader reads, attribute a is field DRAWN[a]
+        static constexpr int DRAWN_FIELDS = 5;
+        static constexpr Field DRAWN[DRAWN_FIELDS] = {POSITION_X, POSITION_Y, POSITION_Z, AGE, LIFE};
+
+        ParticleBackend kind = PARTICLES_CPU;
+        size_t room = 0;
+        double emitCarry = 0.0;         //particles due but not yet emitted, below 1
+        uint32_t emittedTotal = 0;      //emission index of the next particle born, wraps
+
+        //CPU backend: two copies of the streams, the live particles are [0, alive) of streams[current]
+        std::vector<float> streams[2];
+        std::vector<size_t> chunkCounts;
+        size_t alive = 0;
+        int current = 0;                //GPU backend: buffer and draw command of the live particles
+
+        unsigned int vaos[2] = {};      //the CPU backend draws with the first
+        unsigned int buffers[2] = {};   //CPU backend: the first is the upload buffer without frames
+        unsigned int commandBuffer = 0;
+        ComputeShader simulateShader;
+        ComputeShader emitShader;
+
+        //GPU backend: live counts copied back a few updates late, and what was emitted since
+        unsigned int readbackBuffers[READBACK_LATENCY] = {};
+        GLsync readbackFences[READBACK_LATENCY] = {};  //signaled once the slot's copy has landed
+        size_t readbackEmitted[READBACK_LATENCY] = {};
+        unsigned long long updates = 0;
+        size_t simulateBound = 0;       //at least as many as are alive, the simulate kernel runs over this many
+
+        static const CompactTable &compactTable(){
+            static const CompactTable table;
+            return table;
+        }
+
+        /**
+         * makes attribute a of vao read floats from buffers[a] at offsets[a], one per instance
+        */
+        static void pointAttributes(unsigned int vao, const unsigned int buffers[DRAWN_FIELDS], const size_t offsets[DRAWN_FIELDS]){
+            glBindVertexArray(vao);
+            for(int a = 0; a < DRAWN_FIELDS; a++){
+                glBindBuffer(GL_ARRAY_BUFFER, buffers[a]);
+                glEnableVertexAttribArray(a);
+                glVertexAttribPointer(a, 1, GL_FLOAT, GL_FALSE, sizeof(float), (void*)offsets[a]);
+                glVertexAttribDivisor(a, 1);
+            }
+            glBindVertexArray(0);
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+        }
+
+        /**
+         * lowbias32 integer hash, the same as hash() in common/particles.glsl
+        */
+        static uint32_t hash(uint32_t x){
+            x ^= x >> 16;
+            x *= 0x7feb352du;
+            x ^= x >> 15;
+            x *= 0x846ca68bu;
+            x ^= x >> 16;
+            return x;
+        }
+
+        /**
+         * @return uniform random number in [0, 1) for field of the particle emitted index-th
+        */
+        static float random(uint32_t index, uint32_t field){
+            return (float)(hash(index * 8u + field) >> 8) * (1.0f / 16777216.0f);
+        }
+
+        /**
+         * counts the particles in [begin, end) that live through the step
+        */
+        static size_t countSurvivors(const float *age, const float *life, float dt, size_t begin, size_t end){
+            const CompactTable &table = compactTable();
+            size_t survivors = 0;
+            size_t i = begin;
+#if defined(CULL_AVX2)
+            __m256 step = _mm256_set1_ps(dt);
+            for(; i + 8 <= end; i += 8){
+                __m256 aged = _mm256_add_ps(_mm256_loadu_ps(age + i), step);
+                survivors += table.counts[_mm256_movemask_ps(_mm256_cmp_ps(aged, _mm256_loadu_ps(life + i), _CMP_LT_OQ))];
+            }
+#elif defined(CULL_SSE)
+            __m128 step = _mm_set1_ps(dt);
+            for(; i + 4 <= end; i += 4){
+                __m128 aged = _mm_add_ps(_mm_loadu_ps(age + i), step);
+                survivors += table.counts[_mm_movemask_ps(_mm_cmplt_ps(aged, _mm_loadu_ps(life + i)))];
+            }
+#endif
+            for(; i < end; i++)
+                survivors += age[i] + dt < life[i];
+            return survivors;
+        }
+
+        /**
+         * steps the particles in [begin, end) of src and writes the survivors, packed, to dst from out on
+         * @param outEnd out plus the survivors countSurvivors() counted, nothing is written past it
+        */
+        static void simulateChunk(float *const *src, float *const *dst, const Step &step, size_t begin, size_t end, size_t out, size_t outEnd){
+            size_t i = begin;
+#if defined(CULL_AVX2)
+            const CompactTable &table = compactTable();
+            __m256 dt = _mm256_set1_ps(step.dt), damping = _mm256_set1_ps(step.damping), gravity = _mm256_set1_ps(step.gravity);
+            __m256 ground = _mm256_set1_ps(step.ground), bounce = _mm256_set1_ps(step.bounce);
+            for(; i + 8 <= end; i += 8){
+                __m256 age = _mm256_add_ps(_mm256_loadu_ps(src[AGE] + i), dt);
+                __m256 life = _mm256_loadu_ps(src[LIFE] + i);
+                int bits = _mm256_movemask_ps(_mm256_cmp_ps(age, life, _CMP_LT_OQ));
+                if(bits == 0)
+                    continue;
+                __m256 vx = _mm256_mul_ps(_mm256_loadu_ps(src[VELOCITY_X] + i), damping);
+                __m256 vy = _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(src[VELOCITY_Y] + i), damping), gravity);
+                __m256 vz = _mm256_mul_ps(_mm256_loadu_ps(src[VELOCITY_Z] + i), damping);
+                __m256 x = _mm256_add_ps(_mm256_loadu_ps(src[POSITION_X] + i), _mm256_mul_ps(vx, dt));
+                __m256 y = _mm256_add_ps(_mm256_loadu_ps(src[POSITION_Y] + i), _mm256_mul_ps(vy, dt));
+                __m256 z = _mm256_add_ps(_mm256_loadu_ps(src[POSITION_Z] + i), _mm256_mul_ps(vz, dt));
+                __m256 below = _mm256_cmp_ps(y, ground, _CMP_LT_OQ);
+                y = _mm256_blendv_ps(y, ground, below);
+                vy = _mm256_blendv_ps(vy, _mm256_mul_ps(vy, bounce), below);
+                __m256 values[FIELDS] = {x, y, z, vx, vy, vz, age, life};
+                if(out + 8 <= outEnd){
+                    //left pack the survivors, the lanes stored past them are overwritten by the next block
+                    __m256i lanes = _mm256_load_si256((const __m256i*)table.lanes[bits]);
+                    for(int f = 0; f < FIELDS; f++)
+                        _mm256_storeu_ps(dst[f] + out, _mm256_permutevar8x32_ps(values[f], lanes));
+                    out += table.counts[bits];
+                } else{
+                    //the chunk's last few survivors, 8 wide stores would run into the next chunk's
+                    alignas(32) float lanes[FIELDS][8];
+                    for(int f = 0; f < FIELDS; f++)
+                        _mm256_store_ps(lanes[f], values[f]);
+                    for(int k = 0; k < 8; k++){
+                        if(!(bits >> k & 1))
+                            continue;
+                        for(int f = 0; f < FIELDS; f++)
+                            dst[f][out] = lanes[f][k];
+                        out++;
+                    }
+                }
+            }
+#elif defined(CULL_SSE)
+            __m128 dt = _mm_set1_ps(step.dt), damping = _mm_set1_ps(step.damping), gravity = _mm_set1_ps(step.gravity);
+            __m128 ground = _mm_set1_ps(step.ground), bounce = _mm_set1_ps(step.bounce);
+            for(; i + 4 <= end; i += 4){
+                __m128 age = _mm_add_ps(_mm_loadu_ps(src[AGE] + i), dt);
+                __m128 life = _mm_loadu_ps(src[LIFE] + i);
+                int bits = _mm_movemask_ps(_mm_cmplt_ps(age, life));
+                if(bits == 0)
+                    continue;
+                __m128 vx = _mm_mul_ps(_mm_loadu_ps(src[VELOCITY_X] + i), damping);
+                __m128 vy = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(src[VELOCITY_Y] + i), damping), gravity);
+                __m128 vz = _mm_mul_ps(_mm_loadu_ps(src[VELOCITY_Z] + i), damping);
+                __m128 x = _mm_add_ps(_mm_loadu_ps(src[POSITION_X] + i), _mm_mul_ps(vx, dt));
+                __m128 y = _mm_add_ps(_mm_loadu_ps(src[POSITION_Y] + i), _mm_mul_ps(vy, dt));
+                __m128 z = _mm_add_ps(_mm_loadu_ps(src[POSITION_Z] + i), _mm_mul_ps(vz, dt));
+                __m128 below = _mm_cmplt_ps(y, ground);
+                y = _mm_or_ps(_mm_and_ps(below, ground), _mm_andnot_ps(below, y));
+                vy = _mm_or_ps(_mm_and_ps(below, _mm_mul_ps(vy, bounce)), _mm_andnot_ps(below, vy));
+                //SSE has no lane permute, the survivors are packed one by one
+                alignas(16) float lanes[FIELDS][4];
+                __m128 values[FIELDS] = {x, y, z, vx, vy, vz, age, life};
+                for(int f = 0; f < FIELDS; f++)
+                    _mm_store_ps(lanes[f], values[f]);
+                for(int k = 0; k < 4; k++){
+                    if(!(bits >> k & 1))
+                        continue;
+                    for(int f = 0; f < FIELDS; f++)
+                        dst[f][out] = lanes[f][k];
+                    out++;
+                }
+            }
+#endif
+            for(; i < end; i++){
+                float age = src[AGE][i] + step.dt;
+                if(!(age < src[LIFE][i]))
+                    continue;
+                float vx = src[VELOCITY_X][i] * step.damping;
+                float vy = src[VELOCITY_Y][i] * step.damping + step.gravity;
+                float vz = src[VELOCITY_Z][i] * step.damping;
+                float y = src[POSITION_Y][i] + vy * step.dt;
+                if(y < step.ground){
+                    y = step.ground;
+                    vy = vy * step.bounce;
+                }
+                dst[POSITION_X][out] = src[POSITION_X][i] + vx * step.dt;
+                dst[POSITION_Y][out] = y;
+                dst[POSITION_Z][out] = src[POSITION_Z][i] + vz * step.dt;
+                dst[VELOCITY_X][out] = vx;
+                dst[VELOCITY_Y][out] = vy;
+                dst[VELOCITY_Z][out] = vz;
+                dst[AGE][out] = age;
+                dst[LIFE][out] = src[LIFE][i];
+                out++;
+            }
+            (void)outEnd;
+        }
+
+#if defined(CULL_AVX2)
+        static __m256i hash8(__m256i x){
+            x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 16));
+            x = _mm256_mullo_epi32(x, _mm256_set1_epi32(0x7feb352d));
+            x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 15));
+            x = _mm256_mullo_epi32(x, _mm256_set1_epi32((int)0x846ca68bu));
+            return _mm256_xor_si256(x, _mm256_srli_epi32(x, 16));
+        }
+
+        static __m256 random8(__m256i index, uint32_t field){
+            __m256i key = _mm256_add_epi32(_mm256_slli_epi32(index, 3), _mm256_set1_epi32((int)field));
+            return _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(hash8(key), 8)), _mm256_set1_ps(1.0f / 16777216.0f));
+        }
+#endif
+
+        /**
+         * writes count new particles to the streams from first on, emission indices from emittedTotal on
+        */
+        void emitCpu(float *const *dst, size_t first, size_t count){
+            const ParticleEmitter e = emitter;
+            uint32_t base = emittedTotal;
+            JobSystem::instance().parallelFor(count, CHUNK, [&](size_t begin, size_t end){
+                size_t i = begin;
+#if defined(CULL_AVX2)
+                __m256 one = _mm256_set1_ps(1.0f), two = _mm256_set1_ps(2.0f);
+                __m256 radius = _mm256_set1_ps(e.radius), spread = _mm256_set1_ps(e.spread);
+                __m256 minLife = _mm256_set1_ps(e.minLife), lifeRange = _mm256_set1_ps(e.maxLife - e.minLife);
+                for(; i + 8 <= end; i += 8){
+                    __m256i index = _mm256_add_epi32(_mm256_set1_epi32((int)(base + (uint32_t)i)), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+                    //a random number r in [0, 1) becomes an offset in [-scale, scale) as (2r - 1) * scale
+                    auto offset = [&](uint32_t field, __m256 scale){
+                        return _mm256_mul_ps(_mm256_sub_ps(_mm256_mul_ps(random8(index, field), two), one), scale);
+                    };
+                    size_t o = first + i;
+                    _mm256_storeu_ps(dst[POSITION_X] + o, _mm256_add_ps(_mm256_set1_ps(e.position.x), offset(RANDOM_X, radius)));
+                    _mm256_storeu_ps(dst[POSITION_Y] + o, _mm256_set1_ps(e.position.y));
+                    _mm256_storeu_ps(dst[POSITION_Z] + o, _mm256_add_ps(_mm256_set1_ps(e.position.z), offset(RANDOM_Z, radius)));
+                    _mm256_storeu_ps(dst[VELOCITY_X] + o, _mm256_add_ps(_mm256_set1_ps(e.velocity.x), offset(RANDOM_VELOCITY_X, spread)));
+                    _mm256_storeu_ps(dst[VELOCITY_Y] + o, _mm256_add_ps(_mm256_set1_ps(e.velocity.y), offset(RANDOM_VELOCITY_Y, spread)));
+                    _mm256_storeu_ps(dst[VELOCITY_Z] + o, _mm256_add_ps(_mm256_set1_ps(e.velocity.z), offset(RANDOM_VELOCITY_Z, spread)));
+                    _mm256_storeu_ps(dst[AGE] + o, _mm256_setzero_ps());
+                    _mm256_storeu_ps(dst[LIFE] + o, _mm256_add_ps(minLife, _mm256_mul_ps(random8(index, RANDOM_LIFE), lifeRange)));
+                }
+#endif
+                for(; i < end; i++){
+                    uint32_t index = base + (uint32_t)i;
+                    size_t o = first + i;
+                    dst[POSITION_X][o] = e.position.x + (random(index, RANDOM_X) * 2.0f - 1.0f) * e.radius;
+                    dst[POSITION_Y][o] = e.position.y;
+                    dst[POSITION_Z][o] = e.position.z + (random(index, RANDOM_Z) * 2.0f - 1.0f) * e.radius;
+                    dst[VELOCITY_X][o] = e.velocity.x + (random(index, RANDOM_VELOCITY_X) * 2.0f - 1.0f) * e.spread;
+                    dst[VELOCITY_Y][o] = e.velocity.y + (random(index, RANDOM_VELOCITY_Y) * 2.0f - 1.0f) * e.spread;
+                    dst[VELOCITY_Z][o] = e.velocity.z + (random(index, RANDOM_VELOCITY_Z) * 2.0f - 1.0f) * e.spread;
+                    dst[AGE][o] = 0.0f;
+                    dst[LIFE][o] = e.minLife + random(index, RANDOM_LIFE) * (e.maxLife - e.minLife);
+                }
+            });
+        }
+
+        void updateCpu(const Step &step, size_t emitCount){
+            float *src[FIELDS], *dst[FIELDS];
+            for(int f = 0; f < FIELDS; f++){
+                src[f] = streams[current].data() + f * room;
+                dst[f] = streams[1 - current].data() + f * room;
+            }
+            JobSystem &jobs = JobSystem::instance();
+            //survivors per chunk, then each chunk's offset in the other copy is the sum of those before it
+            size_t chunks = (alive + CHUNK - 1) / CHUNK;
+            chunkCounts.assign(chunks + 1, 0);
+            jobs.parallelFor(alive, CHUNK, [&](size_t begin, size_t end){
+                for(size_t chunk = begin; chunk < end; chunk += CHUNK)
+                    chunkCounts[chunk / CHUNK + 1] = countSurvivors(src[AGE], src[LIFE], step.dt, chunk, std::min(chunk + CHUNK, end));
+            });
+            for(size_t c = 1; c <= chunks; c++)
+                chunkCounts[c] += chunkCounts[c - 1];
+            jobs.parallelFor(alive, CHUNK, [&](size_t begin, size_t end){
+                for(size_t chunk = begin; chunk < end; chunk += CHUNK){
+                    size_t c = chunk / CHUNK;
+                    simulateChunk(src, dst, step, chunk, std::min(chunk + CHUNK, end), chunkCounts[c], chunkCounts[c + 1]);
+                }
+            });
+            size_t survivors = chunkCounts[chunks];
+
+            size_t born = std::min(emitCount, room - survivors);
+            emitCpu(dst, survivors, born);
+            emittedTotal += (uint32_t)born;
+            alive = survivors + born;
+            current = 1 - current;
+            stats.alive = alive;
+            stats.emitted = born;
+            stats.dropped = emitCount - born;
+        }
+
+        /**
+         * copies the live range of the streams the vertex shader reads to where vaos[0] reads them
+        */
+        void upload(){
+            PROFILE_ZONE("particle upload");
+            double start = nowSeconds();
+            unsigned int sources[DRAWN_FIELDS];
+            size_t offsets[DRAWN_FIELDS];
+            size_t bytes = alive * sizeof(float);
+            if(frames != NULL){
+                //each stream may land in a different buffer when the upload buffer grows in between
+                for(int a = 0; a < DRAWN_FIELDS; a++){
+                    TransientAllocation range = frames->upload(streams[current].data() + DRAWN[a] * room, bytes, sizeof(float));
+                    sources[a] = range.buffer;
+                    offsets[a] = range.offset;
+                }
+            } else{
+                glBindBuffer(GL_ARRAY_BUFFER, buffers[0]);
+                //orphan the buffer so last frame's draw can still read the old contents
+                glBufferData(GL_ARRAY_BUFFER, DRAWN_FIELDS * room * sizeof(float), NULL, GL_STREAM_DRAW);
+                for(int a = 0; a < DRAWN_FIELDS; a++){
+                    sources[a] = buffers[0];
+                    offsets[a] = a * room * sizeof(float);
+                    glBufferSubData(GL_ARRAY_BUFFER, offsets[a], bytes, streams[current].data() + DRAWN[a] * room);
+                }
+            }
+            pointAttributes(vaos[0], sources, offsets);
+            stats.uploadMs = (nowSeconds() - start) * 1000.0;
+        }
+
+        void updateGpu(const Step &step, size_t emitCount){
+            PROFILE_GPU_ZONE("particles");
+            //the live count of READBACK_LATENCY updates ago plus everything emitted since bounds the count now.
+            //several updates can run in one frame, so the copy may not have landed yet; reading it then
+            //would stall, and the running bound stays valid until a later update can read its slot
+            int slot = updates % READBACK_LATENCY;
+            GLenum state = GL_TIMEOUT_EXPIRED;
+            if(readbackFences[slot] != NULL){
+                state = glClientWaitSync(readbackFences[slot], GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+                glDeleteSync(readbackFences[slot]);
+                readbackFences[slot] = NULL;
+            }
+            if(state == GL_ALREADY_SIGNALED || state == GL_CONDITION_SATISFIED){
+                uint32_t count = 0;
+                glBindBuffer(GL_COPY_READ_BUFFER, readbackBuffers[slot]);
+                glGetBufferSubData(GL_COPY_READ_BUFFER, 0, sizeof(count), &count);
+                glBindBuffer(GL_COPY_READ_BUFFER, 0);
+                stats.alive = count;
+                simulateBound = count;
+                for(int s = 0; s < READBACK_LATENCY; s++)
+                    if(s != slot)
+                        simulateBound += readbackEmitted[s];
+                simulateBound = std::min(simulateBound, room);
+            }
+            int src = current, dst = 1 - current;
+            //the kernels count the survivors and the newborn up from 0
+            GLuint zero = 0;
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, commandBuffer);
+            glClearBufferSubData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, dst * sizeof(DrawCommand) + offsetof(DrawCommand, instanceCount),
+                                 sizeof(uint32_t), GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, buffers[src]);
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, buffers[dst]);
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, commandBuffer);
+            glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+
+            if(simulateBound > 0){
+                simulateShader.use();
+                glUniform1ui(simulateShader.getUniformLocation("capacity"), (GLuint)room);
+                glUniform1ui(simulateShader.getUniformLocation("sourceCommand"), (GLuint)src);
+                glUniform1ui(simulateShader.getUniformLocation("destinationCommand"), (GLuint)dst);
+                glUniform1f(simulateShader.getUniformLocation("dt"), step.dt);
+                glUniform1f(simulateShader.getUniformLocation("damping"), step.damping);
+                glUniform1f(simulateShader.getUniformLocation("gravity"), step.gravity);
+                glUniform1f(simulateShader.getUniformLocation("ground"), step.ground);
+                glUniform1f(simulateShader.getUniformLocation("bounce"), step.bounce);
+                ComputeShader::dispatch1D((unsigned int)simulateBound, GROUP_SIZE);
+                //the newborn go after every survivor
+                glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+            }
+            if(emitCount > 0){
+                emitShader.use();
+                glUniform1ui(emitShader.getUniformLocation("capacity"), (GLuint)room);
+                glUniform1ui(emitShader.getUniformLocation("destinationCommand"), (GLuint)dst);
+                glUniform1ui(emitShader.getUniformLocation("emitCount"), (GLuint)emitCount);
+                glUniform1ui(emitShader.getUniformLocation("firstIndex"), emittedTotal);
+                glUniform3fv(emitShader.getUniformLocation("emitterPosition"), 1, glm::value_ptr(emitter.position));
+                glUniform1f(emitShader.getUniformLocation("emitterRadius"), emitter.radius);
+                glUniform3fv(emitShader.getUniformLocation("emitterVelocity"), 1, glm::value_ptr(emitter.velocity));
+                glUniform1f(emitShader.getUniformLocation("spread"), emitter.spread);
+                glUniform1f(emitShader.getUniformLocation("minLife"), emitter.minLife);
+                glUniform1f(emitShader.getUniformLocation("maxLife"), emitter.maxLife);
+                ComputeShader::dispatch1D((unsigned int)emitCount, GROUP_SIZE);
+            }
+            glMemoryBarrier(GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+            for(int binding = 0; binding < 3; binding++)
+                glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, 0);
+
+            //keep the count for a later update to read without waiting
+            glBindBuffer(GL_COPY_READ_BUFFER, commandBuffer);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, readbackBuffers[slot]);
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, dst * sizeof(DrawCommand) + offsetof(DrawCommand, instanceCount), 0, sizeof(uint32_t));
+            glBindBuffer(GL_COPY_READ_BUFFER, 0);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+            readbackFences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            readbackEmitted[slot] = emitCount;
+            updates++;
+
+            emittedTotal += (uint32_t)emitCount;
+            simulateBound = std::min(simulateBound + emitCount, room);
+            current = dst;
+            stats.emitted = emitCount;
+        }
+};
+
+#endif
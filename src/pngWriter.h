@@ -0,0 +1,152 @@
+/**
+ * Minimal PNG writer: 8-bit RGBA, no filtering, and zlib "stored" (uncompressed)
+ * deflate blocks. Files are larger than a real encoder's but need nothing beyond
+ * a CRC and an Adler checksum, and writing is fast enough to dump every frame.
+ * writeRaw() skips even that, for tools that take headerless RGBA.
+*/
+#ifndef PNG_WRITER_H
+#define PNG_WRITER_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <array>
+#include <vector>
+
+/**
+ * @return CRC-32 (as used by PNG chunks) of data, continuing from crc
+*/
+inline uint32_t pngCrc(const unsigned char *data, size_t size, uint32_t crc = 0){
+    //slicing by 8: table[k][n] is the CRC of byte n followed by k zero bytes, so 8 bytes
+    //take 8 independent lookups instead of a chain of 8 dependent ones
+    static const std::array<std::array<uint32_t, 256>, 8> table = []{
+        std::array<std::array<uint32_t, 256>, 8> entries;
+        for(uint32_t n = 0; n < 256; n++){
+            uint32_t c = n;
+            for(int k = 0; k < 8; k++)
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            entries[0][n] = c;
+        }
+        for(int k = 1; k < 8; k++)
+            for(uint32_t n = 0; n < 256; n++)
+                entries[k][n] = (entries[k - 1][n] >> 8) ^ entries[0][entries[k - 1][n] & 0xFF];
+        return entries;
+    }();
+    crc = ~crc;
+    size_t i = 0;
+    for(; i + 8 <= size; i += 8){
+        uint32_t low = crc ^ ((uint32_t)data[i] | (uint32_t)data[i + 1] << 8 | (uint32_t)data[i + 2] << 16 | (uint32_t)data[i + 3] << 24);
+        crc = table[7][low & 0xFF] ^ table[6][(low >> 8) & 0xFF] ^ table[5][(low >> 16) & 0xFF] ^ table[4][low >> 24] ^
+              table[3][data[i + 4]] ^ table[2][data[i + 5]] ^ table[1][data[i + 6]] ^ table[0][data[i + 7]];
+    }
+    for(; i < size; i++)
+        crc = table[0][(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+/**
+ * writes an RGBA image as a PNG file
+ * @param path the file to write
+ * @param width width of the image in pixels
+ * @param height height of the image in pixels
+ * @param rgba width * height * 4 bytes
+ * @param bottomUp true if rgba starts with the bottom row, as glReadPixels returns it
+ * @return false if the file couldn't be written
+*/
+inline bool writePng(const char *path, int width, int height, const unsigned char *rgba, bool bottomUp){
+    size_t rowSize = (size_t)width * 4 + 1;     //filter byte + pixels
+    std::vector<unsigned char> raw(rowSize * height);
+    for(int y = 0; y < height; y++){
+        int source = bottomUp ? height - 1 - y : y;
+        raw[y * rowSize] = 0;
+        memcpy(&raw[y * rowSize + 1], rgba + (size_t)source * width * 4, (size_t)width * 4);
+    }
+
+    //zlib stream of stored deflate blocks, at most 65535 bytes each
+    std::vector<unsigned char> zlib = {0x78, 0x01};
+    zlib.reserve(raw.size() + raw.size() / 65535 * 5 + 16);
+    uint32_t a = 1, b = 0;
+    for(size_t offset = 0; offset < raw.size() || offset == 0; ){
+        size_t size = std::min<size_t>(raw.size() - offset, 65535);
+        bool last = offset + size == raw.size();
+        zlib.push_back(last ? 1 : 0);
+        zlib.push_back(size & 0xFF);
+        zlib.push_back((size >> 8) & 0xFF);
+        zlib.push_back(~size & 0xFF);
+        zlib.push_back((~size >> 8) & 0xFF);
+        zlib.insert(zlib.end(), raw.begin() + offset, raw.begin() + offset + size);
+        //5552 bytes is the most that can be summed before b could overflow 32 bits
+        for(size_t run = offset; run < offset + size; run += 5552){
+            size_t runEnd = std::min(offset + size, run + 5552);
+            for(size_t i = run; i < runEnd; i++){
+                a += raw[i];
+                b += a;
+            }
+            a %= 65521;
+            b %= 65521;
+        }
+        offset += size;
+        if(last)
+            break;
+    }
+    uint32_t adler = (b << 16) | a;
+    for(int shift = 24; shift >= 0; shift -= 8)
+        zlib.push_back((adler >> shift) & 0xFF);
+
+    FILE *file = fopen(path, "wb");
+    if(file == NULL){
+        printf("failed to write %s\n", path);
+        return false;
+    }
+    auto writeChunk = [&](const char *type, const unsigned char *data, size_t size){
+        unsigned char header[8] = {
+            (unsigned char)(size >> 24), (unsigned char)(size >> 16), (unsigned char)(size >> 8), (unsigned char)size,
+            (unsigned char)type[0], (unsigned char)type[1], (unsigned char)type[2], (unsigned char)type[3],
+        };
+        uint32_t crc = pngCrc(data, size, pngCrc(header + 4, 4));
+        unsigned char footer[4] = {(unsigned char)(crc >> 24), (unsigned char)(crc >> 16), (unsigned char)(crc >> 8), (unsigned char)crc};
+        fwrite(header, 1, 8, file);
+        if(size > 0)
+            fwrite(data, 1, size, file);
+        fwrite(footer, 1, 4, file);
+    };
+    const unsigned char signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    fwrite(signature, 1, 8, file);
+    unsigned char ihdr[13] = {
+        (unsigned char)(width >> 24), (unsigned char)(width >> 16), (unsigned char)(width >> 8), (unsigned char)width,
+        (unsigned char)(height >> 24), (unsigned char)(height >> 16), (unsigned char)(height >> 8), (unsigned char)height,
+        8, 6, 0, 0, 0,      //8 bits per channel, RGBA, deflate, no filtering, no interlacing
+    };
+    writeChunk("IHDR", ihdr, sizeof(ihdr));
+    writeChunk("IDAT", zlib.data(), zlib.size());
+    writeChunk("IEND", NULL, 0);
+    bool ok = ferror(file) == 0;
+    fclose(file);
+    return ok;
+}
+
+/**
+ * writes an RGBA image as headerless pixels, top row first
+ * @param path the file to write
+ * @param width width of the image in pixels
+ * @param height height of the image in pixels
+ * @param rgba width * height * 4 bytes
+ * @param bottomUp true if rgba starts with the bottom row, as glReadPixels returns it
+ * @return false if the file couldn't be written
+*/
+inline bool writeRaw(const char *path, int width, int height, const unsigned char *rgba, bool bottomUp){
+    FILE *file = fopen(path, "wb");
+    if(file == NULL){
+        printf("failed to write %s\n", path);
+        return false;
+    }
+    size_t rowSize = (size_t)width * 4;
+    for(int y = 0; y < height; y++)
+        fwrite(rgba + (size_t)(bottomUp ? height - 1 - y : y) * rowSize, 1, rowSize, file);
+    bool ok = ferror(file) == 0;
+    fclose(file);
+    return ok;
+}
+
+#endif
@@ -0,0 +1,354 @@
+/**
+ * CPU/GPU profiler with chrome://tracing (and Perfetto) export.
+ *
+ * CPU zones are scoped: PROFILE_ZONE("name") records the time from its line to
+ * the end of the enclosing block into a ring buffer owned by the calling
+ * thread, so recording takes no locks. GPU zones (PROFILE_GPU_ZONE) write
+ * GL_TIMESTAMP queries around the GL commands in their scope; the queries of a
+ * frame are only read GPU_LATENCY frames later, when they are long finished,
+ * so reading them never stalls. PROFILE_COUNTER("name", value) records a value
+ * that shows up as a graph over time. Nothing is recorded until capture starts.
+ *
+ * names must be string literals (or otherwise outlive the profiler), only the
+ * pointer is stored. build with -DDISABLE_PROFILER to compile every zone out.
+*/
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <glad/glad.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct ProfileEvent{
+    const char *name;
+    int64_t start;      //ns since the profiler started
+    int64_t end;        //-1 for counters
+    double value;       //value of a counter
+};
+
+/**
+ * Events of one thread. only the owning thread writes, older events are overwritten once it's full
+*/
+class ProfileThreadBuffer{
+    public:
+        static constexpr size_t CAPACITY = 1 << 16;
+
+        std::string name;
+        int id;
+
+        ProfileThreadBuffer(const std::string &name, int id) : name(name), id(id), events(CAPACITY){}
+
+        void push(const ProfileEvent &event){
+            uint64_t index = head.load(std::memory_order_relaxed);
+            events[index % CAPACITY] = event;
+            head.store(index + 1, std::memory_order_release);
+        }
+
+        /**
+         * @param out the buffered events are appended to it, oldest first
+        */
+        void copyTo(std::vector<ProfileEvent> &out) const{
+            uint64_t end = head.load(std::memory_order_acquire);
+            uint64_t begin = end > CAPACITY ? end - CAPACITY : 0;
+            for(uint64_t i = begin; i < end; i++)
+                out.push_back(events[i % CAPACITY]);
+        }
+
+        void clear(){
+            head.store(0, std::memory_order_release);
+        }
+
+    private:
+        std::vector<ProfileEvent> events;
+        std::atomic<uint64_t> head{0};      //total events ever pushed
+};
+
+class Profiler{
+    public:
+        static constexpr int GPU_LATENCY = 4;      //frames between issuing GPU queries and reading them
+
+        static Profiler &instance(){
+            static Profiler profiler;
+            return profiler;
+        }
+
+        /**
+         * @return ns elapsed since the profiler was created
+        */
+        int64_t now() const{
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+        }
+
+        bool capturing() const{
+            return enabled.load(std::memory_order_relaxed);
+        }
+
+        /**
+         * pre: none
+         * post: zones are recorded from now on, previous events are discarded
+        */
+        void startCapture(){
+            std::lock_guard<std::mutex> lock(mutex);
+            for(std::unique_ptr<ProfileThreadBuffer> &buffer : buffers)
+                buffer->clear();
+            enabled = true;
+        }
+
+        void stopCapture(){
+            enabled = false;
+        }
+
+        /**
+         * names the calling thread in exported traces
+        */
+        void setThreadName(const std::string &name){
+            ProfileThreadBuffer &buffer = threadBuffer();
+            std::lock_guard<std::mutex> lock(mutex);
+            buffer.name = name;
+        }
+
+        /**
+         * @return the calling thread's event buffer, created on first use
+        */
+        ProfileThreadBuffer &threadBuffer(){
+            static thread_local ProfileThreadBuffer *buffer = NULL;
+            if(buffer == NULL)
+                buffer = addBuffer("thread");
+            return *buffer;
+        }
+
+        /**
+         * records the value of a counter at the current time
+         * @param name the counter, a string literal
+        */
+        void counter(const char *name, double value){
+            if(capturing())
+                threadBuffer().push({name, now(), -1, value});
+        }
+
+        //----------------------------------- GPU -----------------------------------
+
+        /**
+         * enables GPU zones
+         * pre: a GL context is current on the calling thread, the only thread GPU zones may be used on
+        */
+        void initGpu(){
+            gpuBuffer = addBuffer("GPU");
+            gpuReady = true;
+        }
+
+        /**
+         * marks the start of a frame: reads back the GPU zones of GPU_LATENCY frames ago
+         * and starts a new set of queries
+         * pre: called once per frame on the GL thread
+        */
+        void newFrame(){
+            if(!gpuReady)
+                return;
+            frameIndex = (frameIndex + 1) % GPU_LATENCY;
+            GpuFrame &frame = gpuFrames[frameIndex];
+            if(!frame.zones.empty())
+                collect(frame);
+            frame.zones.clear();
+            frame.used = 0;
+            //map GPU time onto the CPU timeline of this frame
+            GLint64 gpuNow = 0;
+            glGetInteger64v(GL_TIMESTAMP, &gpuNow);
+            frame.gpuToCpu = now() - gpuNow;
+        }
+
+        /**
+         * @return a handle for endGpuZone, -1 if nothing is recorded
+        */
+        int beginGpuZone(const char *name){
+            if(!gpuReady || !capturing())
+                return -1;
+            GpuFrame &frame = gpuFrames[frameIndex];
+            frame.zones.push_back({name, writeTimestamp(frame), 0});
+            return (int)frame.zones.size() - 1;
+        }
+
+        void endGpuZone(int zone){
+            if(zone < 0)
+                return;
+            GpuFrame &frame = gpuFrames[frameIndex];
+            frame.zones[zone].endQuery = writeTimestamp(frame);
+        }
+
+        /**
+         * pre: the context given to initGpu is current
+         * post: every query object is deleted and GPU zones are disabled
+        */
+        void destroyGpu(){
+            for(GpuFrame &frame : gpuFrames){
+                if(!frame.queries.empty())
+                    glDeleteQueries((GLsizei)frame.queries.size(), frame.queries.data());
+                frame.queries.clear();
+                frame.zones.clear();
+            }
+            gpuReady = false;
+        }
+
+        //--------------------------------- export ---------------------------------
+
+        /**
+         * writes every buffered event as a Chrome trace event file
+         * @param path file to write, open it in chrome://tracing or ui.perfetto.dev
+         * @return false if the file couldn't be written
+         * pre: best called between frames, events recorded while exporting may be torn
+        */
+        bool exportChromeTrace(const char *path){
+            FILE *file = fopen(path, "w");
+            if(file == NULL){
+                printf("failed to write trace %s\n", path);
+                return false;
+            }
+            fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+            bool first = true;
+            size_t count = 0;
+            std::vector<ProfileEvent> events;
+            std::lock_guard<std::mutex> lock(mutex);
+            for(std::unique_ptr<ProfileThreadBuffer> &buffer : buffers){
+                fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                        first ? "" : ",\n", buffer->id, escape(buffer->name.c_str()).c_str());
+                first = false;
+                events.clear();
+                buffer->copyTo(events);
+                for(const ProfileEvent &event : events){
+                    if(event.end < 0)
+                        fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"C\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"args\":{\"value\":%g}}",
+                                escape(event.name).c_str(), buffer->id, event.start / 1000.0, event.value);
+                    else
+                        fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+                                escape(event.name).c_str(), buffer->id, event.start / 1000.0, (event.end - event.start) / 1000.0);
+                }
+                count += events.size();
+            }
+            fprintf(file, "\n]}\n");
+            fclose(file);
+            printf("wrote %zu profiler events to %s\n", count, path);
+            return true;
+        }
+
+    private:
+        struct GpuZoneRecord{
+            const char *name;
+            size_t beginQuery;          //indices into the frame's queries
+            size_t endQuery;
+        };
+
+        struct GpuFrame{
+            std::vector<unsigned int> queries;      //reused every time the frame comes around
+            size_t used = 0;
+            std::vector<GpuZoneRecord> zones;
+            int64_t gpuToCpu = 0;
+        };
+
+        std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+        std::atomic<bool> enabled{false};
+        std::mutex mutex;                           //guards buffers
+        std::vector<std::unique_ptr<ProfileThreadBuffer>> buffers;
+
+        bool gpuReady = false;
+        ProfileThreadBuffer *gpuBuffer = NULL;
+        GpuFrame gpuFrames[GPU_LATENCY];
+        int frameIndex = 0;
+
+        ProfileThreadBuffer *addBuffer(const char *name){
+            std::lock_guard<std::mutex> lock(mutex);
+            buffers.emplace_back(new ProfileThreadBuffer(name, (int)buffers.size()));
+            return buffers.back().get();
+        }
+
+        size_t writeTimestamp(GpuFrame &frame){
+            if(frame.used == frame.queries.size()){
+                frame.queries.push_back(0);
+                glGenQueries(1, &frame.queries.back());
+            }
+            glQueryCounter(frame.queries[frame.used], GL_TIMESTAMP);
+            return frame.used++;
+        }
+
+        /**
+         * moves the finished GPU zones of a frame into the GPU event buffer
+        */
+        void collect(GpuFrame &frame){
+            GLint available = 0;
+            glGetQueryObjectiv(frame.queries[frame.used - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+            //still not done after GPU_LATENCY frames: drop it rather than wait
+            if(!available)
+                return;
+            for(const GpuZoneRecord &zone : frame.zones){
+                GLuint64 begin = 0, end = 0;
+                glGetQueryObjectui64v(frame.queries[zone.beginQuery], GL_QUERY_RESULT, &begin);
+                glGetQueryObjectui64v(frame.queries[zone.endQuery], GL_QUERY_RESULT, &end);
+                gpuBuffer->push({zone.name, (int64_t)begin + frame.gpuToCpu, (int64_t)end + frame.gpuToCpu, 0.0});
+            }
+        }
+
+        static std::string escape(const char *text){
+            std::string out;
+            for(; *text; text++){
+                if(*text == '"' || *text == '\\')
+                    out += '\\';
+                out += *text;
+            }
+            return out;
+        }
+};
+
+/**
+ * records the time from construction to destruction as a CPU zone
+*/
+class ProfileZone{
+    public:
+        explicit ProfileZone(const char *name) : name(name){
+            if(Profiler::instance().capturing())
+                start = Profiler::instance().now();
+        }
+
+        ~ProfileZone(){
+            if(start >= 0 && Profiler::instance().capturing())
+                Profiler::instance().threadBuffer().push({name, start, Profiler::instance().now(), 0.0});
+        }
+
+    private:
+        const char *name;
+        int64_t start = -1;
+};
+
+/**
+ * records the GPU time of the GL commands issued during its lifetime
+*/
+class GpuProfileZone{
+    public:
+        explicit GpuProfileZone(const char *name) : zone(Profiler::instance().beginGpuZone(name)){}
+
+        ~GpuProfileZone(){
+            Profiler::instance().endGpuZone(zone);
+        }
+
+    private:
+        int zone;
+};
+
+#ifndef DISABLE_PROFILER
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+#define PROFILE_ZONE(name) ProfileZone PROFILE_CONCAT(profileZone, __LINE__)(name)
+#define PROFILE_GPU_ZONE(name) GpuProfileZone PROFILE_CONCAT(gpuProfileZone, __LINE__)(name)
+#define PROFILE_COUNTER(name, value) Profiler::instance().counter(name, value)
+#else
+#define PROFILE_ZONE(name) ((void)0)
+#define PROFILE_GPU_ZONE(name) ((void)0)
+#define PROFILE_COUNTER(name, value) ((void)0)
+#endif
+
+#endif
@@ -0,0 +1,151 @@
+/**
+ * Separable single-stage programs and program pipelines (GL 4.1 /
+ * GL_ARB_separate_shader_objects).
+ *
+ * Instead of linking one program per vertex/fragment pairing, each stage is
+ * compiled once into a separable program and pairings are made by attaching
+ * stage programs to a pipeline object, which needs no relink. Both stage
+ * programs and pipelines are cached, so N vertex and M fragment variants cost
+ * N + M programs and at most N * M (cheap) pipeline objects.
+*/
+#ifndef PROGRAM_PIPELINE_CLASS
+#define PROGRAM_PIPELINE_CLASS
+
+#include <glad/glad.h>
+
+#include <stdio.h>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "shaderPreprocessor.h"
+#include "profiler.h"
+
+/**
+ * @return true if the current context supports separable programs & pipelines (core since 4.1)
+*/
+inline bool pipelinesSupported(){
+    return GLAD_GL_VERSION_4_1;
+}
+
+class ProgramPipelineCache{
+    public:
+
+        /**
+         * returns the separable program for one shader stage, building it on first use
+         * @param stage GL_VERTEX_SHADER or GL_FRAGMENT_SHADER
+         * @param path the path to the shader source
+         * @param defines "NAME" or "NAME VALUE" strings injected after #version
+         * @return the ID of the separable program, or 0 if it failed to build
+         * pre: pipelinesSupported()
+         * post: the program is cached under (stage, path, defines)
+        */
+        unsigned int getStage(GLenum stage, const std::string &path, const std::vector<std::string> &defines = {}){
+            std::string key = std::to_string(stage) + "|" + path;
+            for(const std::string &define : defines)
+                key += "|" + define;
+            auto it = stages.find(key);
+            if(it != stages.end())
+                return it->second;
+
+            PROFILE_ZONE("shader compile");
+            PreprocessedShader shader = ShaderPreprocessor::process(path);
+            unsigned int program = 0;
+            if(shader.ok){
+                std::string source = ShaderPreprocessor::addDefines(shader.source, defines);
+                const char *code = source.c_str();
+                program = glCreateShaderProgramv(stage, 1, &code);
+                int success;
+                glGetProgramiv(program, GL_LINK_STATUS, &success);
+                if(!success){
+                    char log[1024];
+                    glGetProgramInfoLog(program, 1024, NULL, log);
+                    printf("\nSEPARABLE PROGRAM ERROR (%s):\n%s\n", path.c_str(), log);
+                    shader.printSourceMap();
+                    glDeleteProgram(program);
+                    program = 0;
+                }
+            }
+            //failures are cached too so a broken variant isn't rebuilt every frame
+            stages.emplace(key, program);
+            return program;
+        }
+
+        /**
+         * returns the pipeline combining a vertex and a fragment stage program
+         * @param vertProgram separable program for the vertex stage
+         * @param fragProgram separable program for the fragment stage
+         * @return the ID of the pipeline, or 0 if either stage is missing
+         * pre: both programs were returned by getStage()
+         * post: the pipeline is cached under the stage pair
+        */
+        unsigned int getPipeline(unsigned int vertProgram, unsigned int fragProgram){
+            if(vertProgram == 0 || fragProgram == 0)
+                return 0;
+            std::pair<unsigned int, unsigned int> key(vertProgram, fragProgram);
+            auto it = pipelines.find(key);
+            if(it != pipelines.end())
+                return it->second;
+            unsigned int pipeline;
+            glGenProgramPipelines(1, &pipeline);
+            glUseProgramStages(pipeline, GL_VERTEX_SHADER_BIT, vertProgram);
+            glUseProgramStages(pipeline, GL_FRAGMENT_SHADER_BIT, fragProgram);
+            pipelines.emplace(key, pipeline);
+            return pipeline;
+        }
+
+        /**
+         * convenience wrapper that builds/looks up both stages and their pipeline
+         * @return the ID of the pipeline, or 0 if a stage failed to build
+        */
+        unsigned int get(const std::string &vertPath, const std::vector<std::string> &vertDefines,
+                         const std::string &fragPath, const std::vector<std::string> &fragDefines){
+            return getPipeline(getStage(GL_VERTEX_SHADER, vertPath, vertDefines),
+                               getStage(GL_FRAGMENT_SHADER, fragPath, fragDefines));
+        }
+
+        /**
+         * binds a pipeline for rendering
+         * pre: pipeline was returned by this cache
+         * post: no monolithic program is bound, so the pipeline takes effect
+        */
+        static void bind(unsigned int pipeline){
+            glUseProgram(0);
+            glBindProgramPipeline(pipeline);
+        }
+
+        /**
+         * @return the number of separable programs built (including failed ones)
+        */
+        size_t stageCount() const{
+            return stages.size();
+        }
+
+        /**
+         * @return the number of pipeline objects created
+        */
+        size_t pipelineCount() const{
+            return pipelines.size();
+        }
+
+        /**
+         * pre: none
+         * post: every stage program and pipeline made by this cache is deleted
+        */
+        void destroy(){
+            for(auto &pipeline : pipelines)
+                glDeleteProgramPipelines(1, &pipeline.second);
+            for(auto &stage : stages)
+                if(stage.second != 0)
+                    glDeleteProgram(stage.second);
+            pipelines.clear();
+            stages.clear();
+        }
+
+    private:
+        std::map<std::string, unsigned int> stages;
+        std::map<std::pair<unsigned int, unsigned int>, unsigned int> pipelines;
+};
+
+#endif
@@ -0,0 +1,502 @@
+/**
+ * Render queue that collects draws as 64-bit sort keys + payload indices,
+ * radix sorts them every frame and submits them in an order that minimizes
+ * program/texture/VAO changes.
+ *
+ * key layout, most significant bit first:
+ *   opaque:      pass(4) | 0 | program(10) | texture(10) | vao(10) | depth(24) | unused(5)
+ *   translucent: pass(4) | 1 | inverted depth(24) | program(10) | texture(10) | vao(10) | unused(5)
+ * opaque draws are grouped by state and then sorted front to back, translucent
+ * draws are sorted back to front first since their order affects the result.
+ *
+ * draws are recorded into per-thread command lists, so keys and uniforms can be
+ * built on worker threads; execute() merges the lists and makes every GL call
+ * on the calling thread.
+ *
+ * with a DepthPrepass set, the opaque buckets (pass and state bits of the key) it
+ * picks are drawn depth only before anything else, then shaded without writing depth.
+*/
+#ifndef RENDER_QUEUE_H
+#define RENDER_QUEUE_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+
+#include "shader.h"
+#include "commandList.h"
+#include "depthPrepass.h"
+#include "jobSystem.h"
+#include "profiler.h"
+
+struct SortEntry{
+    uint64_t key;
+    uint32_t index;     //index of the payload the key was made for
+};
+
+/**
+ * sorts entries by key with an LSD radix sort, 8 bits per pass
+ * @param entries the entries to sort
+ * @param scratch buffer reused between calls to avoid reallocating every frame
+ * pre: none
+ * post: entries is sorted ascending by key, equal keys keep their submission order.
+ *       passes where every key has the same byte are skipped.
+*/
+inline void radixSort(std::vector<SortEntry> &entries, std::vector<SortEntry> &scratch){
+    size_t count = entries.size();
+    if(count < 2)
+        return;
+    scratch.resize(count);
+    //one histogram per byte, built in a single read of the keys
+    uint32_t histograms[8][256];
+    memset(histograms, 0, sizeof(histograms));
+    for(const SortEntry &entry : entries)
+        for(int b = 0; b < 8; b++)
+            histograms[b][(entry.key >> (b * 8)) & 0xFF]++;
+
+    SortEntry *src = entries.data();
+    SortEntry *dst = scratch.data();
+    for(int b = 0; b < 8; b++){
+        uint32_t *histogram = histograms[b];
+        //every key shares this byte, the pass wouldn't move anything
+        if(histogram[(src[0].key >> (b * 8)) & 0xFF] == count)
+            continue;
+        uint32_t offset = 0;
+        for(int i = 0; i < 256; i++){
+            uint32_t bucket = histogram[i];
+            histogram[i] = offset;
+            offset += bucket;
+        }
+        for(size_t i = 0; i < count; i++)
+            dst[histogram[(src[i].key >> (b * 8)) & 0xFF]++] = src[i];
+        std::swap(src, dst);
+    }
+    if(src != entries.data())
+        memcpy(entries.data(), src, count * sizeof(SortEntry));
+}
+
+enum RenderPass{
+    PASS_MAIN = 0,
+    PASS_OVERLAY = 1,
+};
+
+/**
+ * everything needed to issue one indexed draw, for draws submitted from the GL thread
+*/
+struct DrawCommand{
+    Shader *shader;
+    unsigned int texture;       //GL_TEXTURE_2D bound to unit 0, 0 for none
+    unsigned int vao;
+    int indexCount;
+    glm::mat4 model;
+    float opacity;              //< 1 makes the draw translucent
+};
+
+/**
+ * number of state changes needed to submit a frame
+*/
+struct StateChanges{
+    int programs = 0;
+    int textures = 0;
+    int vaos = 0;
+
+    int total() const{
+        return programs + textures + vaos;
+    }
+};
+
+struct RenderQueueStats{
+    int draws = 0;
+    int lists = 0;              //command lists the draws were recorded in
+    long long triangles = 0;
+    long long uploadBytes = 0;  //uniform data sent
+    StateChanges unsorted;      //changes submitting in scene order would have needed
+    StateChanges sorted;        //changes actually made after sorting
+};
+
+class RenderQueue{
+    public:
+        RenderQueueStats stats;     //stats of the last executed frame
+        DepthPrepass *prepass = NULL;   //draws opaque buckets it picks depth first, NULL for none
+
+        /**
+         * @param near distance of the near plane, used to quantize depth
+         * @param far distance of the far plane, used to quantize depth
+        */
+        RenderQueue(float near = 0.1f, float far = 100.0f)
+            : nearPlane(near), farPlane(far), threadLists(JobSystem::instance().threadCount()){}
+
+        /**
+         * dense ids for the key fields of GL objects. ids are handed out on first use,
+         * so these must only be called from one thread (the GL thread)
+         * @return the id of the given GL object name
+        */
+        uint32_t programSlot(unsigned int program){
+            return slotOf(programSlots, program);
+        }
+
+        uint32_t textureSlot(unsigned int texture){
+            return slotOf(textureSlots, texture);
+        }
+
+        uint32_t vaoSlot(unsigned int vao){
+            return slotOf(vaoSlots, vao);
+        }
+
+        /**
+         * builds the sort key of a draw. safe to call from any thread
+         * @param program id from programSlot()
+         * @param texture id from textureSlot()
+         * @param vao id from vaoSlot()
+         * @param translucent true if the draw blends over what's behind it
+         * @param viewDepth distance of the object from the camera along the view direction
+         * @param pass the pass the draw belongs to, lower passes are drawn first
+         * @return the key, laid out as described at the top of this file
+        */
+        uint64_t makeKey(uint32_t program, uint32_t texture, uint32_t vao, bool translucent, float viewDepth, RenderPass pass = PASS_MAIN) const{
+            float t = (viewDepth - nearPlane) / (farPlane - nearPlane);
+            t = std::min(std::max(t, 0.0f), 1.0f);
+            uint64_t depth = (uint64_t)(t * DEPTH_MAX);
+
+            uint64_t key = ((uint64_t)pass << 60) | ((uint64_t)translucent << 59);
+            if(translucent)
+                key |= ((DEPTH_MAX - depth) << 35) | ((uint64_t)program << 25) | ((uint64_t)texture << 15) | ((uint64_t)vao << 5);
+            else
+                key |= ((uint64_t)program << 49) | ((uint64_t)texture << 39) | ((uint64_t)vao << 29) | (depth << 5);
+            return key;
+        }
+
+        /**
+         * adds a draw to this frame
+         * @param command the draw to make
+         * @param viewDepth distance of the object from the camera along the view direction
+         * @param pass the pass the draw belongs to, lower passes are drawn first
+         * pre: called from the GL thread
+         * post: the draw is queued until the next execute()
+        */
+        void submit(const DrawCommand &command, float viewDepth, RenderPass pass = PASS_MAIN){
+            uint64_t key = makeKey(programSlot(command.shader->programID), textureSlot(command.texture), vaoSlot(command.vao),
+                                   command.opacity < 1.0f, viewDepth, pass);
+            threadList().draw(key, command.shader, command.texture, command.vao, command.indexCount, command.model, command.opacity);
+        }
+
+        /**
+         * @return the command list the calling thread records into. every job system
+         *         thread has its own, so workers can record without locking
+        */
+        CommandList &threadList(){
+            return threadLists[JobSystem::threadIndex()];
+        }
+
+        /**
+         * gathers the draws recorded in every command list into one array and sorts it
+         * pre: no thread is recording
+         * post: stats holds the draw count and the state changes recording order would have needed
+        */
+        void merge(){
+            stats = RenderQueueStats();
+            entries.clear();
+            packets.clear();
+            for(CommandList &list : threadLists){
+                if(list.size() == 0)
+                    continue;
+                for(size_t i = 0; i < list.size(); i++){
+                    entries.push_back({list.keys[i], (uint32_t)packets.size()});
+                    packets.push_back(list.packets[i]);
+                }
+                stats.lists++;
+            }
+            stats.draws = (int)packets.size();
+            stats.unsorted = countChanges(entries);
+            radixSort(entries, scratch);
+        }
+
+        /**
+         * sorts and submits every draw recorded since the last call
+         * pre: a GL context is current, no thread is recording and the camera the draws
+         *      are seen from is latched, see cameraUniforms.h
+         * post: every queued draw is drawn and the queue is empty. stats holds
+         *       the state changes made, and the ones recording order would have made.
+        */
+        void execute(){
+            PROFILE_ZONE("draw submission");
+            PROFILE_GPU_ZONE("draws");
+            merge();
+            submit(true, true);
+            clear();
+        }
+
+        /**
+         * execute() in two halves, for renderers that do something between the opaque
+         * draws and the translucent ones blended over them (like lighting a G-buffer)
+         * pre: as execute(). executeTranslucent() is called after executeOpaque() in the same frame
+         * post: executeOpaque() draws the opaque draws and keeps the translucent ones queued,
+         *       executeTranslucent() draws those and empties the queue
+        */
+        void executeOpaque(){
+            PROFILE_ZONE("opaque submission");
+            PROFILE_GPU_ZONE("opaque draws");
+            merge();
+            submit(true, false);
+        }
+
+        void executeTranslucent(){
+            PROFILE_ZONE("translucent submission");
+            PROFILE_GPU_ZONE("translucent draws");
+            submit(false, true);
+            clear();
+        }
+
+        /**
+         * pre: no thread is recording
+         * post: every recorded draw is dropped and all command lists are empty
+        */
+        void clear(){
+            entries.clear();
+            packets.clear();
+            for(CommandList &list : threadLists)
+                list.reset();
+            //deleted objects keep their ids, and every shader hot reload links a program under a
+            //new name. once a map has handed out its last id, later names would all share SLOT_MAX,
+            //so it starts over and the objects still in use get dense ids again next frame
+            for(std::unordered_map<unsigned int, uint32_t> *slots : {&programSlots, &textureSlots, &vaoSlots})
+                if(slots->size() > SLOT_MAX)
+                    slots->clear();
+        }
+
+        /**
+         * pre: none
+         * post: the state change stats of the last frame are printed to stdout
+        */
+        void printStats() const{
+            printf("render queue: %d draws from %d lists | state changes unsorted %d (prog %d, tex %d, vao %d) -> sorted %d (prog %d, tex %d, vao %d)\n",
+                   stats.draws, stats.lists, stats.unsorted.total(), stats.unsorted.programs, stats.unsorted.textures, stats.unsorted.vaos,
+                   stats.sorted.total(), stats.sorted.programs, stats.sorted.textures, stats.sorted.vaos);
+        }
+
+    private:
+        static constexpr uint64_t DEPTH_MAX = (1u << 24) - 1;
+        static constexpr uint32_t SLOT_MAX = (1u << 10) - 1;
+        static constexpr uint64_t NO_BUCKET = ~0ull;
+
+        float nearPlane, farPlane;
+        std::vector<SortEntry> entries;
+        std::vector<SortEntry> scratch;
+        std::vector<const DrawPacket *> packets;       //merged from every list, in list order
+        std::vector<CommandList> threadLists;           //indexed by JobSystem::threadIndex()
+        //GL object name -> small dense id that fits in its key field. ids are kept
+        //across frames so keys (and therefore draw order) stay stable, until clear() finds
+        //a map out of ids
+        std::unordered_map<unsigned int, uint32_t> programSlots, textureSlots, vaoSlots;
+
+        static uint64_t slotOf(std::unordered_map<unsigned int, uint32_t> &slots, unsigned int name){
+            auto it = slots.find(name);
+            if(it != slots.end())
+                return it->second;
+            uint32_t slot = std::min((uint32_t)slots.size(), SLOT_MAX);
+            slots.emplace(name, slot);
+            return slot;
+        }
+
+        /**
+         * draws the sorted entries of one or both kinds
+         * @param drawOpaque draw the opaque entries, with the depth prepass if there is one
+         * @param drawTranslucent draw the translucent entries
+         * pre: merge() ran this frame
+         * post: depth, blend and VAO state are back to the defaults
+        */
+        void submit(bool drawOpaque, bool drawTranslucent){
+            bool measuring = false;
+            if(drawOpaque && prepass != NULL){
+                prepass->beginFrame();
+                measuring = prepass->measuring();
+                drawDepthPrepass(measuring);
+            }
+
+            Shader *boundShader = NULL;
+            unsigned int boundTexture = ~0u, boundVao = ~0u;
+            bool blending = false;
+            uint64_t bucket = NO_BUCKET;
+            bool querying = false;
+            for(const SortEntry &entry : entries){
+                const DrawPacket &packet = *packets[entry.index];
+                bool translucent = (entry.key >> 59) & 1;
+                if(translucent ? !drawTranslucent : !drawOpaque)
+                    continue;
+                if(translucent != blending){
+                    //translucent draws come last: blend them over the opaque scene without writing depth
+                    blending = translucent;
+                    if(blending){
+                        glEnable(GL_BLEND);
+                        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+                        glDepthMask(GL_FALSE);
+                    } else{
+                        glDisable(GL_BLEND);
+                        glDepthMask(GL_TRUE);
+                    }
+                }
+                if(prepass != NULL){
+                    uint64_t drawBucket = translucent ? NO_BUCKET : bucketOf(entry.key);
+                    if(drawBucket != bucket){
+                        bucket = drawBucket;
+                        if(querying)
+                            prepass->endQuery();
+                        //buckets that went through the prepass only shade the fragments it left in the depth buffer
+                        bool depthFirst = !translucent && prepass->usePrepass(bucket);
+                        glDepthFunc(depthFirst ? GL_LEQUAL : GL_LESS);
+                        if(!translucent)
+                            glDepthMask(depthFirst ? GL_FALSE : GL_TRUE);
+                        //the prepass counted what depth first buckets would have shaded
+                        querying = measuring && !translucent && !depthFirst;
+                        if(querying)
+                            prepass->beginQuery(bucket, false);
+                    }
+                }
+                if(packet.shader != boundShader){
+                    boundShader = packet.shader;
+                    boundShader->use();
+                    stats.sorted.programs++;
+                }
+                if(packet.texture != boundTexture){
+                    boundTexture = packet.texture;
+                    glBindTexture(GL_TEXTURE_2D, boundTexture);
+                    stats.sorted.textures++;
+                }
+                if(packet.vao != boundVao){
+                    boundVao = packet.vao;
+                    glBindVertexArray(boundVao);
+                    stats.sorted.vaos++;
+                }
+                boundShader->setMat4Uniform("model", glm::value_ptr(packet.uniforms->model));
+                boundShader->setFloatUniform("opacity", packet.uniforms->opacity);
+                glDrawElements(GL_TRIANGLES, packet.indexCount, GL_UNSIGNED_INT, 0);
+                stats.triangles += packet.indexCount / 3;
+                stats.uploadBytes += sizeof(glm::mat4) + sizeof(float);
+            }
+            if(querying)
+                prepass->endQuery();
+            if(blending){
+                glDisable(GL_BLEND);
+                glDepthMask(GL_TRUE);
+            }
+            if(prepass != NULL){
+                glDepthFunc(GL_LESS);
+                glDepthMask(GL_TRUE);
+                if(measuring)
+                    measureVisible();
+            }
+            glBindVertexArray(0);
+        }
+
+        /**
+         * @return the pass and state bits of an opaque key: draws with the same bucket
+         *         are adjacent after sorting and differ only in depth
+        */
+        static uint64_t bucketOf(uint64_t key){
+            return key >> 29;
+        }
+
+        /**
+         * draws the opaque buckets prepass picks depth only, front to back like the shading pass
+         * @param measuring true if this frame's overdraw is measured: depth first buckets
+         *        count what they would have shaded here
+         * post: the depth buffer holds the nearest depth of every depth first bucket
+        */
+        void drawDepthPrepass(bool measuring){
+            PROFILE_ZONE("depth prepass");
+            PROFILE_GPU_ZONE("depth prepass");
+            PrepassStats &prepassStats = prepass->stats;
+            uint64_t bucket = NO_BUCKET;
+            bool depthFirst = false, drawing = false, querying = false;
+            for(const SortEntry &entry : entries){
+                if((entry.key >> 59) & 1)
+                    continue;
+                if(bucketOf(entry.key) != bucket){
+                    bucket = bucketOf(entry.key);
+                    if(querying)
+                        prepass->endQuery();
+                    depthFirst = prepass->usePrepass(bucket);
+                    querying = measuring && depthFirst;
+                    if(querying)
+                        prepass->beginQuery(bucket, false);
+                    prepassStats.buckets++;
+                    prepassStats.prepassBuckets += depthFirst;
+                }
+                if(!depthFirst)
+                    continue;
+                if(!drawing){
+                    prepass->beginDepthOnly();
+                    drawing = true;
+                }
+                const DrawPacket &packet = *packets[entry.index];
+                prepass->drawDepth(packet.vao, packet.indexCount, packet.uniforms->model);
+                prepassStats.prepassDraws++;
+                stats.triangles += packet.indexCount / 3;
+                stats.uploadBytes += sizeof(glm::mat4);
+            }
+            if(querying)
+                prepass->endQuery();
+            if(drawing)
+                prepass->endDepthOnly();
+        }
+
+        /**
+         * redraws every opaque bucket depth only against the finished depth buffer,
+         * counting the samples of each that are still visible
+         * pre: the frame's opaque draws are done and its overdraw is being measured
+         * post: the measurement is handed to the prepass, depth state is back to the default
+        */
+        void measureVisible(){
+            PROFILE_ZONE("overdraw measurement");
+            prepass->beginDepthOnly();
+            glDepthFunc(GL_LEQUAL);
+            glDepthMask(GL_FALSE);
+            uint64_t bucket = NO_BUCKET;
+            for(const SortEntry &entry : entries){
+                if((entry.key >> 59) & 1)
+                    continue;
+                if(bucketOf(entry.key) != bucket){
+                    if(bucket != NO_BUCKET)
+                        prepass->endQuery();
+                    bucket = bucketOf(entry.key);
+                    prepass->beginQuery(bucket, true);
+                }
+                const DrawPacket &packet = *packets[entry.index];
+                prepass->drawDepth(packet.vao, packet.indexCount, packet.uniforms->model);
+            }
+            if(bucket != NO_BUCKET)
+                prepass->endQuery();
+            glDepthFunc(GL_LESS);
+            glDepthMask(GL_TRUE);
+            prepass->endDepthOnly();
+            prepass->endMeasurement();
+        }
+
+        /**
+         * @return the state changes needed to submit entries in their current order
+        */
+        StateChanges countChanges(const std::vector<SortEntry> &order) const{
+            StateChanges changes;
+            unsigned int program = ~0u, texture = ~0u, vao = ~0u;
+            for(const SortEntry &entry : order){
+                const DrawPacket &packet = *packets[entry.index];
+                changes.programs += packet.shader->programID != program;
+                changes.textures += packet.texture != texture;
+                changes.vaos += packet.vao != vao;
+                program = packet.shader->programID;
+                texture = packet.texture;
+                vao = packet.vao;
+            }
+            return changes;
+        }
+};
+
+#endif
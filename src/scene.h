@@ -0,0 +1,266 @@
+/**
+ * Scene: entities, their transforms and the mesh/material tables components refer to
+*/
+#ifndef SCENE_H
+#define SCENE_H
+
+#include <glm/glm.hpp>
+
+#include <stdint.h>
+#include <algorithm>
+#include <vector>
+
+#include "entityStore.h"
+#include "frustumCuller.h"
+#include "gpuCuller.h"
+#include "occlusionCuller.h"
+#include "profiler.h"
+#include "renderQueue.h"
+#include "shader.h"
+#include "shadowMaps.h"
+#include "transformSystem.h"
+
+/**
+ * geometry that can be drawn: an indexed triangle list in a VAO
+*/
+struct Mesh{
+    unsigned int vao;
+    int indexCount;
+    glm::vec3 boundsCenter;     //local space bounding sphere
+    float boundsRadius;
+};
+
+/**
+ * how a mesh is shaded
+*/
+struct Material{
+    Shader *shader;
+    unsigned int texture;
+    float opacity;
+};
+
+class Scene{
+    public:
+        EntityStore entities;
+        TransformSystem transforms;
+        std::vector<Mesh> meshes;
+        std::vector<Material> materials;
+        FrustumCuller culler;
+        OcclusionCuller occlusion;
+        bool occlusionCulling = false;      //also hide entities behind occluders, see makeOccluder()
+        GpuCuller gpuCuller;
+        bool gpuCulling = false;            //opaque entities are culled and drawn by gpuCuller, see drawGpuCulled()
+        ShadowMaps shadows;
+        bool shadowCasting = false;         //ShadowCaster entities are drawn into shadows, see renderShadows()
+
+        uint32_t addMesh(const Mesh &mesh){
+            meshes.push_back(mesh);
+            return (uint32_t)meshes.size() - 1;
+        }
+
+        uint32_t addMaterial(const Material &material){
+            materials.push_back(material);
+            return (uint32_t)materials.size() - 1;
+        }
+
+        /**
+         * creates a renderable entity
+         * @param parent the transform node to attach to, NO_PARENT for none
+         * @param position local position relative to parent
+         * @param mesh index returned by addMesh()
+         * @param material index returned by addMaterial()
+         * @return the new entity, with all renderable components
+        */
+        Entity spawn(TransformHandle parent, const glm::vec3 &position, uint32_t mesh, uint32_t material){
+            Entity entity = entities.create();
+            entities.add(entity, Transform{transforms.create(parent, position)});
+            entities.add(entity, MeshRef{mesh});
+            entities.add(entity, MaterialRef{material});
+            entities.add(entity, Bounds{position, meshes[mesh].boundsRadius});
+            entities.add(entity, Visibility{1, 0xFF});
+            return entity;
+        }
+
+        /**
+         * makes an entity hide what is behind it when occlusionCulling is on
+         * @param entity an entity created by spawn()
+         * @param occluderMesh id returned by occlusion.addMesh(), a simplified mesh lying
+         *        inside what the entity draws. translucent entities mustn't occlude
+        */
+        void makeOccluder(Entity entity, uint32_t occluderMesh){
+            entities.add(entity, OccluderRef{occluderMesh});
+        }
+
+        /**
+         * makes an entity cast shadows when shadowCasting is on
+         * @param entity an entity created by spawn()
+         * @param isStatic true if its transform never changes, it is then cached in the far cascades
+        */
+        void makeShadowCaster(Entity entity, bool isStatic){
+            entities.add(entity, ShadowCaster{(uint8_t)isStatic});
+            if(isStatic)
+                shadows.staticCastersChanged();
+        }
+
+        /**
+         * @return true if entity is a static shadow caster, whose transform mustn't change
+        */
+        bool isStatic(Entity entity){
+            return entities.has<ShadowCaster>(entity) && entities.get<ShadowCaster>(entity).isStatic;
+        }
+
+        /**
+         * updates world matrices, then moves every bounding sphere to world space
+         * pre: none
+         * post: Bounds of every entity match its current transform
+        */
+        void updateTransforms(){
+            PROFILE_ZONE("update transforms");
+            transforms.update();
+            entities.parallelEach<Bounds, Transform, MeshRef>(4096, [this](Entity, Bounds &bounds, Transform &transform, MeshRef &meshRef){
+                const Mesh &mesh = meshes[meshRef.mesh];
+                const glm::mat4 &world = transforms.getWorld(transform.node);
+                bounds.center = glm::vec3(world * glm::vec4(mesh.boundsCenter, 1.0f));
+                float scale = std::max(glm::length(glm::vec3(world[0])), std::max(glm::length(glm::vec3(world[1])), glm::length(glm::vec3(world[2]))));
+                bounds.radius = mesh.boundsRadius * scale;
+            });
+        }
+
+        /**
+         * sets Visibility of every entity to whether its bounds are inside the view frustum,
+         * and with occlusionCulling whether they aren't hidden behind occluders. with
+         * gpuCulling only translucent entities are tested here, the opaque ones are
+         * handed to gpuCuller instead
+         * @param viewProjection projection * view of the camera
+         * pre: updateTransforms() ran this frame, gpuCuller.init() succeeded if gpuCulling is on
+         * post: culler.stats (and occlusion.stats) hold this frame's counters
+        */
+        void cull(const glm::mat4 &viewProjection){
+            PROFILE_ZONE("culling");
+            if(gpuCulling){
+                cullOnGpu(viewProjection);
+                return;
+            }
+            SparseSet<Bounds> &bounds = entities.pool<Bounds>();
+            culler.spheres.resize(bounds.size());
+            for(size_t i = 0; i < bounds.size(); i++)
+                culler.spheres.set(i, bounds.components[i].center, bounds.components[i].radius);
+            culler.cull(Frustum(viewProjection));
+            if(occlusionCulling){
+                occlusion.clearOccluders();
+                entities.each<OccluderRef, Transform>([&](Entity, OccluderRef &occluder, Transform &transform){
+                    occlusion.addOccluder(occluder.mesh, transforms.getWorld(transform.node));
+                });
+                occlusion.rasterize(viewProjection);
+                occlusion.testSpheres(culler.spheres, culler.visible);
+            }
+            SparseSet<Visibility> &visibility = entities.pool<Visibility>();
+            for(size_t i = 0; i < bounds.size(); i++){
+                Entity entity = bounds.entities[i];
+                if(visibility.has(entity))
+                    visibility.get(entity).visible = culler.visible[i];
+            }
+        }
+
+        /**
+         * records a draw for every visible entity. sort keys and uniforms are built on
+         * the job system, each thread into its own command list of the queue
+         * @param queue the queue to record into
+         * @param view the camera's view matrix, for depth sorting
+         * pre: called from the GL thread
+         * post: the draws are recorded until queue.execute()
+        */
+        void buildDraws(RenderQueue &queue, const glm::mat4 &view){
+            PROFILE_ZONE("record draws");
+            //key ids are handed out on this thread, workers only read them
+            materialSlots.resize(materials.size());
+            for(size_t i = 0; i < materials.size(); i++)
+                materialSlots[i] = {queue.programSlot(materials[i].shader->programID), queue.textureSlot(materials[i].texture)};
+            meshSlots.resize(meshes.size());
+            for(size_t i = 0; i < meshes.size(); i++)
+                meshSlots[i] = queue.vaoSlot(meshes[i].vao);
+
+            entities.parallelEach<Visibility, Transform, MeshRef, MaterialRef>(RECORD_CHUNK,
+                [&](Entity, Visibility &visibility, Transform &transform, MeshRef &meshRef, MaterialRef &materialRef){
+                if(!visibility.visible)
+                    return;
+                const Mesh &mesh = meshes[meshRef.mesh];
+                const Material &material = materials[materialRef.material];
+                const MaterialSlots &slots = materialSlots[materialRef.material];
+                const glm::mat4 &world = transforms.getWorld(transform.node);
+                uint64_t key = queue.makeKey(slots.program, slots.texture, meshSlots[meshRef.mesh], material.opacity < 1.0f, -(view * world[3]).z);
+                queue.threadList().draw(key, material.shader, material.texture, mesh.vao, mesh.indexCount, world, material.opacity);
+            });
+        }
+
+        /**
+         * draws every opaque shadow caster into the cascades of the shadow maps
+         * @param view the camera's view matrix
+         * @param projection the camera's projection matrix
+         * pre: shadowCasting is on, shadows.init() succeeded and updateTransforms() ran this frame
+         * post: forward programs given to shadows.apply() receive this frame's shadows
+        */
+        void renderShadows(const glm::mat4 &view, const glm::mat4 &projection){
+            shadows.clearCasters();
+            entities.each<ShadowCaster, Transform, MeshRef, MaterialRef, Bounds>(
+                [&](Entity, ShadowCaster &caster, Transform &transform, MeshRef &meshRef, MaterialRef &materialRef, Bounds &bounds){
+                if(materials[materialRef.material].opacity < 1.0f)
+                    return;
+                const Mesh &mesh = meshes[meshRef.mesh];
+                shadows.addCaster(mesh.vao, mesh.indexCount, transforms.getWorld(transform.node), bounds.center, bounds.radius, caster.isStatic);
+            });
+            shadows.render(view, projection);
+        }
+
+        /**
+         * draws the opaque entities culled on the GPU this frame
+         * pre: gpuCulling is on, cull() ran this frame and the camera is latched. call it
+         *      before the render queue's translucent draws so they blend over it
+        */
+        void drawGpuCulled(){
+            gpuCuller.draw();
+        }
+
+    private:
+        static constexpr size_t RECORD_CHUNK = 2048;
+        static constexpr uint32_t NO_BATCH = 0xFFFFFFFF;
+
+        struct MaterialSlots{
+            uint32_t program;
+            uint32_t texture;
+        };
+        std::vector<MaterialSlots> materialSlots;       //render queue key ids of each material
+        std::vector<uint32_t> meshSlots;                //render queue key id of each mesh's VAO
+        std::vector<std::vector<uint32_t>> gpuBatches;  //gpuBatches[material][mesh] = gpuCuller batch id
+
+        /**
+         * frustum culls the translucent entities on the CPU, then hands every opaque
+         * entity to gpuCuller and culls those on the GPU
+        */
+        void cullOnGpu(const glm::mat4 &viewProjection){
+            Frustum frustum(viewProjection);
+            gpuBatches.resize(materials.size());
+            gpuCuller.clearInstances();
+            entities.each<Visibility, Transform, MeshRef, MaterialRef, Bounds>(
+                [&](Entity, Visibility &visibility, Transform &transform, MeshRef &meshRef, MaterialRef &materialRef, Bounds &bounds){
+                const Material &material = materials[materialRef.material];
+                if(material.opacity < 1.0f){
+                    visibility.visible = frustum.sphereVisible(bounds.center, bounds.radius);
+                    return;
+                }
+                visibility.visible = 0;
+                std::vector<uint32_t> &materialBatches = gpuBatches[materialRef.material];
+                if(materialBatches.size() < meshes.size())
+                    materialBatches.resize(meshes.size(), NO_BATCH);
+                uint32_t &batch = materialBatches[meshRef.mesh];
+                if(batch == NO_BATCH){
+                    const Mesh &mesh = meshes[meshRef.mesh];
+                    batch = gpuCuller.addBatch(mesh.vao, mesh.indexCount, material.texture, material.opacity);
+                }
+                gpuCuller.addInstance(batch, transforms.getWorld(transform.node), bounds.center, bounds.radius);
+            });
+            gpuCuller.cull(viewProjection);
+        }
+};
+
+#endif
@@ -7,62 +7,122 @@
 
 #include<glad/glad.h>   //get required OpenGL headers
 
-#include<iostream>      //I/O libraries needed to read Vertex & Fragment Shader Files
 #include<stdio.h>
-#include<fstream>
-#include<sstream>
 #include<string>
+#include<unordered_map>
+#include<vector>
+
+#include "shaderPreprocessor.h"     //resolves #include & caches shader file reads
+#include "profiler.h"
 
 #define SHADER_PROGRAM 0xDEADBEEF   //random int value used for error handling
 
 class Shader{
     public:
         unsigned int programID;    //program ID
+        std::string vertPath;      //path the vertex shader was loaded from
+        std::string fragPath;      //path the fragment shader was loaded from
+        std::vector<std::string> sourceFiles;  //every file (incl. #includes) the program was built from
+        std::vector<std::string> defines;      //"NAME" or "NAME VALUE" strings injected into both stages
 
         /**
          * Constructor for a Shader object
          * @param vShaderPath the path to the vertex shader
          * @param fShaderPath the path to the fragment shader
+         * @param defines "NAME" or "NAME VALUE" strings injected after #version in both shaders,
+         *        to build a variant of shared sources
          * pre: none
          * post: Shader object constructed with a program ID referring to 
          *       a shader program that has linked the vertex and fragment
          *       shaders specified in the paths given to the constructor.
         */
-        Shader(const char *vShaderPath, const char *fShaderPath){
-            //1. retrieve source code from path(s)
-            std::string vertexCode = getFileContents(vShaderPath);
-            std::string fragmentCode = getFileContents(fShaderPath);
+        Shader(const char *vShaderPath, const char *fShaderPath, const std::vector<std::string> &defines = {})
+            : vertPath(vShaderPath), fragPath(fShaderPath), defines(defines){
+            programID = buildProgramFromFiles(vertPath, fragPath, &sourceFiles, defines);
+        }
 
+        /**
+         * preprocesses, compiles and links the shaders at the given paths
+         * @param vPath the path to the vertex shader
+         * @param fPath the path to the fragment shader
+         * @param dependencies if not NULL, filled with every file the sources were built from
+         * @param defines "NAME" or "NAME VALUE" strings injected after #version in both shaders
+         * @return the ID of the linked program, or 0 if anything failed
+         * pre: a GL context is current on the calling thread
+         * post: on failure the error log is printed along with which file each
+         *       source string number refers to
+        */
+        static unsigned int buildProgramFromFiles(const std::string &vPath, const std::string &fPath, std::vector<std::string> *dependencies,
+                                                  const std::vector<std::string> &defines = {}){
+            //1. retrieve & preprocess source code from path(s)
+            PreprocessedShader vertex = ShaderPreprocessor::process(vPath);
+            PreprocessedShader fragment = ShaderPreprocessor::process(fPath);
+            if(dependencies != NULL){
+                *dependencies = vertex.files;
+                dependencies->insert(dependencies->end(), fragment.files.begin(), fragment.files.end());
+            }
+
+            //2. compile and link shaders
+            unsigned int program = 0;
+            if(vertex.ok && fragment.ok)
+                program = buildProgram(ShaderPreprocessor::addDefines(vertex.source, defines), ShaderPreprocessor::addDefines(fragment.source, defines));
+            if(program == 0){
+                printf("vertex shader sources:\n");
+                vertex.printSourceMap();
+                printf("fragment shader sources:\n");
+                fragment.printSourceMap();
+            }
+            return program;
+        }
+
+        /**
+         * compiles the given vertex & fragment source code and links them into a new program.
+         * does not touch any Shader object, so it can be called from a worker thread that has
+         * a context sharing objects with the render context.
+         * @param vertexCode the vertex shader source code
+         * @param fragmentCode the fragment shader source code
+         * @return the ID of the linked program, or 0 if compilation or linking failed
+         * pre: a GL context is current on the calling thread
+         * post: the intermediate shader objects are deleted, errors are printed to stdout
+        */
+        static unsigned int buildProgram(const std::string &vertexCode, const std::string &fragmentCode){
             //convert to C-style strings since
             //openGL only recognizes them as valid shader programs
+            PROFILE_ZONE("shader compile");
             const char *vShaderSourceCode = vertexCode.c_str();
             const char *fShaderSourceCode = fragmentCode.c_str();
 
-            //2. compile and link shaders
-            unsigned int vert, frag;
+            unsigned int vert, frag, program;
+            bool ok = true;
             //compile vertex shader
             vert = glCreateShader(GL_VERTEX_SHADER);
             glShaderSource(vert, 1, &vShaderSourceCode, NULL);
             glCompileShader(vert);
-            checkError(vert, GL_VERTEX_SHADER);
+            ok &= checkError(vert, GL_VERTEX_SHADER);
 
             //compile fragment shader
             frag = glCreateShader(GL_FRAGMENT_SHADER);
             glShaderSource(frag, 1, &fShaderSourceCode, NULL);
             glCompileShader(frag);
-            checkError(frag, GL_FRAGMENT_SHADER);
+            ok &= checkError(frag, GL_FRAGMENT_SHADER);
 
 
             //link shaders
-            programID = glCreateProgram();
-            glAttachShader(programID, vert);
-            glAttachShader(programID, frag);
-            glLinkProgram(programID);
-            checkError(programID, SHADER_PROGRAM);
+            program = glCreateProgram();
+            glAttachShader(program, vert);
+            glAttachShader(program, frag);
+            glLinkProgram(program);
+            ok &= checkError(program, SHADER_PROGRAM);
 
             //delete unused shaders
             glDeleteShader(vert);
             glDeleteShader(frag);
+
+            if(!ok){
+                glDeleteProgram(program);
+                return 0;
+            }
+            return program;
         }
 
         /**
@@ -74,6 +134,7 @@ class Shader{
             if(programID != 0)
                 glDeleteProgram(programID);
             programID = 0;
+            uniformLocations.clear();
         }
 
         /**
@@ -81,10 +142,43 @@ class Shader{
          * @param fPath the path to a file w/ fragment shader source code
          * pre: vPath & fPath are valid directories
          * post: this shader object now refers to a shader program linking
-         *       the shaders specified by the given paths
+         *       the shaders specified by the given paths. if the new shaders fail to
+         *       compile the previous program is kept.
         */
         void setShaders(const char *vPath, const char *fPath){
-            *this = Shader(vPath, fPath);
+            std::vector<std::string> dependencies;
+            unsigned int newProgram = buildProgramFromFiles(vPath, fPath, &dependencies, defines);
+            if(newProgram == 0)
+                return;
+            sourceFiles = dependencies;
+            vertPath = vPath;
+            fragPath = fPath;
+            swapProgram(newProgram);
+        }
+
+        /**
+         * replaces the program this object refers to with an already linked one
+         * @param newProgram the ID of a successfully linked program
+         * pre: newProgram != 0, called on the thread that owns the render context
+         * post: the old program is deleted, cached uniform locations are dropped and
+         *       every int/sampler binding made through this object is re-applied
+         *       to the new program
+        */
+        void swapProgram(unsigned int newProgram){
+            if(programID != 0)
+                glDeleteProgram(programID);
+            programID = newProgram;
+            uniformLocations.clear();
+
+            if(intBindings.empty())
+                return;
+            //re-apply sampler/int bindings without disturbing the bound program
+            int prevProgram;
+            glGetIntegerv(GL_CURRENT_PROGRAM, &prevProgram);
+            glUseProgram(programID);
+            for(const auto &binding : intBindings)
+                glUniform1i(getUniformLocation(binding.first), binding.second);
+            glUseProgram(prevProgram);
         }
 
         /**
@@ -98,21 +192,37 @@ class Shader{
             glUseProgram(programID);
         }
 
+        /**
+         * @param name the name of a uniform in this program
+         * @return the location of the uniform, looked up once per program and cached after
+        */
+        int getUniformLocation(const std::string &name) const{
+            auto it = uniformLocations.find(name);
+            if(it != uniformLocations.end())
+                return it->second;
+            int location = glGetUniformLocation(programID, name.c_str());
+            uniformLocations.emplace(name, location);
+            return location;
+        }
+
         //modifier methods to set uniform shader attributes
         /**
          * @param name the name of the uniform attribute we want to set
          * @param value the value we want to change the uniform attribute to 
         */
         void setBoolUniform(const std::string &name, bool value) const{
-            glUniform1i(glGetUniformLocation(programID, name.c_str()), (int)value); 
+            glUniform1i(getUniformLocation(name), (int)value); 
         }
 
         /**
+         * int uniforms are usually sampler bindings, so they are remembered and
+         * re-applied when the program is swapped out by a reload
          * @param name the name of the uniform attribute we want to set
          * @param value the value we want to change the uniform attribute to 
         */
-        void setIntUniform(const std::string &name, int value) const{
-            glUniform1i(glGetUniformLocation(programID, name.c_str()), value);
+        void setIntUniform(const std::string &name, int value){
+            intBindings[name] = value;
+            glUniform1i(getUniformLocation(name), value);
         }
 
         /**
@@ -120,47 +230,30 @@ class Shader{
          * @param value the value we want to change the uniform attribute to 
         */
         void setFloatUniform(const std::string &name, float value) const{
-            glUniform1f(glGetUniformLocation(programID, name.c_str()), value);
+            glUniform1f(getUniformLocation(name), value);
         }
 
-    private:
-
         /**
-         * private helper function that takes a path to a file, and returns the contents
-         * of that file in a std::string
-         * @param path a string that specifies the path to a file
-         * @return a std::string that contains the contents of the file
-         * pre: path is a valid path to a file
-         * post: return the contents of that file inside a std::string object
+         * @param name the name of the uniform attribute we want to set
+         * @param value pointer to the 16 floats of a column-major 4x4 matrix
         */
-        std::string getFileContents(const char *path){
-            std::ifstream file;
-            std::string fContent;
-            //make sure we can throw exceptions
-            file.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-            try{
-                file.open(path);
-                std::stringstream fileContentStream;
-                fileContentStream << file.rdbuf();
-
-                file.close();
-
-                fContent = fileContentStream.str();
-
-            } catch(std::ifstream::failure error){
-                printf("\nERROR TRYING TO READ IN FILE AT PATH %s", path);
-            }
-            return fContent;
+        void setMat4Uniform(const std::string &name, const float *value) const{
+            glUniformMatrix4fv(getUniformLocation(name), 1, GL_FALSE, value);
         }
 
+    private:
+        mutable std::unordered_map<std::string, int> uniformLocations;  //uniform name -> location cache
+        std::unordered_map<std::string, int> intBindings;               //int/sampler uniforms set on this program
+
         /**
          * private helper function to check for compilation and linking errors
          * @param shader an ID to a valid shader or shader program
          * @param shaderType the type of shader passed into the function
+         * @return true if the shader compiled/linked successfully
          * pre: shaderType == GL_VERTEX_SHADER || GL_FRAGMENT_SHADER || SHADER_PROGRAM
          * post: checks for errors in compilation/linking process
         */
-        void checkError(unsigned int shader, unsigned int shaderType){
+        static bool checkError(unsigned int shader, unsigned int shaderType){
             int success;
             char log[1024];
             switch(shaderType){
@@ -191,8 +284,9 @@ class Shader{
 
                 default:
                     printf("\nCHECK_ERROR called for undefined type\n");
-                    break;
+                    return false;
             }
+            return success != 0;
         }
 
 };
@@ -0,0 +1,297 @@
+/**
+ * Shader source preprocessor: resolves #include directives, caches file reads
+ * and emits #line directives so compiler errors can be mapped back to files.
+ *
+ * When built with -DSHADER_EMBED the preprocessed sources are taken from
+ * embeddedShaders.h (generated by tools/embedShaders.cpp) instead, so no
+ * shader files are read at runtime.
+*/
+#ifndef SHADER_PREPROCESSOR_CLASS
+#define SHADER_PREPROCESSOR_CLASS
+
+#include <stdio.h>
+#include <string.h>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#ifdef SHADER_EMBED
+#include "embeddedShaders.h"
+#endif
+
+/**
+ * @param path a string that specifies the path to a file
+ * @param contents the string the file is read into
+ * @return true if the file could be read
+ * pre: none
+ * post: contents holds the whole file, read with a single allocation and copy
+*/
+inline bool readFileContents(const std::string &path, std::string &contents){
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if(!file)
+        return false;
+    std::streamsize size = file.tellg();
+    if(size < 0)
+        return false;
+    contents.resize((size_t)size);
+    file.seekg(0, std::ios::beg);
+    return (bool)file.read(&contents[0], size);
+}
+
+/**
+ * @return the normalized form of path, so every spelling of a file maps to the same key
+*/
+inline std::string normalizeShaderPath(const std::string &path){
+    std::error_code ec;
+    std::filesystem::path p = std::filesystem::weakly_canonical(path, ec);
+    return ec ? std::filesystem::path(path).lexically_normal().generic_string() : p.generic_string();
+}
+
+/**
+ * Thread safe cache of shader file contents keyed by normalized path, so a
+ * file included by many shaders is only read from disk once.
+*/
+class ShaderSourceCache{
+    public:
+        /**
+         * @return the process wide cache shared by every Shader
+        */
+        static ShaderSourceCache &instance(){
+            static ShaderSourceCache cache;
+            return cache;
+        }
+
+        /**
+         * @param path the normalized path of the file
+         * @return the contents of the file, or NULL if it can't be read
+         * pre: none
+         * post: the file is read on first request and served from memory afterwards
+        */
+        std::shared_ptr<const std::string> get(const std::string &path){
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = files.find(path);
+            if(it != files.end())
+                return it->second;
+            auto contents = std::make_shared<std::string>();
+            if(!readFileContents(path, *contents)){
+                printf("\nERROR TRYING TO READ IN FILE AT PATH %s\n", path.c_str());
+                return NULL;
+            }
+            files.emplace(path, contents);
+            return contents;
+        }
+
+        /**
+         * pre: none
+         * post: the next get() of path reads the file from disk again
+        */
+        void invalidate(const std::string &path){
+            std::lock_guard<std::mutex> lock(mutex);
+            files.erase(path);
+        }
+
+    private:
+        std::mutex mutex;
+        std::unordered_map<std::string, std::shared_ptr<const std::string>> files;
+};
+
+/**
+ * Result of preprocessing a shader. files[i] is the file that GLSL source
+ * string number i in #line directives (and compiler errors) refers to.
+*/
+struct PreprocessedShader{
+    std::string source;
+    std::vector<std::string> files;
+    bool ok = true;
+
+    /**
+     * prints which file each source string number in an error log refers to
+    */
+    void printSourceMap() const{
+        for(size_t i = 0; i < files.size(); i++)
+            printf("  source %zu = %s\n", i, files[i].c_str());
+    }
+};
+
+class ShaderPreprocessor{
+    public:
+        /**
+         * preprocesses the shader at path
+         * @param path the path to the root shader file
+         * @return the source with includes resolved and the list of files it depends on
+         * pre: none
+         * post: every file is read through ShaderSourceCache
+        */
+        static PreprocessedShader process(const std::string &path){
+            PreprocessedShader result;
+#ifdef SHADER_EMBED
+            const char *embedded = findEmbeddedShader(path);
+            if(embedded != NULL){
+                result.source = embedded;
+                result.files.push_back(path);
+                return result;
+            }
+            printf("\nSHADER %s IS NOT EMBEDDED, READING FROM DISK\n", path.c_str());
+#endif
+            std::set<std::string> included;
+            result.ok = expand(normalizeShaderPath(path), result, included, true);
+            return result;
+        }
+
+        /**
+         * adds #define lines to already preprocessed source, right after #version
+         * @param source preprocessed GLSL source
+         * @param defines list of "NAME" or "NAME VALUE" strings
+         * @return the source with the defines injected
+        */
+        static std::string addDefines(const std::string &source, const std::vector<std::string> &defines){
+            if(defines.empty())
+                return source;
+            size_t insertAt = 0;
+            size_t version = source.find("#version");
+            if(version != std::string::npos){
+                insertAt = source.find('\n', version);
+                insertAt = insertAt == std::string::npos ? source.size() : insertAt + 1;
+            }
+            std::string block;
+            for(const std::string &define : defines)
+                block += "#define " + define + "\n";
+            //keep error line numbers of the first file unchanged
+            if(version != std::string::npos)
+                block += "#line " + std::to_string(lineOf(source, insertAt)) + " 0\n";
+            return source.substr(0, insertAt) + block + source.substr(insertAt);
+        }
+
+#ifdef SHADER_EMBED
+        /**
+         * @param path path the shader would be loaded from
+         * @return the embedded preprocessed source, or NULL if there is none
+        */
+        static const char *findEmbeddedShader(const std::string &path){
+            std::string key = embeddedKey(path);
+            for(const EmbeddedShader &shader : embeddedShaders)
+                if(key == shader.path)
+                    return shader.source;
+            return NULL;
+        }
+#endif
+
+        /**
+         * @param path a shader path
+         * @return the part of path below resources/shaders/, used as the key of embedded shaders
+        */
+        static std::string embeddedKey(const std::string &path){
+            std::string generic = std::filesystem::path(path).lexically_normal().generic_string();
+            const char *root = "shaders/";
+            size_t at = generic.find(root);
+            return at == std::string::npos ? generic : generic.substr(at + strlen(root));
+        }
+
+    private:
+        /**
+         * @return the 1-based line number of the character at offset in source
+        */
+        static int lineOf(const std::string &source, size_t offset){
+            int line = 1;
+            for(size_t i = 0; i < offset && i < source.size(); i++)
+                line += source[i] == '\n';
+            return line;
+        }
+
+        /**
+         * appends the preprocessed contents of path to result
+         * @param path normalized path of the file
+         * @param included files already pasted in, acts as an include guard for every file
+         * @param root true for the top level file, whose #version stays first
+         * @return false if a file couldn't be read
+        */
+        static bool expand(const std::string &path, PreprocessedShader &result, std::set<std::string> &included, bool root){
+            if(!included.insert(path).second)
+                return true;
+            std::shared_ptr<const std::string> contents = ShaderSourceCache::instance().get(path);
+            if(!contents)
+                return false;
+
+            int fileIndex = (int)result.files.size();
+            result.files.push_back(path);
+            std::filesystem::path dir = std::filesystem::path(path).parent_path();
+            bool ok = true;
+
+            const std::string &text = *contents;
+            int lineNumber = 0;
+            //the root file's #line is emitted after #version, since #version has to come first
+            bool needLine = !root;
+            for(size_t start = 0; start < text.size();){
+                size_t end = text.find('\n', start);
+                if(end == std::string::npos)
+                    end = text.size();
+                lineNumber++;
+                std::string line = text.substr(start, end - start);
+                start = end + 1;
+
+                std::string directive = directiveOf(line);
+                if(directive == "include"){
+                    std::string name = includeName(line);
+                    if(name.empty()){
+                        printf("\nMALFORMED #include IN %s:%d\n", path.c_str(), lineNumber);
+                        ok = false;
+                    } else{
+                        ok &= expand(normalizeShaderPath((dir / name).string()), result, included, false);
+                    }
+                    needLine = true;
+                    continue;
+                }
+                if(directive == "pragma" && line.find("once") != std::string::npos){
+                    //every file is only included once, so #pragma once is implied
+                    needLine = true;
+                    continue;
+                }
+                if(needLine && !(root && directive == "version")){
+                    result.source += "#line " + std::to_string(lineNumber) + " " + std::to_string(fileIndex) + "\n";
+                    needLine = false;
+                }
+                result.source += line;
+                result.source += '\n';
+                if(root && directive == "version")
+                    needLine = true;
+            }
+            return ok;
+        }
+
+        /**
+         * @return the name of the preprocessor directive on line ("" if it isn't one)
+        */
+        static std::string directiveOf(const std::string &line){
+            size_t i = line.find_first_not_of(" \t");
+            if(i == std::string::npos || line[i] != '#')
+                return "";
+            i = line.find_first_not_of(" \t", i + 1);
+            if(i == std::string::npos)
+                return "";
+            size_t end = i;
+            while(end < line.size() && isalpha((unsigned char)line[end]))
+                end++;
+            return line.substr(i, end - i);
+        }
+
+        /**
+         * @return the file name between the quotes/brackets of an #include line
+        */
+        static std::string includeName(const std::string &line){
+            size_t open = line.find_first_of("\"<");
+            if(open == std::string::npos)
+                return "";
+            char closeChar = line[open] == '<' ? '>' : '"';
+            size_t close = line.find(closeChar, open + 1);
+            if(close == std::string::npos)
+                return "";
+            return line.substr(open + 1, close - open - 1);
+        }
+};
+
+#endif
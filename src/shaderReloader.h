@@ -0,0 +1,311 @@
+/**
+ * Class that watches the shader directory (and its subdirectories) and hot
+ * reloads Shader objects whose source files or #includes change.
+ *
+ * Changed files are detected on a watcher thread (inotify on linux, polling
+ * file modification times elsewhere). That thread owns a hidden GLFW window
+ * whose context shares objects with the render context, so shaders are
+ * compiled and linked there without blocking the render loop. Finished
+ * programs are fenced and handed back; poll() swaps them into every Shader
+ * that uses the changed file once the fence has signaled.
+*/
+#ifndef SHADER_RELOADER_CLASS
+#define SHADER_RELOADER_CLASS
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+
+#include <stdio.h>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+#include "shader.h"
+
+class ShaderReloader{
+    public:
+
+        /**
+         * Constructor for a ShaderReloader
+         * @param mainWindow the window whose context the reloaded programs are used in,
+         *                   NULL disables reloading (contexts not made by GLFW)
+         * @param shaderDir the directory to watch for changes
+         * pre: called on the main thread (GLFW only creates windows there) after the
+         *      window hints used to create mainWindow are still set
+         * post: a hidden shared context is created and the watcher thread is running.
+         *       if the shared context can't be created reloading is disabled.
+        */
+        ShaderReloader(GLFWwindow *mainWindow, const char *shaderDir) : watchDir(shaderDir){
+#ifdef SHADER_EMBED
+            //sources are compiled into the executable, there is nothing to watch
+            (void)mainWindow;
+#else
+            if(mainWindow == NULL)
+                return;
+            glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+            compileContext = glfwCreateWindow(1, 1, "shader compiler", NULL, mainWindow);
+            glfwWindowHint(GLFW_VISIBLE, GLFW_TRUE);
+            if(compileContext == NULL){
+                printf("\nSHADER RELOADER: failed to create shared context, hot reload disabled\n");
+                return;
+            }
+            running = true;
+            worker = std::thread(&ShaderReloader::watchLoop, this);
+#endif
+        }
+
+        ~ShaderReloader(){
+            stop();
+        }
+
+        /**
+         * registers a shader to be reloaded when one of its source files changes
+         * @param shader the shader to keep up to date
+         * pre: shader outlives this reloader or is unwatched before being destroyed
+         * post: shader will be swapped to a new program by poll() after its files change
+        */
+        void watch(Shader &shader){
+            std::lock_guard<std::mutex> lock(mutex);
+            watched.push_back({&shader, shader.vertPath, shader.fragPath, shader.defines, normalizeAll(shader.sourceFiles)});
+        }
+
+        /**
+         * stops reloading the given shader
+         * pre: none
+         * post: shader will no longer be modified by this reloader
+        */
+        void unwatch(Shader &shader){
+            std::lock_guard<std::mutex> lock(mutex);
+            for(size_t i = 0; i < watched.size(); i++){
+                if(watched[i].shader == &shader){
+                    watched.erase(watched.begin() + i);
+                    break;
+                }
+            }
+            for(Pending &p : pending)
+                if(p.shader == &shader)
+                    p.shader = NULL;
+        }
+
+        /**
+         * swaps every finished program whose fence has signaled into its shader.
+         * never blocks: a program that isn't ready yet is left for the next call.
+         * @return the number of shaders that were swapped
+         * pre: called on the render thread, once per frame
+         * post: reloaded shaders refer to their new program and the old one is deleted
+        */
+        int poll(){
+            std::lock_guard<std::mutex> lock(mutex);
+            int swapped = 0;
+            for(size_t i = 0; i < pending.size();){
+                Pending &p = pending[i];
+                GLenum status = glClientWaitSync(p.fence, 0, 0);
+                if(status == GL_TIMEOUT_EXPIRED){
+                    i++;
+                    continue;
+                }
+                glDeleteSync(p.fence);
+                if(p.shader != NULL && status != GL_WAIT_FAILED){
+                    p.shader->swapProgram(p.program);
+                    printf("\nreloaded shader (%s, %s)\n", p.shader->vertPath.c_str(), p.shader->fragPath.c_str());
+                    swapped++;
+                } else{
+                    glDeleteProgram(p.program);
+                }
+                pending.erase(pending.begin() + i);
+            }
+            return swapped;
+        }
+
+        /**
+         * pre: called on the main thread
+         * post: the watcher thread is joined and the shared context destroyed.
+         *       programs that were never swapped in are deleted.
+        */
+        void stop(){
+            if(worker.joinable()){
+                running = false;
+                worker.join();
+            }
+            for(Pending &p : pending){
+                glDeleteSync(p.fence);
+                glDeleteProgram(p.program);
+            }
+            pending.clear();
+            if(compileContext != NULL){
+                glfwDestroyWindow(compileContext);
+                compileContext = NULL;
+            }
+        }
+
+    private:
+        struct Watched{
+            Shader *shader;
+            std::string vertPath;
+            std::string fragPath;
+            std::vector<std::string> defines;
+            std::vector<std::string> files;     //normalized paths of every file the program uses
+        };
+        struct Pending{
+            Shader *shader;
+            unsigned int program;
+            GLsync fence;
+        };
+
+        std::string watchDir;
+        GLFWwindow *compileContext = NULL;
+        std::thread worker;
+        std::atomic<bool> running{false};
+        std::mutex mutex;                   //guards watched & pending
+        std::vector<Watched> watched;
+        std::vector<Pending> pending;
+
+        static std::vector<std::string> normalizeAll(const std::vector<std::string> &paths){
+            std::vector<std::string> normalized;
+            for(const std::string &path : paths)
+                normalized.push_back(normalizeShaderPath(path));
+            return normalized;
+        }
+
+        /**
+         * body of the watcher thread: waits for changed files, debounces them,
+         * then rebuilds every watched shader that uses one of them
+        */
+        void watchLoop(){
+            Profiler::instance().setThreadName("shader reloader");
+            glfwMakeContextCurrent(compileContext);
+            std::set<std::string> changed;
+#ifdef __linux__
+            int fd = inotify_init1(IN_NONBLOCK);
+            //watch descriptor -> directory, shared include directories are watched too
+            std::unordered_map<int, std::string> dirs;
+            if(fd >= 0){
+                std::error_code ec;
+                addWatch(fd, watchDir, dirs);
+                for(auto it = std::filesystem::recursive_directory_iterator(watchDir, ec);
+                    !ec && it != std::filesystem::recursive_directory_iterator(); it.increment(ec))
+                    if(it->is_directory())
+                        addWatch(fd, it->path().string(), dirs);
+            }
+            if(dirs.empty()){
+                printf("\nSHADER RELOADER: could not watch %s\n", watchDir.c_str());
+                if(fd >= 0)
+                    close(fd);
+                glfwMakeContextCurrent(NULL);
+                return;
+            }
+            alignas(struct inotify_event) char buffer[4096];
+            while(running){
+                pollfd pfd = {fd, POLLIN, 0};
+                if(::poll(&pfd, 1, 100) <= 0){
+                    //quiet for 100ms: everything collected so far has settled
+                    rebuild(changed);
+                    changed.clear();
+                    continue;
+                }
+                ssize_t len;
+                while((len = read(fd, buffer, sizeof(buffer))) > 0){
+                    for(char *ptr = buffer; ptr < buffer + len;){
+                        inotify_event *event = (inotify_event *)ptr;
+                        if(event->len > 0 && dirs.count(event->wd))
+                            changed.insert(normalizeShaderPath(dirs[event->wd] + "/" + event->name));
+                        ptr += sizeof(inotify_event) + event->len;
+                    }
+                }
+            }
+            close(fd);
+#else
+            //no inotify: poll the modification time of every watched file
+            std::unordered_map<std::string, std::filesystem::file_time_type> stamps;
+            while(running){
+                std::this_thread::sleep_for(std::chrono::milliseconds(250));
+                std::vector<std::string> files;
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    for(const Watched &w : watched)
+                        files.insert(files.end(), w.files.begin(), w.files.end());
+                }
+                for(const std::string &file : files){
+                    std::error_code ec;
+                    auto stamp = std::filesystem::last_write_time(file, ec);
+                    if(ec)
+                        continue;
+                    auto it = stamps.find(file);
+                    if(it != stamps.end() && it->second != stamp)
+                        changed.insert(file);
+                    stamps[file] = stamp;
+                }
+                rebuild(changed);
+                changed.clear();
+            }
+#endif
+            glfwMakeContextCurrent(NULL);
+        }
+
+        /**
+         * recompiles every watched shader that references one of the changed files
+         * @param changed normalized paths of the files that changed
+         * pre: called on the watcher thread with the shared context current
+         * post: successfully linked programs are queued for poll(); failures keep the old program
+        */
+        void rebuild(const std::set<std::string> &changed){
+            if(changed.empty())
+                return;
+            for(const std::string &file : changed)
+                ShaderSourceCache::instance().invalidate(file);
+            std::vector<Watched> targets;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                for(const Watched &w : watched){
+                    bool affected = false;
+                    for(const std::string &file : w.files)
+                        affected |= changed.count(file) > 0;
+                    if(affected)
+                        targets.push_back(w);
+                }
+            }
+            for(const Watched &w : targets){
+                std::vector<std::string> dependencies;
+                unsigned int program = Shader::buildProgramFromFiles(w.vertPath, w.fragPath, &dependencies, w.defines);
+                if(program == 0){
+                    printf("\nkeeping previous program for (%s, %s)\n", w.vertPath.c_str(), w.fragPath.c_str());
+                    continue;
+                }
+                //fence so the render context only picks the program up once it is complete
+                GLsync fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+                glFlush();
+                std::lock_guard<std::mutex> lock(mutex);
+                Shader *target = NULL;
+                for(Watched &cur : watched){
+                    if(cur.shader == w.shader){
+                        //an edit may have added or removed #includes
+                        cur.files = normalizeAll(dependencies);
+                        target = cur.shader;
+                    }
+                }
+                pending.push_back({target, program, fence});
+            }
+        }
+
+#ifdef __linux__
+        static void addWatch(int fd, const std::string &dir, std::unordered_map<int, std::string> &dirs){
+            int wd = inotify_add_watch(fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+            if(wd >= 0)
+                dirs[wd] = dir;
+        }
+#endif
+};
+
+#endif
@@ -0,0 +1,486 @@
+/**
+ * Cascaded shadow maps for a directional light (the sun).
+ *
+ * The view frustum up to maxDistance is split into CASCADES slices, each covered by
+ * an orthographic light view fitted around the slice's bounding sphere. The sphere
+ * doesn't change as the camera turns, and its center is snapped to whole texels in
+ * light space, so shadow edges don't shimmer while the camera moves. All cascades
+ * are layers of one depth texture array, and every caster is drawn once: a geometry
+ * shader copies its triangles into the layers of the cascades it was culled into.
+ *
+ * Cascades from FIRST_CACHED on are cached. They are fitted with a margin and snapped
+ * to a coarse grid instead, so their projection only changes when the camera has moved
+ * a good part of a cascade, and their static casters are kept in a second texture
+ * array that is only redrawn when that projection, the light or the static casters
+ * change. Each frame the cached layers are copied into the live array and only the
+ * dynamic casters are drawn over them. The near cascades are redrawn in full.
+ *
+ * Casters are culled per cascade with the frustum culler's sphere kernel, from the
+ * same world space bounds the camera culling uses. The cascade frustums leave out
+ * their near plane and depth clamping is on while drawing, so casters between the
+ * sun and a cascade still shadow it.
+*/
+#ifndef SHADOW_MAPS_H
+#define SHADOW_MAPS_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "frameTimer.h"
+#include "frustumCuller.h"
+#include "profiler.h"
+#include "shader.h"
+#include "shaderPreprocessor.h"
+
+struct ShadowStats{
+    static constexpr int CASCADES = 4;
+
+    int draws = 0;                      //draw calls of the shadow pass this frame
+    int staticDraws = 0;                //of those, redrawing cached static casters
+    int cascadeDraws[CASCADES] = {};    //draws that wrote each cascade this frame, one draw can write several
+    int casters[CASCADES] = {};         //casters culled into each cascade, cached ones included
+    uint64_t hits[CASCADES] = {};       //frames a cached cascade was reused, since startup
+    uint64_t misses[CASCADES] = {};     //frames it had to be redrawn
+    double cpuMs = 0.0;
+
+    void print(const char *name, int firstCached) const{
+        printf("%s: %d draws (%d static), draws/casters per cascade", name, draws, staticDraws);
+        for(int c = 0; c < CASCADES; c++)
+            printf(" %d/%d", cascadeDraws[c], casters[c]);
+        printf(", cache hits");
+        for(int c = firstCached; c < CASCADES; c++){
+            uint64_t frames = hits[c] + misses[c];
+            printf(" %d: %.1f%%", c, frames > 0 ? 100.0 * hits[c] / frames : 0.0);
+        }
+        printf(", %.3f ms cpu\n", cpuMs);
+    }
+};
+
+class ShadowMaps{
+    public:
+        static constexpr int CASCADES = ShadowStats::CASCADES;
+        static constexpr int FIRST_CACHED = 2;              //cascades from this one on cache their static casters
+        static constexpr float CACHE_MARGIN = 0.25f;        //cached cascades grow by this part of their radius
+        static constexpr int TEXTURE_UNIT = 4;              //after the clustered lighting buffers
+
+        glm::vec3 sunDirection = glm::normalize(glm::vec3(-0.7f, -0.6f, -0.4f));   //world space, the way the light travels
+        glm::vec3 sunColor{1.0f, 0.95f, 0.85f};
+        glm::vec3 ambient{0.15f};
+        float maxDistance = 25.0f;          //no shadows further from the camera than this
+        float splitLambda = 0.75f;          //cascade splits: 0 uniform, 1 logarithmic
+        ShadowStats stats;
+
+        /**
+         * @return the defines the forward shaders are built with to receive these shadows
+        */
+        static std::vector<std::string> shaderDefines(){
+            return {"SHADOWS", "CASCADES " + std::to_string(CASCADES)};
+        }
+
+        /**
+         * builds the layered shadow program and creates the texture arrays
+         * @param shaderDir directory holding the Shadow shaders and DepthFragmentShader.glsl
+         * @param size width and height of each cascade in texels, clamped to [1, GL_MAX_TEXTURE_SIZE]
+         * @return false if the program failed to build or a framebuffer is incomplete
+         * pre: a GL 3.3 context is current
+        */
+        bool init(const std::string &shaderDir, int size){
+            int maxSize = 0;
+            glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+            resolution = std::min(std::max(size, 1), maxSize);
+            if(resolution != size)
+                printf("shadow size %d clamped to %d\n", size, resolution);
+            //layout qualifiers take no expressions before GLSL 4.40, so the vertex count is spelled out
+            std::vector<std::string> defines = {"CASCADES " + std::to_string(CASCADES), "MAX_VERTICES " + std::to_string(3 * CASCADES)};
+            unsigned int stages[3] = {
+                compileStage(GL_VERTEX_SHADER, shaderDir + "/ShadowVertexShader.glsl", defines),
+                compileStage(GL_GEOMETRY_SHADER, shaderDir + "/ShadowGeometryShader.glsl", defines),
+                compileStage(GL_FRAGMENT_SHADER, shaderDir + "/DepthFragmentShader.glsl", defines),
+            };
+            bool compiled = stages[0] != 0 && stages[1] != 0 && stages[2] != 0;
+            if(compiled){
+                program = glCreateProgram();
+                for(unsigned int stage : stages)
+                    glAttachShader(program, stage);
+                glLinkProgram(program);
+                int success;
+                glGetProgramiv(program, GL_LINK_STATUS, &success);
+                if(!success){
+                    char log[1024];
+                    glGetProgramInfoLog(program, 1024, NULL, log);
+                    printf("\nSHADOW PROGRAM LINKING ERROR:\n%s\n", log);
+                    glDeleteProgram(program);
+                    program = 0;
+                }
+            }
+            for(unsigned int stage : stages)
+                if(stage != 0)
+                    glDeleteShader(stage);
+            if(program == 0)
+                return false;
+            modelLocation = glGetUniformLocation(program, "model");
+            layerMaskLocation = glGetUniformLocation(program, "layerMask");
+            matricesLocation = glGetUniformLocation(program, "cascadeViewProjection");
+
+            liveArray = createArray(CASCADES, true);
+            staticArray = createArray(CASCADES - FIRST_CACHED, false);
+            liveFramebuffer = createFramebuffer(liveArray, -1);
+            staticFramebuffer = createFramebuffer(staticArray, -1);
+            for(int c = 0; c < CASCADES; c++)
+                liveLayers[c] = createFramebuffer(liveArray, c);
+            for(int c = FIRST_CACHED; c < CASCADES; c++)
+                staticLayers[c - FIRST_CACHED] = createFramebuffer(staticArray, c - FIRST_CACHED);
+            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+            bool complete = liveFramebuffer != 0 && staticFramebuffer != 0;
+            for(int c = 0; c < CASCADES; c++)
+                complete = complete && liveLayers[c] != 0;
+            for(int c = FIRST_CACHED; c < CASCADES; c++)
+                complete = complete && staticLayers[c - FIRST_CACHED] != 0;
+            if(!complete)
+                destroy();
+            return complete;
+        }
+
+        /**
+         * pre: none
+         * post: no casters are drawn until added again
+        */
+        void clearCasters(){
+            casters.clear();
+            bounds.resize(0);
+        }
+
+        /**
+         * @param vao vertex array with positions at attribute 0 and an element buffer
+         * @param indexCount indices per draw
+         * @param model the caster's world matrix
+         * @param center world space center of its bounding sphere
+         * @param radius radius of its bounding sphere
+         * @param isStatic true if it never moves: it is then drawn into the cached cascades
+         *        only when they are invalidated, see staticCastersChanged()
+        */
+        void addCaster(unsigned int vao, int indexCount, const glm::mat4 &model, const glm::vec3 &center, float radius, bool isStatic){
+            casters.push_back({vao, indexCount, model, isStatic});
+            size_t i = bounds.size();
+            bounds.resize(i + 1);
+            bounds.set(i, center, radius);
+        }
+
+        /**
+         * invalidates the cached cascades, call it when a static caster was added, moved or removed
+        */
+        void staticCastersChanged(){
+            staticRevision++;
+        }
+
+        /**
+         * fits the cascades to the camera and draws the casters added this frame
+         * @param view the camera's view matrix
+         * @param projection the camera's perspective projection matrix
+         * pre: init() succeeded
+         * post: apply() shadows draws with this frame's cascades. the framebuffer and viewport
+         *       bound before are bound again
+        */
+        void render(const glm::mat4 &view, const glm::mat4 &projection){
+            PROFILE_ZONE("shadow maps");
+            PROFILE_GPU_ZONE("shadow maps");
+            double start = nowSeconds();
+            fitCascades(view, projection);
+            int stale = 0;      //bit c: cached cascade c has to be redrawn
+            for(int c = FIRST_CACHED; c < CASCADES; c++){
+                bool valid = cacheValid[c] && cachedViewProjection[c] == cascadeViewProjection[c] && cachedRevision == staticRevision;
+                stale |= valid ? 0 : 1 << c;
+                if(valid)
+                    stats.hits[c]++;
+                else
+                    stats.misses[c]++;
+            }
+
+            //per cascade culling, without the near plane: casters towards the sun still count
+            masks.assign(casters.size(), 0);
+            visible.resize(casters.size());
+            for(int c = 0; c < CASCADES; c++){
+                stats.casters[c] = stats.cascadeDraws[c] = 0;
+                cullSpheres(Frustum(cascadeViewProjection[c]), ALL_PLANES & ~(1 << 4), bounds, 0, casters.size(), visible.data());
+                for(size_t i = 0; i < casters.size(); i++)
+                    masks[i] |= visible[i] << c;
+            }
+
+            int previousFramebuffer = 0;
+            int previousViewport[4];
+            glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &previousFramebuffer);
+            glGetIntegerv(GL_VIEWPORT, previousViewport);
+            glViewport(0, 0, resolution, resolution);
+            glEnable(GL_DEPTH_CLAMP);
+            glEnable(GL_POLYGON_OFFSET_FILL);
+            glPolygonOffset(1.5f, 2.0f);
+            glUseProgram(program);
+            glUniformMatrix4fv(matricesLocation, CASCADES, GL_FALSE, glm::value_ptr(cascadeViewProjection[0]));
+            stats.draws = stats.staticDraws = 0;
+
+            //redraw the static casters of the stale cached cascades
+            if(stale != 0){
+                for(int c = FIRST_CACHED; c < CASCADES; c++){
+                    if(!(stale >> c & 1))
+                        continue;
+                    glBindFramebuffer(GL_FRAMEBUFFER, staticLayers[c - FIRST_CACHED]);
+                    glClear(GL_DEPTH_BUFFER_BIT);
+                    cachedViewProjection[c] = cascadeViewProjection[c];
+                    cacheValid[c] = true;
+                }
+                //the static array's layers are the cached cascades, shifted down
+                glm::mat4 shifted[CASCADES];
+                for(int c = 0; c < CASCADES; c++)
+                    shifted[c] = c + FIRST_CACHED < CASCADES ? cascadeViewProjection[c + FIRST_CACHED] : glm::mat4(1.0f);
+                glUniformMatrix4fv(matricesLocation, CASCADES, GL_FALSE, glm::value_ptr(shifted[0]));
+                glBindFramebuffer(GL_FRAMEBUFFER, staticFramebuffer);
+                for(size_t i = 0; i < casters.size(); i++){
+                    int mask = casters[i].isStatic ? masks[i] & stale : 0;
+                    if(mask != 0){
+                        drawCaster(casters[i], mask >> FIRST_CACHED, mask);
+                        stats.staticDraws++;
+                    }
+                }
+                glUniformMatrix4fv(matricesLocation, CASCADES, GL_FALSE, glm::value_ptr(cascadeViewProjection[0]));
+                cachedRevision = staticRevision;
+            }
+
+            //near cascades start empty, cached ones from their static casters
+            for(int c = 0; c < CASCADES; c++){
+                glBindFramebuffer(GL_DRAW_FRAMEBUFFER, liveLayers[c]);
+                if(c < FIRST_CACHED){
+                    glClear(GL_DEPTH_BUFFER_BIT);
+                } else{
+                    glBindFramebuffer(GL_READ_FRAMEBUFFER, staticLayers[c - FIRST_CACHED]);
+                    glBlitFramebuffer(0, 0, resolution, resolution, 0, 0, resolution, resolution, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+                }
+            }
+
+            //then every caster that isn't already in a cached layer
+            int nearMask = (1 << FIRST_CACHED) - 1;
+            glBindFramebuffer(GL_FRAMEBUFFER, liveFramebuffer);
+            for(size_t i = 0; i < casters.size(); i++){
+                int mask = casters[i].isStatic ? masks[i] & nearMask : masks[i];
+                if(mask != 0)
+                    drawCaster(casters[i], mask, mask);
+                for(int c = 0; c < CASCADES; c++)
+                    stats.casters[c] += masks[i] >> c & 1;
+            }
+
+            glBindVertexArray(0);
+            glDisable(GL_POLYGON_OFFSET_FILL);
+            glDisable(GL_DEPTH_CLAMP);
+            glBindFramebuffer(GL_FRAMEBUFFER, previousFramebuffer);
+            glViewport(previousViewport[0], previousViewport[1], previousViewport[2], previousViewport[3]);
+            stats.cpuMs = (nowSeconds() - start) * 1000.0;
+            PROFILE_COUNTER("shadow draws", stats.draws);
+        }
+
+        /**
+         * makes shader receive the shadows of the last render()
+         * @param shader a forward program built with shaderDefines()
+         * @param view the camera's view matrix the frame is drawn with, which may be newer than
+         *        the one render() fitted the cascades to (see cameraUniforms.h)
+         * post: shader is bound, the cascade array is bound to TEXTURE_UNIT and
+         *       texture unit 0 is active
+        */
+        void apply(Shader &shader, const glm::mat4 &view){
+            shader.use();
+            shader.setIntUniform("shadowMap", TEXTURE_UNIT);
+            //[-1, 1] clip space to [0, 1] texture space
+            glm::mat4 bias = glm::translate(glm::mat4(1.0f), glm::vec3(0.5f)) * glm::scale(glm::mat4(1.0f), glm::vec3(0.5f));
+            glm::mat4 inverseView = glm::inverse(view);
+            glm::mat4 matrices[CASCADES];
+            for(int c = 0; c < CASCADES; c++)
+                matrices[c] = bias * cascadeViewProjection[c] * inverseView;
+            glUniformMatrix4fv(shader.getUniformLocation("shadowMatrices"), CASCADES, GL_FALSE, glm::value_ptr(matrices[0]));
+            glUniform1fv(shader.getUniformLocation("cascadeEnds"), CASCADES, cascadeEnds);
+            glUniform1fv(shader.getUniformLocation("cascadeTexelSizes"), CASCADES, texelSizes);
+            glm::vec3 direction = glm::normalize(glm::vec3(view * glm::vec4(sunDirection, 0.0f)));
+            glUniform3fv(shader.getUniformLocation("sunDirection"), 1, glm::value_ptr(direction));
+            glUniform3fv(shader.getUniformLocation("sunColor"), 1, glm::value_ptr(sunColor));
+            glUniform3fv(shader.getUniformLocation("ambient"), 1, glm::value_ptr(ambient));
+            glActiveTexture(GL_TEXTURE0 + TEXTURE_UNIT);
+            glBindTexture(GL_TEXTURE_2D_ARRAY, liveArray);
+            glActiveTexture(GL_TEXTURE0);
+        }
+
+        /**
+         * pre: the context init() ran on is current
+         * post: every GL object of the shadow maps is deleted
+        */
+        void destroy(){
+            if(program != 0)
+                glDeleteProgram(program);
+            program = 0;
+            glDeleteFramebuffers(1, &liveFramebuffer);
+            glDeleteFramebuffers(1, &staticFramebuffer);
+            glDeleteFramebuffers(CASCADES, liveLayers);
+            glDeleteFramebuffers(CASCADES - FIRST_CACHED, staticLayers);
+            glDeleteTextures(1, &liveArray);
+            glDeleteTextures(1, &staticArray);
+            liveFramebuffer = staticFramebuffer = liveArray = staticArray = 0;
+        }
+
+    private:
+        struct Caster{
+            unsigned int vao;
+            int indexCount;
+            glm::mat4 model;
+            bool isStatic;
+        };
+
+        int resolution = 1024;
+        unsigned int program = 0;
+        int modelLocation = -1, layerMaskLocation = -1, matricesLocation = -1;
+        unsigned int liveArray = 0, staticArray = 0;
+        unsigned int liveFramebuffer = 0, staticFramebuffer = 0;     //every layer, for layered drawing
+        unsigned int liveLayers[CASCADES] = {};                      //one layer each, to clear and copy
+        unsigned int staticLayers[CASCADES - FIRST_CACHED] = {};
+
+        std::vector<Caster> casters;
+        SphereBounds bounds;
+        std::vector<uint8_t> visible;
+        std::vector<uint8_t> masks;     //bit c: caster i is in cascade c
+
+        glm::mat4 cascadeViewProjection[CASCADES];
+        float cascadeEnds[CASCADES] = {};
+        float texelSizes[CASCADES] = {};
+        glm::mat4 cachedViewProjection[CASCADES];
+        bool cacheValid[CASCADES] = {};
+        uint64_t staticRevision = 0, cachedRevision = 0;
+
+        /**
+         * computes each cascade's light view projection for the camera
+        */
+        void fitCascades(const glm::mat4 &view, const glm::mat4 &projection){
+            //near distance and field of view back out of a GL perspective matrix
+            float nearZ = projection[3][2] / (projection[2][2] - 1.0f);
+            float tanX = 1.0f / projection[0][0], tanY = 1.0f / projection[1][1];
+            glm::vec3 up = fabsf(sunDirection.y) > 0.99f ? glm::vec3(1.0f, 0.0f, 0.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+            glm::mat4 lightView = glm::lookAt(glm::vec3(0.0f), sunDirection, up);
+            glm::mat4 inverseView = glm::inverse(view);
+            float sliceStart = nearZ;
+            for(int c = 0; c < CASCADES; c++){
+                //practical split scheme: a blend of uniform and logarithmic splits
+                float t = (float)(c + 1) / CASCADES;
+                float sliceEnd = glm::mix(nearZ + (maxDistance - nearZ) * t, nearZ * powf(maxDistance / nearZ, t), splitLambda);
+                cascadeEnds[c] = sliceEnd;
+                //bounding sphere of the slice, in view space it only depends on the projection
+                glm::vec3 center(0.0f, 0.0f, -0.5f * (sliceStart + sliceEnd));
+                float radius = 0.0f;
+                for(float depth : {sliceStart, sliceEnd})
+                    radius = std::max(radius, glm::length(glm::vec3(depth * tanX, depth * tanY, -depth) - center));
+                //round up so float noise doesn't change the projection
+                radius = ceilf(radius * 16.0f) / 16.0f;
+                bool cached = c >= FIRST_CACHED;
+                if(cached)
+                    radius *= 1.0f + CACHE_MARGIN;
+                float texel = 2.0f * radius / resolution;
+                //cached cascades snap to a grid as coarse as their margin allows
+                float step = cached ? floorf(radius * CACHE_MARGIN / (1.0f + CACHE_MARGIN) / texel) * texel : texel;
+                glm::vec3 lightCenter = glm::vec3(lightView * inverseView * glm::vec4(center, 1.0f));
+                lightCenter.x = floorf(lightCenter.x / step) * step;
+                lightCenter.y = floorf(lightCenter.y / step) * step;
+                if(cached)
+                    lightCenter.z = floorf(lightCenter.z / step) * step;
+                glm::mat4 lightProjection = glm::ortho(lightCenter.x - radius, lightCenter.x + radius, lightCenter.y - radius, lightCenter.y + radius,
+                                                       -lightCenter.z - radius, -lightCenter.z + radius);
+                cascadeViewProjection[c] = lightProjection * lightView;
+                texelSizes[c] = texel;
+                sliceStart = sliceEnd;
+            }
+        }
+
+        /**
+         * @param layerMask layers of the bound framebuffer to draw into
+         * @param cascades the cascades those layers are, for the stats
+        */
+        void drawCaster(const Caster &caster, int layerMask, int cascades){
+            glUniformMatrix4fv(modelLocation, 1, GL_FALSE, glm::value_ptr(caster.model));
+            glUniform1i(layerMaskLocation, layerMask);
+            glBindVertexArray(caster.vao);
+            glDrawElements(GL_TRIANGLES, caster.indexCount, GL_UNSIGNED_INT, 0);
+            stats.draws++;
+            for(int c = 0; c < CASCADES; c++)
+                stats.cascadeDraws[c] += cascades >> c & 1;
+        }
+
+        unsigned int createArray(int layers, bool compare){
+            unsigned int texture;
+            glGenTextures(1, &texture);
+            glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+            glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT32F, resolution, resolution, layers, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, compare ? GL_LINEAR : GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, compare ? GL_LINEAR : GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            if(compare){
+                glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+                glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+            }
+            glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+            return texture;
+        }
+
+        /**
+         * @param layer the layer to attach, -1 for all of them (layered rendering)
+         * @return the framebuffer, 0 if it is incomplete (the error is printed)
+        */
+        static unsigned int createFramebuffer(unsigned int array, int layer){
+            unsigned int framebuffer;
+            glGenFramebuffers(1, &framebuffer);
+            glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+            if(layer < 0)
+                glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, array, 0);
+            else
+                glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, array, 0, layer);
+            glDrawBuffer(GL_NONE);
+            glReadBuffer(GL_NONE);
+            GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+            if(status != GL_FRAMEBUFFER_COMPLETE){
+                printf("\nERROR: shadow framebuffer (layer %d) incomplete (0x%x)\n", layer, status);
+                glDeleteFramebuffers(1, &framebuffer);
+                return 0;
+            }
+            return framebuffer;
+        }
+
+        /**
+         * @return the compiled shader, 0 if it failed (errors are printed)
+        */
+        static unsigned int compileStage(GLenum type, const std::string &path, const std::vector<std::string> &defines){
+            PROFILE_ZONE("shader compile");
+            PreprocessedShader shader = ShaderPreprocessor::process(path);
+            if(!shader.ok)
+                return 0;
+            std::string source = ShaderPreprocessor::addDefines(shader.source, defines);
+            const char *code = source.c_str();
+            unsigned int stage = glCreateShader(type);
+            glShaderSource(stage, 1, &code, NULL);
+            glCompileShader(stage);
+            int success;
+            glGetShaderiv(stage, GL_COMPILE_STATUS, &success);
+            if(!success){
+                char log[1024];
+                glGetShaderInfoLog(stage, 1024, NULL, log);
+                printf("\nSHADOW SHADER COMPILATION ERROR (%s):\n%s\n", path.c_str(), log);
+                shader.printSourceMap();
+                glDeleteShader(stage);
+                return 0;
+            }
+            return stage;
+        }
+};
+
+#endif
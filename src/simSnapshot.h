@@ -0,0 +1,44 @@
+/**
+ * The simulation state a frame is drawn from, with the input sampled alongside
+ * it. Single threaded runs fill one in place every frame. With --render-thread
+ * the main thread polls events and steps the simulation on its own clock,
+ * writing a snapshot after every poll into a TripleBuffer, and the render
+ * thread, which owns the GL context, draws whichever snapshot is newest when
+ * it starts a frame. A slow frame then no longer delays input handling, and a
+ * blocking swap no longer delays the simulation.
+*/
+#ifndef SIM_SNAPSHOT_H
+#define SIM_SNAPSHOT_H
+
+#include <algorithm>
+
+struct SimSnapshot{
+    float rotation = 0.0f;          //of the spinning pyramids after the newest step, in degrees
+    float prevRotation = 0.0f;      //after the step before it
+    unsigned long long stepCount = 0;   //steps taken since startup
+    double stepTime = 0.0;          //nowSeconds() the newest step was due at
+
+    double polledAt = 0.0;          //nowSeconds() of the event poll the input below was read after
+    bool screenshotKey = false;     //F2 held
+    bool traceKey = false;          //F12 held
+    int framebufferWidth = 0;       //of the window, 0 while minimized
+    int framebufferHeight = 0;
+
+    /**
+     * @param time nowSeconds() a frame is drawn at
+     * @param step simulation step in seconds
+     * @return how far time lies between the last two steps, for interpolating, in [0, 1]
+    */
+    float alphaAt(double time, double step) const{
+        return (float)std::min(1.0, std::max(0.0, (time - stepTime) / step));
+    }
+};
+
+/**
+ * window title the render thread hands back to the main thread, which alone may set it
+*/
+struct WindowTitle{
+    char text[128] = "";
+};
+
+#endif
@@ -0,0 +1,17 @@
+/**
+ * Picks the widest SIMD instruction set the build targets and includes its
+ * intrinsics. CULL_AVX2 is defined when compiled with AVX2, CULL_SSE when only
+ * SSE2 is available, and neither when code has to fall back to scalar loops.
+*/
+#ifndef SIMD_H
+#define SIMD_H
+
+#if defined(__AVX2__)
+#define CULL_AVX2 1
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#define CULL_SSE 1
+#include <emmintrin.h>
+#endif
+
+#endif
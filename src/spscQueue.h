@@ -0,0 +1,70 @@
+/**
+ * Bounded lock-free queue for exactly one producer thread and one consumer
+ * thread. The producer only writes tail and the consumer only writes head, so
+ * neither side ever waits on the other: push() fails when the queue is full
+ * and pop() fails when it is empty, and the caller decides what to do then.
+*/
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <atomic>
+#include <stddef.h>
+#include <utility>
+#include <vector>
+
+template<typename T>
+class SpscQueue{
+    public:
+        /**
+         * @param capacity most items queued at once, rounded up to a power of two
+        */
+        explicit SpscQueue(size_t capacity){
+            size_t size = 1;
+            while(size < capacity)
+                size <<= 1;
+            items.resize(size);
+            mask = size - 1;
+        }
+
+        /**
+         * producer side
+         * @return false if the queue is full, item is left untouched then
+        */
+        bool push(T &item){
+            size_t t = tail.load(std::memory_order_relaxed);
+            if(t - head.load(std::memory_order_acquire) > mask)
+                return false;
+            items[t & mask] = std::move(item);
+            tail.store(t + 1, std::memory_order_release);
+            return true;
+        }
+
+        /**
+         * consumer side
+         * @return false if the queue is empty
+        */
+        bool pop(T &item){
+            size_t h = head.load(std::memory_order_relaxed);
+            if(h == tail.load(std::memory_order_acquire))
+                return false;
+            item = std::move(items[h & mask]);
+            head.store(h + 1, std::memory_order_release);
+            return true;
+        }
+
+        /**
+         * @return items queued, exact only when called from one of the two threads while the other is idle
+        */
+        size_t size() const{
+            return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+        }
+
+    private:
+        std::vector<T> items;
+        size_t mask = 0;
+        //on separate cache lines so the two threads don't keep stealing each other's
+        alignas(64) std::atomic<size_t> head{0};    //next item to pop
+        alignas(64) std::atomic<size_t> tail{0};    //next slot to push into
+};
+
+#endif
@@ -2,8 +2,10 @@
 #define TEXTURE_CLASS
 
 #include<glad/glad.h>
+#include<stdio.h>
 #include "stb_image.h"
 #include "shader.h"
+#include "profiler.h"
 
 class Texture {
     public:
@@ -20,6 +22,7 @@ class Texture {
      * @param pixelType the format the image is stored in (GL_UNSIGNED_BYTE for an unsigned byte array in this case)
     */
 	Texture(const char* imagePath, GLenum texType, GLenum slot, GLenum format, GLenum pixelType){
+        PROFILE_ZONE("texture load");
         // Assigns the type of the texture ot the texture object
         type = texType;
 
@@ -29,6 +32,14 @@ class Texture {
         stbi_set_flip_vertically_on_load(true);
         // Reads the image from a file and stores it in bytes
         unsigned char* bytes = stbi_load(imagePath, &imgW, &imgH, &imgCh, 0);
+        // Falls back to a single white pixel so a missing image doesn't upload garbage
+        unsigned char white[4] = {255, 255, 255, 255};
+        if(bytes == NULL){
+            printf("\nERROR LOADING TEXTURE AT PATH %s\n", imagePath);
+            imgW = imgH = 1;
+            format = GL_RGBA;
+            pixelType = GL_UNSIGNED_BYTE;
+        }
 
         // Generates an OpenGL texture object
         glGenTextures(1, &ID);
@@ -49,12 +60,13 @@ class Texture {
         // glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, flatColor);
 
         // Assigns the image to the OpenGL Texture object
-        glTexImage2D(texType, 0, GL_RGBA, imgW, imgH, 0, format, pixelType, bytes);
+        glTexImage2D(texType, 0, GL_RGBA, imgW, imgH, 0, format, pixelType, bytes ? bytes : white);
         // Generates MipMaps
         glGenerateMipmap(texType);
 
         // Deletes the image data as it is already in the OpenGL Texture object
-        stbi_image_free(bytes);
+        if(bytes != NULL)
+            stbi_image_free(bytes);
 
         // Unbinds the OpenGL Texture object so that it can't accidentally be modified
         glBindTexture(texType, 0);
@@ -66,12 +78,10 @@ class Texture {
      * @param unit the value we want to set th
     */
 	void texUnit(Shader& shader, const char* uniName, GLuint unit){
-        // Gets the location of the uniform
-        GLuint texUniLoc = glGetUniformLocation(shader.programID, uniName);
         // Shader needs to be activated before changing the value of a uniform
         shader.use();
-        // Sets the value of the uniform
-        glUniform1i(texUniLoc, unit);
+        // Sets the value of the uniform (the shader remembers it so it survives a reload)
+        shader.setIntUniform(uniName, unit);
     }
 
 	// Binds a texture
@@ -0,0 +1,346 @@
+/**
+ * Scene transform hierarchy stored as structure-of-arrays.
+ *
+ * Local translation/rotation/scale live in separate float arrays, ordered by
+ * depth in the hierarchy so every parent comes before its children and each
+ * depth level is one contiguous range. update() walks the levels in order:
+ * dirty flags are inherited from the parent, and only dirty nodes get their
+ * world matrix rebuilt, 4 at a time with SSE, with each level split across
+ * the job system's threads.
+ *
+ * Handles stay valid when nodes are reordered. Released nodes drop out of the
+ * hierarchy and are reused by later create() calls.
+*/
+#ifndef TRANSFORM_SYSTEM_H
+#define TRANSFORM_SYSTEM_H
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#define TRANSFORM_SIMD 1
+#include <xmmintrin.h>
+#endif
+
+#include "jobSystem.h"
+
+typedef uint32_t TransformHandle;
+const TransformHandle NO_PARENT = 0xFFFFFFFF;
+
+class TransformSystem{
+    public:
+        size_t lastUpdated = 0;     //world matrices recomputed by the last update()
+
+        /**
+         * adds a node to the hierarchy
+         * @param parent the parent node, NO_PARENT for a root
+         * @param position local translation
+         * @param rotation local rotation
+         * @param scale local scale
+         * @return a handle that refers to the node until it is released
+         * pre: parent is NO_PARENT or a live handle returned by this system
+         * post: the node is dirty, its world matrix is valid after the next update()
+        */
+        TransformHandle create(TransformHandle parent = NO_PARENT, const glm::vec3 &position = glm::vec3(0.0f),
+                               const glm::quat &rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f), const glm::vec3 &scale = glm::vec3(1.0f)){
+            int32_t parentIdx = parent == NO_PARENT ? -1 : (int32_t)handleToIndex[parent];
+            uint16_t depth = parentIdx < 0 ? 0 : level[parentIdx] + 1;
+            //level ranges have to be rebuilt (and the order fixed if this node is shallower than the last)
+            layoutChanged = true;
+            anyDirty = true;
+            if(!freeHandles.empty()){
+                //a released node's slot is overwritten in place, sortByLevel() moves it to its new level
+                TransformHandle handle = freeHandles.back();
+                freeHandles.pop_back();
+                uint32_t i = handleToIndex[handle];
+                px[i] = position.x; py[i] = position.y; pz[i] = position.z;
+                qx[i] = rotation.x; qy[i] = rotation.y; qz[i] = rotation.z; qw[i] = rotation.w;
+                sx[i] = scale.x; sy[i] = scale.y; sz[i] = scale.z;
+                parentIndex[i] = parentIdx;
+                level[i] = depth;
+                dirty[i] = 1;
+                world[i] = glm::mat4(1.0f);
+                return handle;
+            }
+            uint32_t index = (uint32_t)parentIndex.size();
+
+            px.push_back(position.x); py.push_back(position.y); pz.push_back(position.z);
+            qx.push_back(rotation.x); qy.push_back(rotation.y); qz.push_back(rotation.z); qw.push_back(rotation.w);
+            sx.push_back(scale.x); sy.push_back(scale.y); sz.push_back(scale.z);
+            parentIndex.push_back(parentIdx);
+            level.push_back(depth);
+            dirty.push_back(1);
+            world.push_back(glm::mat4(1.0f));
+
+            TransformHandle handle = (TransformHandle)handleToIndex.size();
+            handleToIndex.push_back(index);
+            indexToHandle.push_back(handle);
+            return handle;
+        }
+
+        /**
+         * takes a node out of the hierarchy, its handle goes back to be reused by create()
+         * pre: handle is live and no live node has it as its parent
+         * post: the handle is stale. the node is a clean root until reused, so update()
+         *       never recomputes it
+        */
+        void release(TransformHandle handle){
+            uint32_t i = handleToIndex[handle];
+            parentIndex[i] = -1;
+            dirty[i] = 0;
+            if(level[i] != 0){
+                level[i] = 0;
+                layoutChanged = true;
+            }
+            freeHandles.push_back(handle);
+        }
+
+        void setPosition(TransformHandle handle, const glm::vec3 &position){
+            uint32_t i = handleToIndex[handle];
+            px[i] = position.x; py[i] = position.y; pz[i] = position.z;
+            dirty[i] = 1;
+            anyDirty = true;
+        }
+
+        void setRotation(TransformHandle handle, const glm::quat &rotation){
+            uint32_t i = handleToIndex[handle];
+            qx[i] = rotation.x; qy[i] = rotation.y; qz[i] = rotation.z; qw[i] = rotation.w;
+            dirty[i] = 1;
+            anyDirty = true;
+        }
+
+        void setScale(TransformHandle handle, const glm::vec3 &scale){
+            uint32_t i = handleToIndex[handle];
+            sx[i] = scale.x; sy[i] = scale.y; sz[i] = scale.z;
+            dirty[i] = 1;
+            anyDirty = true;
+        }
+
+        glm::vec3 getPosition(TransformHandle handle) const{
+            uint32_t i = handleToIndex[handle];
+            return glm::vec3(px[i], py[i], pz[i]);
+        }
+
+        /**
+         * @return the local to world matrix of the node as of the last update()
+        */
+        const glm::mat4 &getWorld(TransformHandle handle) const{
+            return world[handleToIndex[handle]];
+        }
+
+        /**
+         * @return the number of live nodes in the hierarchy
+        */
+        size_t size() const{
+            return parentIndex.size() - freeHandles.size();
+        }
+
+        /**
+         * pre: none
+         * post: every node is dirty, the next update() recomputes the whole hierarchy
+        */
+        void markAllDirty(){
+            memset(dirty.data(), 1, dirty.size());
+            anyDirty = true;
+        }
+
+        /**
+         * recomputes the world matrix of every dirty node and of everything below it
+         * pre: none
+         * post: world matrices are up to date, no node is dirty, lastUpdated holds
+         *       the number of matrices recomputed
+        */
+        void update(){
+            lastUpdated = 0;
+            if(!anyDirty)
+                return;
+            if(layoutChanged)
+                sortByLevel();
+            std::atomic<size_t> updated{0};
+            JobSystem &jobs = JobSystem::instance();
+            for(size_t l = 0; l + 1 < levelStart.size(); l++){
+                size_t begin = levelStart[l];
+                size_t count = levelStart[l + 1] - begin;
+                //a level has to be finished before its children read the parents' dirty flags & matrices
+                jobs.parallelFor(count, CHUNK_SIZE, [&](size_t b, size_t e){
+                    updated += updateRange(begin + b, begin + e);
+                });
+            }
+            memset(dirty.data(), 0, dirty.size());
+            anyDirty = false;
+            lastUpdated = updated;
+        }
+
+    private:
+        static constexpr size_t CHUNK_SIZE = 4096;      //multiple of 4 so chunks split on SIMD groups
+
+        //local transform, one array per component
+        std::vector<float> px, py, pz;
+        std::vector<float> qx, qy, qz, qw;
+        std::vector<float> sx, sy, sz;
+        std::vector<int32_t> parentIndex;           //index of the parent, -1 for roots
+        std::vector<uint16_t> level;                //depth in the hierarchy, roots are 0
+        std::vector<uint8_t> dirty;
+        std::vector<glm::mat4> world;
+        std::vector<uint32_t> handleToIndex;
+        std::vector<TransformHandle> indexToHandle;
+        std::vector<TransformHandle> freeHandles;   //released nodes, reused before the arrays grow
+        std::vector<size_t> levelStart{0, 0};       //first index of each level + end sentinel
+        bool layoutChanged = false;
+        bool anyDirty = false;                      //lets update() skip the scan when nothing changed
+
+        /**
+         * updates nodes [begin, end) of one level
+         * @return the number of world matrices recomputed
+        */
+        size_t updateRange(size_t begin, size_t end){
+            size_t updated = 0;
+            //inherit dirtiness from the parent, whose level is already done
+            for(size_t i = begin; i < end; i++){
+                int32_t parent = parentIndex[i];
+                dirty[i] |= parent >= 0 ? dirty[parent] : 0;
+            }
+            size_t i = begin;
+#ifdef TRANSFORM_SIMD
+            for(; i + 4 <= end; i += 4){
+                if((dirty[i] | dirty[i + 1] | dirty[i + 2] | dirty[i + 3]) == 0)
+                    continue;
+                __m128 local[4][4];
+                composeLocal4(i, local);
+                for(int k = 0; k < 4; k++){
+                    if(!dirty[i + k])
+                        continue;
+                    int32_t parent = parentIndex[i + k];
+                    float *out = &world[i + k][0][0];
+                    if(parent < 0){
+                        for(int c = 0; c < 4; c++)
+                            _mm_storeu_ps(out + c * 4, local[k][c]);
+                    } else{
+                        multiply(&world[parent][0][0], local[k], out);
+                    }
+                    updated++;
+                }
+            }
+#endif
+            for(; i < end; i++){
+                if(!dirty[i])
+                    continue;
+                glm::mat4 local = glm::mat4_cast(glm::quat(qw[i], qx[i], qy[i], qz[i]));
+                local[0] *= sx[i];
+                local[1] *= sy[i];
+                local[2] *= sz[i];
+                local[3] = glm::vec4(px[i], py[i], pz[i], 1.0f);
+                int32_t parent = parentIndex[i];
+                world[i] = parent < 0 ? local : world[parent] * local;
+                updated++;
+            }
+            return updated;
+        }
+
+#ifdef TRANSFORM_SIMD
+        /**
+         * builds the local TRS matrices of nodes [i, i + 4) straight from the SoA arrays,
+         * one node per SIMD lane
+         * @param out out[k][c] is column c of node i + k
+        */
+        void composeLocal4(size_t i, __m128 out[4][4]) const{
+            __m128 x = _mm_loadu_ps(&qx[i]), y = _mm_loadu_ps(&qy[i]), z = _mm_loadu_ps(&qz[i]), w = _mm_loadu_ps(&qw[i]);
+            __m128 one = _mm_set1_ps(1.0f), two = _mm_set1_ps(2.0f);
+            __m128 xx = _mm_mul_ps(x, x), yy = _mm_mul_ps(y, y), zz = _mm_mul_ps(z, z);
+            __m128 xy = _mm_mul_ps(x, y), xz = _mm_mul_ps(x, z), yz = _mm_mul_ps(y, z);
+            __m128 wx = _mm_mul_ps(w, x), wy = _mm_mul_ps(w, y), wz = _mm_mul_ps(w, z);
+            __m128 scaleX = _mm_loadu_ps(&sx[i]), scaleY = _mm_loadu_ps(&sy[i]), scaleZ = _mm_loadu_ps(&sz[i]);
+
+            //rotation matrix entries (same as glm::mat3_cast), each column scaled
+            __m128 c0x = _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(yy, zz))), scaleX);
+            __m128 c0y = _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(xy, wz)), scaleX);
+            __m128 c0z = _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(xz, wy)), scaleX);
+            __m128 c1x = _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(xy, wz)), scaleY);
+            __m128 c1y = _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, zz))), scaleY);
+            __m128 c1z = _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(yz, wx)), scaleY);
+            __m128 c2x = _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(xz, wy)), scaleZ);
+            __m128 c2y = _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(yz, wx)), scaleZ);
+            __m128 c2z = _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, yy))), scaleZ);
+            __m128 zero = _mm_setzero_ps();
+            __m128 c3x = _mm_loadu_ps(&px[i]), c3y = _mm_loadu_ps(&py[i]), c3z = _mm_loadu_ps(&pz[i]);
+            __m128 c3w = one;
+
+            //transpose lanes (one node each) into per-node columns
+            _MM_TRANSPOSE4_PS(c0x, c0y, c0z, zero);
+            out[0][0] = c0x; out[1][0] = c0y; out[2][0] = c0z; out[3][0] = zero;
+            zero = _mm_setzero_ps();
+            _MM_TRANSPOSE4_PS(c1x, c1y, c1z, zero);
+            out[0][1] = c1x; out[1][1] = c1y; out[2][1] = c1z; out[3][1] = zero;
+            zero = _mm_setzero_ps();
+            _MM_TRANSPOSE4_PS(c2x, c2y, c2z, zero);
+            out[0][2] = c2x; out[1][2] = c2y; out[2][2] = c2z; out[3][2] = zero;
+            _MM_TRANSPOSE4_PS(c3x, c3y, c3z, c3w);
+            out[0][3] = c3x; out[1][3] = c3y; out[2][3] = c3z; out[3][3] = c3w;
+        }
+
+        /**
+         * out = parent * local, for column-major 4x4 matrices
+        */
+        static void multiply(const float *parent, const __m128 local[4], float *out){
+            __m128 p0 = _mm_loadu_ps(parent), p1 = _mm_loadu_ps(parent + 4);
+            __m128 p2 = _mm_loadu_ps(parent + 8), p3 = _mm_loadu_ps(parent + 12);
+            for(int c = 0; c < 4; c++){
+                __m128 col = local[c];
+                __m128 r = _mm_mul_ps(p0, _mm_shuffle_ps(col, col, _MM_SHUFFLE(0, 0, 0, 0)));
+                r = _mm_add_ps(r, _mm_mul_ps(p1, _mm_shuffle_ps(col, col, _MM_SHUFFLE(1, 1, 1, 1))));
+                r = _mm_add_ps(r, _mm_mul_ps(p2, _mm_shuffle_ps(col, col, _MM_SHUFFLE(2, 2, 2, 2))));
+                r = _mm_add_ps(r, _mm_mul_ps(p3, _mm_shuffle_ps(col, col, _MM_SHUFFLE(3, 3, 3, 3))));
+                _mm_storeu_ps(out + c * 4, r);
+            }
+        }
+#endif
+
+        /**
+         * reorders every array so nodes are grouped by level (stable counting sort),
+         * which keeps parents ahead of their children
+        */
+        void sortByLevel(){
+            size_t count = level.size();
+            uint16_t maxLevel = 0;
+            for(uint16_t l : level)
+                maxLevel = std::max(maxLevel, l);
+            std::vector<size_t> start(maxLevel + 2, 0);
+            for(uint16_t l : level)
+                start[l + 1]++;
+            for(size_t l = 1; l < start.size(); l++)
+                start[l] += start[l - 1];
+            levelStart = start;
+
+            //order[newIndex] = oldIndex
+            std::vector<uint32_t> order(count), newIndexOf(count);
+            for(size_t i = 0; i < count; i++){
+                uint32_t to = (uint32_t)start[level[i]]++;
+                order[to] = (uint32_t)i;
+                newIndexOf[i] = to;
+            }
+            auto permute = [&](auto &values){
+                auto copy = values;
+                for(size_t i = 0; i < count; i++)
+                    values[i] = copy[order[i]];
+            };
+            permute(px); permute(py); permute(pz);
+            permute(qx); permute(qy); permute(qz); permute(qw);
+            permute(sx); permute(sy); permute(sz);
+            permute(level); permute(dirty); permute(world);
+            permute(parentIndex);
+            for(int32_t &parent : parentIndex)
+                if(parent >= 0)
+                    parent = (int32_t)newIndexOf[parent];
+            permute(indexToHandle);
+            for(size_t i = 0; i < count; i++)
+                handleToIndex[indexToHandle[i]] = (uint32_t)i;
+            layoutChanged = false;
+        }
+};
+
+#endif
@@ -0,0 +1,57 @@
+/**
+ * Lock-free triple buffer: hands the newest value of something from one
+ * writer thread to one reader thread. There are three slots: the writer fills
+ * its back slot and swaps it with the middle one, the reader swaps its front
+ * slot with the middle one when a fresh value is waiting. Neither side ever
+ * waits, the writer can publish faster than the reader reads (values in
+ * between are skipped) and the reader can read faster than the writer
+ * publishes (it keeps the last value).
+*/
+#ifndef TRIPLE_BUFFER_H
+#define TRIPLE_BUFFER_H
+
+#include <atomic>
+
+template<typename T>
+class TripleBuffer{
+    public:
+        /**
+         * writer side
+         * post: the reader's next update() picks value up, unless a newer one is written first
+        */
+        void write(const T &value){
+            slots[backSlot] = value;
+            backSlot = middle.exchange(backSlot | FRESH, std::memory_order_acq_rel) & INDEX;
+        }
+
+        /**
+         * reader side: moves to the newest written value, if there is one
+         * @return true if front() changed
+        */
+        bool update(){
+            if(!(middle.load(std::memory_order_relaxed) & FRESH))
+                return false;
+            frontSlot = middle.exchange(frontSlot, std::memory_order_acq_rel) & INDEX;
+            return true;
+        }
+
+        /**
+         * reader side
+         * @return the value update() last moved to, a default T before the first one
+        */
+        const T &front() const{
+            return slots[frontSlot];
+        }
+
+    private:
+        static constexpr unsigned int INDEX = 3;    //low bits of middle: its slot
+        static constexpr unsigned int FRESH = 4;    //set when the middle slot holds a value the reader hasn't seen
+
+        T slots[3];
+        //each side's index on its own cache line, so writing one doesn't slow the other
+        alignas(64) std::atomic<unsigned int> middle{1};
+        alignas(64) unsigned int backSlot = 0;     //the writer's
+        alignas(64) unsigned int frontSlot = 2;    //the reader's
+};
+
+#endif
@@ -0,0 +1,422 @@
+/**
+ * Records frames to a YUV4MPEG2 (.y4m) video, which ffmpeg and most players
+ * read as is. push() converts an RGBA frame to YUV 4:2:0 (BT.601, limited
+ * range) with 16 pixels at a time under AVX2 and SSE2, then hands it to a disk
+ * writer thread through a lock-free queue.
+ *
+ * Converted frames live in a fixed pool of POOL_SIZE buffers that travel
+ * between the two threads through a pair of SpscQueues: free buffers go to
+ * push(), filled ones to the writer. When the disk falls behind every buffer
+ * ends up waiting to be written, and push() drops the frame and counts it
+ * instead of waiting.
+ *
+ * The writer gathers frames into a BLOCK_SIZE staging buffer aligned to
+ * BLOCK_ALIGNMENT and writes it out whole through an unbuffered FILE, so the
+ * file is written in large aligned blocks rather than one plane at a time.
+*/
+#ifndef VIDEO_RECORDER_H
+#define VIDEO_RECORDER_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "frameTimer.h"
+#include "profiler.h"
+#include "simd.h"
+#include "spscQueue.h"
+
+/**
+ * @return two 16 bit coefficients packed for _mm_madd_epi16: low applies to the
+ *         low half of each 32 bit lane, high to the upper half
+*/
+inline int32_t pairCoefficients(int low, int high){
+    return (int32_t)((uint32_t)(uint16_t)low | (uint32_t)(uint16_t)high << 16);
+}
+
+/**
+ * BT.601 limited range luma of one RGBA pixel, the same integer math the SIMD kernels do
+*/
+inline unsigned char rgbToY(int r, int g, int b){
+    return (unsigned char)(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+}
+
+inline unsigned char rgbToU(int r, int g, int b){
+    return (unsigned char)(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+}
+
+inline unsigned char rgbToV(int r, int g, int b){
+    return (unsigned char)(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+}
+
+/**
+ * luma of one row
+ * @param rgba width pixels
+ * @param y width bytes
+*/
+inline void lumaRow(const unsigned char *rgba, int width, unsigned char *y){
+    int x = 0;
+#if defined(CULL_AVX2)
+    const __m256i lowBytes = _mm256_set1_epi32(0x00FF00FF);
+    const __m256i rbWeights = _mm256_set1_epi32(pairCoefficients(66, 25));
+    const __m256i gWeights = _mm256_set1_epi32(pairCoefficients(129, 0));
+    const __m256i rounding = _mm256_set1_epi32(128), offset = _mm256_set1_epi32(16);
+    //packing works within 128 bit lanes, this puts the 4 byte groups back in order
+    const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+    for(; x + 32 <= width; x += 32){
+        __m256i luma[4];
+        for(int k = 0; k < 4; k++){
+            //R and B in the 16 bit halves of one lane, G and A in another
+            __m256i pixels = _mm256_loadu_si256((const __m256i*)(rgba + 4 * (x + 8 * k)));
+            __m256i rb = _mm256_and_si256(pixels, lowBytes);
+            __m256i ga = _mm256_and_si256(_mm256_srli_epi32(pixels, 8), lowBytes);
+            __m256i sum = _mm256_add_epi32(_mm256_madd_epi16(rb, rbWeights), _mm256_madd_epi16(ga, gWeights));
+            luma[k] = _mm256_add_epi32(_mm256_srai_epi32(_mm256_add_epi32(sum, rounding), 8), offset);
+        }
+        __m256i bytes = _mm256_packus_epi16(_mm256_packs_epi32(luma[0], luma[1]), _mm256_packs_epi32(luma[2], luma[3]));
+        _mm256_storeu_si256((__m256i*)(y + x), _mm256_permutevar8x32_epi32(bytes, order));
+    }
+#elif defined(CULL_SSE)
+    const __m128i lowBytes = _mm_set1_epi32(0x00FF00FF);
+    const __m128i rbWeights = _mm_set1_epi32(pairCoefficients(66, 25));
+    const __m128i gWeights = _mm_set1_epi32(pairCoefficients(129, 0));
+    const __m128i rounding = _mm_set1_epi32(128), offset = _mm_set1_epi32(16);
+    for(; x + 16 <= width; x += 16){
+        __m128i luma[4];
+        for(int k = 0; k < 4; k++){
+            //R and B in the 16 bit halves of one lane, G and A in another
+            __m128i pixels = _mm_loadu_si128((const __m128i*)(rgba + 4 * (x + 4 * k)));
+            __m128i rb = _mm_and_si128(pixels, lowBytes);
+            __m128i ga = _mm_and_si128(_mm_srli_epi32(pixels, 8), lowBytes);
+            __m128i sum = _mm_add_epi32(_mm_madd_epi16(rb, rbWeights), _mm_madd_epi16(ga, gWeights));
+            luma[k] = _mm_add_epi32(_mm_srai_epi32(_mm_add_epi32(sum, rounding), 8), offset);
+        }
+        __m128i bytes = _mm_packus_epi16(_mm_packs_epi32(luma[0], luma[1]), _mm_packs_epi32(luma[2], luma[3]));
+        _mm_storeu_si128((__m128i*)(y + x), bytes);
+    }
+#endif
+    for(; x < width; x++)
+        y[x] = rgbToY(rgba[4 * x], rgba[4 * x + 1], rgba[4 * x + 2]);
+}
+
+/**
+ * chroma of a pair of rows, each sample from the average of a 2x2 block
+ * @param top width pixels
+ * @param bottom width pixels below them, top again for the last row of an odd height
+ * @param u (width + 1) / 2 bytes
+ * @param v (width + 1) / 2 bytes
+*/
+inline void chromaRow(const unsigned char *top, const unsigned char *bottom, int width, unsigned char *u, unsigned char *v){
+    int block = 0;
+#if defined(CULL_AVX2)
+    const __m256i lowBytes = _mm256_set1_epi32(0x00FF00FF);
+    const __m256i uRb = _mm256_set1_epi32(pairCoefficients(-38, 112)), uGa = _mm256_set1_epi32(pairCoefficients(-74, 0));
+    const __m256i vRb = _mm256_set1_epi32(pairCoefficients(112, -18)), vGa = _mm256_set1_epi32(pairCoefficients(-94, 0));
+    const __m256i two = _mm256_set1_epi16(2), rounding = _mm256_set1_epi32(128), offset = _mm256_set1_epi32(128);
+    for(; 2 * block + 16 <= width; block += 8){
+        const unsigned char *t = top + 8 * block, *b = bottom + 8 * block;
+        __m256i t0 = _mm256_loadu_si256((const __m256i*)t), t1 = _mm256_loadu_si256((const __m256i*)(t + 32));
+        __m256i b0 = _mm256_loadu_si256((const __m256i*)b), b1 = _mm256_loadu_si256((const __m256i*)(b + 32));
+        //vertical sums of the columns, R and B in one lane and G and A in another
+        __m256i rb0 = _mm256_add_epi16(_mm256_and_si256(t0, lowBytes), _mm256_and_si256(b0, lowBytes));
+        __m256i rb1 = _mm256_add_epi16(_mm256_and_si256(t1, lowBytes), _mm256_and_si256(b1, lowBytes));
+        __m256i ga0 = _mm256_add_epi16(_mm256_and_si256(_mm256_srli_epi32(t0, 8), lowBytes), _mm256_and_si256(_mm256_srli_epi32(b0, 8), lowBytes));
+        __m256i ga1 = _mm256_add_epi16(_mm256_and_si256(_mm256_srli_epi32(t1, 8), lowBytes), _mm256_and_si256(_mm256_srli_epi32(b1, 8), lowBytes));
+        //add even columns to odd ones. shuffles stay within 128 bit lanes, so the
+        //blocks come out as 0 1 4 5 | 2 3 6 7 and the 64 bit permute sorts them
+        __m256 rbA = _mm256_castsi256_ps(rb0), rbB = _mm256_castsi256_ps(rb1);
+        __m256 gaA = _mm256_castsi256_ps(ga0), gaB = _mm256_castsi256_ps(ga1);
+        __m256i rb = _mm256_add_epi16(_mm256_castps_si256(_mm256_shuffle_ps(rbA, rbB, _MM_SHUFFLE(2, 0, 2, 0))),
+                                      _mm256_castps_si256(_mm256_shuffle_ps(rbA, rbB, _MM_SHUFFLE(3, 1, 3, 1))));
+        __m256i ga = _mm256_add_epi16(_mm256_castps_si256(_mm256_shuffle_ps(gaA, gaB, _MM_SHUFFLE(2, 0, 2, 0))),
+                                      _mm256_castps_si256(_mm256_shuffle_ps(gaA, gaB, _MM_SHUFFLE(3, 1, 3, 1))));
+        rb = _mm256_srli_epi16(_mm256_add_epi16(_mm256_permute4x64_epi64(rb, _MM_SHUFFLE(3, 1, 2, 0)), two), 2);
+        ga = _mm256_srli_epi16(_mm256_add_epi16(_mm256_permute4x64_epi64(ga, _MM_SHUFFLE(3, 1, 2, 0)), two), 2);
+        __m256i uSum = _mm256_add_epi32(_mm256_madd_epi16(rb, uRb), _mm256_madd_epi16(ga, uGa));
+        __m256i vSum = _mm256_add_epi32(_mm256_madd_epi16(rb, vRb), _mm256_madd_epi16(ga, vGa));
+        __m256i chroma[2] = {_mm256_add_epi32(_mm256_srai_epi32(_mm256_add_epi32(uSum, rounding), 8), offset),
+                             _mm256_add_epi32(_mm256_srai_epi32(_mm256_add_epi32(vSum, rounding), 8), offset)};
+        unsigned char *outputs[2] = {u + block, v + block};
+        for(int k = 0; k < 2; k++){
+            //each lane packs its 4 samples into its low 4 bytes
+            __m256i bytes = _mm256_packus_epi16(_mm256_packs_epi32(chroma[k], chroma[k]), _mm256_setzero_si256());
+            __m128i joined = _mm_unpacklo_epi32(_mm256_castsi256_si128(bytes), _mm256_extracti128_si256(bytes, 1));
+            _mm_storel_epi64((__m128i*)outputs[k], joined);
+        }
+    }
+#elif defined(CULL_SSE)
+    const __m128i lowBytes = _mm_set1_epi32(0x00FF00FF);
+    const __m128i uRb = _mm_set1_epi32(pairCoefficients(-38, 112)), uGa = _mm_set1_epi32(pairCoefficients(-74, 0));
+    const __m128i vRb = _mm_set1_epi32(pairCoefficients(112, -18)), vGa = _mm_set1_epi32(pairCoefficients(-94, 0));
+    const __m128i two = _mm_set1_epi16(2), rounding = _mm_set1_epi32(128), offset = _mm_set1_epi32(128);
+    for(; 2 * block + 16 <= width; block += 8){
+        __m128i uHalves[2], vHalves[2];
+        for(int half = 0; half < 2; half++){
+            const unsigned char *t = top + 8 * block + 32 * half, *b = bottom + 8 * block + 32 * half;
+            __m128i t0 = _mm_loadu_si128((const __m128i*)t), t1 = _mm_loadu_si128((const __m128i*)(t + 16));
+            __m128i b0 = _mm_loadu_si128((const __m128i*)b), b1 = _mm_loadu_si128((const __m128i*)(b + 16));
+            //vertical sums of the columns, R and B in one lane and G and A in another
+            __m128 rbA = _mm_castsi128_ps(_mm_add_epi16(_mm_and_si128(t0, lowBytes), _mm_and_si128(b0, lowBytes)));
+            __m128 rbB = _mm_castsi128_ps(_mm_add_epi16(_mm_and_si128(t1, lowBytes), _mm_and_si128(b1, lowBytes)));
+            __m128 gaA = _mm_castsi128_ps(_mm_add_epi16(_mm_and_si128(_mm_srli_epi32(t0, 8), lowBytes), _mm_and_si128(_mm_srli_epi32(b0, 8), lowBytes)));
+            __m128 gaB = _mm_castsi128_ps(_mm_add_epi16(_mm_and_si128(_mm_srli_epi32(t1, 8), lowBytes), _mm_and_si128(_mm_srli_epi32(b1, 8), lowBytes)));
+            //add even columns to odd ones
+            __m128i rb = _mm_add_epi16(_mm_castps_si128(_mm_shuffle_ps(rbA, rbB, _MM_SHUFFLE(2, 0, 2, 0))),
+                                       _mm_castps_si128(_mm_shuffle_ps(rbA, rbB, _MM_SHUFFLE(3, 1, 3, 1))));
+            __m128i ga = _mm_add_epi16(_mm_castps_si128(_mm_shuffle_ps(gaA, gaB, _MM_SHUFFLE(2, 0, 2, 0))),
+                                       _mm_castps_si128(_mm_shuffle_ps(gaA, gaB, _MM_SHUFFLE(3, 1, 3, 1))));
+            rb = _mm_srli_epi16(_mm_add_epi16(rb, two), 2);
+            ga = _mm_srli_epi16(_mm_add_epi16(ga, two), 2);
+            __m128i uSum = _mm_add_epi32(_mm_madd_epi16(rb, uRb), _mm_madd_epi16(ga, uGa));
+            __m128i vSum = _mm_add_epi32(_mm_madd_epi16(rb, vRb), _mm_madd_epi16(ga, vGa));
+            uHalves[half] = _mm_add_epi32(_mm_srai_epi32(_mm_add_epi32(uSum, rounding), 8), offset);
+            vHalves[half] = _mm_add_epi32(_mm_srai_epi32(_mm_add_epi32(vSum, rounding), 8), offset);
+        }
+        __m128i bytes = _mm_packus_epi16(_mm_packs_epi32(uHalves[0], uHalves[1]), _mm_packs_epi32(vHalves[0], vHalves[1]));
+        _mm_storel_epi64((__m128i*)(u + block), bytes);
+        _mm_storel_epi64((__m128i*)(v + block), _mm_srli_si128(bytes, 8));
+    }
+#endif
+    int blocks = (width + 1) / 2;
+    for(; block < blocks; block++){
+        int left = 2 * block, right = std::min(left + 1, width - 1);
+        int rgb[3];
+        for(int c = 0; c < 3; c++)
+            rgb[c] = (top[4 * left + c] + top[4 * right + c] + bottom[4 * left + c] + bottom[4 * right + c] + 2) >> 2;
+        u[block] = rgbToU(rgb[0], rgb[1], rgb[2]);
+        v[block] = rgbToV(rgb[0], rgb[1], rgb[2]);
+    }
+}
+
+/**
+ * converts a frame to planar YUV 4:2:0
+ * @param rgba width * height pixels
+ * @param bottomUp rgba starts with the bottom row, as glReadPixels returns it
+ * @param yuv (width * height) + 2 * ((width + 1) / 2 * (height + 1) / 2) bytes:
+ *        the Y plane, then U, then V, each top row first
+*/
+inline void rgbaToYuv420(const unsigned char *rgba, int width, int height, bool bottomUp, unsigned char *yuv){
+    int chromaWidth = (width + 1) / 2, chromaHeight = (height + 1) / 2;
+    unsigned char *y = yuv;
+    unsigned char *u = y + (size_t)width * height;
+    unsigned char *v = u + (size_t)chromaWidth * chromaHeight;
+    auto row = [&](int r){
+        return rgba + (size_t)4 * width * (bottomUp ? height - 1 - r : r);
+    };
+    for(int r = 0; r < height; r += 2){
+        const unsigned char *top = row(r);
+        const unsigned char *bottom = r + 1 < height ? row(r + 1) : top;
+        lumaRow(top, width, y + (size_t)width * r);
+        if(r + 1 < height)
+            lumaRow(bottom, width, y + (size_t)width * (r + 1));
+        chromaRow(top, bottom, width, u + (size_t)chromaWidth * (r / 2), v + (size_t)chromaWidth * (r / 2));
+    }
+}
+
+struct RecorderStats{
+    size_t recorded = 0;        //frames written to the file
+    size_t dropped = 0;         //frames pushed while every buffer waited for the disk
+    size_t resized = 0;         //frames skipped for not matching the video's size
+    size_t queued = 0;          //frames converted but not yet written
+    double convertMs = 0.0;     //last frame's RGBA to YUV conversion
+    double megabytes = 0.0;     //written to the file
+
+    void print(const char *name) const{
+        printf("%s: %zu recorded, %zu dropped, %zu resized, %zu queued, %.3f ms convert, %.1f MB written\n",
+               name, recorded, dropped, resized, queued, convertMs, megabytes);
+    }
+};
+
+class VideoRecorder{
+    public:
+        static constexpr int POOL_SIZE = 8;                 //converted frames waiting for the disk at most
+        static constexpr size_t BLOCK_SIZE = 4 << 20;       //bytes per write
+        static constexpr size_t BLOCK_ALIGNMENT = 4096;
+
+        VideoRecorder() : freeFrames(POOL_SIZE), filledFrames(POOL_SIZE){}
+
+        ~VideoRecorder(){
+            close();
+        }
+
+        /**
+         * creates the file and starts the writer thread. The video's size is the
+         * first pushed frame's
+         * @param path .y4m file to write
+         * @param fps frame rate written to the header
+         * @return false if the file couldn't be created
+        */
+        bool open(const char *path, int fps){
+            file = fopen(path, "wb");
+            if(file == NULL){
+                printf("recorder: could not create %s\n", path);
+                return false;
+            }
+            //the staging buffer already makes the writes large, stdio would only copy them again
+            setvbuf(file, NULL, _IONBF, 0);
+            frameRate = std::max(1, fps);
+            staging.reset(new unsigned char[BLOCK_SIZE + BLOCK_ALIGNMENT]);
+            block = staging.get() + (BLOCK_ALIGNMENT - (uintptr_t)staging.get() % BLOCK_ALIGNMENT) % BLOCK_ALIGNMENT;
+            blockUsed = 0;
+            for(int i = 0; i < POOL_SIZE; i++)
+                freeFrames.push(i);
+            quit = false;
+            writer = std::thread(&VideoRecorder::writerLoop, this);
+            return true;
+        }
+
+        /**
+         * converts a frame and queues it for the disk, or drops it if the disk is behind
+         * @param rgba width * height pixels
+         * @param bottomUp rgba starts with the bottom row
+         * pre: open() succeeded. Only ever called from one thread
+        */
+        void push(const unsigned char *rgba, int width, int height, bool bottomUp){
+            PROFILE_ZONE("record frame");
+            if(width != videoWidth || height != videoHeight){
+                //y4m has one size for the whole file
+                if(videoWidth != 0){
+                    resized++;
+                    return;
+                }
+                videoWidth = width;
+                videoHeight = height;
+            }
+            int index;
+            if(!freeFrames.pop(index)){
+                dropped++;
+                return;
+            }
+            double start = nowSeconds();
+            Frame &frame = pool[index];
+            frame.width = width;
+            frame.height = height;
+            frame.yuv.resize((size_t)width * height + 2 * ((size_t)(width + 1) / 2 * ((height + 1) / 2)));
+            rgbaToYuv420(rgba, width, height, bottomUp, frame.yuv.data());
+            convertMs = (nowSeconds() - start) * 1000.0;
+            //never full: there are only POOL_SIZE indices
+            filledFrames.push(index);
+        }
+
+        /**
+         * writes what is queued and closes the file
+         * pre: no push() is running
+        */
+        void close(){
+            if(!writer.joinable())
+                return;
+            quit.store(true, std::memory_order_release);
+            writer.join();
+            flush();
+            fclose(file);
+            file = NULL;
+        }
+
+        /**
+         * @return counters as they are now, callable from any thread
+        */
+        RecorderStats snapshot() const{
+            RecorderStats stats;
+            stats.recorded = recorded.load();
+            stats.dropped = dropped.load();
+            stats.resized = resized.load();
+            stats.queued = filledFrames.size();
+            stats.convertMs = convertMs.load();
+            stats.megabytes = bytesWritten.load() / (1024.0 * 1024.0);
+            return stats;
+        }
+
+    private:
+        struct Frame{
+            int width = 0, height = 0;
+            std::vector<unsigned char> yuv;
+        };
+
+        FILE *file = NULL;
+        int frameRate = 60;
+        int videoWidth = 0, videoHeight = 0;    //push() side
+        Frame pool[POOL_SIZE];
+        SpscQueue<int> freeFrames;      //writer -> push()
+        SpscQueue<int> filledFrames;    //push() -> writer
+        std::thread writer;
+        std::atomic<bool> quit{false};
+        std::unique_ptr<unsigned char[]> staging;
+        unsigned char *block = NULL;    //staging, aligned
+        size_t blockUsed = 0;
+        bool headerWritten = false;
+        bool failed = false;
+
+        std::atomic<size_t> recorded{0};
+        std::atomic<size_t> dropped{0};
+        std::atomic<size_t> resized{0};
+        std::atomic<double> convertMs{0.0};
+        std::atomic<size_t> bytesWritten{0};
+
+        void writerLoop(){
+            Profiler::instance().setThreadName("recorder writer");
+            while(true){
+                int index;
+                if(!filledFrames.pop(index)){
+                    //everything pushed before quit was set is visible after seeing it
+                    if(!quit.load(std::memory_order_acquire)){
+                        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                        continue;
+                    }
+                    if(!filledFrames.pop(index))
+                        return;
+                }
+                {
+                    PROFILE_ZONE("record write");
+                    const Frame &frame = pool[index];
+                    if(!headerWritten){
+                        char header[128];
+                        int length = snprintf(header, sizeof(header), "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg XCOLORRANGE=LIMITED\n",
+                                              frame.width, frame.height, frameRate);
+                        append(header, length);
+                        headerWritten = true;
+                    }
+                    append("FRAME\n", 6);
+                    append(frame.yuv.data(), frame.yuv.size());
+                }
+                freeFrames.push(index);
+                if(!failed)
+                    recorded++;
+            }
+        }
+
+        /**
+         * copies into the staging block, writing it out each time it fills up
+        */
+        void append(const void *data, size_t size){
+            const unsigned char *bytes = (const unsigned char*)data;
+            while(size > 0){
+                size_t count = std::min(size, BLOCK_SIZE - blockUsed);
+                memcpy(block + blockUsed, bytes, count);
+                blockUsed += count;
+                bytes += count;
+                size -= count;
+                if(blockUsed == BLOCK_SIZE)
+                    flush();
+            }
+        }
+
+        void flush(){
+            if(blockUsed > 0 && !failed){
+                if(fwrite(block, 1, blockUsed, file) != blockUsed){
+                    printf("recorder: writing the video failed, the rest is discarded\n");
+                    failed = true;
+                } else{
+                    bytesWritten += blockUsed;
+                }
+            }
+            blockUsed = 0;
+        }
+};
+
+#endif
@@ -0,0 +1,71 @@
+/**
+ * Build tool that preprocesses every shader under a directory and writes them
+ * into a header as constexpr data, used by builds with -DSHADER_EMBED.
+ *
+ * usage: embedShaders <shader directory> <output header>
+ * e.g.   embedShaders resources/shaders src/embeddedShaders.h
+*/
+#include <stdio.h>
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "../src/shaderPreprocessor.h"
+
+/**
+ * @return a raw string literal delimiter that doesn't occur in source
+*/
+static std::string pickDelimiter(const std::string &source){
+    std::string delimiter = "glsl";
+    while(source.find(")" + delimiter + "\"") != std::string::npos)
+        delimiter += "_";
+    return delimiter;
+}
+
+int main(int argc, char **argv){
+    if(argc != 3){
+        printf("usage: %s <shader directory> <output header>\n", argv[0]);
+        return 1;
+    }
+    std::filesystem::path shaderDir = argv[1];
+
+    std::vector<std::filesystem::path> shaders;
+    std::error_code ec;
+    for(auto it = std::filesystem::recursive_directory_iterator(shaderDir, ec);
+        !ec && it != std::filesystem::recursive_directory_iterator(); it.increment(ec))
+        if(it->is_regular_file())
+            shaders.push_back(it->path());
+    if(ec){
+        printf("could not read shader directory %s\n", argv[1]);
+        return 1;
+    }
+    //stable output so the header only changes when a shader does
+    std::sort(shaders.begin(), shaders.end());
+
+    std::string out;
+    out += "// generated by tools/embedShaders.cpp, do not edit\n";
+    out += "#ifndef EMBEDDED_SHADERS_H\n#define EMBEDDED_SHADERS_H\n\n";
+    out += "struct EmbeddedShader{\n    const char *path;\n    const char *source;\n};\n\n";
+    out += "constexpr EmbeddedShader embeddedShaders[] = {\n";
+    for(const std::filesystem::path &path : shaders){
+        PreprocessedShader shader = ShaderPreprocessor::process(path.string());
+        if(!shader.ok){
+            printf("failed to preprocess %s\n", path.string().c_str());
+            return 1;
+        }
+        std::string key = std::filesystem::relative(path, shaderDir).generic_string();
+        std::string delimiter = pickDelimiter(shader.source);
+        out += "    {\"" + key + "\", R\"" + delimiter + "(" + shader.source + ")" + delimiter + "\"},\n";
+        printf("embedded %s\n", key.c_str());
+    }
+    out += "};\n\n#endif\n";
+
+    std::ofstream file(argv[2], std::ios::binary);
+    if(!file.write(out.data(), out.size())){
+        printf("could not write %s\n", argv[2]);
+        return 1;
+    }
+    return 0;
+}